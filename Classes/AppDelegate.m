@@ -23,6 +23,10 @@
 #import "ObjectiveFlickr.h"
 #import "IPFlickrAuthorizationManager.h"
 #import "IPOptimizingPhotoNotification.h"
+#import "IPOptimizationJournal.h"
+#import "IPPhotoStore.h"
+#import "IPPortfolioSaveCoordinator.h"
+#import "IPImageMemoryManager.h"
 #import "NSString+TestHelper.h"
 #import "IPDropBoxApiKeys.h"
 #import <DropboxSDK/DropboxSDK.h>
@@ -119,17 +123,19 @@ const int ddLogLevel = LOG_LEVEL_INFO;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Save the portfolio (in case I forgot to save it somewhere else -- I *should*
-//  save as changes are made in case the app crashes, so this is a no-op)
+//  Flush the pending coalesced portfolio save and the photo store index.
 //
 
-- (void)applicationWillResignActive:(UIApplication *)application {
+- (void)applicationDidEnterBackground:(UIApplication *)application {
 
   //
-  //  Catchall, in case I forget to save somewhere else.
+  //  Catchall, in case I forget to save somewhere else. This also does any
+  //  save still waiting out its coalescing window; we may not get to run
+  //  again.
   //
   
   [self.portfolioGridView.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[IPPhotoStore sharedStore] flushIndex];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -183,6 +189,7 @@ const int ddLogLevel = LOG_LEVEL_INFO;
 
 - (void)applicationWillTerminate:(UIApplication *)application {
   [self.portfolioGridView.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[IPPhotoStore sharedStore] flushIndex];
 }
 
 #pragma mark - IPPhotoOptimizationManagerDelegate
@@ -218,6 +225,22 @@ const int ddLogLevel = LOG_LEVEL_INFO;
   }];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Log optimization throughput, so we can see how well a portfolio upgrade
+//  is using the cores.
+//
+
+- (void)optimizationManager:(IPPhotoOptimizationManager *)optimizationManager
+ didOptimizePhotosPerSecond:(CGFloat)photosPerSecond
+  megabytesDecodedPerSecond:(CGFloat)megabytesPerSecond {
+
+  DDLogVerbose(@"%s -- %.2f photos/sec, %.1f MB/sec decoded",
+               __PRETTY_FUNCTION__,
+               photosPerSecond,
+               megabytesPerSecond);
+}
+
 #pragma mark -
 #pragma mark Memory management
 
@@ -227,9 +250,13 @@ const int ddLogLevel = LOG_LEVEL_INFO;
 //
 
 - (void)applicationDidReceiveMemoryWarning:(UIApplication *)application {
-  /*
-   Free up as much memory as possible by purging cached data objects that can be recreated (or reloaded from disk) later.
-   */
+  
+  //
+  //  Decoded images are the bulk of what can be recreated later. The shared
+  //  IPImageMemoryManager sheds them itself when the warning is posted.
+  //
+  
+  DDLogInfo(@"%s -- %@", __PRETTY_FUNCTION__, [[IPImageMemoryManager sharedManager] usageDescription]);
 }
 
 #pragma mark - Properties
@@ -253,8 +280,16 @@ const int ddLogLevel = LOG_LEVEL_INFO;
 
 - (void)preparePortfolioForDisplay {
   
-  [[[IPPhotoOptimizationManager sharedManager] optimizationQueue] addOperationWithBlock:^(void) {
+  [[IPPhotoOptimizationManager sharedManager] addOperationInLane:IPOptimizationLaneInteractive withBlock:^(void) {
 
+    CFAbsoluteTime loadStart = CFAbsoluteTimeGetCurrent();
+    
+    //
+    //  Portfolios saved as keyed archives get rewritten in the binary format
+    //  once, the first time this version runs.
+    //
+    
+    [IPPortfolio migratePortfolioAtPath:[IPPortfolio defaultPortfolioPath]];
     IPPortfolio *portfolio = [IPPortfolio loadPortfolioFromPath:[IPPortfolio defaultPortfolioPath]];
     
     DDLogVerbose(@"%s -- saved version = %d, in memory version = %d",
@@ -293,18 +328,79 @@ const int ddLogLevel = LOG_LEVEL_INFO;
     
     if (saveNeeded) {
       
-      [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+      [[IPPortfolioSaveCoordinator sharedCoordinator] setNeedsSaveOfPortfolio:portfolio 
+                                                                       toPath:[IPPortfolio defaultPortfolioPath]];
     }
     //
     //  Make sure we have our welcome content.
     //
     
     [self ensureWelcomeSetForPortfolio:portfolio];
-    [self upgradePhotoOptimizationForPortfolio:portfolio completion:^(void) {
+    
+    //
+    //  Make sure the photo store's reference counts match the model. The
+    //  sets know their file names without loading their pages. If a set's
+    //  pages are damaged, its names aren't known, and a reset would drop
+    //  files it still uses; leave the counts alone.
+    //
+    
+    NSMutableArray *filenames = [NSMutableArray array];
+    for (IPSet *theSet in portfolio.sets) {
+      
+      NSArray *setFilenames = theSet.photoFilenames;
+      if (setFilenames == nil) {
+        
+        filenames = nil;
+        break;
+      }
+      [filenames addObjectsFromArray:setFilenames];
+    }
+    if (filenames != nil) {
+      
+      [[IPPhotoStore sharedStore] resetReferenceCountsWithFilenames:filenames];
+      
+    } else {
+      
+      DDLogError(@"%s -- damaged pages in the portfolio; not resetting reference counts", __PRETTY_FUNCTION__);
+    }
+    
+    //
+    //  Any optimization upgrade runs behind the grid; photos that come on
+    //  screen get promoted out of the background lane.
+    //
+    
+    [self upgradePhotoOptimizationForPortfolio:portfolio];
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
 
       self.portfolioGridView.portfolio = portfolio;
       [self.portfolioGridView lookForFoundPictures];
       [self.portfolioGridView startTutorial];
+      
+      //
+      //  The grid lays out and draws on this pass through the run loop.
+      //
+      
+      dispatch_async(dispatch_get_main_queue(), ^(void) {
+        
+        DDLogInfo(@"%s -- first grid shown %.1fms after loading started",
+                  __PRETTY_FUNCTION__,
+                  (CFAbsoluteTimeGetCurrent() - loadStart) * 1000);
+        
+        //
+        //  Now check that the photo files are all there. A missing
+        //  thumbnail means another optimization pass, unless one is
+        //  already under way.
+        //
+        
+        BOOL optimized = (portfolio.imageOptimizationVersion == kIPPhotoCurrentOptimizationVersion);
+        [portfolio validatePhotoFilesAsyncWithCompletion:^(NSUInteger countOfRemovedPhotos) {
+          
+          if (optimized && portfolio.imageOptimizationVersion != kIPPhotoCurrentOptimizationVersion) {
+            
+            [self upgradePhotoOptimizationForPortfolio:portfolio];
+          }
+        }];
+      });
     }];
   }];
 }
@@ -414,18 +510,26 @@ const int ddLogLevel = LOG_LEVEL_INFO;
       [portfolio insertObject:welcomeSet inSetsAtIndex:[portfolio countOfSets]];
     }
     userDefaults.welcomeVersion = welcomeSetVersion;
-    [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+    [[IPPortfolioSaveCoordinator sharedCoordinator] setNeedsSaveOfPortfolio:portfolio 
+                                                                     toPath:[IPPortfolio defaultPortfolioPath]];
   }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Upgrade optimization of any photos.
+//  Upgrade optimization of any photos. Returns right away; the work happens
+//  in the background lane.
+//
+//  Progress is kept in an |IPOptimizationJournal| that commits as each photo
+//  finishes. If we get killed partway through, the next launch trusts the
+//  journal for the photos it lists (their |optimizedVersion| may not have
+//  made it into a saved portfolio) and resumes with the first photo it
+//  doesn't. Once every photo is done, the portfolio gets saved with the new
+//  |imageOptimizationVersion| and the journal goes away.
 //
 
-- (void)upgradePhotoOptimizationForPortfolio:(IPPortfolio *)portfolio completion:(IPPhotoOptimizationCompletion)completion {
+- (void)upgradePhotoOptimizationForPortfolio:(IPPortfolio *)portfolio {
   
-  completion = [completion copy];
   DDLogVerbose(@"%s -- Portfolio image optimization version = %d, current = %d",
              __PRETTY_FUNCTION__,
              portfolio.imageOptimizationVersion,
@@ -436,15 +540,11 @@ const int ddLogLevel = LOG_LEVEL_INFO;
     //  The portfolio has already been optimized. Short-circuit.
     //
     
-    if (completion != nil) {
-      [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
-
-        completion();
-      }];
-    }
     return;
   }
   
+  IPOptimizationJournal *journal = [IPOptimizationJournal journalAtPath:[IPOptimizationJournal defaultJournalPath] 
+                                                  forOptimizationVersion:kIPPhotoCurrentOptimizationVersion];
   NSMutableArray *toOptimize = [[NSMutableArray alloc] init];
   for (IPSet *theSet in portfolio.sets) {
     
@@ -452,36 +552,69 @@ const int ddLogLevel = LOG_LEVEL_INFO;
       
       for (IPPhoto *thePhoto in thePage.photos) {
         
-        if (![thePhoto isOptimized]) {
+        if ([thePhoto isOptimized]) {
+          
+          continue;
+        }
+        if ([journal containsPhoto:thePhoto]) {
+          
+          thePhoto.optimizedVersion = kIPPhotoCurrentOptimizationVersion;
+          
+        } else {
           
           [toOptimize addObject:thePhoto];
         }
       }
     }
   }
+  DDLogVerbose(@"%s -- %d photos already in the journal, %d to go",
+             __PRETTY_FUNCTION__,
+             journal.countOfCommittedPhotos,
+             [toOptimize count]);
   
   if ([toOptimize count] == 0) {
     
-    portfolio.imageOptimizationVersion = kIPPhotoCurrentOptimizationVersion;
-    [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-    if (completion != nil) {
+    //
+    //  We may be on the loading queue. The save has to happen on the main
+    //  thread, and has to be on disk before the journal goes away.
+    //
+    
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
       
-      [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
-        
-        completion();
-      }];
-    }
+      portfolio.imageOptimizationVersion = kIPPhotoCurrentOptimizationVersion;
+      [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+      [journal finish];
+    }];
     return;
   }
   
-  [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhotos:toOptimize withCompletion:^(void) {
-
-    portfolio.imageOptimizationVersion = kIPPhotoCurrentOptimizationVersion;
-    [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-    if (completion != nil) {
+  //
+  //  Photos are queued in portfolio order, and each one commits to the
+  //  journal as soon as it's done, from the thread that optimized it. Only
+  //  the UI update goes to the main thread.
+  //
+  
+  [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhotos:toOptimize 
+                                                          inLane:IPOptimizationLaneBackground 
+                                                          commit:^(IPPhoto *thePhoto) {
+                                                            
+    if ([thePhoto isOptimized]) {
+      
+      [journal commitPhoto:thePhoto];
+    }
+    
+  } progress:^(IPPhoto *thePhoto, NSUInteger completedCount, NSUInteger totalCount) {
+                                                          
+    if ([thePhoto isOptimized]) {
       
-      completion();
+      [thePhoto.parent.parent photoInSetHasChanged:thePhoto];
     }
+    
+  } withCompletion:^(void) {
+    
+    portfolio.imageOptimizationVersion = kIPPhotoCurrentOptimizationVersion;
+    [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+    [journal finish];
   }];
 }
 @end
@@ -22,6 +22,7 @@
 #import <AssetsLibrary/AssetsLibrary.h>
 #import "BDSelectableALAsset.h"
 #import "IPPhoto.h"
+#import "IPPhotoStore.h"
 #import "IPPhotoOptimizationManager.h"
 
 @interface BDSelectableALAsset()
@@ -101,7 +102,7 @@
   //  in one go.
   //
   
-  NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:^(void) {
+  [[IPPhotoOptimizationManager sharedManager] addOperationInLane:IPOptimizationLaneImport withBlock:^(void) {
       
     //
     //  General strategy: Create a CGImageSourceRef from the raw asset image.
@@ -112,6 +113,23 @@
     NSString *filename = nil;
     @autoreleasepool {
       
+      //
+      //  If this asset was imported before, share the stored copy and skip
+      //  the decode entirely.
+      //
+      
+      IPPhotoStore *store = [IPPhotoStore sharedStore];
+      NSString *sourceIdentifier = [[self.asset valueForProperty:ALAssetPropertyAssetURL] absoluteString];
+      filename = [store retainFilenameForSourceIdentifier:sourceIdentifier];
+      if (filename != nil) {
+        
+        [[NSOperationQueue mainQueue] addOperationWithBlock:^ {
+          
+          completion(filename, @"public.jpeg");
+        }];
+        return;
+      }
+      
       UIImageOrientation orientation = [[self.asset valueForProperty:ALAssetPropertyOrientation] intValue];
       ALAssetRepresentation *representation = [self.asset defaultRepresentation];
       NSDictionary *metadata = [representation metadata];
@@ -152,8 +170,7 @@
         
         UIImage *uiImage = [[UIImage alloc] initWithCGImage:theImage scale:1.0 orientation:orientation];
         NSData *jpegData = UIImageJPEGRepresentation(uiImage, 0.8);
-        filename = [IPPhoto filenameForNewPhoto];
-        [jpegData writeToFile:filename atomically:YES];
+        filename = [store filenameForData:jpegData sourceIdentifier:sourceIdentifier];
         CFRelease(theImage);
       }
     }
@@ -163,9 +180,6 @@
       completion(filename, @"public.jpeg");
     }];
   }];
-  
-  [operation setQueuePriority:NSOperationQueuePriorityNormal];
-  [[[IPPhotoOptimizationManager sharedManager] optimizationQueue] addOperation:operation];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,61 @@
+//
+//  IPBandTiler.h
+//  ipad-portfolio
+//
+//  Builds a tile pyramid from an image file without ever holding the whole
+//  image in memory. The source is decoded one horizontal band (one row of
+//  tiles) at a time. Each band gets cut into tiles, then scaled in half and
+//  handed down to the next level, which cuts its own tiles whenever it has a
+//  full band. Peak memory is about two bands of the full-width image, no
+//  matter how tall it is.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class IPTileEncoder;
+
+@interface IPBandTiler : NSObject
+
+//
+//  Encodes each band's tiles. If nil, |tileImageAtPath:...| makes one sized
+//  for the tile size.
+//
+
+@property (nonatomic, strong) IPTileEncoder *encoder;
+
+//
+//  Bytes of band buffers the last |tileImageAtPath:...| call held at once.
+//  For tests and benchmarking.
+//
+
+@property (nonatomic, readonly) NSUInteger peakBandBytes;
+
+//
+//  Can |path| be tiled in bands? Images that need an EXIF rotation can't be,
+//  because their rows run the wrong way.
+//
+
++ (BOOL)canTileImageAtPath:(NSString *)path;
+
+//
+//  Writes the pyramid for the image at |sourcePath| to |pyramidPath|.
+//  Synchronous and slow; call it off the main thread.
+//
+
+- (BOOL)tileImageAtPath:(NSString *)sourcePath
+        toPyramidAtPath:(NSString *)pyramidPath
+               tileSize:(NSUInteger)tileSize;
+
+@end
@@ -0,0 +1,240 @@
+//
+//  IPBandTiler.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <ImageIO/ImageIO.h>
+#import <UIKit/UIKit.h>
+#import "IPBandTiler.h"
+#import "IPTilePyramid.h"
+#import "IPTileEncoder.h"
+
+@interface IPBandTiler ()
+
+@property (nonatomic, readwrite) NSUInteger peakBandBytes;
+@property (nonatomic, strong) IPTilePyramidWriter *writer;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPBandTiler {
+
+  //
+  //  Per level: the band being filled, how many of its rows are filled, which
+  //  row of tiles it is, and how many rows the level has received in total.
+  //
+
+  CGContextRef _bands[kIPTilePyramidMaxLevels];
+  NSUInteger _filledRows[kIPTilePyramidMaxLevels];
+  NSUInteger _bandIndex[kIPTilePyramidMaxLevels];
+  NSUInteger _receivedRows[kIPTilePyramidMaxLevels];
+  CGSize _levelSizes[kIPTilePyramidMaxLevels];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (BOOL)canTileImageAtPath:(NSString *)path {
+
+  if (path == nil) {
+
+    return NO;
+  }
+  CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:path], NULL);
+  if (source == NULL) {
+
+    return NO;
+  }
+  NSDictionary *properties = (NSDictionary *)CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source, 0, NULL));
+  CFRelease(source);
+  return properties != nil && [properties[(id)kCGImagePropertyOrientation] integerValue] <= 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [self releaseBands];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)releaseBands {
+
+  for (NSUInteger level = 0; level < kIPTilePyramidMaxLevels; level++) {
+
+    CGContextRelease(_bands[level]);
+    _bands[level] = NULL;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Allocates one band per level: full level width, one tile tall (or the
+//  whole level, if that's shorter).
+//
+
+- (BOOL)createBandsForImageSize:(CGSize)imageSize {
+
+  CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+  NSUInteger totalBytes = 0;
+  BOOL succeeded = YES;
+  for (NSUInteger level = 0; level < self.writer.levelCount; level++) {
+
+    _levelSizes[level] = [IPTilePyramid sizeOfLevel:level forImageSize:imageSize];
+    _bands[level] = CGBitmapContextCreate(NULL,
+                                          _levelSizes[level].width,
+                                          MIN(self.writer.tileSize, _levelSizes[level].height),
+                                          8,
+                                          0,
+                                          rgbColorSpace,
+                                          kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+    if (_bands[level] == NULL) {
+
+      succeeded = NO;
+      break;
+    }
+    CGContextSetInterpolationQuality(_bands[level], kCGInterpolationHigh);
+    totalBytes += CGBitmapContextGetBytesPerRow(_bands[level]) * CGBitmapContextGetHeight(_bands[level]);
+  }
+  CGColorSpaceRelease(rgbColorSpace);
+  self.peakBandBytes = totalBytes;
+  return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Cuts the filled rows of |level|'s band into tiles, passes a half-size copy
+//  down to the next level, and empties the band.
+//
+
+- (BOOL)flushLevel:(NSUInteger)level {
+
+  CGContextRef band = _bands[level];
+  NSUInteger rows = _filledRows[level];
+  CGFloat width = _levelSizes[level].width;
+
+  CGImageRef bandImage = CGBitmapContextCreateImage(band);
+  CGImageRef filled = CGImageCreateWithImageInRect(bandImage, CGRectMake(0, 0, width, rows));
+  CGImageRelease(bandImage);
+  if (filled == NULL) {
+
+    return NO;
+  }
+
+  BOOL succeeded = [self.encoder addRowOfTiles:filled
+                                           row:_bandIndex[level]
+                                         level:level
+                                     toPyramid:self.writer];
+
+  NSUInteger nextLevel = level + 1;
+  if (succeeded && nextLevel < self.writer.levelCount) {
+
+    CGContextRef nextBand = _bands[nextLevel];
+    CGFloat nextBandHeight = CGBitmapContextGetHeight(nextBand);
+    NSUInteger halfRows = MIN((rows + 1) / 2, _levelSizes[nextLevel].height - _receivedRows[nextLevel]);
+    CGContextDrawImage(nextBand,
+                       CGRectMake(0,
+                                  nextBandHeight - _filledRows[nextLevel] - halfRows,
+                                  _levelSizes[nextLevel].width,
+                                  halfRows),
+                       filled);
+    _filledRows[nextLevel] += halfRows;
+    _receivedRows[nextLevel] += halfRows;
+    if (_filledRows[nextLevel] == nextBandHeight ||
+        _receivedRows[nextLevel] == _levelSizes[nextLevel].height) {
+
+      succeeded = [self flushLevel:nextLevel];
+    }
+  }
+  CGImageRelease(filled);
+  _filledRows[level] = 0;
+  _bandIndex[level]++;
+  return succeeded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)tileImageAtPath:(NSString *)sourcePath
+        toPyramidAtPath:(NSString *)pyramidPath
+               tileSize:(NSUInteger)tileSize {
+
+  //
+  //  Don't let ImageIO keep decoded pixels around between bands; each band
+  //  draw decodes only what it needs.
+  //
+
+  NSDictionary *options = @{(id)kCGImageSourceShouldCache: (id)kCFBooleanFalse};
+  CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:sourcePath],
+                                                       (__bridge CFDictionaryRef)options);
+  if (source == NULL) {
+
+    return NO;
+  }
+  CGImageRef image = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+  CFRelease(source);
+  if (image == NULL) {
+
+    return NO;
+  }
+  CGFloat width = CGImageGetWidth(image);
+  CGFloat height = CGImageGetHeight(image);
+
+  if (self.encoder == nil) {
+
+    self.encoder = [[IPTileEncoder alloc] initWithTileSize:tileSize];
+  }
+  memset(_filledRows, 0, sizeof(_filledRows));
+  memset(_bandIndex, 0, sizeof(_bandIndex));
+  memset(_receivedRows, 0, sizeof(_receivedRows));
+  self.writer = [[IPTilePyramidWriter alloc] initWithPath:pyramidPath
+                                                imageSize:CGSizeMake(width, height)
+                                                 tileSize:tileSize];
+  BOOL succeeded = (self.writer != nil) && [self createBandsForImageSize:CGSizeMake(width, height)];
+
+  CGContextRef band = _bands[0];
+  CGFloat bandHeight = succeeded ? CGBitmapContextGetHeight(band) : 0;
+  for (NSUInteger y = 0; succeeded && y < height; y += tileSize) {
+
+    @autoreleasepool {
+
+      //
+      //  Position the image so source row |y| lands on the band's top row.
+      //  Everything else is clipped away by the band's bounds.
+      //
+
+      CGContextDrawImage(band, CGRectMake(0, bandHeight - (height - y), width, height), image);
+      _filledRows[0] = MIN(tileSize, height - y);
+      succeeded = [self flushLevel:0];
+    }
+  }
+  CGImageRelease(image);
+  [self releaseBands];
+
+  if (!succeeded) {
+
+    DDLogError(@"%s -- unable to tile %@", __PRETTY_FUNCTION__, sourcePath);
+    [self.writer cancel];
+    self.writer = nil;
+    return NO;
+  }
+  succeeded = [self.writer finish];
+  self.writer = nil;
+  return succeeded;
+}
+
+@end
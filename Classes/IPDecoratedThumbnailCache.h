@@ -0,0 +1,79 @@
+//
+//  IPDecoratedThumbnailCache.h
+//  ipad-portfolio
+//
+//  Thumbnails with their grid decoration (a solid border) already drawn
+//  in. Each one gets drawn once, then comes from memory (the
+//  IPImageMemoryManager) or from a PNG in the caches folder. Keys follow the
+//  photo's content and optimization version and the decoration, so a
+//  changed photo or a new border never picks up a stale image. Saved files
+//  are recorded in the IPDerivedFileIndex and go away with the photo.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+#define kIPDecoratedThumbnailDirectory    @"DecoratedThumbnails"
+
+@class IPPhoto;
+
+@interface IPDecoratedThumbnailCache : NSObject
+
+//
+//  Thumbnails actually drawn, as opposed to found in memory or on disk. For
+//  tests.
+//
+
+@property (nonatomic, readonly) NSUInteger renderCount;
+
++ (IPDecoratedThumbnailCache *)sharedCache;
+
+//
+//  Saves thumbnails in |directory|, which gets created if needed.
+//
+
+- (id)initWithDirectory:(NSString *)directory;
+
+//
+//  Identifies |photo|'s thumbnail covering |pixelSize|, framed in a
+//  |borderWidth| border of |borderColor|.
+//
+
++ (NSString *)keyForPhoto:(IPPhoto *)photo
+                pixelSize:(CGSize)pixelSize
+              borderWidth:(CGFloat)borderWidth
+              borderColor:(UIColor *)borderColor;
+
+//
+//  The decorated thumbnail if it's already in memory; never touches disk.
+//  This is all a grid cell should need once the grid has been seen.
+//
+
+- (UIImage *)cachedThumbnailForPhoto:(IPPhoto *)photo
+                           pixelSize:(CGSize)pixelSize
+                         borderWidth:(CGFloat)borderWidth
+                         borderColor:(UIColor *)borderColor;
+
+//
+//  The decorated thumbnail, from memory, from disk, or freshly drawn. Nil
+//  if the photo isn't optimized yet. Slow; call it off the main thread.
+//
+
+- (UIImage *)thumbnailForPhoto:(IPPhoto *)photo
+                     pixelSize:(CGSize)pixelSize
+                   borderWidth:(CGFloat)borderWidth
+                   borderColor:(UIColor *)borderColor;
+
+@end
@@ -0,0 +1,201 @@
+//
+//  IPDecoratedThumbnailCache.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <ImageIO/ImageIO.h>
+#import "IPDecoratedThumbnailCache.h"
+#import "IPPhoto.h"
+#import "IPImageMemoryManager.h"
+#import "IPDerivedFileIndex.h"
+#import "UIImage+Border.h"
+#import "NSString+TestHelper.h"
+
+@interface IPDecoratedThumbnailCache ()
+
+@property (nonatomic, readwrite) NSUInteger renderCount;
+@property (nonatomic, copy) NSString *directory;
+
+@end
+
+@implementation IPDecoratedThumbnailCache
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPDecoratedThumbnailCache *)sharedCache {
+
+  static IPDecoratedThumbnailCache *sharedCache = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    sharedCache = [[IPDecoratedThumbnailCache alloc] initWithDirectory:[kIPDecoratedThumbnailDirectory asPathInCachesFolder]];
+  });
+  return sharedCache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithDirectory:(NSString *)directory {
+
+  self = [super init];
+  if (self != nil) {
+
+    _directory = [directory copy];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:NULL];
+  }
+  return self;
+}
+
+#pragma mark - Keys
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The part of the key that names the file: the thumbnail rung (named for
+//  the photo's content), the optimization version that drew it, and the
+//  decoration. Nil if there's no rung yet.
+//
+
++ (NSString *)nameForPhoto:(IPPhoto *)photo
+                 pixelSize:(CGSize)pixelSize
+               borderWidth:(CGFloat)borderWidth
+               borderColor:(UIColor *)borderColor {
+
+  NSString *rung = [[photo thumbnailFilenameCoveringPixelSize:pixelSize] lastPathComponent];
+  if (rung == nil) {
+
+    return nil;
+  }
+  CGFloat red = 0, green = 0, blue = 0, alpha = 0;
+  [borderColor getRed:&red green:&green blue:&blue alpha:&alpha];
+  return [NSString stringWithFormat:@"%@-v%d-b%.0f-%02x%02x%02x%02x.png",
+          [rung stringByDeletingPathExtension],
+          photo.optimizedVersion,
+          borderWidth,
+          (int)roundf(red * 255),
+          (int)roundf(green * 255),
+          (int)roundf(blue * 255),
+          (int)roundf(alpha * 255)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSString *)keyForPhoto:(IPPhoto *)photo
+                pixelSize:(CGSize)pixelSize
+              borderWidth:(CGFloat)borderWidth
+              borderColor:(UIColor *)borderColor {
+
+  NSString *name = [self nameForPhoto:photo pixelSize:pixelSize borderWidth:borderWidth borderColor:borderColor];
+  return (name == nil) ? nil : [@"decorated|" stringByAppendingString:name];
+}
+
+#pragma mark - Thumbnails
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)cachedThumbnailForPhoto:(IPPhoto *)photo
+                           pixelSize:(CGSize)pixelSize
+                         borderWidth:(CGFloat)borderWidth
+                         borderColor:(UIColor *)borderColor {
+
+  if (![photo isOptimized]) {
+
+    return nil;
+  }
+  NSString *key = [IPDecoratedThumbnailCache keyForPhoto:photo
+                                               pixelSize:pixelSize
+                                             borderWidth:borderWidth
+                                             borderColor:borderColor];
+  return [[IPImageMemoryManager sharedManager] imageForKey:key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Loads a saved thumbnail, decoded now rather than at first draw.
+//
+
+- (UIImage *)thumbnailFromFile:(NSString *)path {
+
+  if (![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+
+    return nil;
+  }
+  CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:path], NULL);
+  if (source == NULL) {
+
+    return nil;
+  }
+  NSDictionary *options = @{(id)kCGImageSourceShouldCacheImmediately: (id)kCFBooleanTrue};
+  CGImageRef pixels = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+  CFRelease(source);
+  if (pixels == NULL) {
+
+    return nil;
+  }
+  UIImage *thumbnail = [UIImage imageWithCGImage:pixels];
+  CGImageRelease(pixels);
+  return thumbnail;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)thumbnailForPhoto:(IPPhoto *)photo
+                     pixelSize:(CGSize)pixelSize
+                   borderWidth:(CGFloat)borderWidth
+                   borderColor:(UIColor *)borderColor {
+
+  if (![photo isOptimized]) {
+
+    return nil;
+  }
+  NSString *name = [IPDecoratedThumbnailCache nameForPhoto:photo
+                                                 pixelSize:pixelSize
+                                               borderWidth:borderWidth
+                                               borderColor:borderColor];
+  if (name == nil) {
+
+    return nil;
+  }
+  NSString *key = [@"decorated|" stringByAppendingString:name];
+  IPImageMemoryManager *memoryManager = [IPImageMemoryManager sharedManager];
+  UIImage *decorated = [memoryManager imageForKey:key];
+  if (decorated != nil) {
+
+    return decorated;
+  }
+  NSString *path = [self.directory stringByAppendingPathComponent:name];
+  decorated = [self thumbnailFromFile:path];
+  if (decorated == nil) {
+
+    UIImage *thumbnail = [photo thumbnailCoveringPixelSize:pixelSize];
+    decorated = [thumbnail imageWithBorderWidth:borderWidth andColor:[borderColor CGColor]];
+    if (decorated == nil) {
+
+      return nil;
+    }
+    @synchronized(self) {
+
+      self.renderCount++;
+    }
+    [UIImagePNGRepresentation(decorated) writeToFile:path atomically:YES];
+    [[IPDerivedFileIndex sharedIndex] addPath:path forFilename:photo.filename];
+  }
+  [memoryManager setImage:decorated forKey:key kind:IPImageMemoryKindThumbnail];
+  return decorated;
+}
+
+@end
@@ -0,0 +1,77 @@
+//
+//  IPDerivedFileIndex.h
+//  ipad-portfolio
+//
+//  Remembers which files were made from each photo file (thumbnails, tile
+//  pyramids, composites, ...), so deleting a photo touches only what it owns
+//  instead of scanning whole folders. Deletions happen in the background, in
+//  batches.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+#define kIPDerivedFileIndexFilename   @"derived-files.plist"
+
+@interface IPDerivedFileIndex : NSObject
+
+//
+//  The index for the app's Caches folder. Paths are recorded relative to the
+//  home directory, so they survive the container moving.
+//
+
++ (IPDerivedFileIndex *)sharedIndex;
+
+//
+//  Designated initializer. The index file lives in |directory|; recorded
+//  paths are stored relative to |rootDirectory|. The first time there is no
+//  index file, |directory| gets swept once for the per-scale tile folders
+//  older versions left behind.
+//
+
+- (id)initWithDirectory:(NSString *)directory rootDirectory:(NSString *)rootDirectory;
+
+//
+//  Records that |path| was made from the photo file |filename|.
+//
+
+- (void)addPath:(NSString *)path forFilename:(NSString *)filename;
+
+//
+//  Everything recorded for |filename|, as full paths.
+//
+
+- (NSArray *)pathsForFilename:(NSString *)filename;
+
+//
+//  Drops one photo store reference to |filename|. If that was the last one,
+//  deletes |filename|, the paths recorded for it, and |knownPaths| (derived
+//  files whose names are predictable, which may predate the index). Returns
+//  right away; all of it happens in the background. Requests close together
+//  are done as one batch, with one save of each index.
+//
+//  If the photo store has taken a new reference to |filename| by the time
+//  the batch runs (the same image was added again), nothing of it is
+//  deleted.
+//
+
+- (void)releaseFilename:(NSString *)filename derivedPaths:(NSArray *)knownPaths;
+
+//
+//  Blocks until queued removals have finished. For tests.
+//
+
+- (void)waitUntilRemovalsFinish;
+
+@end
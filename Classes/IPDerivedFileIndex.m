@@ -0,0 +1,347 @@
+//
+//  IPDerivedFileIndex.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPDerivedFileIndex.h"
+#import "IPPhotoStore.h"
+
+//
+//  Older versions kept tiles in one folder per scale, named
+//  "<photo>_jpg_<tile size>_<scale>".
+//
+
+#define kIPDerivedFileIndexLegacyTileMarker   @"_jpg_"
+
+@interface IPDerivedFileIndex ()
+
+@property (nonatomic, copy) NSString *directory;
+@property (nonatomic, copy) NSString *rootDirectory;
+
+//
+//  Photo file name -> mutable set of relative paths.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *entries;
+
+//
+//  Photo files waiting for the next batch, once per reference to drop.
+//
+
+@property (nonatomic, strong) NSMutableArray *pendingReleases;
+
+//
+//  Predictable paths to go with them: photo file -> full paths derived from
+//  it.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *pendingRemovals;
+
+//
+//  Serial queue for removals and index saves.
+//
+
+@property (nonatomic, strong) dispatch_queue_t queue;
+
+//
+//  Is a save already queued?
+//
+
+@property (nonatomic, assign) BOOL saveScheduled;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPDerivedFileIndex
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPDerivedFileIndex *)sharedIndex {
+
+  static IPDerivedFileIndex *sharedIndex = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+    sharedIndex = [[IPDerivedFileIndex alloc] initWithDirectory:paths[0] rootDirectory:NSHomeDirectory()];
+  });
+  return sharedIndex;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithDirectory:(NSString *)directory rootDirectory:(NSString *)rootDirectory {
+
+  self = [super init];
+  if (self != nil) {
+
+    _directory = [directory copy];
+    _rootDirectory = [rootDirectory copy];
+    _entries = [[NSMutableDictionary alloc] init];
+    _pendingReleases = [[NSMutableArray alloc] init];
+    _pendingRemovals = [[NSMutableDictionary alloc] init];
+    _queue = dispatch_queue_create("pholio.IPDerivedFileIndex", DISPATCH_QUEUE_SERIAL);
+
+    NSDictionary *index = [NSDictionary dictionaryWithContentsOfFile:[self indexPath]];
+    if (index != nil) {
+
+      [index enumerateKeysAndObjectsUsingBlock:^(id filename, id paths, BOOL *stop) {
+
+        (self.entries)[filename] = [NSMutableSet setWithArray:paths];
+      }];
+
+    } else {
+
+      dispatch_async(_queue, ^{
+
+        [self removeLegacyTileDirectories];
+      });
+      [self scheduleSave];
+    }
+  }
+  return self;
+}
+
+#pragma mark - Helpers
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)indexPath {
+
+  return [self.directory stringByAppendingPathComponent:kIPDerivedFileIndexFilename];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Entries are keyed by the last path component; photo files all live in
+//  the same folder.
+//
+
+- (NSString *)keyForFilename:(NSString *)filename {
+
+  return [filename lastPathComponent];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)relativePathForPath:(NSString *)path {
+
+  NSString *root = [self.rootDirectory stringByAppendingString:@"/"];
+  if ([path hasPrefix:root]) {
+
+    return [path substringFromIndex:[root length]];
+  }
+  return path;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)fullPathForRelativePath:(NSString *)relativePath {
+
+  if ([relativePath isAbsolutePath]) {
+
+    return relativePath;
+  }
+  return [self.rootDirectory stringByAppendingPathComponent:relativePath];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Queues a write of the index, unless one is already queued. Call while
+//  synchronized on |self|. Many changes in a row cost one write.
+//
+
+- (void)scheduleSave {
+
+  if (self.saveScheduled) {
+
+    return;
+  }
+  self.saveScheduled = YES;
+  dispatch_async(self.queue, ^{
+
+    NSMutableDictionary *index = [NSMutableDictionary dictionary];
+    @synchronized(self) {
+
+      self.saveScheduled = NO;
+      [self.entries enumerateKeysAndObjectsUsingBlock:^(id filename, id paths, BOOL *stop) {
+
+        index[filename] = [paths allObjects];
+      }];
+    }
+    if (![index writeToFile:[self indexPath] atomically:YES]) {
+
+      DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, [self indexPath]);
+    }
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  One-time cleanup when upgrading: per-scale tile folders predate tile
+//  pyramids, and nothing reads them any more. Runs on |queue|.
+//
+
+- (void)removeLegacyTileDirectories {
+
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  for (NSString *name in [fileManager contentsOfDirectoryAtPath:self.directory error:NULL]) {
+
+    if ([name rangeOfString:kIPDerivedFileIndexLegacyTileMarker].location != NSNotFound) {
+
+      DDLogVerbose(@"%s -- removing directory %@", __PRETTY_FUNCTION__, name);
+      [fileManager removeItemAtPath:[self.directory stringByAppendingPathComponent:name] error:NULL];
+    }
+  }
+}
+
+#pragma mark - Recording
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)addPath:(NSString *)path forFilename:(NSString *)filename {
+
+  if (path == nil || filename == nil) {
+
+    return;
+  }
+  NSString *key = [self keyForFilename:filename];
+  NSString *relativePath = [self relativePathForPath:path];
+  @synchronized(self) {
+
+    NSMutableSet *paths = (self.entries)[key];
+    if (paths == nil) {
+
+      paths = [NSMutableSet set];
+      (self.entries)[key] = paths;
+    }
+    if (![paths containsObject:relativePath]) {
+
+      [paths addObject:relativePath];
+      [self scheduleSave];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSArray *)pathsForFilename:(NSString *)filename {
+
+  NSMutableArray *paths = [NSMutableArray array];
+  @synchronized(self) {
+
+    for (NSString *relativePath in (self.entries)[[self keyForFilename:filename]]) {
+
+      [paths addObject:[self fullPathForRelativePath:relativePath]];
+    }
+  }
+  return paths;
+}
+
+#pragma mark - Removing
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)releaseFilename:(NSString *)filename derivedPaths:(NSArray *)knownPaths {
+
+  if (filename == nil) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    BOOL batchQueued = ([self.pendingReleases count] > 0);
+    [self.pendingReleases addObject:filename];
+    NSMutableSet *pending = (self.pendingRemovals)[filename];
+    if (pending == nil) {
+
+      pending = [NSMutableSet set];
+      (self.pendingRemovals)[filename] = pending;
+    }
+    if (knownPaths != nil) {
+
+      [pending addObjectsFromArray:knownPaths];
+    }
+    if (batchQueued) {
+
+      return;
+    }
+  }
+  dispatch_async(self.queue, ^{
+
+    [self removePendingFiles];
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Takes everything queued so far, drops its photo store references in one
+//  go, and deletes whatever no photo uses any more. Runs on |queue|. Files
+//  get removed without checking for them first; a missing file is just an
+//  error to ignore.
+//
+
+- (void)removePendingFiles {
+
+  NSArray *releases;
+  NSDictionary *knownPaths;
+  @synchronized(self) {
+
+    releases = self.pendingReleases;
+    knownPaths = self.pendingRemovals;
+    self.pendingReleases = [[NSMutableArray alloc] init];
+    self.pendingRemovals = [[NSMutableDictionary alloc] init];
+  }
+  IPPhotoStore *store = [IPPhotoStore sharedStore];
+  NSSet *unreferenced = [store releaseFilenames:releases];
+  DDLogVerbose(@"%s -- released %d photo files, removing %d", __PRETTY_FUNCTION__, [releases count], [unreferenced count]);
+
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  for (NSString *filename in unreferenced) {
+
+    if (![store removeFilenameIfUnreferenced:filename]) {
+
+      DDLogVerbose(@"%s -- %@ is in use again; keeping it", __PRETTY_FUNCTION__, filename);
+      continue;
+    }
+    NSMutableSet *paths = [NSMutableSet setWithArray:[self pathsForFilename:filename]];
+    [paths unionSet:knownPaths[filename]];
+    @synchronized(self) {
+
+      [self.entries removeObjectForKey:[self keyForFilename:filename]];
+      [self scheduleSave];
+    }
+    for (NSString *path in paths) {
+
+      [fileManager removeItemAtPath:path error:NULL];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilRemovalsFinish {
+
+  //
+  //  The queue is serial, so an empty block runs after everything queued.
+  //
+
+  dispatch_sync(self.queue, ^{});
+}
+
+@end
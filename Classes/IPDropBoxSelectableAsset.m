@@ -22,6 +22,7 @@
 #import <DropboxSDK/DropboxSDK.h>
 #import "NSString+TestHelper.h"
 #import "IPPhoto.h"
+#import "IPPhotoStore.h"
 
 @interface IPDropBoxSelectableAsset()
 
@@ -79,6 +80,17 @@
 - (void)imageAsyncWithCompletion:(void(^)(NSString *filename, NSString *uti))completion {
   
   self.imageCompletion = completion;
+  
+  //
+  //  Skip the download if we already have this revision of the file.
+  //
+  
+  NSString *existing = [[IPPhotoStore sharedStore] retainFilenameForSourceIdentifier:[self sourceIdentifier]];
+  if (existing != nil) {
+    
+    self.imageCompletion(existing, @"public.jpeg");
+    return;
+  }
   NSString *localPath = [IPPhoto filenameForNewPhoto];
   DDLogVerbose(@"Loading image into %@", localPath);
   [self.restClient loadFile:self.metadata.path intoPath:localPath];
@@ -86,6 +98,16 @@
 
 #pragma mark - Properties
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Identifies this file & revision for the photo store.
+//
+
+- (NSString *)sourceIdentifier {
+  
+  return [NSString stringWithFormat:@"dropbox:%@#%@", self.metadata.path, self.metadata.rev];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 - (NSString *)title {
@@ -137,7 +159,8 @@
 - (void)restClient:(DBRestClient *)client loadedFile:(NSString *)destPath contentType:(NSString *)contentType {
   
   DDLogVerbose(@"%s -- loaded file from DropBox (%@, %@)", __PRETTY_FUNCTION__, destPath, contentType);
-  self.imageCompletion(destPath, contentType);
+  NSString *filename = [[IPPhotoStore sharedStore] adoptFileAtPath:destPath sourceIdentifier:[self sourceIdentifier]];
+  self.imageCompletion(filename, contentType);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -600,7 +600,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
   
   self.backgroundImageName = backgroundImageName;
   self.portfolio.backgroundImageName = backgroundImageName;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioBackgroundImageName ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -621,7 +621,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
 - (void)ipSettingsSetNavigationColor:(UIColor *)navigationColor {
   
   self.portfolio.navigationColor = navigationColor;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioNavigationColor ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
   
   self.navigationController.navigationBar.barTintColor = navigationColor;
   self.navigationController.navigationBar.translucent = YES;
@@ -645,7 +645,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
 - (void)ipSettingsSetGridTextColor:(UIColor *)gridTextColor {
   
   self.portfolio.fontColor = gridTextColor;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioFontColor ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -668,7 +668,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
   UIFont *font = [UIFont fontWithName:fontFamily size:kIPPortfolioTitleFontSize];
   self.portfolio.titleFont = font;
   self.titleTextField.font = font;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioTitleFont ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -690,7 +690,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
   
   UIFont *font = [UIFont fontWithName:fontFamily size:[UIFont labelFontSize]];
   self.portfolio.textFont = font;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioTextFont ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -712,7 +712,7 @@ didFinishPickingMediaWithInfo:(NSDictionary *)info {
     
     self.portfolio.layoutStyle = IPPortfolioLayoutStyleStacks;
   }
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioLayoutStyle ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 #pragma mark - BDOverlayViewControllerDelegate
@@ -21,6 +21,7 @@
 #import "IPFlickrSelectableAsset.h"
 #import "IPFlickrAuthorizationManager.h"
 #import "IPPhoto.h"
+#import "IPPhotoStore.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -172,7 +173,17 @@
         }
       }
       
-      if (imageUrl != nil) {
+      IPPhotoStore *store = [IPPhotoStore sharedStore];
+      NSString *existing = [store retainFilenameForSourceIdentifier:[imageUrl absoluteString]];
+      if (existing != nil) {
+        
+        //
+        //  Already imported; no need to download again.
+        //
+        
+        filename = existing;
+        
+      } else if (imageUrl != nil) {
         
         DDLogVerbose(@"%s -- requesting image from %@",
                    __PRETTY_FUNCTION__,
@@ -183,8 +194,10 @@
                                                   returningResponse:&response
                                                               error:NULL];
         
-        filename = [IPPhoto filenameForNewPhoto];
-        [imageData writeToFile:filename atomically:YES];
+        if (imageData != nil) {
+          
+          filename = [store filenameForData:imageData sourceIdentifier:[imageUrl absoluteString]];
+        }
         
       } else {
         
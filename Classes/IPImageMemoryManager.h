@@ -0,0 +1,129 @@
+//
+//  IPImageMemoryManager.h
+//  ipad-portfolio
+//
+//  Owns the app's decoded bitmaps: full images, downsampled images,
+//  thumbnails, composites, and tiles. Everything shares one byte budget;
+//  the least recently used image goes first once it's exceeded. Images can
+//  be pinned while they're on screen. On a memory warning, unpinned images
+//  get shed a kind at a time, cheapest to rebuild first. Safe to use from
+//  any thread.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+#define kIPImageMemoryManagerDefaultByteLimit    (96 * 1024 * 1024)
+
+//
+//  After a memory warning, no more than this fraction of |byteLimit| stays.
+//
+
+#define kIPImageMemoryManagerPressureFraction    0.25
+
+//
+//  Kinds of bitmap, in the order they get shed under memory pressure.
+//
+
+typedef enum {
+  IPImageMemoryKindTile = 0,
+  IPImageMemoryKindFullImage,
+  IPImageMemoryKindDownsampled,
+  IPImageMemoryKindComposite,
+  IPImageMemoryKindThumbnail,
+  IPImageMemoryKindCount
+} IPImageMemoryKind;
+
+@interface IPImageMemoryManager : NSObject
+
+@property (nonatomic, readonly) NSUInteger byteLimit;
+
+//
+//  Bytes of decoded pixels held, in total and pinned.
+//
+
+@property (nonatomic, readonly) NSUInteger currentBytes;
+@property (nonatomic, readonly) NSUInteger pinnedBytes;
+
+//
+//  Number of images held.
+//
+
+@property (nonatomic, readonly) NSUInteger count;
+
++ (IPImageMemoryManager *)sharedManager;
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit;
+
+//
+//  Bytes held of one kind of image.
+//
+
+- (NSUInteger)bytesOfKind:(IPImageMemoryKind)kind;
+
+//
+//  The image for |key|, marked most recently used; or nil.
+//
+
+- (UIImage *)imageForKey:(NSString *)key;
+
+//
+//  Like |imageForKey:|, but doesn't count as a use.
+//
+
+- (BOOL)containsImageForKey:(NSString *)key;
+
+//
+//  Adds |image|, replacing any image already under |key|, then evicts
+//  least recently used unpinned images until under budget. The cost is the
+//  size of the image's bitmap.
+//
+
+- (void)setImage:(UIImage *)image forKey:(NSString *)key kind:(IPImageMemoryKind)kind;
+
+- (void)removeImageForKey:(NSString *)key;
+- (void)removeImagesWithKeyPrefix:(NSString *)prefix;
+- (void)removeImagesOfKind:(IPImageMemoryKind)kind;
+- (void)removeAllImages;
+
+//
+//  While pinned, images whose keys start with |prefix| don't get evicted
+//  or shed, including ones added later. Pins nest; each pin needs an unpin.
+//
+
+- (void)pinImagesWithKeyPrefix:(NSString *)prefix;
+- (void)unpinImagesWithKeyPrefix:(NSString *)prefix;
+
+//
+//  Sheds unpinned images, kind by kind in |IPImageMemoryKind| order and
+//  least recently used first within a kind, until no more than |byteCount|
+//  bytes are held.
+//
+
+- (void)shedImagesToByteCount:(NSUInteger)byteCount;
+
+//
+//  Called for UIApplicationDidReceiveMemoryWarningNotification.
+//
+
+- (void)didReceiveMemoryWarning;
+
+//
+//  One line of sizes by kind, for the log.
+//
+
+- (NSString *)usageDescription;
+
+@end
@@ -0,0 +1,439 @@
+//
+//  IPImageMemoryManager.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPImageMemoryManager.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  One held image.
+//
+
+@interface IPImageMemoryEntry : NSObject
+
+@property (nonatomic, strong) UIImage *image;
+@property (nonatomic, assign) IPImageMemoryKind kind;
+@property (nonatomic, assign) NSUInteger cost;
+
+@end
+
+@implementation IPImageMemoryEntry
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPImageMemoryManager ()
+
+@property (nonatomic, readwrite) NSUInteger currentBytes;
+
+//
+//  Key -> IPImageMemoryEntry.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *entries;
+
+//
+//  Keys, least recently used first.
+//
+
+@property (nonatomic, strong) NSMutableOrderedSet *recentlyUsed;
+
+//
+//  Pinned key prefixes, counted.
+//
+
+@property (nonatomic, strong) NSCountedSet *pinnedPrefixes;
+
+@end
+
+@implementation IPImageMemoryManager {
+
+  NSUInteger _bytesOfKind[IPImageMemoryKindCount];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPImageMemoryManager *)sharedManager {
+
+  static IPImageMemoryManager *sharedManager = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    sharedManager = [[IPImageMemoryManager alloc] initWithByteLimit:kIPImageMemoryManagerDefaultByteLimit];
+  });
+  return sharedManager;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit {
+
+  self = [super init];
+  if (self != nil) {
+
+    _byteLimit = byteLimit;
+    _entries = [[NSMutableDictionary alloc] init];
+    _recentlyUsed = [[NSMutableOrderedSet alloc] init];
+    _pinnedPrefixes = [[NSCountedSet alloc] init];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(didReceiveMemoryWarning)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)init {
+
+  return [self initWithByteLimit:kIPImageMemoryManagerDefaultByteLimit];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+#pragma mark - Accounting
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)bytesOfKind:(IPImageMemoryKind)kind {
+
+  if (kind >= IPImageMemoryKindCount) {
+
+    return 0;
+  }
+  @synchronized(self) {
+
+    return _bytesOfKind[kind];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)pinnedBytes {
+
+  @synchronized(self) {
+
+    NSUInteger pinnedBytes = 0;
+    for (NSString *key in self.entries) {
+
+      if ([self isPinnedKey:key]) {
+
+        pinnedBytes += [(self.entries)[key] cost];
+      }
+    }
+    return pinnedBytes;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)count {
+
+  @synchronized(self) {
+
+    return [self.entries count];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)usageDescription {
+
+  static NSString * const kindNames[IPImageMemoryKindCount] = {
+    @"tiles", @"full images", @"downsampled", @"composites", @"thumbnails"
+  };
+  @synchronized(self) {
+
+    NSMutableArray *parts = [NSMutableArray arrayWithCapacity:IPImageMemoryKindCount];
+    for (NSUInteger kind = 0; kind < IPImageMemoryKindCount; kind++) {
+
+      [parts addObject:[NSString stringWithFormat:@"%@ %.1f MB",
+                        kindNames[kind],
+                        _bytesOfKind[kind] / (1024.0 * 1024.0)]];
+    }
+    return [NSString stringWithFormat:@"%.1f of %.1f MB in %d images (%.1f MB pinned): %@",
+            self.currentBytes / (1024.0 * 1024.0),
+            self.byteLimit / (1024.0 * 1024.0),
+            [self.entries count],
+            self.pinnedBytes / (1024.0 * 1024.0),
+            [parts componentsJoinedByString:@", "]];
+  }
+}
+
+#pragma mark - Images
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Call while synchronized on |self|.
+//
+
+- (BOOL)isPinnedKey:(NSString *)key {
+
+  for (NSString *prefix in self.pinnedPrefixes) {
+
+    if ([key hasPrefix:prefix]) {
+
+      return YES;
+    }
+  }
+  return NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)imageForKey:(NSString *)key {
+
+  if (key == nil) {
+
+    return nil;
+  }
+  @synchronized(self) {
+
+    IPImageMemoryEntry *entry = (self.entries)[key];
+    if (entry != nil) {
+
+      [self.recentlyUsed removeObject:key];
+      [self.recentlyUsed addObject:key];
+    }
+    return entry.image;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)containsImageForKey:(NSString *)key {
+
+  if (key == nil) {
+
+    return NO;
+  }
+  @synchronized(self) {
+
+    return (self.entries)[key] != nil;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)setImage:(UIImage *)image forKey:(NSString *)key kind:(IPImageMemoryKind)kind {
+
+  if (key == nil || kind >= IPImageMemoryKindCount) {
+
+    return;
+  }
+  if (image == nil) {
+
+    [self removeImageForKey:key];
+    return;
+  }
+  CGImageRef pixels = [image CGImage];
+  NSUInteger cost = (pixels == NULL) ? 0 : CGImageGetBytesPerRow(pixels) * CGImageGetHeight(pixels);
+  IPImageMemoryEntry *entry = [[IPImageMemoryEntry alloc] init];
+  entry.image = image;
+  entry.kind = kind;
+  entry.cost = cost;
+  @synchronized(self) {
+
+    [self removeEntryForKey:key];
+    (self.entries)[key] = entry;
+    [self.recentlyUsed addObject:key];
+    _bytesOfKind[kind] += cost;
+    self.currentBytes += cost;
+    [self evictToByteCount:self.byteLimit sparingKey:key];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Call while synchronized on |self|.
+//
+
+- (void)removeEntryForKey:(NSString *)key {
+
+  IPImageMemoryEntry *entry = (self.entries)[key];
+  if (entry == nil) {
+
+    return;
+  }
+  _bytesOfKind[entry.kind] -= entry.cost;
+  self.currentBytes -= entry.cost;
+  [self.entries removeObjectForKey:key];
+  [self.recentlyUsed removeObject:key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Evicts unpinned images from the cold end, whatever their kind, until no
+//  more than |byteCount| bytes are held. Call while synchronized on |self|.
+//
+
+- (void)evictToByteCount:(NSUInteger)byteCount sparingKey:(NSString *)sparedKey {
+
+  if (self.currentBytes <= byteCount) {
+
+    return;
+  }
+  for (NSString *key in [self.recentlyUsed array]) {
+
+    if (self.currentBytes <= byteCount) {
+
+      break;
+    }
+    if (![key isEqualToString:sparedKey] && ![self isPinnedKey:key]) {
+
+      [self removeEntryForKey:key];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeImageForKey:(NSString *)key {
+
+  if (key == nil) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    [self removeEntryForKey:key];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeImagesWithKeyPrefix:(NSString *)prefix {
+
+  if (prefix == nil) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    for (NSString *key in [self.entries allKeys]) {
+
+      if ([key hasPrefix:prefix]) {
+
+        [self removeEntryForKey:key];
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeImagesOfKind:(IPImageMemoryKind)kind {
+
+  @synchronized(self) {
+
+    for (NSString *key in [self.entries allKeys]) {
+
+      if ([(self.entries)[key] kind] == kind) {
+
+        [self removeEntryForKey:key];
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeAllImages {
+
+  @synchronized(self) {
+
+    [self.entries removeAllObjects];
+    [self.recentlyUsed removeAllObjects];
+    memset(_bytesOfKind, 0, sizeof(_bytesOfKind));
+    self.currentBytes = 0;
+  }
+}
+
+#pragma mark - Pinning
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)pinImagesWithKeyPrefix:(NSString *)prefix {
+
+  if (prefix == nil) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    [self.pinnedPrefixes addObject:prefix];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)unpinImagesWithKeyPrefix:(NSString *)prefix {
+
+  if (prefix == nil) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    [self.pinnedPrefixes removeObject:prefix];
+    [self evictToByteCount:self.byteLimit sparingKey:nil];
+  }
+}
+
+#pragma mark - Memory pressure
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)shedImagesToByteCount:(NSUInteger)byteCount {
+
+  @synchronized(self) {
+
+    for (NSUInteger kind = 0; kind < IPImageMemoryKindCount && self.currentBytes > byteCount; kind++) {
+
+      for (NSString *key in [self.recentlyUsed array]) {
+
+        if (self.currentBytes <= byteCount) {
+
+          break;
+        }
+        IPImageMemoryEntry *entry = (self.entries)[key];
+        if (entry.kind == kind && ![self isPinnedKey:key]) {
+
+          [self removeEntryForKey:key];
+        }
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)didReceiveMemoryWarning {
+
+  [self shedImagesToByteCount:self.byteLimit * kIPImageMemoryManagerPressureFraction];
+  DDLogInfo(@"%s -- now holding %@", __PRETTY_FUNCTION__, [self usageDescription]);
+}
+
+@end
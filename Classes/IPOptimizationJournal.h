@@ -0,0 +1,73 @@
+//
+//  IPOptimizationJournal.h
+//  ipad-portfolio
+//
+//  Records which photos have finished an optimization upgrade, one photo at
+//  a time, so an upgrade that gets interrupted can pick up where it left off.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+#define kIPOptimizationJournalFilename    @"optimization-journal.txt"
+
+@class IPPhoto;
+
+@interface IPOptimizationJournal : NSObject
+
+//
+//  The optimization version this journal records progress toward.
+//
+
+@property (nonatomic, readonly) NSUInteger optimizationVersion;
+
+//
+//  How many photos have been committed.
+//
+
+@property (nonatomic, readonly) NSUInteger countOfCommittedPhotos;
+
+//
+//  The location of the journal for the default portfolio.
+//
+
++ (NSString *)defaultJournalPath;
+
+//
+//  Opens the journal at |path|. If the file holds progress toward a different
+//  optimization version, it gets thrown away and the journal starts empty.
+//
+
++ (IPOptimizationJournal *)journalAtPath:(NSString *)path forOptimizationVersion:(NSUInteger)version;
+
+//
+//  Has |photo| already been committed?
+//
+
+- (BOOL)containsPhoto:(IPPhoto *)photo;
+
+//
+//  Durably records that |photo| is done. When this returns, the record has
+//  been flushed to disk. Safe to call from any thread.
+//
+
+- (void)commitPhoto:(IPPhoto *)photo;
+
+//
+//  The upgrade is complete and saved elsewhere; delete the journal.
+//
+
+- (void)finish;
+
+@end
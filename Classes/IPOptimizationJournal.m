@@ -0,0 +1,207 @@
+//
+//  IPOptimizationJournal.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPOptimizationJournal.h"
+#import "IPPhoto.h"
+#import "NSString+TestHelper.h"
+
+//
+//  The journal is a text file. The first line is this prefix followed by the
+//  optimization version; each following line is the last path component of
+//  a committed photo. A line only counts once its newline is on disk, so a
+//  write torn by a crash just looks like an uncommitted photo.
+//
+
+#define kIPOptimizationJournalHeaderPrefix    @"IPOptimizationJournal "
+
+@interface IPOptimizationJournal ()
+
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, strong) NSMutableSet *committedNames;
+@property (nonatomic, strong) NSFileHandle *fileHandle;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPOptimizationJournal
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSString *)defaultJournalPath {
+
+  return [kIPOptimizationJournalFilename asPathInDocumentsFolder];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Designated initializer. Reads whatever progress is already on disk.
+//
+
+- (id)initWithPath:(NSString *)path optimizationVersion:(NSUInteger)version {
+
+  self = [super init];
+  if (self != nil) {
+
+    _path = [path copy];
+    _optimizationVersion = version;
+    _committedNames = [[NSMutableSet alloc] init];
+    [self readJournal];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPOptimizationJournal *)journalAtPath:(NSString *)path forOptimizationVersion:(NSUInteger)version {
+
+  return [[IPOptimizationJournal alloc] initWithPath:path optimizationVersion:version];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [_fileHandle closeFile];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Loads committed names from disk. If the file is missing, unreadable, or
+//  for another version, starts it over.
+//
+
+- (void)readJournal {
+
+  NSString *header = [NSString stringWithFormat:@"%@%d\n",
+                      kIPOptimizationJournalHeaderPrefix,
+                      self.optimizationVersion];
+  NSString *contents = [NSString stringWithContentsOfFile:self.path
+                                                 encoding:NSUTF8StringEncoding
+                                                    error:NULL];
+  if (![contents hasPrefix:header]) {
+
+    DDLogVerbose(@"%s -- starting new journal at %@", __PRETTY_FUNCTION__, self.path);
+    [header writeToFile:self.path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+    return;
+  }
+
+  NSArray *lines = [[contents substringFromIndex:[header length]] componentsSeparatedByString:@"\n"];
+
+  //
+  //  The last element is whatever followed the final newline: empty if the
+  //  last write finished, a partial name if it didn't. Either way, skip it.
+  //
+
+  for (NSUInteger i = 0; i + 1 < [lines count]; i++) {
+
+    NSString *name = lines[i];
+    if ([name length] > 0) {
+
+      [self.committedNames addObject:name];
+    }
+  }
+  if ([[lines lastObject] length] > 0) {
+
+    //
+    //  Drop the torn record so the next append starts on a fresh line.
+    //
+
+    NSString *intact = [contents substringToIndex:[contents length] - [[lines lastObject] length]];
+    [intact writeToFile:self.path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+  }
+  DDLogVerbose(@"%s -- resuming with %d photos already committed",
+               __PRETTY_FUNCTION__,
+               [self.committedNames count]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Lazily opens the journal for appending.
+//
+
+- (NSFileHandle *)fileHandle {
+
+  if (_fileHandle == nil) {
+
+    _fileHandle = [NSFileHandle fileHandleForWritingAtPath:self.path];
+    [_fileHandle seekToEndOfFile];
+  }
+  return _fileHandle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)countOfCommittedPhotos {
+
+  @synchronized(self) {
+
+    return [self.committedNames count];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)containsPhoto:(IPPhoto *)photo {
+
+  @synchronized(self) {
+
+    return [self.committedNames containsObject:[photo.filename lastPathComponent]];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Append the photo's name and flush.
+//
+
+- (void)commitPhoto:(IPPhoto *)photo {
+
+  NSString *name = [photo.filename lastPathComponent];
+  if ([name length] == 0) {
+
+    return;
+  }
+  @synchronized(self) {
+
+    if ([self.committedNames containsObject:name]) {
+
+      return;
+    }
+    NSData *line = [[name stringByAppendingString:@"\n"] dataUsingEncoding:NSUTF8StringEncoding];
+    [self.fileHandle writeData:line];
+    [self.fileHandle synchronizeFile];
+    [self.committedNames addObject:name];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)finish {
+
+  @synchronized(self) {
+
+    [_fileHandle closeFile];
+    _fileHandle = nil;
+    [self.committedNames removeAllObjects];
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:NULL];
+  }
+}
+
+@end
@@ -108,5 +108,11 @@
 
 -(void)removeObjectFromPhotosAtIndex:(NSUInteger)index;
 
+//
+//  Removes several photos from the page at once.
+//
+
+-(void)removePhotosAtIndexes:(NSIndexSet *)indexes;
+
 
 @end
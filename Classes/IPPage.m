@@ -20,6 +20,7 @@
 
 #import "IPPage.h"
 #import "IPPhoto.h"
+#import "IPPhotoStore.h"
 
 @implementation IPPage
 
@@ -149,6 +150,11 @@
   [self.photos removeObjectAtIndex:index];
 }
 
+-(void)removePhotosAtIndexes:(NSIndexSet *)indexes {
+  [[self.photos objectsAtIndexes:indexes] makeObjectsPerformSelector:@selector(setParent:) withObject:nil];
+  [self.photos removeObjectsAtIndexes:indexes];
+}
+
 #pragma mark - IPPasteboardObjectDelegate
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -163,6 +169,7 @@
                 @"imageDictionary must not be nil");
   for (IPPhoto *photo in self.photos) {
     
+    [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:photo.filename];
     NSData *imageData = [NSData dataWithContentsOfFile:photo.filename];
     if (imageData) {
       (pasteboardObject.imageDataDictionary)[photo.filename] = imageData;
@@ -172,8 +179,10 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  We got unarchived. Unpack the image data. Each photo should have the same
-//  image but a different filename at the end of this.
+//  We got unarchived. If the photo store still has a photo's file (a copy,
+//  or a set duplicated), the pasted photo just shares it: no decode, no new
+//  file, and it keeps its optimization. Otherwise (e.g., after a cut), unpack
+//  the image data into a new file.
 //
 
 - (void)pasteboardObjectDidUnarchive:(IPPasteboardObject *)pasteboardObject {
@@ -183,6 +192,10 @@
   for (IPPhoto *photo in self.photos) {
 
     NSString *oldFilename = photo.filename;
+    if ([[IPPhotoStore sharedStore] retainFilename:oldFilename]) {
+      
+      continue;
+    }
     NSData *data = (pasteboardObject.imageDataDictionary)[oldFilename];
     UIImage *image = [UIImage imageWithData:data];
     if (image != nil) {
@@ -30,7 +30,16 @@
 #define kThumbnailSize              384
 #define kThumbnailBorderSize        10
 #define kThumbnailCornerRadius      0
-#define kThumbnailPathComponent     @"thumbnails_v4"
+#define kThumbnailPathComponent     @"thumbnails_v5"
+
+//
+//  |optimize| saves a ladder of thumbnails, by long edge in pixels. The
+//  middle rung is |kThumbnailSize| and backs the |thumbnail| property.
+//
+
+#define kThumbnailSizeSmall         96
+#define kThumbnailSizeLarge         1024
+#define kThumbnailJPEGQuality       0.7
 
 //
 //  When we rescale this image for tiling, we don't need to worry about
@@ -41,12 +50,20 @@
 
 extern CGFloat kIPPhotoMaxEdgeSize;
 
+//
+//  Images whose long edge is more than this many times |kIPPhotoMaxEdgeSize|
+//  (e.g., panoramas) keep their full resolution, displayed through tiles,
+//  instead of getting scaled down.
+//
+
+#define kIPPhotoFullResolutionFactor  2
+
 //
 //  The version number of the image optimization algorithm we use. 
 //  Used in -[IPPhoto optimize].
 //
 
-#define kIPPhotoCurrentOptimizationVersion    (4)
+#define kIPPhotoCurrentOptimizationVersion    (5)
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -54,6 +71,7 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 ////////////////////////////////////////////////////////////////////////////////
 
 @class IPPage;
+@class IPTilePyramid;
 @interface IPPhoto : NSObject <NSCoding, NSCopying> { }
 
 @property (nonatomic, copy) NSString *filename;
@@ -79,11 +97,73 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 @property (nonatomic, weak) IPPage *parent;
 
 //
-//  Unload the image.
+//  The thumbnail rung sizes, smallest first.
+//
+
++ (NSArray *)thumbnailLadder;
+
+//
+//  The file for the thumbnail rung whose long edge is |edge| pixels.
+//
+
+- (NSString *)thumbnailFilenameForEdge:(NSUInteger)edge;
+
+//
+//  The file of the smallest thumbnail rung whose long edge is at least the
+//  long edge of |pixelSize|. If no rung is big enough, returns |filename|.
+//
+
+- (NSString *)thumbnailFilenameCoveringPixelSize:(CGSize)pixelSize;
+
+//
+//  Loads the smallest image that covers |pixelSize| (see above). Does not
+//  cache, except that the |kThumbnailSize| rung comes from |thumbnail|.
+//  Safe to call off the main thread.
+//
+
+- (UIImage *)thumbnailCoveringPixelSize:(CGSize)pixelSize;
+
+//
+//  The photo decoded straight to a long edge of at least that of |pixelSize|
+//  (never more than the source), using the decoder's scaled decode, so the
+//  full-size pixels never exist. The source is the smallest thumbnail rung
+//  that covers, or the file. Results are fully decoded and cached by size.
+//  Safe to call off the main thread.
+//
+
+- (UIImage *)imageDecodedToPixelSize:(CGSize)pixelSize;
+
+//
+//  What |imageDecodedToPixelSize:| would return, if it's already in memory;
+//  nil otherwise. Never decodes, so it's safe on the main thread.
+//
+
+- (UIImage *)cachedImageDecodedToPixelSize:(CGSize)pixelSize;
+
+//
+//  Drop this photo's reference to the image. The pixels belong to the
+//  shared IPImageMemoryManager, which frees them when it needs the room.
 //
 
 - (void)unloadImage;
 
+//
+//  Keep every decoded image of this photo (image, thumbnail, downsampled
+//  copies) from being evicted, e.g. while it's on screen. Calls nest; each
+//  pin needs an unpin.
+//
+
+- (void)pinDecodedImages;
+- (void)unpinDecodedImages;
+
+//
+//  |image|, with its pixels already decoded, so the first draw on the main
+//  thread doesn't have to decode. Also becomes |image|. Slow; call it off the
+//  main thread.
+//
+
+- (UIImage *)decodedImage;
+
 //
 //  Gets a filename suitable for a new photo file.
 //
@@ -102,16 +182,34 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 - (BOOL)isOptimized;
 
 //
-//  Synchronously saves tiles for all needed display scales.
+//  Did |optimize| keep this photo at full resolution? If so, |imageSize| is
+//  the full size, |image| is scaled to the display size, and the photo is
+//  meant to be shown with its tiles.
 //
 
-- (void)saveTilesForAllScales;
+- (BOOL)keepsFullResolution;
 
 //
-//  Synchronously save the tiles for a given scale.
+//  The pixel dimensions of the image stored in |filename|, read from the
+//  file header without decoding the image. Returns CGSizeZero if the file
+//  cannot be read. Used to estimate how much memory |optimize| will need.
 //
 
-- (void)saveTilesForScale:(CGFloat)scale;
+- (CGSize)pixelSizeOfImageFile;
+
+//
+//  How many times image files have been decoded, across all photos. Only
+//  meant for benchmarking the optimization pipeline.
+//
+
++ (NSUInteger)decodeCount;
+
+//
+//  Synchronously saves tiles for all needed display scales, as a single tile
+//  pyramid file (see IPTilePyramid.h).
+//
+
+- (void)saveTilesForAllScales;
 
 //
 //  Test if all tiles have been written for a given scale.
@@ -120,10 +218,16 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 - (BOOL)tilesExistForScale:(CGFloat)scale;
 
 //
-//  The prefix of the filenames of our tile.
+//  Where the tile pyramid for this photo lives.
+//
+
+- (NSString *)tilePyramidPath;
+
+//
+//  The mapped tile pyramid, or nil if none has been saved.
 //
 
-- (NSString *)tileDirectoryForTileSize:(CGSize)tileSize andScale:(CGFloat)currentScale;
+- (IPTilePyramid *)tilePyramid;
 
 //
 //  The default tile size.
@@ -132,11 +236,20 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 - (CGSize)defaultTileSize;
 
 //
-//  How many levels of detail should we have for this photo?
+//  How many levels of detail should we have for this photo? Just one until
+//  its tiles are on disk.
 //
 
 - (size_t)levelsOfDetail;
 
+//
+//  Is this photo meant to be shown with tiles it doesn't have (because the
+//  system purged them)? Rebuild them with |saveTilesForAllScales|, off the
+//  main thread.
+//
+
+- (BOOL)needsTiles;
+
 //
 //  The minimum scale level we expect when displaying this photo in a tiled view.
 //
@@ -144,7 +257,7 @@ extern CGFloat kIPPhotoMaxEdgeSize;
 - (CGFloat)minimumTileScale;
 
 //
-//  Gets a tile.
+//  Gets a tile, decoded, through the shared IPTileCache.
 //
 
 - (UIImage *)tileForScale:(CGFloat)scale row:(NSUInteger)row column:(NSUInteger)column;
@@ -19,6 +19,7 @@
 //
 
 #import <ImageIO/ImageIO.h>
+#import <libkern/OSAtomic.h>
 #import "IPPhoto.h"
 #import "IPSet.h"
 #import "UIImage+Alpha.h"
@@ -26,9 +27,113 @@
 #import "UIImage+Border.h"
 #import "NSString+TestHelper.h"
 #import "IPPortfolio.h"
+#import "IPPhotoStore.h"
+#import "IPTilePyramid.h"
+#import "IPBandTiler.h"
+#import "IPTileCache.h"
+#import "IPTileEncoder.h"
+#import "IPDerivedFileIndex.h"
+#import "IPImageMemoryManager.h"
 
 CGFloat kIPPhotoMaxEdgeSize;
 
+//
+//  Count of image file decodes, for benchmarking. See |+decodeCount|.
+//
+
+static volatile int32_t IPPhotoDecodeCount = 0;
+
+//
+//  |imageDecodedToPixelSize:| rounds requests up to a multiple of this many
+//  pixels on the long edge, so nearby sizes share a cache entry.
+//
+
+#define kIPPhotoDecodedSizeStep           128
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Draws |image| into a new bitmap whose long edge is at most |maxEdge|
+//  pixels. Returns a +1 reference, or NULL on failure. Never scales up.
+//
+
+static CGImageRef IPCreateImageScaledToSize(CGImageRef image, size_t scaledWidth, size_t scaledHeight);
+
+static CGImageRef IPCreateImageScaledToMaxEdge(CGImageRef image, CGFloat maxEdge) {
+  
+  if (image == NULL) {
+    
+    return NULL;
+  }
+  CGFloat width  = CGImageGetWidth(image);
+  CGFloat height = CGImageGetHeight(image);
+  CGFloat scale  = MIN(1.0, maxEdge / MAX(width, height));
+  return IPCreateImageScaledToSize(image, 
+                                   MAX(1, (size_t)roundf(width * scale)), 
+                                   MAX(1, (size_t)roundf(height * scale)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Draws |image| into a new bitmap of exactly |scaledWidth| x |scaledHeight|
+//  pixels. Returns a +1 reference, or NULL on failure.
+//
+
+static CGImageRef IPCreateImageScaledToSize(CGImageRef image, size_t scaledWidth, size_t scaledHeight) {
+  
+  if (image == NULL) {
+    
+    return NULL;
+  }
+  CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef bitmap = CGBitmapContextCreate(NULL,
+                                              scaledWidth,
+                                              scaledHeight,
+                                              8,
+                                              0,
+                                              rgbColorSpace,
+                                              kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+  CGColorSpaceRelease(rgbColorSpace);
+  if (bitmap == NULL) {
+    
+    return NULL;
+  }
+  CGContextSetInterpolationQuality(bitmap, kCGInterpolationHigh);
+  CGContextDrawImage(bitmap, CGRectMake(0, 0, scaledWidth, scaledHeight), image);
+  CGImageRef scaledImage = CGBitmapContextCreateImage(bitmap);
+  CGContextRelease(bitmap);
+  return scaledImage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Loads the image at |path| with its pixels decoded here, on the calling
+//  thread. |-[UIImage initWithContentsOfFile:]| would leave that to the
+//  first draw, which happens on the main thread.
+//
+
+static UIImage *IPDecodedImageWithContentsOfFile(NSString *path) {
+  
+  if (path == nil) {
+    
+    return nil;
+  }
+  CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:path], NULL);
+  if (source == NULL) {
+    
+    return nil;
+  }
+  NSDictionary *options = @{(id)kCGImageSourceShouldCacheImmediately: (id)kCFBooleanTrue};
+  CGImageRef pixels = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+  CFRelease(source);
+  if (pixels == NULL) {
+    
+    return nil;
+  }
+  UIImage *image = [UIImage imageWithCGImage:pixels];
+  CGImageRelease(pixels);
+  return image;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,12 +145,8 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 @interface IPPhoto ()
 
-- (UIImage *)thumbnailFromImage:(UIImage *)image;
+- (UIImage *)thumbnailFromImage:(UIImage *)image maxEdge:(CGFloat)maxEdge;
 - (void)saveThumbnail:(UIImage *)thumbnail toPath:(NSString *)thumbnailPath;
-- (void)saveTilesOfSize:(CGSize)size 
-               forImage:(UIImage*)image 
-            toDirectory:(NSString*)directoryPath 
-            usingPrefix:(NSString*)prefix;
 + (UIImage *)rescaleIfNecessary:(UIImage *)image;
 
 @end
@@ -54,15 +155,28 @@ CGFloat kIPPhotoMaxEdgeSize;
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-@implementation IPPhoto
+@implementation IPPhoto {
+  
+  //
+  //  Mapped on first use; see |tilePyramid|.
+  //
+  
+  IPTilePyramid *tilePyramid_;
+  
+  //
+  //  The decoded pixels belong to the IPImageMemoryManager; these only save
+  //  a lookup while something else keeps them alive.
+  //
+  
+  __weak UIImage *image_;
+  __weak UIImage *thumbnail_;
+}
 
 @synthesize filename = filename_;
 @dynamic thumbnailFilename;
 @synthesize title = title_;
 @synthesize caption = caption_;
-@synthesize image = image_;
 @synthesize imageSize = imageSize_;
-@synthesize thumbnail = thumbnail_;
 @synthesize parent = parent_;
 @synthesize optimizedVersion = optimizedVersion_;
 
@@ -254,7 +368,9 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Gets a new filename suitable for a new image.
+//  Gets a new filename suitable for a new image. This is a staging name;
+//  once the file is written, hand it to |-[IPPhotoStore adoptFileAtPath:...]|
+//  to get its permanent, content-addressed name.
 //
 
 + (NSString *)filenameForNewPhoto {
@@ -262,13 +378,18 @@ CGFloat kIPPhotoMaxEdgeSize;
   NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
   NSString *docDirectory = paths[0];
   
-  //
-  //  Generate a random filename. TODO: Check for collisions.
-  //
+  NSString *uniqueName = [[[NSProcessInfo processInfo] globallyUniqueString] stringByAppendingPathExtension:@"jpg"];
+  return [docDirectory stringByAppendingPathComponent:uniqueName];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  How many times any photo has decoded an image file.
+//
+
++ (NSUInteger)decodeCount {
   
-  NSNumber *random = @(arc4random());
-  NSString *_filename = [[random stringValue] stringByAppendingPathExtension:@"jpg"];
-  return [docDirectory stringByAppendingPathComponent:_filename];
+  return IPPhotoDecodeCount;
 }
 
 #pragma mark - Properties
@@ -285,18 +406,87 @@ CGFloat kIPPhotoMaxEdgeSize;
   
   NSString *thumbnailFilename_ = [[[docDirectory stringByAppendingPathComponent:kThumbnailPathComponent] 
                                    stringByAppendingPathComponent:[[self.filename lastPathComponent] stringByDeletingPathExtension]] 
-                                  stringByAppendingPathExtension:@"png"];
+                                  stringByAppendingPathExtension:@"jpg"];
   return thumbnailFilename_;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSArray *)thumbnailLadder {
+  
+  return @[@(kThumbnailSizeSmall), @(kThumbnailSize), @(kThumbnailSizeLarge)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The |kThumbnailSize| rung keeps the plain |thumbnailFilename|; the others
+//  get their edge size appended, e.g. "1234-96.jpg".
+//
+
+- (NSString *)thumbnailFilenameForEdge:(NSUInteger)edge {
+  
+  NSString *thumbnailFilename = self.thumbnailFilename;
+  if (edge == kThumbnailSize) {
+    
+    return thumbnailFilename;
+  }
+  NSString *base = [thumbnailFilename stringByDeletingPathExtension];
+  return [[base stringByAppendingFormat:@"-%d", edge] stringByAppendingPathExtension:@"jpg"];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Which rung covers |pixelSize|? Returns 0 if none does. An empty size
+//  (e.g., a view not laid out yet) gets the default rung.
+//
+
+- (NSUInteger)thumbnailEdgeCoveringPixelSize:(CGSize)pixelSize {
+  
+  CGFloat needed = MAX(pixelSize.width, pixelSize.height);
+  if (needed <= 0) {
+    
+    return kThumbnailSize;
+  }
+  for (NSNumber *edge in [IPPhoto thumbnailLadder]) {
+    
+    if ([edge floatValue] >= needed) {
+      
+      return [edge unsignedIntegerValue];
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)thumbnailFilenameCoveringPixelSize:(CGSize)pixelSize {
+  
+  NSUInteger edge = [self thumbnailEdgeCoveringPixelSize:pixelSize];
+  if (edge == 0) {
+    
+    return self.filename;
+  }
+  return [self thumbnailFilenameForEdge:edge];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)thumbnailCoveringPixelSize:(CGSize)pixelSize {
+  
+  NSUInteger edge = [self thumbnailEdgeCoveringPixelSize:pixelSize];
+  if (edge == kThumbnailSize) {
+    
+    return self.thumbnail;
+  }
+  return IPDecodedImageWithContentsOfFile([self thumbnailFilenameCoveringPixelSize:pixelSize]);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Deletes the files backing this photo.
 //
 
 - (void)deletePhotoFiles {
-  BOOL isDirectory;
-  NSFileManager *fileManager = [NSFileManager defaultManager];
   
   if (self.filename == nil) {
   
@@ -307,73 +497,69 @@ CGFloat kIPPhotoMaxEdgeSize;
     return;
   }
   
-  if ([fileManager fileExistsAtPath:self.filename isDirectory:&isDirectory]) {
-    if (!isDirectory) {
-      [fileManager removeItemAtPath:self.filename error:nil];
-    }
-  }
-  if ([fileManager fileExistsAtPath:self.thumbnailFilename isDirectory:&isDirectory]) {
-    if (!isDirectory) {
-      [fileManager removeItemAtPath:self.thumbnailFilename error:nil];
-    }
+  @synchronized(self) {
+    
+    tilePyramid_ = nil;
   }
+  [[IPTileCache sharedCache] removeTilesForPyramidAtPath:[self tilePyramidPath]];
+  [[IPImageMemoryManager sharedManager] removeImagesWithKeyPrefix:[self memoryKeyPrefix]];
   
   //
-  //  Delete any tiled files. Need to figure out what scales we would have
-  //  generated tiles for, find the directory for that scale, and delete it.
+  //  Other photos may share this file; only the last one out deletes it.
+  //  Working that out touches the photo store's index, so it happens in the
+  //  background, batched with other deletions, along with removing the file
+  //  and everything made from it. The index knows what was made; the
+  //  predictable names cover photos from before it existed. Until then,
+  //  dropping what's in memory is safe either way.
   //
   
-  NSArray *cacheContents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[NSString cachesFolder] error:NULL];
-  for (NSString *directoryName in cacheContents) {
-    
-    NSString *prefix = [[self.filename lastPathComponent] stringByDeletingPathExtension];
-    NSRange location = [directoryName rangeOfString:prefix];
-    if (location.location == 0) {
-      
-      DDLogVerbose(@"%s -- removing directory %@", __PRETTY_FUNCTION__, directoryName);
-      [fileManager removeItemAtPath:[directoryName asPathInCachesFolder] error:NULL];
-    }
-  }
+  [[IPDerivedFileIndex sharedIndex] releaseFilename:self.filename derivedPaths:[self derivedFilePaths]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Creates random values for filename and thumbnailFilename.
+//  Files this photo may have made from |filename| whose names we can work
+//  out: the thumbnail ladder and the tile pyramid.
 //
 
--(void)createRandomFilenames {
-
-  self.filename = [IPPhoto filenameForNewPhoto];
+- (NSArray *)derivedFilePaths {
+  
+  NSMutableArray *paths = [NSMutableArray array];
+  for (NSNumber *edge in [IPPhoto thumbnailLadder]) {
+    
+    [paths addObject:[self thumbnailFilenameForEdge:[edge unsignedIntegerValue]]];
+  }
+  [paths addObject:[self tilePyramidPath]];
+  return paths;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Creates a thumbnail image from the current image property. This is 
-//  |kThumbnailSize| pixels, and it's saved to a PNG file.
+//  Creates a thumbnail image from an already-decoded image. This is at most
+//  |maxEdge| pixels on the long edge. It works entirely from the pixels in
+//  |image|; the file does not get opened or decoded again.
 //
 
-- (UIImage *)thumbnailFromImage:(UIImage *)image {
+- (UIImage *)thumbnailFromImage:(UIImage *)image maxEdge:(CGFloat)maxEdge {
 
-  NSURL *imageUrl = [NSURL fileURLWithPath:self.filename];
-  CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)imageUrl, NULL);
-  NSDictionary *thumbnailOptions = @{(id)kCGImageSourceCreateThumbnailWithTransform: (id)kCFBooleanTrue,
-                                    (id)(id)kCGImageSourceCreateThumbnailFromImageAlways: (id)kCFBooleanTrue,
-                                    (id)kCGImageSourceThumbnailMaxPixelSize: [NSNumber numberWithFloat:kThumbnailSize]};
-  CGImageRef thumbnail = CGImageSourceCreateThumbnailAtIndex(imageSource, 0, (__bridge CFDictionaryRef)thumbnailOptions);
+  CGImageRef thumbnail = IPCreateImageScaledToMaxEdge([image CGImage], maxEdge);
+  if (thumbnail == NULL) {
+    
+    return nil;
+  }
   UIImage *resizedImage = [UIImage imageWithCGImage:thumbnail];
-  CFRelease(thumbnail);
-  CFRelease(imageSource);
+  CGImageRelease(thumbnail);
   return resizedImage;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Saves an image to a path in PNG format.
+//  Saves a thumbnail to a path in JPEG format.
 //
 
 - (void)saveThumbnail:(UIImage *)thumbnail toPath:(NSString *)thumbnailPath {
   
-  NSData *thumbnailData = UIImagePNGRepresentation(thumbnail);
+  NSData *thumbnailData = UIImageJPEGRepresentation(thumbnail, kThumbnailJPEGQuality);
   NSError *error = nil;
   if (thumbnailData && 
       ![thumbnailData writeToFile:thumbnailPath options:NSDataWritingAtomic error:&error]) {
@@ -405,19 +591,180 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 - (void)saveImageData {
   
-  NSData *imageData = UIImageJPEGRepresentation(image_, 0.8);
-  NSAssert(image_ != nil, @"Cannot save nil image");
+  UIImage *image = image_;
+  NSData *imageData = UIImageJPEGRepresentation(image, 0.8);
+  NSAssert(image != nil, @"Cannot save nil image");
   NSAssert(imageData != nil, 
                 @"Cannot get JPEG representation of image %@",
-                image_);
+                image);
   
   DDLogVerbose(@"%s -- saving image to %@", __PRETTY_FUNCTION__, self.filename);
   [imageData writeToFile:self.filename atomically:YES];
 }
 
+#pragma mark - Decoded images
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Every memory manager key for this photo's pixels starts with this, so
+//  they can be pinned or dropped together. Photos sharing a file share
+//  their pixels, too.
+//
+
+- (NSString *)memoryKeyPrefix {
+  
+  return [self.filename stringByAppendingString:@"|"];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Unloads the image.
+//  The version changes whenever |optimize| rewrites the file in place.
+//
+
+- (NSString *)imageMemoryKey {
+  
+  return [NSString stringWithFormat:@"%@image|%d", [self memoryKeyPrefix], self.optimizedVersion];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)thumbnailMemoryKey {
+  
+  return [[self memoryKeyPrefix] stringByAppendingString:@"thumbnail"];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  PRIVATE: Hands |image| to the memory manager as this photo's image.
+//
+
+- (void)holdImage:(UIImage *)image {
+  
+  if (self.filename != nil) {
+    
+    [[IPImageMemoryManager sharedManager] setImage:image 
+                                            forKey:[self imageMemoryKey] 
+                                              kind:IPImageMemoryKindFullImage];
+  }
+  image_ = image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)holdThumbnail:(UIImage *)thumbnail {
+  
+  if (self.filename != nil) {
+    
+    [[IPImageMemoryManager sharedManager] setImage:thumbnail 
+                                            forKey:[self thumbnailMemoryKey] 
+                                              kind:IPImageMemoryKindThumbnail];
+  }
+  thumbnail_ = thumbnail;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)pinDecodedImages {
+  
+  if (self.filename != nil) {
+    
+    [[IPImageMemoryManager sharedManager] pinImagesWithKeyPrefix:[self memoryKeyPrefix]];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)unpinDecodedImages {
+  
+  if (self.filename != nil) {
+    
+    [[IPImageMemoryManager sharedManager] unpinImagesWithKeyPrefix:[self memoryKeyPrefix]];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  ImageIO's thumbnail path decodes JPEGs at a reduced scale directly (DCT
+//  scaling), so asking it for a small image never materializes the big one.
+//  |ShouldCacheImmediately| makes the decode happen here, not at first draw.
+//
+
+- (NSUInteger)decodedEdgeForPixelSize:(CGSize)pixelSize {
+  
+  CGFloat needed = MAX(pixelSize.width, pixelSize.height);
+  return kIPPhotoDecodedSizeStep * (NSUInteger)ceilf(MAX(1, needed) / kIPPhotoDecodedSizeStep);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)memoryKeyForDecodedEdge:(NSUInteger)edge {
+  
+  return [NSString stringWithFormat:@"%@decoded|%d|%d", [self memoryKeyPrefix], self.optimizedVersion, edge];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)cachedImageDecodedToPixelSize:(CGSize)pixelSize {
+  
+  if (self.filename == nil) {
+    
+    return nil;
+  }
+  NSString *key = [self memoryKeyForDecodedEdge:[self decodedEdgeForPixelSize:pixelSize]];
+  return [[IPImageMemoryManager sharedManager] imageForKey:key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)imageDecodedToPixelSize:(CGSize)pixelSize {
+  
+  if (self.filename == nil) {
+    
+    return nil;
+  }
+  NSUInteger edge = [self decodedEdgeForPixelSize:pixelSize];
+  NSString *key = [self memoryKeyForDecodedEdge:edge];
+  IPImageMemoryManager *memoryManager = [IPImageMemoryManager sharedManager];
+  UIImage *cached = [memoryManager imageForKey:key];
+  if (cached != nil) {
+    
+    return cached;
+  }
+  
+  //
+  //  Until |optimize| runs there are no rungs; go to the file.
+  //
+  
+  NSString *source = [self isOptimized] ? [self thumbnailFilenameCoveringPixelSize:CGSizeMake(edge, edge)] 
+                                        : self.filename;
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:source];
+  CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:source], NULL);
+  if (imageSource == NULL) {
+    
+    return nil;
+  }
+  NSDictionary *decodeOptions = @{(id)kCGImageSourceCreateThumbnailWithTransform: (id)kCFBooleanTrue,
+                                  (id)kCGImageSourceCreateThumbnailFromImageAlways: (id)kCFBooleanTrue,
+                                  (id)kCGImageSourceShouldCacheImmediately: (id)kCFBooleanTrue,
+                                  (id)kCGImageSourceThumbnailMaxPixelSize: @(edge)};
+  CGImageRef decoded = CGImageSourceCreateThumbnailAtIndex(imageSource, 0, (__bridge CFDictionaryRef)decodeOptions);
+  CFRelease(imageSource);
+  if (decoded == NULL) {
+    
+    DDLogError(@"%s -- unable to decode %@", __PRETTY_FUNCTION__, source);
+    return nil;
+  }
+  OSAtomicIncrement32(&IPPhotoDecodeCount);
+  UIImage *image = [UIImage imageWithCGImage:decoded];
+  [memoryManager setImage:image forKey:key kind:IPImageMemoryKindDownsampled];
+  CGImageRelease(decoded);
+  return image;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Drops this photo's reference to the image. The memory manager keeps the
+//  pixels until it needs the room.
 //
 
 - (void)unloadImage {
@@ -425,6 +772,37 @@ CGFloat kIPPhotoMaxEdgeSize;
   image_ = nil;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  UIImage decodes lazily, on first draw. Drawing into a bitmap here moves
+//  that cost to the calling thread.
+//
+
+- (UIImage *)decodedImage {
+  
+  UIImage *image = self.image;
+  CGImageRef pixels = [image CGImage];
+  if (pixels == NULL) {
+    
+    return nil;
+  }
+  CGImageRef decoded = IPCreateImageScaledToSize(pixels, CGImageGetWidth(pixels), CGImageGetHeight(pixels));
+  if (decoded == NULL) {
+    
+    return image;
+  }
+  UIImage *decodedImage = [UIImage imageWithCGImage:decoded scale:image.scale orientation:image.imageOrientation];
+  CGImageRelease(decoded);
+  @synchronized(self) {
+    
+    if (image_ == image) {
+      
+      [self holdImage:decodedImage];
+    }
+  }
+  return decodedImage;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Returns the image. If the image has not yet been loaded, loads it
@@ -433,19 +811,46 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 - (UIImage *)image {
   
-  if (image_ != nil) {
-    return image_;
+  UIImage *image = image_;
+  if (image != nil) {
+    return image;
+  }
+  image = [[IPImageMemoryManager sharedManager] imageForKey:[self imageMemoryKey]];
+  if (image != nil) {
+    
+    image_ = image;
+    return image;
   }
-  image_ = [[UIImage alloc] initWithContentsOfFile:self.filename];
   
-  self.imageSize = [image_ size];
-  return image_;
+  //
+  //  A full-resolution photo is only ever decoded at display size. Its
+  //  |imageSize| stays the full size, which is what the tiles cover.
+  //
+  
+  if ([self keepsFullResolution]) {
+    
+    BOOL needsWrite;
+    image = [self displayImageFromFileNeedingWrite:&needsWrite];
+    [self holdImage:image];
+    return image;
+  }
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:self.filename];
+  image = [[UIImage alloc] initWithContentsOfFile:self.filename];
+  if (image != nil) {
+    
+    OSAtomicIncrement32(&IPPhotoDecodeCount);
+  }
+  [self holdImage:image];
+  
+  self.imageSize = [image size];
+  return image;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Sets the main image property. This causes a chain reaction... if the image
-//  is not |nil|, then the image gets saved to a randomly-generated file name.
+//  is not |nil|, then the image gets saved to a file named for its content
+//  (in the background; the pixels stay in memory for |optimize|).
 //  If there was already a file name associated with this photo, then the old
 //  file will get deleted. Finally, a thumbnail image will get created for the
 //  image and saved. Finally, if the photo belongs to a set *and* it is the
@@ -468,30 +873,25 @@ CGFloat kIPPhotoMaxEdgeSize;
   }
 
   //
-  //  NOTE: Instead of just storing |theImage| into |image_|, I'm first going
-  //  to save |theImage| (rescaled if necessary) and then load the saved file.
-  //  That will mark the image data as purgable.
-  //
-  
-  [self createRandomFilenames];
-  
+  //  Hand the pixels we were given to the memory manager; |optimize| derives
+  //  the display image and thumbnails straight from them, unless memory
+  //  pressure took them first. The encoded bytes go to the store in the
+  //  background. The file is named for its content, so pasting the same image
+  //  twice stores it once, and the name is known before the write finishes.
   //
   //  Create & drain an autorelease pool to get rid of |data| from memory as soon
-  //  as I'm done with it.
+  //  as the store has it.
   //
   
   @autoreleasepool {
     NSData *data = UIImageJPEGRepresentation(theImage, 0.8);
-    [data writeToFile:self.filename atomically:YES];
+    self.filename = [[IPPhotoStore sharedStore] filenameForData:data 
+                                               sourceIdentifier:nil 
+                                            writeAsynchronously:YES];
   }
-  
-  //
-  //  TODO -- wait, why do I read & decode the image here? I should just
-  //  assign |theImage|, right?
-  //
-  
-  image_ = [[UIImage alloc] initWithContentsOfFile:self.filename];
-  self.imageSize = [image_ size];
+  [self holdImage:theImage];
+  self.imageSize = CGSizeMake(theImage.size.width * theImage.scale, 
+                              theImage.size.height * theImage.scale);
 
   //
   //  Invalidate any existing thumbnail.
@@ -516,8 +916,9 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 - (UIImage *)thumbnail {
   
-  if (thumbnail_ != nil) {
-    return thumbnail_;
+  UIImage *thumbnail = thumbnail_;
+  if (thumbnail != nil) {
+    return thumbnail;
   }
 
   //
@@ -535,14 +936,26 @@ CGFloat kIPPhotoMaxEdgeSize;
     
     return nil;
   }
+  
+  //
+  //  A thumbnail still in memory came from the file, so only go to the disk
+  //  on a miss.
+  //
+  
+  thumbnail = [[IPImageMemoryManager sharedManager] imageForKey:[self thumbnailMemoryKey]];
+  if (thumbnail != nil) {
+    
+    thumbnail_ = thumbnail;
+    return thumbnail;
+  }
   if (![[NSFileManager defaultManager] fileExistsAtPath:thumbnailFilename]) {
 
     NSAssert(NO, @"Called -[IPPhoto thumbnail] before calling -[IPPhoto optimize]");
     return nil;
   }
-  
-  thumbnail_ = [[UIImage alloc] initWithContentsOfFile:thumbnailFilename];
-  return thumbnail_;
+  thumbnail = IPDecodedImageWithContentsOfFile(thumbnailFilename);
+  [self holdThumbnail:thumbnail];
+  return thumbnail;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -552,7 +965,8 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 - (CGSize)imageSize {
   
-  if (image_ != nil) {
+  UIImage *image = image_;
+  if (image != nil && ![self keepsFullResolution]) {
 
     //
     //  If the image has been loaded, then we cache and return its value.
@@ -560,13 +974,105 @@ CGFloat kIPPhotoMaxEdgeSize;
     //  gets unloaded.
     //
     
-    imageSize_ = image_.size;
+    imageSize_ = CGSizeMake(image.size.width * image.scale, 
+                            image.size.height * image.scale);
   }
   return imageSize_;
 }
 
 #pragma mark - Image optimization
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  PRIVATE: The display image for |optimize|, made from pixels already in
+//  memory (e.g., the image handed to |setImage:|). Returns nil if there are
+//  none, or if they still need an orientation applied; the file path handles
+//  that. Sets |*needsWrite| if the result differs from the file.
+//
+
+- (UIImage *)displayImageFromMemoryNeedingWrite:(BOOL *)needsWrite {
+  
+  UIImage *image = image_;
+  CGImageRef pixels = [image CGImage];
+  if (pixels == NULL || image.imageOrientation != UIImageOrientationUp) {
+    
+    return nil;
+  }
+  CGFloat maxEdge = MAX(CGImageGetWidth(pixels), CGImageGetHeight(pixels));
+  if (maxEdge <= kIPPhotoMaxEdgeSize) {
+    
+    *needsWrite = NO;
+    return image;
+  }
+  CGImageRef scaled = IPCreateImageScaledToMaxEdge(pixels, kIPPhotoMaxEdgeSize);
+  if (scaled == NULL) {
+    
+    return nil;
+  }
+  UIImage *displayImage = [UIImage imageWithCGImage:scaled];
+  CGImageRelease(scaled);
+  *needsWrite = YES;
+  return displayImage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  PRIVATE: The display image for |optimize|, decoded from |filename|. Sets
+//  |*needsWrite| if the result differs from the file.
+//
+
+- (UIImage *)displayImageFromFileNeedingWrite:(BOOL *)needsWrite {
+  
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:self.filename];
+  NSURL *imageUrl = [NSURL fileURLWithPath:self.filename];
+  CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)imageUrl, NULL);
+  if (imageSource == NULL) {
+    
+    DDLogError(@"%s -- unable to open %@", __PRETTY_FUNCTION__, self.filename);
+    return nil;
+  }
+  
+  //
+  //  Inspect the header: size and orientation.
+  //
+  
+  NSDictionary *imageProperties = (NSDictionary *)CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(imageSource, 0, NULL));
+  DDLogVerbose(@"%s -- got properties %@", 
+             __PRETTY_FUNCTION__,
+             imageProperties);
+  CGFloat pixelWidth = [imageProperties[(id)kCGImagePropertyPixelWidth] floatValue];
+  CGFloat pixelHeight = [imageProperties[(id)kCGImagePropertyPixelHeight] floatValue];
+  NSInteger orientation = [imageProperties[(id)kCGImagePropertyOrientation] integerValue];
+  CGFloat maxEdge = MAX(pixelWidth, pixelHeight);
+  DDLogVerbose(@"%s -- found max edge = %f (%f, %f)",
+             __PRETTY_FUNCTION__,
+             maxEdge,
+             pixelWidth,
+             pixelHeight);
+  
+  //
+  //  The one decode. Ask ImageIO for a "thumbnail" no bigger than the
+  //  display size; for images already small enough, that's a full-size,
+  //  fully-decoded, correctly-rotated bitmap.
+  //
+  
+  NSDictionary *decodeOptions = @{(id)kCGImageSourceCreateThumbnailWithTransform: (id)kCFBooleanTrue,
+                                  (id)kCGImageSourceCreateThumbnailFromImageAlways: (id)kCFBooleanTrue,
+                                  (id)kCGImageSourceThumbnailMaxPixelSize: @(MIN(maxEdge, kIPPhotoMaxEdgeSize))};
+  CGImageRef decoded = CGImageSourceCreateThumbnailAtIndex(imageSource, 0, (__bridge CFDictionaryRef)decodeOptions);
+  OSAtomicIncrement32(&IPPhotoDecodeCount);
+  CFRelease(imageSource);
+  if (decoded == NULL) {
+    
+    DDLogError(@"%s -- unable to decode %@", __PRETTY_FUNCTION__, self.filename);
+    return nil;
+  }
+  UIImage *displayImage = [UIImage imageWithCGImage:decoded];
+  CGImageRelease(decoded);
+  *needsWrite = (maxEdge > kIPPhotoMaxEdgeSize) || (orientation > 1);
+  return displayImage;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  "Optimize" the current photo. This involves:
@@ -575,6 +1081,13 @@ CGFloat kIPPhotoMaxEdgeSize;
 //      without blowing out all memory.
 //    - Computing & saving a thumbnail for the image.
 //
+//  The file gets decoded at most once. If the photo already holds decoded
+//  pixels (it just came from |setImage:|), those get used and the file isn't
+//  decoded at all. Otherwise ImageIO decodes straight to the display size
+//  (applying any EXIF orientation). The display image, the thumbnail, and
+//  |imageSize| all come from that one buffer. Outputs get written to disk but
+//  never read back.
+//
 //  This method runs synchronously, and can take a long time (and a lot of
 //  memory) to complete. Thus, the caller is advised to run it off the UI
 //  thread, but control how many background operations run concurrently.
@@ -591,66 +1104,115 @@ CGFloat kIPPhotoMaxEdgeSize;
     return;
   }
   
-  @autoreleasepool {
-  
   //
-  //  Use ImageIO to inspect the size of the image, and generate a 
-  //  resized image if needed.
+  //  Another photo sharing this file may have done the work already.
   //
   
-    NSURL *imageUrl = [NSURL fileURLWithPath:self.filename];
-    CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)imageUrl, NULL);
-    CFDictionaryRef imageProperties = CGImageSourceCopyPropertiesAtIndex(imageSource, 0, NULL);
-    DDLogVerbose(@"%s -- got properties %@", 
-               __PRETTY_FUNCTION__,
-               imageProperties);
-    CFNumberRef pixelWidthRef  = CFDictionaryGetValue(imageProperties, kCGImagePropertyPixelWidth);
-    CFNumberRef pixelHeightRef = CFDictionaryGetValue(imageProperties, kCGImagePropertyPixelHeight);
-    CGFloat pixelWidth = [(__bridge NSNumber *)pixelWidthRef floatValue];
-    CGFloat pixelHeight = [(__bridge NSNumber *)pixelHeightRef floatValue];
-    CGFloat maxEdge = MAX(pixelWidth, pixelHeight);
-    DDLogVerbose(@"%s -- found max edge = %f (%f, %f)",
-               __PRETTY_FUNCTION__,
-               maxEdge,
-               pixelWidth,
-               pixelHeight);
+  IPPhotoStore *store = [IPPhotoStore sharedStore];
+  if ([store optimizedVersionForFilename:self.filename] == kIPPhotoCurrentOptimizationVersion &&
+      [[NSFileManager defaultManager] fileExistsAtPath:self.thumbnailFilename]) {
     
-    if (maxEdge > kIPPhotoMaxEdgeSize) {
+    if (image_ == nil) {
       
-      //
-      //  We need to rescale the image. Ask ImageIO to make a thumbnail for us.
-      //
+      self.imageSize = [self pixelSizeOfImageFile];
+    }
+    self.optimizedVersion = kIPPhotoCurrentOptimizationVersion;
+    return;
+  }
+  
+  @autoreleasepool {
+  
+    BOOL needsWrite = NO;
+    UIImage *displayImage = [self displayImageFromMemoryNeedingWrite:&needsWrite];
+    if (displayImage == nil) {
       
-      NSDictionary *thumbnailOptions = @{(id)kCGImageSourceCreateThumbnailWithTransform: (id)kCFBooleanTrue,
-                                        (id)(id)kCGImageSourceCreateThumbnailFromImageAlways: (id)kCFBooleanTrue,
-                                        (id)kCGImageSourceThumbnailMaxPixelSize: @(kIPPhotoMaxEdgeSize)};
-      CGImageRef thumbnail = CGImageSourceCreateThumbnailAtIndex(imageSource, 0, (__bridge CFDictionaryRef)thumbnailOptions);
-      UIImage *resizedImage = [UIImage imageWithCGImage:thumbnail];
-      NSData *jpegData = UIImageJPEGRepresentation(resizedImage, 0.8);
-      [jpegData writeToFile:self.filename atomically:YES];
-      CFRelease(thumbnail);
+      displayImage = [self displayImageFromFileNeedingWrite:&needsWrite];
+    }
+    if (displayImage == nil) {
+      
+      return;
     }
     
-    CFRelease(imageSource);
-    CFRelease(imageProperties);
+    //
+    //  If the display pixels differ from what's on disk, they become the new
+    //  file. Wait out any pending write of the original so it can't land on
+    //  top of this one.
+    //
+    //  The exception is a very large image (e.g., a panorama) that needs no
+    //  rotation. That file stays as it is, and gets streamed into a tile
+    //  pyramid band by band, so it can be shown at full resolution.
+    //
+    
+    CGSize sourceSize = CGSizeZero;
+    BOOL keepsFullResolution = NO;
+    if (needsWrite) {
+      
+      sourceSize = [self pixelSizeOfImageFile];
+      if (MAX(sourceSize.width, sourceSize.height) > kIPPhotoMaxEdgeSize * kIPPhotoFullResolutionFactor &&
+          [IPBandTiler canTileImageAtPath:self.filename]) {
+        
+        IPBandTiler *tiler = [[IPBandTiler alloc] init];
+        keepsFullResolution = [tiler tileImageAtPath:self.filename 
+                                     toPyramidAtPath:[self tilePyramidPath] 
+                                            tileSize:[self defaultTileSize].width];
+        @synchronized(self) {
+          
+          tilePyramid_ = nil;
+        }
+        if (keepsFullResolution) {
+          
+          [[IPDerivedFileIndex sharedIndex] addPath:[self tilePyramidPath] forFilename:self.filename];
+        }
+      }
+    }
+    if (needsWrite && !keepsFullResolution) {
+      
+      [store waitUntilFilenameIsWritten:self.filename];
+      NSData *jpegData = UIImageJPEGRepresentation(displayImage, 0.8);
+      [jpegData writeToFile:self.filename atomically:YES];
+    }
 
     //
-    //  Force a thumbnail, even if one was there already.
+    //  Derive the thumbnail ladder from the same buffer, largest rung first,
+    //  each rung scaled from the one above it. Force the thumbnails, even if
+    //  they were there already.
     //
     
-    [self image];
-    UIImage *tempThumbnail = [self thumbnailFromImage:image_];
-    [self saveThumbnail:tempThumbnail toPath:self.thumbnailFilename];
-    thumbnail_ = [[UIImage alloc] initWithContentsOfFile:self.thumbnailFilename];
-    NSAssert([[NSFileManager defaultManager] fileExistsAtPath:self.thumbnailFilename],
-                  @"Thumbnail file should have been saved");
+    UIImage *tempThumbnail = nil;
+    UIImage *rungSource = displayImage;
+    for (NSNumber *edge in [[IPPhoto thumbnailLadder] reverseObjectEnumerator]) {
+      
+      UIImage *rung = [self thumbnailFromImage:rungSource maxEdge:[edge floatValue]];
+      NSString *rungPath = [self thumbnailFilenameForEdge:[edge unsignedIntegerValue]];
+      [self saveThumbnail:rung toPath:rungPath];
+      [[IPDerivedFileIndex sharedIndex] addPath:rungPath forFilename:self.filename];
+      if ([edge unsignedIntegerValue] == kThumbnailSize) {
+        
+        tempThumbnail = rung;
+      }
+      rungSource = rung;
+    }
+    
+    if (keepsFullResolution) {
+      
+      imageSize_ = sourceSize;
+      
+    } else {
+      
+      imageSize_ = CGSizeMake(CGImageGetWidth([displayImage CGImage]), 
+                              CGImageGetHeight([displayImage CGImage]));
+    }
     
     //
-    //  Update this photo's optimization version.
+    //  Update this photo's optimization version. The pixels from before are
+    //  stale under the old version's key.
     //
     
+    [[IPImageMemoryManager sharedManager] removeImageForKey:[self imageMemoryKey]];
     self.optimizedVersion = kIPPhotoCurrentOptimizationVersion;
-  
+    [store setOptimizedVersion:kIPPhotoCurrentOptimizationVersion forFilename:self.filename];
+    [self holdImage:displayImage];
+    [self holdThumbnail:tempThumbnail];
   }
 }
 
@@ -661,6 +1223,51 @@ CGFloat kIPPhotoMaxEdgeSize;
   return self.optimizedVersion == kIPPhotoCurrentOptimizationVersion;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  |optimize| only leaves a photo bigger than the display size if it kept
+//  the full resolution. Reads the ivar; |imageSize| depends on this.
+//
+
+- (BOOL)keepsFullResolution {
+  
+  return [self isOptimized] && MAX(imageSize_.width, imageSize_.height) > kIPPhotoMaxEdgeSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Use ImageIO to read the pixel dimensions out of the file header. This
+//  does not decode the image, so it's cheap enough to call before deciding
+//  whether we can afford to optimize the photo right now.
+//
+
+- (CGSize)pixelSizeOfImageFile {
+
+  if (self.filename == nil) {
+
+    return CGSizeZero;
+  }
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:self.filename];
+  NSURL *imageUrl = [NSURL fileURLWithPath:self.filename];
+  CGImageSourceRef imageSource = CGImageSourceCreateWithURL((__bridge CFURLRef)imageUrl, NULL);
+  if (imageSource == NULL) {
+
+    return CGSizeZero;
+  }
+  CGSize pixelSize = CGSizeZero;
+  CFDictionaryRef imageProperties = CGImageSourceCopyPropertiesAtIndex(imageSource, 0, NULL);
+  if (imageProperties != NULL) {
+
+    CFNumberRef pixelWidthRef  = CFDictionaryGetValue(imageProperties, kCGImagePropertyPixelWidth);
+    CFNumberRef pixelHeightRef = CFDictionaryGetValue(imageProperties, kCGImagePropertyPixelHeight);
+    pixelSize = CGSizeMake([(__bridge NSNumber *)pixelWidthRef floatValue],
+                           [(__bridge NSNumber *)pixelHeightRef floatValue]);
+    CFRelease(imageProperties);
+  }
+  CFRelease(imageSource);
+  return pixelSize;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  This is a blunt hammer, and something from earlier incarnations of the program.
@@ -700,241 +1307,214 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Creates tiles of an image.
+//  Where this photo's tile pyramid lives.
 //
-//  From http://www.cimgf.com/2011/03/01/subduing-catiledlayer/
-//
-
-- (void)saveTilesOfSize:(CGSize)size 
-               forImage:(UIImage*)image 
-            toDirectory:(NSString*)directoryPath 
-            usingPrefix:(NSString*)prefix {
 
-  CGFloat cols = [image size].width / size.width;
-  CGFloat rows = [image size].height / size.height;
-  
-  int fullColumns = floorf(cols);
-  int fullRows = floorf(rows);
-  
-  CGFloat remainderWidth = [image size].width - 
-  (fullColumns * size.width);
-  CGFloat remainderHeight = [image size].height - 
-  (fullRows * size.height);
+- (NSString *)tilePyramidPath {
   
-  
-  if (cols > fullColumns) fullColumns++;
-  if (rows > fullRows) fullRows++;
-  
-  CGImageRef fullImage = [image CGImage];
-  CFRetain(fullImage);
-  
-  for (int y = 0; y < fullRows; ++y) {
+  if (self.filename == nil) {
     
-    for (int x = 0; x < fullColumns; ++x) {
-
-      @autoreleasepool {
-        
-        NSString *path = [NSString stringWithFormat:@"%@/%@%d_%d.jpg",
-                          directoryPath, prefix, x, y];
-        
-        if ([[NSFileManager defaultManager] fileExistsAtPath:path]) {
-          
-          //
-          //  Short-circuit -- the file already exists. The tile's already
-          //  been computed.
-          //
-          
-          continue;
-        }
-        CGSize tileSize = size;
-        if (x + 1 == fullColumns && remainderWidth > 0) {
-          // Last column
-          tileSize.width = remainderWidth;
-        }
-        if (y + 1 == fullRows && remainderHeight > 0) {
-          // Last row
-          tileSize.height = remainderHeight;
-        }
-        
-        CGImageRef tileImage = CGImageCreateWithImageInRect(fullImage,
-                                                            (CGRect){{x*size.width, y*size.height},
-                                                              tileSize});
-        if (tileImage != NULL) {
-          
-          NSData *imageData = UIImageJPEGRepresentation([UIImage imageWithCGImage:tileImage], 0.8);
-          [imageData writeToFile:path atomically:YES];
-          CFRelease(tileImage);
-        }
-      }
-    }
-  } 
-  CFRelease(fullImage);
+    return nil;
+  }
+  NSString *name = [[[self.filename lastPathComponent] stringByDeletingPathExtension] 
+                    stringByAppendingPathExtension:kIPTilePyramidPathExtension];
+  return [name asPathInCachesFolder];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Computes the tile prefix for a given tile size.
+//  The mapped tile pyramid, or nil if none has been saved. Tiled views call
+//  this from background threads.
 //
 
-- (NSString *)tileDirectoryForTileSize:(CGSize)tileSize andScale:(CGFloat)currentScale {
+- (IPTilePyramid *)tilePyramid {
   
-  NSString *tileDirectory = [NSString stringWithFormat:@"%@_jpg_%d_%d",
-                             [[self.filename lastPathComponent] stringByDeletingPathExtension],
-                             (int)tileSize.width,
-                             (int)(1000 * currentScale)];
-  return [tileDirectory asPathInCachesFolder];
+  @synchronized(self) {
+    
+    NSString *path = [self tilePyramidPath];
+    if (path == nil) {
+      
+      return nil;
+    }
+    if (tilePyramid_ == nil || ![tilePyramid_.path isEqualToString:path]) {
+      
+      tilePyramid_ = [IPTilePyramid pyramidWithContentsOfFile:path];
+    }
+    return tilePyramid_;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  The default tile size.
+//  Cuts |image| into rows of tiles and adds them to |writer| as |level|.
+//  Each row's tiles get encoded in parallel by |encoder|.
 //
 
-- (CGSize)defaultTileSize {
+- (BOOL)addTilesOfImage:(CGImageRef)image 
+                  level:(NSUInteger)level 
+              toPyramid:(IPTilePyramidWriter *)writer 
+           usingEncoder:(IPTileEncoder *)encoder {
+
+  CGFloat tileSize = writer.tileSize;
+  CGRect bounds = CGRectMake(0, 0, CGImageGetWidth(image), CGImageGetHeight(image));
+  NSUInteger rows = [writer rowsAtLevel:level];
   
-  return CGSizeMake(768, 768);
+  for (NSUInteger y = 0; y < rows; ++y) {
+    
+    @autoreleasepool {
+      
+      //
+      //  Tiles on the bottom edge get truncated.
+      //
+      
+      CGRect rowRect = CGRectIntersection(CGRectMake(0, y * tileSize, bounds.size.width, tileSize), bounds);
+      CGImageRef rowImage = CGImageCreateWithImageInRect(image, rowRect);
+      if (rowImage == NULL) {
+        
+        return NO;
+      }
+      BOOL succeeded = [encoder addRowOfTiles:rowImage row:y level:level toPyramid:writer];
+      CGImageRelease(rowImage);
+      if (!succeeded) {
+        
+        return NO;
+      }
+    }
+  } 
+  return YES;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  How many levels of detail should we have for this, when retiling? Each
-//  level will have half the resolution of the previous level.
+//  Create all of the tiles we'll need for the current image. If the file
+//  can't be streamed, the decoded image gets tiled instead, each level
+//  scaled down from the one above it.
 //
 
-- (size_t)levelsOfDetail {
-
-  //
-  //  TODO -- with tiling currently out, we actually never have any more levels of
-  //  detail. If tiling comes back, remove this.
-  //
-  
-  return 1;
+- (void)saveTilesForAllScales {
   
   //
-  //  THE FOLLOWING IS DEAD CODE.
+  //  Stream from the file if possible; that never needs the whole image in
+  //  memory.
   //
   
-  CGFloat longEdge = MAX(self.imageSize.width, self.imageSize.height);
-  if (longEdge == 0) {
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:self.filename];
+  if ([IPBandTiler canTileImageAtPath:self.filename]) {
     
-    //
-    //  We never figured out the imageSize. Alas, we need to load the image
-    //  and recalculate.
-    //
+    IPBandTiler *tiler = [[IPBandTiler alloc] init];
+    BOOL succeeded = [tiler tileImageAtPath:self.filename 
+                            toPyramidAtPath:[self tilePyramidPath] 
+                                   tileSize:[self defaultTileSize].width];
+    @synchronized(self) {
+      
+      tilePyramid_ = nil;
+    }
+    [[IPTileCache sharedCache] removeTilesForPyramidAtPath:[self tilePyramidPath]];
+    if (succeeded) {
+      
+      [[IPDerivedFileIndex sharedIndex] addPath:[self tilePyramidPath] forFilename:self.filename];
+      return;
+    }
+  }
+  
+  CGImageRef pixels = [self.image CGImage];
+  if (pixels == NULL) {
     
-    [self image];
-    longEdge = MAX(self.imageSize.width, self.imageSize.height);
-    NSAssert(longEdge != 0, @"Should not have zero edge dimension");
+    return;
+  }
+  CGSize pixelSize = CGSizeMake(CGImageGetWidth(pixels), CGImageGetHeight(pixels));
+  IPTilePyramidWriter *writer = [[IPTilePyramidWriter alloc] initWithPath:[self tilePyramidPath] 
+                                                                imageSize:pixelSize 
+                                                                 tileSize:[self defaultTileSize].width];
+  if (writer == nil) {
     
-    //
-    //  Save the portfolio that contains this image, so the newly calcuated
-    //  imageSize gets saved.
-    //
+    return;
+  }
+  
+  BOOL succeeded = YES;
+  IPTileEncoder *encoder = [[IPTileEncoder alloc] initWithTileSize:writer.tileSize];
+  CGImageRef levelImage = CGImageRetain(pixels);
+  for (NSUInteger level = 0; succeeded && level < writer.levelCount; level++) {
     
-    IPPortfolio *portfolio = self.parent.parent.parent;
-    [portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-    DDLogVerbose(@"%s -- just saved portfolio to persist image size", __PRETTY_FUNCTION__);
+    if (level > 0) {
+      
+      CGSize levelSize = [IPTilePyramid sizeOfLevel:level forImageSize:pixelSize];
+      CGImageRef scaled = IPCreateImageScaledToSize(levelImage, levelSize.width, levelSize.height);
+      CGImageRelease(levelImage);
+      levelImage = scaled;
+    }
+    succeeded = (levelImage != NULL) && [self addTilesOfImage:levelImage 
+                                                        level:level 
+                                                    toPyramid:writer 
+                                                 usingEncoder:encoder];
   }
-  CGFloat minScale = kImageLongEdgeMinRescaleSize / longEdge;
-  CGFloat log = ceilf(log2f(minScale));
-  if (log >= 1) {
+  CGImageRelease(levelImage);
+  
+  if (!succeeded) {
     
-    //
-    //  The image is too small to have any levels of detail. Special case this
-    //  as one level.
-    //
+    DDLogError(@"%s -- unable to tile %@", __PRETTY_FUNCTION__, self.filename);
+    [writer cancel];
+    return;
+  }
+  if ([writer finish]) {
     
-    DDLogVerbose(@"%s -- image too small; reporting one level of detail", 
-               __PRETTY_FUNCTION__);
-    return 1;
+    [[IPDerivedFileIndex sharedIndex] addPath:[self tilePyramidPath] forFilename:self.filename];
   }
-  size_t detail = -1.0 * log + 1;
-  DDLogVerbose(@"%s -- (%f x %f) minScale = %f, log = %f, detail = %ld",
-             __PRETTY_FUNCTION__,
-             self.imageSize.width,
-             self.imageSize.height,
-             minScale,
-             log,
-             detail);
-  return detail;
+  @synchronized(self) {
+    
+    tilePyramid_ = nil;
+  }
+  [[IPTileCache sharedCache] removeTilesForPyramidAtPath:[self tilePyramidPath]];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  What's the smallest scale level we expect when displaying this photo in a
-//  tile? This is the scale level that keeps the longest edge from being 
-//  smaller than |kImageLongEdgeMinRescaleSize|.
+//  The default tile size.
 //
 
-- (CGFloat)minimumTileScale {
+- (CGSize)defaultTileSize {
   
-  CGFloat longEdge = MAX(self.imageSize.width, self.imageSize.height);
-  CGFloat minScale = kImageLongEdgeMinRescaleSize / longEdge;
-  CGFloat log = ceilf(log2f(minScale));
-  CGFloat scale = powf(2.0, log);
-  NSAssert(longEdge * scale >= kImageLongEdgeMinRescaleSize, 
-                @"Scale should keep long edge less than %d, but it is %f",
-                kImageLongEdgeMinRescaleSize,
-                longEdge * scale);
-  return scale;
+  return CGSizeMake(768, 768);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Create all of the tiles we'll need for the current image.
+//  How many levels of detail should we have for this, when retiling? Each
+//  level will have half the resolution of the previous level. Without a
+//  saved tile pyramid, there's just the one. This only looks at what's on
+//  disk; it never tiles.
 //
 
-- (void)saveTilesForAllScales {
-  
-  CGFloat currentScale = 1.0;
-  CGFloat longEdge = MAX(self.image.size.height, self.image.size.width);
-  
-  do {
+- (size_t)levelsOfDetail {
+
+  IPTilePyramid *pyramid = [self tilePyramid];
+  if (pyramid == nil) {
     
-    [self saveTilesForScale:currentScale];
-    longEdge /= 2;
-    currentScale /= 2;
-  } while (longEdge > 768);
+    return 1;
+  }
+  return pyramid.levelCount;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Save all the tiles we need for the image at a specific scale.
+//  A full-resolution photo is meant to be shown with its tiles. If the
+//  system purged them from Caches, they have to be built again.
 //
 
-- (void)saveTilesForScale:(CGFloat)scale {
+- (BOOL)needsTiles {
   
-  UIImage *scaledImage;
-  
-  if (scale < 1.0) {
-    
-    //
-    //  Only do this if we're really rescaling.
-    //
-    
-    CGSize scaledSize = CGSizeMake(self.imageSize.width * scale, self.imageSize.height * scale);
-    scaledImage = [self.image resizedImage:scaledSize interpolationQuality:kCGInterpolationHigh];
-    
-  } else {
-    
-    //
-    //  scale == 1, skip the rescale.
-    //  Note this logic will prevent me from scaling up.
-    //
-    
-    scaledImage = self.image;
-  }
+  return [self keepsFullResolution] && [self tilePyramid] == nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  What's the smallest scale level we expect when displaying this photo in a
+//  tile? This is the scale of the pyramid's smallest level.
+//
+
+- (CGFloat)minimumTileScale {
   
-  CGSize tileSize = [self defaultTileSize];
-  NSString *tileDirectory = [self tileDirectoryForTileSize:tileSize andScale:scale];
-  [[NSFileManager defaultManager] createDirectoryAtPath:tileDirectory 
-                            withIntermediateDirectories:YES 
-                                             attributes:nil 
-                                                  error:NULL];
-  [self saveTilesOfSize:tileSize 
-               forImage:scaledImage 
-            toDirectory:tileDirectory 
-            usingPrefix:@"tile_"];
+  return 1.0 / (CGFloat)(1 << ([self levelsOfDetail] - 1));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -944,41 +1524,20 @@ CGFloat kIPPhotoMaxEdgeSize;
 
 - (BOOL)tilesExistForScale:(CGFloat)scale {
   
-  CGSize tileSize = [self defaultTileSize];
-  NSString *tileDirectory = [self tileDirectoryForTileSize:tileSize andScale:scale];
-  NSArray *tiles = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:tileDirectory error:NULL];
-  
-  CGSize scaledSize = CGSizeMake(self.imageSize.width * scale, self.imageSize.height * scale);
-  NSUInteger expectedTileCount = ceilf(scaledSize.width / tileSize.width) *
-                                 ceilf(scaledSize.height / tileSize.height);
-  
-  DDLogVerbose(@"%s -- expected %d tiles, found %d",
-             __PRETTY_FUNCTION__,
-             expectedTileCount,
-             [tiles count]);
-  return [tiles count] == expectedTileCount;
+  return [IPTilePyramid levelForScale:scale] < [[self tilePyramid] levelCount];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Get a tile.
+//  Get a tile. |scale| gets rounded to the nearest power of two.
 //
 
 - (UIImage *)tileForScale:(CGFloat)scale row:(NSUInteger)row column:(NSUInteger)column {
   
-  //
-  //  Round scale to the nearest power of two.
-  //
-  
-  scale = powf(2.0, roundf(log2f(scale)));
-
-  CGSize tileSize = [self defaultTileSize];
-  NSString *tileDirectory = [self tileDirectoryForTileSize:tileSize andScale:scale];
-  NSString *tileName = [NSString stringWithFormat:@"tile_%d_%d.jpg",
-                        column,
-                        row];
-  UIImage *tile = [UIImage imageWithContentsOfFile:[tileDirectory stringByAppendingPathComponent:tileName]];
-  return tile;
+  return [[IPTileCache sharedCache] tileFromPyramid:[self tilePyramid] 
+                                              level:[IPTilePyramid levelForScale:scale] 
+                                                row:row 
+                                             column:column];
 }
 
 @end
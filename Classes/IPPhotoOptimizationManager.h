@@ -20,6 +20,9 @@
 
 #import <Foundation/Foundation.h>
 
+@class IPPhoto;
+@class IPPage;
+
 //
 //  This is a callback that gets called each time a scale level is tiled
 //  for a photo.
@@ -27,12 +30,58 @@
 
 typedef void (^IPPhotoOptimizationCompletion)(void);
 
+//
+//  Called on the main thread as each photo in a batch finishes, with how
+//  many of the batch are done so far.
+//
+
+typedef void (^IPPhotoOptimizationProgress)(IPPhoto *photo, NSUInteger completedCount, NSUInteger totalCount);
+
+//
+//  Called off the main thread as each photo in a batch finishes, once its
+//  optimized files are written.
+//
+
+typedef void (^IPPhotoOptimizationCommit)(IPPhoto *photo);
+
+//
+//  Called on the main thread as each page in a batch finishes. |offset| is
+//  where |page| goes among the pages of the batch inserted so far, so that
+//  they end up in the batch's order however the optimizations finish.
+//
+
+typedef void (^IPPhotoOptimizationPageInsertion)(IPPage *page, NSUInteger offset);
+
+//
+//  The number of pixels we allow to be in flight across all concurrent
+//  optimizations. A photo costs its full source pixel count, because that's
+//  what ImageIO has to decode. A photo bigger than the budget still runs,
+//  but it runs alone.
+//
+
+#define kIPPhotoOptimizationPixelBudget   (40 * 1000 * 1000)
+
+//
+//  Lanes for background work, lowest priority first. Work in a higher lane
+//  gets dequeued first and gets first claim on the pixel budget.
+//
+//    IPOptimizationLaneBackground  -- maintenance, e.g. upgrading the
+//                                     optimization of an existing portfolio.
+//    IPOptimizationLaneImport      -- photos the user chose to add.
+//    IPOptimizationLaneInteractive -- whatever is on screen right now.
+//
+
+typedef enum {
+  IPOptimizationLaneBackground = 0,
+  IPOptimizationLaneImport,
+  IPOptimizationLaneInteractive,
+  IPOptimizationLaneCount
+} IPOptimizationLane;
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-@class IPPhoto;
-@class IPPage;
 @class IPSet;
 @protocol IPPhotoOptimizationManagerDelegate;
 
@@ -45,24 +94,108 @@ typedef void (^IPPhotoOptimizationCompletion)(void);
 + (IPPhotoOptimizationManager *)sharedManager;
 
 //
-//  Asynchronously optimizes the photo. Calls the completion routine on the main
-//  thread when optimization is complete.
+//  Asynchronously optimizes the photo in |lane|. Calls the completion routine
+//  on the main thread when optimization is complete. Cancelling the returned
+//  operation stops the work if it has not started yet; either way, the
+//  completion does not get called once the operation is cancelled.
+//
+
+- (NSOperation *)asyncOptimizePhoto:(IPPhoto *)photo 
+                             inLane:(IPOptimizationLane)lane 
+                     withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  Optimize a set of photos in |lane|, then call the completion when all are
+//  done. Each photo is its own work item, so interactive work can still get
+//  in between them.
+//
+
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+             withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  As above, but calls |progress| for each photo as it finishes, in
+//  completion order. |completion| runs after the last |progress| call.
+//
+
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+                   progress:(IPPhotoOptimizationProgress)progress 
+             withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  As above, but first calls |commit| for each photo on the thread that
+//  optimized it. Bookkeeping that touches the disk goes here, so it stays
+//  off the main thread; |progress| should only update the UI.
+//
+
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+                     commit:(IPPhotoOptimizationCommit)commit 
+                   progress:(IPPhotoOptimizationProgress)progress 
+             withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  Asynchronously optimize a page in |lane|. Cancellation works as for
+//  |asyncOptimizePhoto:inLane:withCompletion:|.
+//
+
+- (NSOperation *)asyncOptimizePage:(IPPage *)page 
+                            inLane:(IPOptimizationLane)lane 
+                    withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  Optimize |pages| in |lane|, handing each to |insertion| as it finishes.
+//  Pages run concurrently and finish in any order; insert each one at the
+//  batch's insertion point plus |offset| and the batch comes out in order.
 //
 
-- (void)asyncOptimizePhoto:(IPPhoto *)photo withCompletion:(IPPhotoOptimizationCompletion)completion;
+- (void)asyncOptimizePages:(NSArray *)pages 
+                    inLane:(IPOptimizationLane)lane 
+             withInsertion:(IPPhotoOptimizationPageInsertion)insertion;
 
 //
-//  Optimize a set of photos, then call the completion when all are done.
+//  Rebuilds the tiles of |photo| in the background lane, if it still needs
+//  them when the work runs, then calls |completion| on the main thread.
+//  Asking again while a rebuild of the same photo is pending waits for that
+//  one instead of tiling twice. Cancellation works as for
+//  |asyncOptimizePhoto:inLane:withCompletion:|.
 //
 
-- (void)asyncOptimizePhotos:(NSArray *)photos withCompletion:(IPPhotoOptimizationCompletion)completion;
+- (NSOperation *)asyncRebuildTilesOfPhoto:(IPPhoto *)photo 
+                           withCompletion:(IPPhotoOptimizationCompletion)completion;
+
+//
+//  Runs an arbitrary block in |lane|. The block should check |isCancelled|
+//  on the returned operation before publishing results if its caller may
+//  cancel it. Interactive blocks get a queue of their own, so they never
+//  wait behind optimizations that are waiting for pixel budget.
+//
+
+- (NSOperation *)addOperationInLane:(IPOptimizationLane)lane withBlock:(void (^)(void))block;
+
+//
+//  Adds an operation the caller built to the optimization queue in |lane|.
+//  Use this when the operation's blocks need a reference to the operation
+//  itself, e.g. to check for cancellation.
+//
 
+- (void)addOperation:(NSOperation *)operation inLane:(IPOptimizationLane)lane;
 
 //
-//  Asynchronously optimize a page.
+//  Moves a pending operation to a different lane. Has no effect on work that
+//  is already running.
 //
 
-- (void)asyncOptimizePage:(IPPage *)page withCompletion:(IPPhotoOptimizationCompletion)completion;
+- (void)moveOperation:(NSOperation *)operation toLane:(IPOptimizationLane)lane;
+
+//
+//  If |photo| is waiting to be optimized in a lower lane, promote it to
+//  |lane|. Call this when an unoptimized photo scrolls into view.
+//
+
+- (void)promotePhoto:(IPPhoto *)photo toLane:(IPOptimizationLane)lane;
 
 //
 //  Delegate, gets to show UI.
@@ -71,12 +204,28 @@ typedef void (^IPPhotoOptimizationCompletion)(void);
 @property (nonatomic, weak) id<IPPhotoOptimizationManagerDelegate> delegate;
 
 //
-//  The queue on which we work. This is a good place to put all resource-intensive
-//  background tasks.
+//  The queue on which optimizations and lower-lane work run. Don't add to
+//  this directly; go through |addOperationInLane:withBlock:| so the work
+//  gets the right priority (and interactive work the right queue).
 //
 
 @property (nonatomic, strong) NSOperationQueue *optimizationQueue;
 
+//
+//  The maximum number of pixels being optimized at once. Defaults to
+//  |kIPPhotoOptimizationPixelBudget|.
+//
+
+@property (nonatomic, assign) NSUInteger pixelBudget;
+
+//
+//  Throughput for the current burst of work, measured from the moment the
+//  optimization count goes above zero. Only valid on the main thread.
+//
+
+@property (nonatomic, readonly) CGFloat photosPerSecond;
+@property (nonatomic, readonly) CGFloat megabytesDecodedPerSecond;
+
 //
 //  Flag for debugging. 
 //
@@ -98,4 +247,16 @@ typedef void (^IPPhotoOptimizationCompletion)(void);
 - (void)optimizationManager:(IPPhotoOptimizationManager *)optimizationManager 
    didHaveOptimizationCount:(NSUInteger)optimizationCount;
 
+@optional
+
+//
+//  Called on the main thread each time a photo finishes optimizing, with the
+//  throughput of the current burst of work. Decoded megabytes assume four
+//  bytes per source pixel.
+//
+
+- (void)optimizationManager:(IPPhotoOptimizationManager *)optimizationManager
+ didOptimizePhotosPerSecond:(CGFloat)photosPerSecond
+  megabytesDecodedPerSecond:(CGFloat)megabytesPerSecond;
+
 @end
@@ -23,16 +23,88 @@
 #import "IPSet.h"
 #import "IPPhotoOptimizationManager.h"
 
+//
+//  Bytes per decoded pixel, for throughput reporting.
+//
+
+#define kIPBytesPerDecodedPixel   (4)
+
+//
+//  An operation that optimizes one or more photos and remembers how many
+//  source pixels it decoded.
+//
+
+@interface IPOptimizationOperation : NSBlockOperation
+
+@property (nonatomic, assign) unsigned long long decodedPixels;
+
+@end
+
+@implementation IPOptimizationOperation
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
 @interface IPPhotoOptimizationManager ()
 
 @property (nonatomic, assign) NSUInteger activeOptimizations;
+
+//
+//  Guards |pixelsInFlight|. Operations wait on this until there is room in
+//  the pixel budget.
+//
+
+@property (nonatomic, strong) NSCondition *budgetCondition;
+@property (nonatomic, assign) NSUInteger pixelsInFlight;
+
+//
+//  Pending optimization operations, keyed by photo pointer, so a photo that
+//  scrolls into view can be promoted. Guarded by @synchronized on itself.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *pendingPhotoOperations;
+
+//
+//  Pending tile rebuilds, keyed the same way.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *pendingTileOperations;
+
+//
+//  Interactive work that isn't an optimization (decoding what's on screen)
+//  runs here instead of on |optimizationQueue|. Optimizations waiting for
+//  pixel budget hold their queue's threads; this work never waits on the
+//  budget, so it shouldn't have to wait for them.
+//
+
+@property (nonatomic, strong) NSOperationQueue *interactiveQueue;
+
+//
+//  Throughput accounting for the current burst of work. Main thread only.
+//
+
+@property (nonatomic, strong) NSDate *burstStartDate;
+@property (nonatomic, assign) NSUInteger burstPhotoCount;
+@property (nonatomic, assign) unsigned long long burstPixelCount;
+
 @end
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-@implementation IPPhotoOptimizationManager
+@implementation IPPhotoOptimizationManager {
+  
+  //
+  //  How many operations in each lane are waiting for pixel budget. Guarded
+  //  by |budgetCondition|.
+  //
+  
+  NSUInteger _waitingInLane[IPOptimizationLaneCount];
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -44,10 +116,22 @@
     self = [super init];
     if (self) {
       
+      //
+      //  One lane per core. The pixel budget keeps us from decoding several
+      //  huge photos at the same time.
+      //
+      
       _optimizationQueue = [[NSOperationQueue alloc] init];
-      [_optimizationQueue setMaxConcurrentOperationCount:1];
+      [_optimizationQueue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+      _interactiveQueue = [[NSOperationQueue alloc] init];
+      [_interactiveQueue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
       _workSynchronouslyForDebugging = NO;
       _activeOptimizations = 0;
+      _pixelBudget = kIPPhotoOptimizationPixelBudget;
+      _budgetCondition = [[NSCondition alloc] init];
+      _pixelsInFlight = 0;
+      _pendingPhotoOperations = [[NSMutableDictionary alloc] init];
+      _pendingTileOperations = [[NSMutableDictionary alloc] init];
     }
     
     return self;
@@ -68,32 +152,366 @@
   return sharedManager;
 }
 
+#pragma mark - Pixel budget
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  How many pixels optimizing |photo| will cost. Photos we can't measure are
+//  charged the whole budget so they run alone.
+//
+
+- (NSUInteger)pixelCostForPhoto:(IPPhoto *)photo {
+  
+  if ([photo isOptimized]) {
+    
+    return 0;
+  }
+  CGSize pixelSize = [photo pixelSizeOfImageFile];
+  NSUInteger cost = (NSUInteger)(pixelSize.width * pixelSize.height);
+  if (cost == 0 || cost > self.pixelBudget) {
+    
+    cost = self.pixelBudget;
+  }
+  return cost;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Is anything in a lane above |lane| waiting for budget? Call with
+//  |budgetCondition| locked.
+//
+
+- (BOOL)hasWaitersAboveLane:(IPOptimizationLane)lane {
+  
+  for (NSUInteger higher = lane + 1; higher < IPOptimizationLaneCount; higher++) {
+    
+    if (_waitingInLane[higher] > 0) {
+      
+      return YES;
+    }
+  }
+  return NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Blocks the calling (background) thread until |pixelCount| pixels fit in
+//  the budget, then claims them. Higher lanes get first claim: work in
+//  |lane| keeps waiting while anything in a higher lane is waiting.
+//
+
+- (void)acquirePixels:(NSUInteger)pixelCount inLane:(IPOptimizationLane)lane {
+  
+  [self.budgetCondition lock];
+  _waitingInLane[lane]++;
+  while ((self.pixelsInFlight > 0 &&
+          self.pixelsInFlight + pixelCount > self.pixelBudget) ||
+         [self hasWaitersAboveLane:lane]) {
+    
+    [self.budgetCondition wait];
+  }
+  _waitingInLane[lane]--;
+  self.pixelsInFlight += pixelCount;
+  [self.budgetCondition broadcast];
+  [self.budgetCondition unlock];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Do the optimization.
+//  Gives pixels back to the budget and wakes up any waiting operations.
 //
 
-- (void)asyncOptimizePhoto:(IPPhoto *)photo withCompletion:(IPPhotoOptimizationCompletion)completion {
+- (void)releasePixels:(NSUInteger)pixelCount {
+  
+  [self.budgetCondition lock];
+  self.pixelsInFlight -= pixelCount;
+  [self.budgetCondition broadcast];
+  [self.budgetCondition unlock];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Optimizes one photo on the current (background) thread, staying inside
+//  the pixel budget. Returns the number of source pixels decoded.
+//
 
-  self.activeOptimizations++;
+- (NSUInteger)optimizePhotoWithinBudget:(IPPhoto *)photo inLane:(IPOptimizationLane)lane {
+  
+  NSUInteger cost = [self pixelCostForPhoto:photo];
+  if (cost == 0) {
+    
+    return 0;
+  }
+  [self acquirePixels:cost inLane:lane];
+  [photo optimize];
+  [self releasePixels:cost];
+  return cost;
+}
+
+#pragma mark - Bookkeeping
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Note that |count| more optimizations are pending. The bookkeeping lives on
+//  the main thread; callers on other threads (e.g., the portfolio upgrade)
+//  get bounced there. Because the main queue is FIFO, this still runs before
+//  the matching |endOptimizations:decodedPixels:|.
+//
+
+- (void)beginOptimizations:(NSUInteger)count {
+  
+  if (![NSThread isMainThread]) {
+    
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+      
+      [self beginOptimizations:count];
+    }];
+    return;
+  }
+  if (self.activeOptimizations == 0) {
+    
+    self.burstStartDate = [NSDate date];
+    self.burstPhotoCount = 0;
+    self.burstPixelCount = 0;
+  }
+  self.activeOptimizations += count;
+  [self.delegate optimizationManager:self 
+            didHaveOptimizationCount:self.activeOptimizations];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Note that |count| optimizations finished, having decoded |pixelCount|
+//  pixels. Main thread only.
+//
+
+- (void)endOptimizations:(NSUInteger)count decodedPixels:(unsigned long long)pixelCount {
+  
+  self.burstPhotoCount += count;
+  self.burstPixelCount += pixelCount;
+  if ([self.delegate respondsToSelector:@selector(optimizationManager:didOptimizePhotosPerSecond:megabytesDecodedPerSecond:)]) {
+    
+    [self.delegate optimizationManager:self
+            didOptimizePhotosPerSecond:self.photosPerSecond
+             megabytesDecodedPerSecond:self.megabytesDecodedPerSecond];
+  }
+  self.activeOptimizations -= count;
   [self.delegate optimizationManager:self 
             didHaveOptimizationCount:self.activeOptimizations];
-  NSBlockOperation *optimizationOperation = [NSBlockOperation blockOperationWithBlock:^(void) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Photos per second for the current burst.
+//
+
+- (CGFloat)photosPerSecond {
+  
+  NSTimeInterval elapsed = -[self.burstStartDate timeIntervalSinceNow];
+  if (elapsed <= 0) {
     
-    [photo optimize];
+    return 0;
+  }
+  return self.burstPhotoCount / elapsed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decoded megabytes per second for the current burst.
+//
+
+- (CGFloat)megabytesDecodedPerSecond {
+  
+  NSTimeInterval elapsed = -[self.burstStartDate timeIntervalSinceNow];
+  if (elapsed <= 0) {
+    
+    return 0;
+  }
+  CGFloat megabytes = (self.burstPixelCount * kIPBytesPerDecodedPixel) / (1024.0 * 1024.0);
+  return megabytes / elapsed;
+}
+
+#pragma mark - Lanes
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Queue priority for each lane.
+//
+
+static NSOperationQueuePriority IPQueuePriorityForLane(IPOptimizationLane lane) {
+  
+  switch (lane) {
+    case IPOptimizationLaneInteractive:
+      return NSOperationQueuePriorityVeryHigh;
+      
+    case IPOptimizationLaneImport:
+      return NSOperationQueuePriorityNormal;
+      
+    default:
+      return NSOperationQueuePriorityVeryLow;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Maps a queue priority back to its lane.
+//
+
+static IPOptimizationLane IPLaneForQueuePriority(NSOperationQueuePriority priority) {
+  
+  if (priority >= NSOperationQueuePriorityVeryHigh) {
+    
+    return IPOptimizationLaneInteractive;
+  }
+  if (priority >= NSOperationQueuePriorityNormal) {
+    
+    return IPOptimizationLaneImport;
+  }
+  return IPOptimizationLaneBackground;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Puts |operation| in |lane|.
+//
+
+- (void)moveOperation:(NSOperation *)operation toLane:(IPOptimizationLane)lane {
+  
+  [operation setQueuePriority:IPQueuePriorityForLane(lane)];
+  [operation setThreadPriority:(lane == IPOptimizationLaneBackground) ? 0.25 : 0.5];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Run a block in a lane.
+//
+
+- (NSOperation *)addOperationInLane:(IPOptimizationLane)lane withBlock:(void (^)(void))block {
+  
+  NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:block];
+  [self addOperation:operation inLane:lane];
+  return operation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Run a caller-built operation in a lane. Optimizations don't come through
+//  here, so interactive work can take the queue that never waits on the
+//  pixel budget.
+//
+
+- (void)addOperation:(NSOperation *)operation inLane:(IPOptimizationLane)lane {
+  
+  [self moveOperation:operation toLane:lane];
+  if (lane == IPOptimizationLaneInteractive) {
+    
+    [self.interactiveQueue addOperation:operation];
+    
+  } else {
+    
+    [self.optimizationQueue addOperation:operation];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Promote the pending optimization of |photo|, if any.
+//
+
+- (void)promotePhoto:(IPPhoto *)photo toLane:(IPOptimizationLane)lane {
+  
+  if (photo == nil || [photo isOptimized]) {
+    
+    return;
+  }
+  NSOperation *operation = nil;
+  @synchronized(self.pendingPhotoOperations) {
+    
+    operation = (self.pendingPhotoOperations)[[NSValue valueWithNonretainedObject:photo]];
+  }
+  if (operation != nil && IPLaneForQueuePriority([operation queuePriority]) < lane) {
+    
+    DDLogVerbose(@"%s -- promoting %@", __PRETTY_FUNCTION__, photo.filename);
+    [self moveOperation:operation toLane:lane];
+  }
+}
+
+#pragma mark - Optimization
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Builds (but does not queue) the operation that optimizes one photo. The
+//  operation reads its lane at the moment it runs, so promotion also moves it
+//  up in the pixel budget line.
+//
+//  If another operation for the same photo is still pending, the new one
+//  waits on it (and will find the photo already optimized).
+//
+
+- (IPOptimizationOperation *)operationOptimizingPhoto:(IPPhoto *)photo inLane:(IPOptimizationLane)lane {
+  
+  IPOptimizationOperation *operation = [[IPOptimizationOperation alloc] init];
+  __weak IPOptimizationOperation *weakOperation = operation;
+  [operation addExecutionBlock:^(void) {
+    
+    if (![weakOperation isCancelled]) {
+      
+      weakOperation.decodedPixels = [self optimizePhotoWithinBudget:photo 
+                                                             inLane:IPLaneForQueuePriority([weakOperation queuePriority])];
+    }
+    @synchronized(self.pendingPhotoOperations) {
+      
+      NSValue *key = [NSValue valueWithNonretainedObject:photo];
+      if ((self.pendingPhotoOperations)[key] == weakOperation) {
+        
+        [self.pendingPhotoOperations removeObjectForKey:key];
+      }
+    }
+  }];
+  [self moveOperation:operation toLane:lane];
+  
+  @synchronized(self.pendingPhotoOperations) {
+    
+    NSValue *key = [NSValue valueWithNonretainedObject:photo];
+    NSOperation *previous = (self.pendingPhotoOperations)[key];
+    if (previous != nil && ![previous isFinished]) {
+      
+      [operation addDependency:previous];
+    }
+    (self.pendingPhotoOperations)[key] = operation;
+  }
+  return operation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Do the optimization. The bookkeeping lives in the completion block
+//  because a cancelled operation never runs its execution block.
+//
+
+- (NSOperation *)asyncOptimizePhoto:(IPPhoto *)photo 
+                             inLane:(IPOptimizationLane)lane 
+                     withCompletion:(IPPhotoOptimizationCompletion)completion {
+
+  [self beginOptimizations:1];
+  IPOptimizationOperation *optimizationOperation = [self operationOptimizingPhoto:photo inLane:lane];
+  __weak IPOptimizationOperation *weakOperation = optimizationOperation;
+  [optimizationOperation setCompletionBlock:^(void) {
+    
+    BOOL cancelled = [weakOperation isCancelled];
+    unsigned long long decodedPixels = weakOperation.decodedPixels;
     [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
 
-      if (completion != nil) {
+      if (completion != nil && !cancelled) {
         
         completion();
       }
-      self.activeOptimizations--;
-      [self.delegate optimizationManager:self 
-                didHaveOptimizationCount:self.activeOptimizations];
+      [self endOptimizations:1 decodedPixels:decodedPixels];
     }];
   }];
   
   [self.optimizationQueue addOperation:optimizationOperation];
+  return optimizationOperation;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -101,29 +519,84 @@
 //  Optimize an array of photos and call the completion routine when all are done.
 //
 
-- (void)asyncOptimizePhotos:(NSArray *)photos withCompletion:(IPPhotoOptimizationCompletion)completion {
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+             withCompletion:(IPPhotoOptimizationCompletion)completion {
   
-  self.activeOptimizations += [photos count];
-  [self.delegate optimizationManager:self 
-            didHaveOptimizationCount:self.activeOptimizations];
-  NSBlockOperation *optimizationOperation = [NSBlockOperation blockOperationWithBlock:^(void) {
+  [self asyncOptimizePhotos:photos inLane:lane commit:nil progress:nil withCompletion:completion];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+                   progress:(IPPhotoOptimizationProgress)progress 
+             withCompletion:(IPPhotoOptimizationCompletion)completion {
+  
+  [self asyncOptimizePhotos:photos inLane:lane commit:nil progress:progress withCompletion:completion];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Fan out: each photo gets its own operation so they spread across cores
+//  and can be promoted individually with |promotePhoto:toLane:|. Fan in: each
+//  operation reports back on the main thread, where a countdown fires the
+//  completion after the last report. Doing the join on the main thread (rather
+//  than in a dependent operation) guarantees every |progress| call lands
+//  before |completion|. |commit| runs in each operation's completion block,
+//  after the photo's files are written and before the hop to main.
+//
+
+- (void)asyncOptimizePhotos:(NSArray *)photos 
+                     inLane:(IPOptimizationLane)lane 
+                     commit:(IPPhotoOptimizationCommit)commit 
+                   progress:(IPPhotoOptimizationProgress)progress 
+             withCompletion:(IPPhotoOptimizationCompletion)completion {
+  
+  commit = [commit copy];
+  progress = [progress copy];
+  completion = [completion copy];
+  NSUInteger totalCount = [photos count];
+  if (totalCount == 0) {
     
-    for (IPPhoto *photo in photos) {
-      [photo optimize];
+    if (completion != nil) {
+      
+      [[NSOperationQueue mainQueue] addOperationWithBlock:completion];
     }
-    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+    return;
+  }
+  [self beginOptimizations:totalCount];
+  
+  __block NSUInteger completedCount = 0;
+  NSMutableArray *operations = [NSMutableArray arrayWithCapacity:totalCount];
+  for (IPPhoto *photo in photos) {
+    
+    IPOptimizationOperation *optimizationOperation = [self operationOptimizingPhoto:photo inLane:lane];
+    __weak IPOptimizationOperation *weakOperation = optimizationOperation;
+    [optimizationOperation setCompletionBlock:^(void) {
       
-      if (completion != nil) {
+      unsigned long long decodedPixels = weakOperation.decodedPixels;
+      if (commit != nil) {
         
-        completion();
+        commit(photo);
       }
-      self.activeOptimizations -= [photos count];
-      [self.delegate optimizationManager:self 
-                didHaveOptimizationCount:self.activeOptimizations];
+      [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+        
+        completedCount++;
+        [self endOptimizations:1 decodedPixels:decodedPixels];
+        if (progress != nil) {
+          
+          progress(photo, completedCount, totalCount);
+        }
+        if (completedCount == totalCount && completion != nil) {
+          
+          completion();
+        }
+      }];
     }];
-  }];
-  
-  [self.optimizationQueue addOperation:optimizationOperation];
+    [operations addObject:optimizationOperation];
+  }
+  [self.optimizationQueue addOperations:operations waitUntilFinished:NO];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -131,7 +604,9 @@
 //  Optimize a page.
 //
 
-- (void)asyncOptimizePage:(IPPage *)page withCompletion:(IPPhotoOptimizationCompletion)completion {
+- (NSOperation *)asyncOptimizePage:(IPPage *)page 
+                            inLane:(IPOptimizationLane)lane 
+                    withCompletion:(IPPhotoOptimizationCompletion)completion {
   
   if (self.workSynchronouslyForDebugging) {
     
@@ -143,29 +618,121 @@
       
       completion();
     }
-    return;
+    return nil;
   }
   
-  self.activeOptimizations++;
-  [self.delegate optimizationManager:self 
-            didHaveOptimizationCount:self.activeOptimizations];
-  [self.optimizationQueue addOperationWithBlock:^(void) {
+  [self beginOptimizations:1];
+  IPOptimizationOperation *pageOperation = [[IPOptimizationOperation alloc] init];
+  __weak IPOptimizationOperation *weakOperation = pageOperation;
+  [pageOperation addExecutionBlock:^(void) {
     
     for (IPPhoto *photo in page.photos) {
       
-      [photo optimize];
+      if ([weakOperation isCancelled]) {
+        
+        break;
+      }
+      weakOperation.decodedPixels += [self optimizePhotoWithinBudget:photo 
+                                                              inLane:IPLaneForQueuePriority([weakOperation queuePriority])];
     }
+  }];
+  [pageOperation setCompletionBlock:^(void) {
+    
+    BOOL cancelled = [weakOperation isCancelled];
+    unsigned long long decodedPixels = weakOperation.decodedPixels;
     [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
       
-      if (completion != nil) {
+      if (completion != nil && !cancelled) {
         
         completion();
       }
-      self.activeOptimizations--;
-      [self.delegate optimizationManager:self 
-                didHaveOptimizationCount:self.activeOptimizations];
+      [self endOptimizations:1 decodedPixels:decodedPixels];
     }];
   }];
+  [self moveOperation:pageOperation toLane:lane];
+  [self.optimizationQueue addOperation:pageOperation];
+  return pageOperation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Pages finish in whatever order the queue gets to them: there's a lane
+//  per core, the pixel budget holds big pages back, promotion moves pages
+//  ahead, and a photo already in the store finishes almost at once. So each
+//  page's place comes from its index in |pages|, counted against the pages
+//  already handed out. The bookkeeping only happens on the main thread.
+//
+
+- (void)asyncOptimizePages:(NSArray *)pages 
+                    inLane:(IPOptimizationLane)lane 
+             withInsertion:(IPPhotoOptimizationPageInsertion)insertion {
+  
+  insertion = [insertion copy];
+  NSMutableIndexSet *inserted = [[NSMutableIndexSet alloc] init];
+  [pages enumerateObjectsUsingBlock:^(IPPage *page, NSUInteger sourceIndex, BOOL *stop) {
+    
+    [self asyncOptimizePage:page inLane:lane withCompletion:^(void) {
+      
+      NSUInteger offset = [inserted countOfIndexesInRange:NSMakeRange(0, sourceIndex)];
+      [inserted addIndex:sourceIndex];
+      insertion(page, offset);
+    }];
+  }];
+}
+
+#pragma mark - Tiles
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Rebuild purged tiles. The photo gets checked again when the work runs:
+//  an earlier rebuild it waited on has usually done the job.
+//
+
+- (NSOperation *)asyncRebuildTilesOfPhoto:(IPPhoto *)photo 
+                           withCompletion:(IPPhotoOptimizationCompletion)completion {
+  
+  NSBlockOperation *tileOperation = [[NSBlockOperation alloc] init];
+  __weak NSBlockOperation *weakOperation = tileOperation;
+  [tileOperation addExecutionBlock:^(void) {
+    
+    if (![weakOperation isCancelled] && [photo needsTiles]) {
+      
+      DDLogVerbose(@"%s -- rebuilding tiles for %@", __PRETTY_FUNCTION__, photo.filename);
+      [photo saveTilesForAllScales];
+    }
+  }];
+  [tileOperation setCompletionBlock:^(void) {
+    
+    BOOL cancelled = [weakOperation isCancelled];
+    @synchronized(self.pendingTileOperations) {
+      
+      NSValue *key = [NSValue valueWithNonretainedObject:photo];
+      if ((self.pendingTileOperations)[key] == weakOperation) {
+        
+        [self.pendingTileOperations removeObjectForKey:key];
+      }
+    }
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+      
+      if (completion != nil && !cancelled) {
+        
+        completion();
+      }
+    }];
+  }];
+  
+  @synchronized(self.pendingTileOperations) {
+    
+    NSValue *key = [NSValue valueWithNonretainedObject:photo];
+    NSOperation *previous = (self.pendingTileOperations)[key];
+    if (previous != nil && ![previous isFinished]) {
+      
+      [tileOperation addDependency:previous];
+    }
+    (self.pendingTileOperations)[key] = tileOperation;
+  }
+  [self addOperation:tileOperation inLane:IPOptimizationLaneBackground];
+  return tileOperation;
 }
 
 @end
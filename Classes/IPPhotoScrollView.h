@@ -27,6 +27,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 @class IPPhoto;
+@class IPPredecodeWindow;
 @interface IPPhotoScrollView : UIScrollView<UIScrollViewDelegate> { }
 
 //
@@ -34,4 +35,12 @@
 //
 
 @property (nonatomic, strong) IPPhoto *photo;
+
+//
+//  If set, images already decoded by the window are shown without decoding
+//  again, and images this view decodes are offered to it. Set it before
+//  |photo|.
+//
+
+@property (nonatomic, weak) IPPredecodeWindow *predecodeWindow;
 @end
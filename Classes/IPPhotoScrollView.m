@@ -22,6 +22,7 @@
 #import "IPPhoto.h"
 #import "IPPhotoTilingView.h"
 #import "IPPhotoOptimizationManager.h"
+#import "IPPredecodeWindow.h"
 
 @interface IPPhotoScrollView ()
 
@@ -32,7 +33,30 @@
 
 @property (nonatomic, strong) UIView *imageView;
 
+//
+//  The pending optimization or decode for |photo|, if any. Cancelled when
+//  the photo changes.
+//
+
+@property (nonatomic, strong) NSOperation *imageOperation;
+
+//
+//  The pending rebuild of |photo|'s purged tiles, if any. Also cancelled
+//  when the photo changes.
+//
+
+@property (nonatomic, strong) NSOperation *tileOperation;
+
+//
+//  Does the image view hold the whole display image, or just enough pixels
+//  to fill the screen?
+//
+
+@property (nonatomic, assign) BOOL showsFullResolution;
+
 - (void)setMaxMinZoomScalesForCurrentBounds;
+- (void)displayPhoto;
+- (void)loadImageIntoImageView:(UIImageView *)imageView fullResolution:(BOOL)fullResolution;
 
 @end
 
@@ -44,6 +68,8 @@
 
 @synthesize photo = photo_;
 @synthesize imageView = imageView_;
+@synthesize imageOperation = imageOperation_;
+@synthesize tileOperation = tileOperation_;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -67,6 +93,9 @@
 
 - (void)dealloc {
 
+  [imageOperation_ cancel];
+  [tileOperation_ cancel];
+  [photo_ unpinDecodedImages];
   [photo_ unloadImage];
 }
 
@@ -105,7 +134,9 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Set the photo we are displaying.
+//  Set the photo we are displaying. Nothing here decodes the full image on
+//  the main thread: that happens in the interactive lane, and the result
+//  gets swapped in when it's ready.
 //
 
 - (void)setPhoto:(IPPhoto *)photo {
@@ -114,21 +145,65 @@
     
     return;
   }
+  [self.imageOperation cancel];
+  self.imageOperation = nil;
+  [self.tileOperation cancel];
+  self.tileOperation = nil;
+  [photo_ unpinDecodedImages];
   [photo_ unloadImage];
   photo_ = photo;
   
+  //
+  //  Whatever gets decoded for the photo on screen stays put under memory
+  //  pressure.
+  //
+  
+  [photo pinDecodedImages];
+  
   //
   //  Clear the previous imageView.
   //
   
   [self.imageView removeFromSuperview];
   self.imageView = nil;
+  if (photo == nil) {
+    
+    return;
+  }
   
   if (![photo isOptimized]) {
 
-    DDLogVerbose(@"%s -- unexpectedly optimizing a photo", __PRETTY_FUNCTION__);
-    [photo optimize];
+    //
+    //  Don't stall the swipe. Put the photo at the front of the line and
+    //  show it once it's optimized.
+    //
+    
+    DDLogVerbose(@"%s -- photo not optimized yet; optimizing in the interactive lane", __PRETTY_FUNCTION__);
+    IPPhotoOptimizationManager *optimizationManager = [IPPhotoOptimizationManager sharedManager];
+    [optimizationManager promotePhoto:photo toLane:IPOptimizationLaneInteractive];
+    __weak IPPhotoScrollView *weakSelf = self;
+    self.imageOperation = [optimizationManager asyncOptimizePhoto:photo 
+                                                           inLane:IPOptimizationLaneInteractive 
+                                                   withCompletion:^(void) {
+                                                     
+                                                     IPPhotoScrollView *strongSelf = weakSelf;
+                                                     if (strongSelf.photo == photo) {
+                                                       
+                                                       strongSelf.imageOperation = nil;
+                                                       [strongSelf displayPhoto];
+                                                     }
+                                                   }];
+    return;
   }
+  [self displayPhoto];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Builds the view for an optimized |photo|.
+//
+
+- (void)displayPhoto {
   
   self.zoomScale = 1.0;
   size_t levelsOfDetail = [self.photo levelsOfDetail];
@@ -136,10 +211,47 @@
   if (levelsOfDetail <= 1) {
     
     //
-    //  With only one level, no point in using a tiling view.
+    //  With only one level, no point in using a tiling view. Stretch the
+    //  thumbnail over the image's frame until the decoded image arrives.
+    //  Only decode as many pixels as the screen shows. Without a recorded
+    //  size, decode it all, so the view can be sized from the result.
     //
     
-    self.imageView = [[UIImageView alloc] initWithImage:self.photo.image];
+    UIImageView *imageView = [[UIImageView alloc] initWithImage:self.photo.thumbnail];
+    CGSize imageSize = self.photo.imageSize;
+    BOOL sizeKnown = (imageSize.width > 0 && imageSize.height > 0);
+    if (sizeKnown) {
+      
+      imageView.frame = CGRectMake(0, 0, imageSize.width, imageSize.height);
+    }
+    self.imageView = imageView;
+    [self loadImageIntoImageView:imageView fullResolution:!sizeKnown];
+    
+    //
+    //  A photo kept at full resolution lost its tiles to a purge of Caches.
+    //  Show it screen-sized for now, and switch to tiles once they're back.
+    //
+    
+    if (self.tileOperation == nil && [self.photo needsTiles]) {
+      
+      IPPhoto *photo = self.photo;
+      __weak IPPhotoScrollView *weakSelf = self;
+      self.tileOperation = [[IPPhotoOptimizationManager sharedManager] asyncRebuildTilesOfPhoto:photo withCompletion:^(void) {
+        
+        IPPhotoScrollView *strongSelf = weakSelf;
+        if (strongSelf.photo != photo) {
+          return;
+        }
+        strongSelf.tileOperation = nil;
+        if ([photo levelsOfDetail] > 1) {
+          
+          [strongSelf.imageOperation cancel];
+          strongSelf.imageOperation = nil;
+          [strongSelf.imageView removeFromSuperview];
+          [strongSelf displayPhoto];
+        }
+      }];
+    }
     
   } else { 
 
@@ -157,11 +269,87 @@
   
   [self addSubview:self.imageView];
   
-  self.contentSize = self.photo.imageSize;
+  self.contentSize = self.imageView.bounds.size;
   [self setMaxMinZoomScalesForCurrentBounds];
   self.zoomScale = self.minimumZoomScale;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  How many pixels the page shows when the photo is fit to it.
+//
+
+- (CGSize)screenPixelSize {
+  
+  CGSize size = self.bounds.size;
+  if (size.width <= 0 || size.height <= 0) {
+    
+    size = [[UIScreen mainScreen] bounds].size;
+  }
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  return CGSizeMake(size.width * scale, size.height * scale);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decodes |photo|'s image in the interactive lane and puts it in
+//  |imageView|. Unless |fullResolution|, the decode is only screen-sized,
+//  and may come straight from |predecodeWindow|.
+//
+
+- (void)loadImageIntoImageView:(UIImageView *)imageView fullResolution:(BOOL)fullResolution {
+  
+  IPPhoto *photo = self.photo;
+  self.showsFullResolution = fullResolution;
+  UIImage *predecoded = fullResolution ? nil : [self.predecodeWindow decodedImageForPhoto:photo];
+  if (predecoded != nil) {
+    
+    imageView.image = predecoded;
+    return;
+  }
+  [self.imageOperation cancel];
+  CGSize pixelSize = [self screenPixelSize];
+  NSBlockOperation *imageOperation = [[NSBlockOperation alloc] init];
+  __weak NSBlockOperation *weakOperation = imageOperation;
+  __weak IPPhotoScrollView *weakSelf = self;
+  [imageOperation addExecutionBlock:^(void) {
+    
+    if ([weakOperation isCancelled]) {
+      return;
+    }
+    UIImage *image = fullResolution ? [photo decodedImage] : [photo imageDecodedToPixelSize:pixelSize];
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+      
+      IPPhotoScrollView *strongSelf = weakSelf;
+      if ([weakOperation isCancelled] || strongSelf.photo != photo || image == nil) {
+        
+        return;
+      }
+      imageView.image = image;
+      if (!fullResolution) {
+        
+        [strongSelf.predecodeWindow addDecodedImage:image forPhoto:photo];
+        
+      } else if (!CGSizeEqualToSize(imageView.bounds.size, image.size)) {
+        
+        //
+        //  No size was recorded for the photo, so the placeholder guessed
+        //  wrong. Lay out again for the real size.
+        //
+        
+        strongSelf.zoomScale = 1.0;
+        imageView.frame = CGRectMake(0, 0, image.size.width, image.size.height);
+        strongSelf.contentSize = image.size;
+        [strongSelf setMaxMinZoomScalesForCurrentBounds];
+        strongSelf.zoomScale = strongSelf.minimumZoomScale;
+      }
+      strongSelf.imageOperation = nil;
+    }];
+  }];
+  [[IPPhotoOptimizationManager sharedManager] addOperation:imageOperation inLane:IPOptimizationLaneInteractive];
+  self.imageOperation = imageOperation;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  We've set a frame... recompute the zoom scale.
@@ -232,4 +420,51 @@
   return self.imageView;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Keep the tiles around the viewport decoded.
+//
+
+- (void)prefetchTiles {
+  
+  if (![self.imageView isKindOfClass:[IPPhotoTilingView class]]) {
+    
+    return;
+  }
+  IPPhotoTilingView *tilingView = (IPPhotoTilingView *)self.imageView;
+  [tilingView prefetchTilesAroundRect:[self convertRect:self.bounds toView:tilingView] 
+                            zoomScale:self.zoomScale 
+                              zooming:self.isZooming];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidScroll:(UIScrollView *)scrollView {
+  
+  [self prefetchTiles];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidZoom:(UIScrollView *)scrollView {
+  
+  [self prefetchTiles];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A screen-sized decode looks soft once zoomed in; swap in the whole image.
+//
+
+- (void)scrollViewDidEndZooming:(UIScrollView *)scrollView withView:(UIView *)view atScale:(CGFloat)scale {
+  
+  if (self.showsFullResolution ||
+      scale <= self.minimumZoomScale ||
+      ![self.imageView isKindOfClass:[UIImageView class]]) {
+    
+    return;
+  }
+  [self loadImageIntoImageView:(UIImageView *)self.imageView fullResolution:YES];
+}
+
 @end
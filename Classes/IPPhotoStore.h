@@ -0,0 +1,150 @@
+//
+//  IPPhotoStore.h
+//  ipad-portfolio
+//
+//  Content-addressed storage for photo files. Each distinct image is stored
+//  once, named for a hash of its bytes, and reference counted by the model
+//  photos that point at it.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+#define kIPPhotoStoreIndexFilename    @"photo-store.plist"
+
+//
+//  A blob's name is the SHA-1 of the bytes it was imported from. Note that
+//  optimizing a photo rewrites its file in place, so the name identifies the
+//  source, not necessarily the current bytes on disk.
+//
+
+@interface IPPhotoStore : NSObject
+
+//
+//  The store for the documents folder.
+//
+
++ (IPPhotoStore *)sharedStore;
+
+//
+//  A store whose blobs and index live in |directory|.
+//
+
+- (id)initWithDirectory:(NSString *)directory;
+
+//
+//  If content from |sourceIdentifier| (e.g., a Flickr URL or an asset library
+//  URL) was imported before and is still stored, takes a reference to it and
+//  returns its filename. Otherwise returns nil, and the caller should fetch
+//  the content.
+//
+
+- (NSString *)retainFilenameForSourceIdentifier:(NSString *)sourceIdentifier;
+
+//
+//  Moves the file at |path| into the store and takes a reference to it.
+//  If identical content is already stored, |path| gets deleted instead and
+//  the existing blob is shared. Returns the stored filename. Records
+//  |sourceIdentifier|, if not nil, for |retainFilenameForSourceIdentifier:|.
+//
+
+- (NSString *)adoptFileAtPath:(NSString *)path sourceIdentifier:(NSString *)sourceIdentifier;
+
+//
+//  Stores |data| (or shares an existing blob with the same content) and takes
+//  a reference to it. Returns the stored filename.
+//
+
+- (NSString *)filenameForData:(NSData *)data sourceIdentifier:(NSString *)sourceIdentifier;
+
+//
+//  Like |filenameForData:sourceIdentifier:|, but can return before |data| is
+//  on disk. Anything that reads the file itself must call
+//  |waitUntilFilenameIsWritten:| first.
+//
+
+- (NSString *)filenameForData:(NSData *)data
+             sourceIdentifier:(NSString *)sourceIdentifier
+          writeAsynchronously:(BOOL)writeAsynchronously;
+
+//
+//  Blocks until an asynchronous write of |filename| (if any) has finished.
+//  Cheap when nothing is pending.
+//
+
+- (void)waitUntilFilenameIsWritten:(NSString *)filename;
+
+//
+//  Takes another reference to an already-stored file, e.g. when a page gets
+//  pasted. Returns NO if the file isn't in the store any more.
+//
+
+- (BOOL)retainFilename:(NSString *)filename;
+
+//
+//  Drops a reference. Returns YES if that was the last one (or the file was
+//  never in the store), meaning the caller should delete the file and
+//  anything derived from it.
+//
+
+- (BOOL)releaseFilename:(NSString *)filename;
+
+//
+//  Drops one reference for each entry in |filenames| (a name may appear more
+//  than once), with one index save for all of them. Returns the names
+//  |releaseFilename:| would have said YES for.
+//
+
+- (NSSet *)releaseFilenames:(NSArray *)filenames;
+
+//
+//  Deletes |filename| after |releaseFilename:| said to, unless it has been
+//  retained or stored again since. Waits out a pending write first. Returns
+//  YES if the file is gone (or never existed).
+//
+
+- (BOOL)removeFilenameIfUnreferenced:(NSString *)filename;
+
+//
+//  How many references |filename| has. Zero for files the store doesn't
+//  know about.
+//
+
+- (NSUInteger)referenceCountForFilename:(NSString *)filename;
+
+//
+//  The optimization version recorded for a stored file, so a photo that
+//  shares an already-optimized blob can skip optimizing. Zero if unknown.
+//
+
+- (NSUInteger)optimizedVersionForFilename:(NSString *)filename;
+- (void)setOptimizedVersion:(NSUInteger)version forFilename:(NSString *)filename;
+
+//
+//  Recomputes every reference count from the filenames the model actually
+//  uses (one entry per photo). Counts drift if the app dies between a model
+//  change and a save; call this after loading the portfolio.
+//
+
+- (void)resetReferenceCountsWithFilenames:(NSArray *)filenames;
+
+//
+//  Changes to the index get written in the background, a batch at a time.
+//  This blocks until the file has every change made so far. Call it when the
+//  app may not get to run again.
+//
+
+- (void)flushIndex;
+
+@end
@@ -0,0 +1,507 @@
+//
+//  IPPhotoStore.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <CommonCrypto/CommonDigest.h>
+#import "IPPhotoStore.h"
+
+//
+//  Keys in the on-disk index.
+//
+
+#define kIPPhotoStoreBlobs              @"blobs"
+#define kIPPhotoStoreSources            @"sources"
+#define kIPPhotoStoreReferenceCount     @"refs"
+#define kIPPhotoStoreOptimizedVersion   @"optimizedVersion"
+
+@interface IPPhotoStore ()
+
+@property (nonatomic, copy) NSString *directory;
+
+//
+//  Blob name -> mutable dictionary with the reference count & optimized
+//  version.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *blobs;
+
+//
+//  Source identifier -> blob name.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *sources;
+
+//
+//  Names of blobs handed to |writeQueue| that aren't on disk yet.
+//
+
+@property (nonatomic, strong) NSMutableSet *pendingWrites;
+
+//
+//  Serial queue for asynchronous blob writes.
+//
+
+@property (nonatomic, strong) dispatch_queue_t writeQueue;
+
+//
+//  Serial queue for index saves, and is one already queued?
+//
+
+@property (nonatomic, strong) dispatch_queue_t indexQueue;
+@property (nonatomic, assign) BOOL saveScheduled;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPPhotoStore
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPPhotoStore *)sharedStore {
+
+  static IPPhotoStore *sharedStore = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    sharedStore = [[IPPhotoStore alloc] initWithDirectory:paths[0]];
+  });
+  return sharedStore;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Designated initializer. Loads the index, if there is one.
+//
+
+- (id)initWithDirectory:(NSString *)directory {
+
+  self = [super init];
+  if (self != nil) {
+
+    _directory = [directory copy];
+    NSDictionary *index = [NSDictionary dictionaryWithContentsOfFile:[self indexPath]];
+    _blobs = [[NSMutableDictionary alloc] init];
+    [index[kIPPhotoStoreBlobs] enumerateKeysAndObjectsUsingBlock:^(id name, id entry, BOOL *stop) {
+
+      (self.blobs)[name] = [entry mutableCopy];
+    }];
+    _sources = [[NSMutableDictionary alloc] initWithDictionary:index[kIPPhotoStoreSources]];
+    _pendingWrites = [[NSMutableSet alloc] init];
+    _writeQueue = dispatch_queue_create("pholio.IPPhotoStore.write", DISPATCH_QUEUE_SERIAL);
+    _indexQueue = dispatch_queue_create("pholio.IPPhotoStore.index", DISPATCH_QUEUE_SERIAL);
+  }
+  return self;
+}
+
+#pragma mark - Helpers
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)indexPath {
+
+  return [self.directory stringByAppendingPathComponent:kIPPhotoStoreIndexFilename];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Queues a write of the index, unless one is already queued. Call while
+//  synchronized on |self|. Many changes in a row cost one write, and none of
+//  them waits for it.
+//
+
+- (void)scheduleSave {
+
+  if (self.saveScheduled) {
+
+    return;
+  }
+  self.saveScheduled = YES;
+  dispatch_async(self.indexQueue, ^{
+
+    NSDictionary *index;
+    @synchronized(self) {
+
+      self.saveScheduled = NO;
+      index = @{kIPPhotoStoreBlobs: [[NSDictionary alloc] initWithDictionary:self.blobs copyItems:YES],
+                kIPPhotoStoreSources: [self.sources copy]};
+    }
+    if (![index writeToFile:[self indexPath] atomically:YES]) {
+
+      DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, [self indexPath]);
+    }
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)flushIndex {
+
+  //
+  //  The queue is serial, so an empty block runs after any queued save.
+  //
+
+  dispatch_sync(self.indexQueue, ^{});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Hex SHA-1 of |data|.
+//
+
+static NSString *IPHashOfData(NSData *data) {
+
+  unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+  CC_SHA1([data bytes], (CC_LONG)[data length], digest);
+  NSMutableString *hash = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+  for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+
+    [hash appendFormat:@"%02x", digest[i]];
+  }
+  return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The blob name for content with hash |hash|.
+//
+
+- (NSString *)blobNameForHash:(NSString *)hash extension:(NSString *)extension {
+
+  if ([extension length] == 0) {
+
+    extension = @"jpg";
+  }
+  return [hash stringByAppendingPathExtension:[extension lowercaseString]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Adds a reference to |name|, creating the entry if needed. Call while
+//  synchronized on |self|.
+//
+
+- (void)addReferenceToBlobNamed:(NSString *)name sourceIdentifier:(NSString *)sourceIdentifier {
+
+  NSMutableDictionary *entry = (self.blobs)[name];
+  if (entry == nil) {
+
+    entry = [NSMutableDictionary dictionaryWithObject:@0 forKey:kIPPhotoStoreReferenceCount];
+    (self.blobs)[name] = entry;
+  }
+  entry[kIPPhotoStoreReferenceCount] = @([entry[kIPPhotoStoreReferenceCount] unsignedIntegerValue] + 1);
+  if (sourceIdentifier != nil) {
+
+    (self.sources)[sourceIdentifier] = name;
+  }
+  [self scheduleSave];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Is the blob |name| on disk, or about to be? Call while synchronized on
+//  |self|.
+//
+
+- (BOOL)blobExistsNamed:(NSString *)name {
+
+  return [self.pendingWrites containsObject:name] ||
+         [[NSFileManager defaultManager] fileExistsAtPath:[self.directory stringByAppendingPathComponent:name]];
+}
+
+#pragma mark - Importing
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)retainFilenameForSourceIdentifier:(NSString *)sourceIdentifier {
+
+  if (sourceIdentifier == nil) {
+
+    return nil;
+  }
+  @synchronized(self) {
+
+    NSString *name = (self.sources)[sourceIdentifier];
+    if (name == nil ||
+        (self.blobs)[name] == nil ||
+        ![self blobExistsNamed:name]) {
+
+      return nil;
+    }
+    NSString *filename = [self.directory stringByAppendingPathComponent:name];
+    DDLogVerbose(@"%s -- already have %@ as %@", __PRETTY_FUNCTION__, sourceIdentifier, name);
+    [self addReferenceToBlobNamed:name sourceIdentifier:nil];
+    return filename;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)adoptFileAtPath:(NSString *)path sourceIdentifier:(NSString *)sourceIdentifier {
+
+  NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:NULL];
+  if (data == nil) {
+
+    return nil;
+  }
+  NSString *name = [self blobNameForHash:IPHashOfData(data) extension:[path pathExtension]];
+  NSString *filename = [self.directory stringByAppendingPathComponent:name];
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  @synchronized(self) {
+
+    if ([self blobExistsNamed:name]) {
+
+      DDLogVerbose(@"%s -- %@ duplicates %@", __PRETTY_FUNCTION__, path, name);
+      if (![path isEqualToString:filename]) {
+
+        [fileManager removeItemAtPath:path error:NULL];
+      }
+
+    } else if (![fileManager moveItemAtPath:path toPath:filename error:NULL]) {
+
+      DDLogError(@"%s -- unable to move %@ to %@", __PRETTY_FUNCTION__, path, filename);
+      return nil;
+    }
+    [self addReferenceToBlobNamed:name sourceIdentifier:sourceIdentifier];
+  }
+  return filename;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)filenameForData:(NSData *)data sourceIdentifier:(NSString *)sourceIdentifier {
+
+  return [self filenameForData:data sourceIdentifier:sourceIdentifier writeAsynchronously:NO];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The name is known as soon as the hash is, so an asynchronous write can
+//  return right away. Until the write lands the blob sits in |pendingWrites|,
+//  which keeps dedupe and retains working in the meantime.
+//
+
+- (NSString *)filenameForData:(NSData *)data
+             sourceIdentifier:(NSString *)sourceIdentifier
+          writeAsynchronously:(BOOL)writeAsynchronously {
+
+  NSString *name = [self blobNameForHash:IPHashOfData(data) extension:nil];
+  NSString *filename = [self.directory stringByAppendingPathComponent:name];
+  @synchronized(self) {
+
+    if (![self blobExistsNamed:name]) {
+
+      if (writeAsynchronously) {
+
+        [self.pendingWrites addObject:name];
+        dispatch_async(self.writeQueue, ^{
+
+          if (![data writeToFile:filename atomically:YES]) {
+
+            DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, filename);
+          }
+          @synchronized(self) {
+
+            [self.pendingWrites removeObject:name];
+          }
+        });
+
+      } else if (![data writeToFile:filename atomically:YES]) {
+
+        DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, filename);
+        return nil;
+      }
+    }
+    [self addReferenceToBlobNamed:name sourceIdentifier:sourceIdentifier];
+  }
+  return filename;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilFilenameIsWritten:(NSString *)filename {
+
+  BOOL pending;
+  @synchronized(self) {
+
+    pending = [self.pendingWrites containsObject:[filename lastPathComponent]];
+  }
+  if (pending) {
+
+    //
+    //  The queue is serial, so an empty block runs after the write.
+    //
+
+    dispatch_sync(self.writeQueue, ^{});
+  }
+}
+
+#pragma mark - Reference counting
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)retainFilename:(NSString *)filename {
+
+  NSString *name = [filename lastPathComponent];
+  @synchronized(self) {
+
+    if ((self.blobs)[name] == nil || ![self blobExistsNamed:name]) {
+
+      return NO;
+    }
+    [self addReferenceToBlobNamed:name sourceIdentifier:nil];
+    return YES;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)releaseFilename:(NSString *)filename {
+
+  return [[self releaseFilenames:@[filename]] count] > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSSet *)releaseFilenames:(NSArray *)filenames {
+
+  NSMutableSet *unreferenced = [NSMutableSet set];
+  @synchronized(self) {
+
+    BOOL changed = NO;
+    for (NSString *filename in filenames) {
+
+      NSString *name = [filename lastPathComponent];
+      NSMutableDictionary *entry = (self.blobs)[name];
+      if (entry == nil) {
+
+        [unreferenced addObject:filename];
+        continue;
+      }
+      changed = YES;
+      NSUInteger references = [entry[kIPPhotoStoreReferenceCount] unsignedIntegerValue];
+      if (references > 1) {
+
+        entry[kIPPhotoStoreReferenceCount] = @(references - 1);
+        continue;
+      }
+      [self.blobs removeObjectForKey:name];
+      [self.sources removeObjectsForKeys:[self.sources allKeysForObject:name]];
+      [unreferenced addObject:filename];
+    }
+    if (changed) {
+
+      [self scheduleSave];
+    }
+  }
+  return unreferenced;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Files the store never managed (from before it existed) have no entry, and
+//  no one else can own them, so they always go.
+//
+
+- (BOOL)removeFilenameIfUnreferenced:(NSString *)filename {
+
+  [self waitUntilFilenameIsWritten:filename];
+  NSString *name = [filename lastPathComponent];
+  @synchronized(self) {
+
+    if ((self.blobs)[name] != nil || [self.pendingWrites containsObject:name]) {
+
+      return NO;
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:filename error:NULL];
+    return YES;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)referenceCountForFilename:(NSString *)filename {
+
+  @synchronized(self) {
+
+    return [(self.blobs)[[filename lastPathComponent]][kIPPhotoStoreReferenceCount] unsignedIntegerValue];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)optimizedVersionForFilename:(NSString *)filename {
+
+  @synchronized(self) {
+
+    return [(self.blobs)[[filename lastPathComponent]][kIPPhotoStoreOptimizedVersion] unsignedIntegerValue];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)setOptimizedVersion:(NSUInteger)version forFilename:(NSString *)filename {
+
+  @synchronized(self) {
+
+    NSMutableDictionary *entry = (self.blobs)[[filename lastPathComponent]];
+    if (entry == nil || [entry[kIPPhotoStoreOptimizedVersion] unsignedIntegerValue] == version) {
+
+      return;
+    }
+    entry[kIPPhotoStoreOptimizedVersion] = @(version);
+    [self scheduleSave];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Only blobs the store already knows about get recounted. Files from before
+//  the store existed stay unmanaged (one owner each). Blobs nothing uses any
+//  more leave the index but keep their files, so the found-pictures scan can
+//  still rescue them.
+//
+
+- (void)resetReferenceCountsWithFilenames:(NSArray *)filenames {
+
+  NSCountedSet *counts = [[NSCountedSet alloc] init];
+  for (NSString *filename in filenames) {
+
+    [counts addObject:[filename lastPathComponent]];
+  }
+  @synchronized(self) {
+
+    for (NSString *name in [self.blobs allKeys]) {
+
+      NSUInteger references = [counts countForObject:name];
+      if (references == 0) {
+
+        [self.blobs removeObjectForKey:name];
+        [self.sources removeObjectsForKeys:[self.sources allKeysForObject:name]];
+
+      } else {
+
+        (self.blobs)[name][kIPPhotoStoreReferenceCount] = @(references);
+      }
+    }
+    [self scheduleSave];
+  }
+}
+
+@end
@@ -46,4 +46,12 @@
 
 @property (nonatomic, assign) CGFloat maximumScale;
 
+//
+//  Starts decoding the tiles likely to be drawn next: a one-tile ring around
+//  |visibleRect| (in this view's coordinates) at the level for |zoomScale|,
+//  plus, if |zooming|, the next finer level under |visibleRect|.
+//
+
+- (void)prefetchTilesAroundRect:(CGRect)visibleRect zoomScale:(CGFloat)zoomScale zooming:(BOOL)zooming;
+
 @end
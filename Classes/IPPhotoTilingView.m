@@ -21,6 +21,20 @@
 #import <QuartzCore/QuartzCore.h>
 #import "IPPhotoTilingView.h"
 #import "IPPhoto.h"
+#import "IPTilePyramid.h"
+#import "IPTileCache.h"
+
+@interface IPPhotoTilingView ()
+
+//
+//  What the last prefetch covered, so repeats can be skipped.
+//
+
+@property (nonatomic, assign) NSUInteger lastPrefetchLevel;
+@property (nonatomic, assign) BOOL lastPrefetchZooming;
+@property (nonatomic, assign) CGRect lastPrefetchTiles;
+
+@end
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -63,6 +77,7 @@
 - (void)setPhoto:(IPPhoto *)photo {
   
   photo_ = photo;
+  self.lastPrefetchTiles = CGRectNull;
   
   CATiledLayer *layer = (CATiledLayer *)[self layer];
   layer.levelsOfDetail = [photo levelsOfDetail];
@@ -72,6 +87,82 @@
              layer.levelsOfDetail);
 }
 
+#pragma mark - Prefetching
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Queues the tiles of |level| that intersect |rect|.
+//
+
+- (void)prefetchLevel:(NSUInteger)level ofPyramid:(IPTilePyramid *)pyramid coveringRect:(CGRect)rect {
+  
+  rect = CGRectIntersection(rect, self.bounds);
+  if (CGRectIsEmpty(rect)) {
+    
+    return;
+  }
+  
+  //
+  //  At |level|, one tile covers 2^level tiles' worth of this view.
+  //
+  
+  CGFloat extent = pyramid.tileSize * (CGFloat)(1 << level);
+  NSUInteger firstCol = floorf(CGRectGetMinX(rect) / extent);
+  NSUInteger lastCol  = floorf((CGRectGetMaxX(rect) - 1) / extent);
+  NSUInteger firstRow = floorf(CGRectGetMinY(rect) / extent);
+  NSUInteger lastRow  = floorf((CGRectGetMaxY(rect) - 1) / extent);
+  [[IPTileCache sharedCache] prefetchTilesFromPyramid:pyramid 
+                                                level:level 
+                                                 rows:NSMakeRange(firstRow, lastRow - firstRow + 1) 
+                                              columns:NSMakeRange(firstCol, lastCol - firstCol + 1)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)prefetchTilesAroundRect:(CGRect)visibleRect zoomScale:(CGFloat)zoomScale zooming:(BOOL)zooming {
+  
+  IPTilePyramid *pyramid = [self.photo tilePyramid];
+  if (pyramid == nil) {
+    
+    return;
+  }
+  
+  //
+  //  Same scale |drawRect:| will see: the zoom times the screen scale,
+  //  clamped to |maximumScale|.
+  //
+  
+  CGFloat scale = MIN(zoomScale * [[UIScreen mainScreen] scale], self.maximumScale);
+  NSUInteger level = MIN([IPTilePyramid levelForScale:scale], pyramid.levelCount - 1);
+  CGFloat extent = pyramid.tileSize * (CGFloat)(1 << level);
+  
+  //
+  //  Scrolling calls this constantly; only requeue when the viewport moves
+  //  onto different tiles.
+  //
+  
+  CGRect tileAligned = CGRectMake(floorf(CGRectGetMinX(visibleRect) / extent),
+                                  floorf(CGRectGetMinY(visibleRect) / extent),
+                                  ceilf(CGRectGetMaxX(visibleRect) / extent),
+                                  ceilf(CGRectGetMaxY(visibleRect) / extent));
+  if (level == self.lastPrefetchLevel && 
+      zooming == self.lastPrefetchZooming &&
+      CGRectEqualToRect(tileAligned, self.lastPrefetchTiles)) {
+    
+    return;
+  }
+  self.lastPrefetchLevel = level;
+  self.lastPrefetchZooming = zooming;
+  self.lastPrefetchTiles = tileAligned;
+  
+  [[IPTileCache sharedCache] cancelPrefetches];
+  [self prefetchLevel:level ofPyramid:pyramid coveringRect:CGRectInset(visibleRect, -extent, -extent)];
+  if (zooming && level > 0) {
+    
+    [self prefetchLevel:level - 1 ofPyramid:pyramid coveringRect:visibleRect];
+  }
+}
+
 #pragma mark - Drawing
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -55,7 +55,8 @@ typedef enum {
 #define kIPPortfolioTitleFontSize   (20.0)
 
 //
-//  Post this notification when the model changes.
+//  Post this notification when the model changes. The portfolio posts it
+//  itself after removing photos whose files are gone.
 //
 
 #define IPPortfolioChanged          @"IPPortfolioChanged"
@@ -145,11 +146,22 @@ typedef enum {
 +(NSString *)defaultPortfolioPath;
 
 //
-//  Loads a portfolio.
+//  Loads a portfolio. Only the first few pages of each set get decoded;
+//  the rest wait until something asks the set for them. Reads the binary
+//  format (IPPortfolioFormat.h) and, for portfolios not yet migrated, the
+//  keyed archive that came before it.
 //
 
 +(IPPortfolio *)loadPortfolioFromPath:(NSString *)portfolioPath;
 
+//
+//  Rewrites a portfolio saved as a keyed archive, with its journal, as one
+//  binary snapshot. Returns YES if there was one to rewrite. Call before
+//  loading; the portfolio must not be in use.
+//
+
++ (BOOL)migratePortfolioAtPath:(NSString *)portfolioPath;
+
 //
 //  Convenience constructor.
 //
@@ -157,14 +169,74 @@ typedef enum {
 + (IPPortfolio *)portfolioWithSets:(IPSet *)firstSet, ...;
 
 //
-//  Saves the portfolio.
+//  Saves the portfolio, and returns once it's on disk. Main thread only, and
+//  blocks it; for anything but termination and backgrounding, prefer
+//  |-[IPPortfolioSaveCoordinator setNeedsSaveOfPortfolio:toPath:]|.
 //
 
 -(void)savePortfolioToPath:(NSString *)portfolioPath;
 
+//
+//  The portfolio encoded as it is right now, in the binary format, for
+//  writing to disk. Bumps |version|. Once the data is on disk, call
+//  |didWriteSnapshotWithVersion:toPath:| with the version this left behind.
+//  IPPortfolioSaveCoordinator does both, writing in the background.
+//
+
+- (NSData *)archivedSnapshot;
+- (void)didWriteSnapshotWithVersion:(NSInteger)version toPath:(NSString *)portfolioPath;
+
+//
+//  Saves a single change, already made to the model, as a small append to
+//  the journal next to the snapshot at |portfolioPath| (see
+//  IPPortfolioJournal). Falls back to a coalesced full save (see
+//  IPPortfolioSaveCoordinator) when there's no snapshot to extend yet, and
+//  every so often to fold the journal back in.
+//
+//  |object| and |container| are this portfolio or a set, page or photo in
+//  it. Insertions and removals are of the child at |index| of |container|.
+//
+
+- (void)saveValueForKey:(NSString *)key ofObject:(id)object toPath:(NSString *)portfolioPath;
+- (void)saveInsertionAtIndex:(NSUInteger)index inObject:(id)container toPath:(NSString *)portfolioPath;
+- (void)saveRemovalAtIndex:(NSUInteger)index inObject:(id)container toPath:(NSString *)portfolioPath;
+- (void)saveMoveFromIndex:(NSUInteger)fromIndex
+                  toIndex:(NSUInteger)toIndex
+                 inObject:(id)container
+                   toPath:(NSString *)portfolioPath;
+
+//
+//  Checks every loaded photo against one listing each of the documents and
+//  thumbnail directories. Photos whose image file is gone are removed, all
+//  in one batch. Photos with no thumbnail get marked for optimization.
+//  Returns the number of photos removed. Main thread only.
+//
+//  Loading doesn't do this, to keep it off the way to the first grid; call
+//  it once the portfolio is on screen.
+//
+
+- (NSUInteger)validatePhotoFiles;
+
+//
+//  Lists the directories in the background, then validates on the main
+//  thread and calls |completion| with the number of photos removed.
+//
+
+- (void)validatePhotoFilesAsyncWithCompletion:(void (^)(NSUInteger countOfRemovedPhotos))completion;
+
+//
+//  |set| just decoded |pages|, which weren't decoded with the portfolio.
+//  If the rest have been validated, checks these too. Photos that fail get
+//  removed later on the main queue, which posts |IPPortfolioChanged| and
+//  schedules a save; |set| doesn't change under its caller.
+//
+
+- (void)set:(IPSet *)set didLoadPages:(NSArray *)pages;
+
 //
 //  Looks for new pictures in the data directory and adds them to a new set
-//  if they are found.
+//  if they are found. Main thread only, since it reads every set's photo
+//  file names.
 //
 
 - (IPSet *)setWithFoundPictures;
@@ -20,9 +20,37 @@
 
 #import <Security/Security.h>
 #import "IPPortfolio.h"
+#import "IPPortfolioCoder.h"
+#import "IPPortfolioJournal.h"
+#import "IPPortfolioSaveCoordinator.h"
 
 #define kAppDelegatePortfolio           @"portfolio"
 
+@interface IPPortfolio ()
+
+//
+//  Changes saved since the last snapshot.
+//
+
+@property (nonatomic, strong) IPPortfolioJournal *journal;
+
+//
+//  The snapshot this portfolio was last loaded from or saved to. Changes the
+//  portfolio makes on its own get saved there.
+//
+
+@property (nonatomic, copy) NSString *portfolioPath;
+
+//
+//  The file names in the documents and thumbnail directories, as listed for
+//  the last validation. Pages loaded after it get checked against these.
+//
+
+@property (nonatomic, strong) NSSet *documentsListing;
+@property (nonatomic, strong) NSSet *thumbnailsListing;
+
+@end
+
 @implementation IPPortfolio
 
 @synthesize title = title_;
@@ -115,6 +143,156 @@
   [aCoder encodeInteger:version_ forKey:kIPPortfolioVersion];
 }
 
+#pragma mark Binary format
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Colors keep their color space, so one that comes back compares equal to
+//  the one that went out.
+//
+
+static IPPFColor IPFormatColorWithColor(UIColor *color) {
+  
+  IPPFColor formatColor = { IPPFColorSpaceNone, { 0, 0, 0, 0 } };
+  if (color == nil) {
+    return formatColor;
+  }
+  CGFloat red = 0, green = 0, blue = 0, alpha = 0;
+  CGColorSpaceModel model = CGColorSpaceGetModel(CGColorGetColorSpace([color CGColor]));
+  if (model == kCGColorSpaceModelMonochrome) {
+    
+    const CGFloat *components = CGColorGetComponents([color CGColor]);
+    formatColor.space = IPPFColorSpaceWhite;
+    formatColor.components[0] = components[0];
+    formatColor.components[1] = components[1];
+    
+  } else if ([color getRed:&red green:&green blue:&blue alpha:&alpha]) {
+    
+    formatColor.space = IPPFColorSpaceRGB;
+    formatColor.components[0] = red;
+    formatColor.components[1] = green;
+    formatColor.components[2] = blue;
+    formatColor.components[3] = alpha;
+  }
+  return formatColor;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static UIColor *IPColorWithFormatColor(IPPFColor formatColor) {
+  
+  switch (formatColor.space) {
+    case IPPFColorSpaceWhite:
+      return [UIColor colorWithWhite:formatColor.components[0] alpha:formatColor.components[1]];
+      
+    case IPPFColorSpaceRGB:
+      return [UIColor colorWithRed:formatColor.components[0]
+                             green:formatColor.components[1]
+                              blue:formatColor.components[2]
+                             alpha:formatColor.components[3]];
+      
+    default:
+      return nil;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static IPPFFont IPFormatFontWithFont(UIFont *font, IPPortfolioCoder *coder) {
+  
+  IPPFFont formatFont;
+  formatFont.name = [coder formatStringWithString:font.fontName];
+  formatFont.size = font.pointSize;
+  return formatFont;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Nil if no font was saved, or it isn't on this device; the property
+//  getters fall back to the defaults.
+//
+
+static UIFont *IPFontWithFormatFont(IPPFFont formatFont, IPPortfolioCoder *coder) {
+  
+  NSString *name = [coder stringWithFormatString:formatFont.name];
+  return (name == nil) ? nil : [UIFont fontWithName:name size:formatFont.size];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Pages a set never decoded stay in their block; |data| is where the
+//  blocks in |formatPortfolio| point.
+//
+
+- (id)initWithFormatPortfolio:(const IPPFPortfolio *)formatPortfolio data:(NSData *)data {
+  
+  if ((self = [super init]) != nil) {
+    
+    IPPortfolioCoder *coder = [[IPPortfolioCoder alloc] init];
+    title_ = [coder stringWithFormatString:formatPortfolio->title];
+    backgroundImageName_ = [coder stringWithFormatString:formatPortfolio->backgroundImageName];
+    navigationColor_ = IPColorWithFormatColor(formatPortfolio->navigationColor);
+    fontColor_ = IPColorWithFormatColor(formatPortfolio->fontColor);
+    if (fontColor_ == nil) {
+      fontColor_ = [UIColor whiteColor];
+    }
+    titleFont_ = IPFontWithFormatFont(formatPortfolio->titleFont, coder);
+    textFont_ = IPFontWithFormatFont(formatPortfolio->textFont, coder);
+    version_ = (NSInteger)formatPortfolio->version;
+    imageOptimizationVersion_ = (NSUInteger)formatPortfolio->imageOptimizationVersion;
+    layoutStyle_ = (IPPortfolioLayoutStyle)formatPortfolio->layoutStyle;
+    sets_ = [[NSMutableArray alloc] initWithCapacity:formatPortfolio->countOfSets];
+    for (uint32_t i = 0; i < formatPortfolio->countOfSets; i++) {
+      
+      const IPPFSet *formatSet = &formatPortfolio->sets[i];
+      IPSet *theSet = [[IPSet alloc] init];
+      theSet.title = [coder stringWithFormatString:formatSet->title];
+      NSData *unloadedPages = nil;
+      if (formatSet->unloadedPages.bytes != NULL) {
+        
+        NSRange range = NSMakeRange(formatSet->unloadedPages.bytes - (const uint8_t *)[data bytes],
+                                    formatSet->unloadedPages.length);
+        unloadedPages = [data subdataWithRange:range];
+      }
+      [theSet setLoadedPages:[coder pagesWithFormatPages:formatSet->pages count:formatSet->countOfPages]
+            unloadedPageData:unloadedPages
+                       count:formatSet->countOfUnloadedPages];
+      [self appendSet:theSet];
+    }
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A portfolio from a snapshot in either format; nil if |data| isn't one.
+//
+
++ (IPPortfolio *)portfolioWithData:(NSData *)data {
+  
+  if (!IPPFIsPortfolio([data bytes], [data length])) {
+    
+    NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
+    IPPortfolio *portfolio = [unarchiver decodeObjectForKey:kAppDelegatePortfolio];
+    [unarchiver finishDecoding];
+    return portfolio;
+  }
+  IPPFArena arena = { NULL };
+  IPPFPortfolio formatPortfolio;
+  IPPFResult result = IPPFDecodePortfolio([data bytes], [data length], &arena, &formatPortfolio);
+  IPPortfolio *portfolio = nil;
+  if (result == IPPFResultOK) {
+    
+    portfolio = [[IPPortfolio alloc] initWithFormatPortfolio:&formatPortfolio data:data];
+    
+  } else {
+    
+    DDLogError(@"%s -- unable to decode %d byte snapshot: %d", __PRETTY_FUNCTION__, [data length], result);
+  }
+  IPPFArenaFree(&arena);
+  return portfolio;
+}
+
 #pragma mark NSCopying
 
 -(id)copyWithZone:(NSZone *)zone {
@@ -152,22 +330,172 @@
 
 -(void)savePortfolioToPath:(NSString *)portfolioPath {
 
-  NSMutableData *data = [[NSMutableData alloc] init];
-  NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:data];
-  [archiver encodeObject:self forKey:kAppDelegatePortfolio];
-  [archiver finishEncoding];
-  [data writeToFile:portfolioPath atomically:YES];
+  //
+  //  Goes through the coordinator so it lands after, not under, any
+  //  background save already on its way to disk.
+  //
+  
+  [[IPPortfolioSaveCoordinator sharedCoordinator] flushPortfolio:self toPath:portfolioPath];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//
+//  Pages a set never decoded go back out in the block they came in.
+//
+
+- (NSData *)archivedSnapshot {
+  
+  version_++;
+  IPPortfolioCoder *coder = [[IPPortfolioCoder alloc] init];
+  IPPFPortfolio formatPortfolio;
+  memset(&formatPortfolio, 0, sizeof(formatPortfolio));
+  formatPortfolio.version = version_;
+  formatPortfolio.imageOptimizationVersion = imageOptimizationVersion_;
+  formatPortfolio.layoutStyle = layoutStyle_;
+  formatPortfolio.title = [coder formatStringWithString:title_];
+  formatPortfolio.backgroundImageName = [coder formatStringWithString:backgroundImageName_];
+  formatPortfolio.navigationColor = IPFormatColorWithColor(navigationColor_);
+  formatPortfolio.fontColor = IPFormatColorWithColor(fontColor_);
+  formatPortfolio.titleFont = IPFormatFontWithFont(titleFont_, coder);
+  formatPortfolio.textFont = IPFormatFontWithFont(textFont_, coder);
+  formatPortfolio.countOfSets = (uint32_t)[sets_ count];
+  formatPortfolio.sets = [coder allocateCount:[sets_ count] size:sizeof(IPPFSet)];
+  uint32_t setIndex = 0;
+  for (IPSet *theSet in sets_) {
+    
+    IPPFSet *formatSet = &formatPortfolio.sets[setIndex++];
+    NSArray *loadedPages = theSet.loadedPages;
+    NSData *unloadedPages = theSet.unloadedPageData;
+    formatSet->title = [coder formatStringWithString:theSet.title];
+    formatSet->pages = [coder formatPagesWithPages:loadedPages];
+    formatSet->countOfPages = (uint32_t)[loadedPages count];
+    if (unloadedPages != nil) {
+      
+      formatSet->unloadedPages.bytes = [unloadedPages bytes];
+      formatSet->unloadedPages.length = [unloadedPages length];
+      formatSet->countOfUnloadedPages = (uint32_t)theSet.unloadedPageCount;
+    }
+  }
+  IPPFWriter writer = { NULL, 0, 0, 0 };
+  IPPFResult result = IPPFEncodePortfolio(&formatPortfolio, &writer);
+  if (result != IPPFResultOK) {
+    
+    DDLogError(@"%s -- unable to encode portfolio: %d", __PRETTY_FUNCTION__, result);
+    free(writer.bytes);
+    return nil;
+  }
+  return [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Everything in the journal is in the snapshot now. If another save is
+//  already waiting, changes made since the snapshot was archived are only
+//  in memory; the journal can't pick up after them.
+//
+
+- (void)didWriteSnapshotWithVersion:(NSInteger)version toPath:(NSString *)portfolioPath {
+  
+  IPPortfolioJournal *journal = [self journalForPath:portfolioPath];
+  [journal resetForPortfolioVersion:version];
+  if ([[IPPortfolioSaveCoordinator sharedCoordinator] hasPendingSaveOfPortfolio:self]) {
+    
+    [journal invalidate];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The journal that extends the snapshot at |portfolioPath|.
+//
+
+- (IPPortfolioJournal *)journalForPath:(NSString *)portfolioPath {
+  
+  self.portfolioPath = portfolioPath;
+  NSString *journalPath = [IPPortfolioJournal journalPathForPortfolioPath:portfolioPath];
+  if (![self.journal.path isEqualToString:journalPath]) {
+    
+    self.journal = [[IPPortfolioJournal alloc] initWithPath:journalPath];
+  }
+  return self.journal;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Appends a change to the journal with |append|. If the journal doesn't
+//  extend the snapshot on disk or can't describe the change, nothing more
+//  goes into it and a new snapshot gets scheduled; the same once it has
+//  grown long enough to be worth folding in.
+//
+
+- (void)journalToPath:(NSString *)portfolioPath withBlock:(BOOL (^)(IPPortfolioJournal *journal))append {
+  
+  IPPortfolioJournal *journal = [self journalForPath:portfolioPath];
+  IPPortfolioSaveCoordinator *saveCoordinator = [IPPortfolioSaveCoordinator sharedCoordinator];
+  if (![journal extendsPortfolioVersion:version_] || !append(journal)) {
+    
+    [journal invalidate];
+    [saveCoordinator setNeedsSaveOfPortfolio:self toPath:portfolioPath];
+    
+  } else if (journal.countOfEntries >= kIPPortfolioJournalCompactionCount ||
+             journal.byteCount >= kIPPortfolioJournalCompactionBytes) {
+    
+    [saveCoordinator setNeedsSaveOfPortfolio:self toPath:portfolioPath];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)saveValueForKey:(NSString *)key ofObject:(id)object toPath:(NSString *)portfolioPath {
+  
+  [self journalToPath:portfolioPath withBlock:^BOOL(IPPortfolioJournal *journal) {
+    
+    return [journal appendValueForKey:key ofObject:object];
+  }];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)saveInsertionAtIndex:(NSUInteger)index inObject:(id)container toPath:(NSString *)portfolioPath {
+  
+  [self journalToPath:portfolioPath withBlock:^BOOL(IPPortfolioJournal *journal) {
+    
+    return [journal appendInsertionAtIndex:index inObject:container];
+  }];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)saveRemovalAtIndex:(NSUInteger)index inObject:(id)container toPath:(NSString *)portfolioPath {
+  
+  [self journalToPath:portfolioPath withBlock:^BOOL(IPPortfolioJournal *journal) {
+    
+    return [journal appendRemovalAtIndex:index inObject:container];
+  }];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)saveMoveFromIndex:(NSUInteger)fromIndex
+                  toIndex:(NSUInteger)toIndex
+                 inObject:(id)container
+                   toPath:(NSString *)portfolioPath {
+  
+  [self journalToPath:portfolioPath withBlock:^BOOL(IPPortfolioJournal *journal) {
+    
+    return [journal appendMoveFromIndex:fromIndex toIndex:toIndex inObject:container];
+  }];
 }
 
 //
-//  Private routine to fix up all of the file names in the portfolio
+//  Private routine to fix up all of the file names in the portfolio, so
+//  they're rooted in this app's doc directory. Only pages that are already
+//  loaded get looked at; the rest get fixed up as they're loaded. Whether
+//  the files are there gets checked later, by |validatePhotoFiles|.
 //
 
 -(void)fixPhotoFileNames {
-  NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
-  NSString *docDirectory = paths[0];
-  BOOL fileExists, isDirectory;
-  NSMutableSet *photosToDelete = [NSMutableSet setWithCapacity:1];
   
   //
   //  Make sure we have a "documents" directory
@@ -176,68 +504,291 @@
   [IPPhoto createThumbnailDirectory];
   
   for (IPSet *theSet in self.sets) {
-    for (IPPage *thePage in theSet.pages) {
-      for (IPPhoto *thePhoto in thePage.photos) {
-        
-        //
-        //  Make sure file names are always rooted in this app's doc directory.
-        //
-        
+    [self fixPhotoFileNamesInPages:theSet.loadedPages];
+  }
+}
+
+-(void)fixPhotoFileNamesInPages:(NSArray *)pages {
+  NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+  NSString *docDirectory = paths[0];
+  
+  for (IPPage *thePage in pages) {
+    for (IPPhoto *thePhoto in thePage.photos) {
+      
+      if (thePhoto.filename != nil) {
         thePhoto.filename = [docDirectory stringByAppendingPathComponent:[thePhoto.filename lastPathComponent]];
-        fileExists = [[NSFileManager defaultManager] fileExistsAtPath:thePhoto.filename isDirectory:&isDirectory];
-        if (!fileExists || isDirectory) {
-          
-          DDLogVerbose(@"%s -- deleting page from set %@; image file %@ does not exist",
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The names of the regular files in |directory|, from a single listing.
+//
+
++ (NSSet *)filenamesInDirectory:(NSString *)directory {
+  
+  NSArray *contents = [[NSFileManager defaultManager] contentsOfDirectoryAtURL:[NSURL fileURLWithPath:directory isDirectory:YES]
+                                                    includingPropertiesForKeys:@[NSURLIsRegularFileKey]
+                                                                       options:0
+                                                                         error:NULL];
+  NSMutableSet *filenames = [NSMutableSet setWithCapacity:[contents count]];
+  for (NSURL *url in contents) {
+    
+    NSNumber *isRegularFile = nil;
+    [url getResourceValue:&isRegularFile forKey:NSURLIsRegularFileKey error:NULL];
+    if ([isRegularFile boolValue]) {
+      
+      [filenames addObject:[url lastPathComponent]];
+    }
+  }
+  return filenames;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Finds the photos on |pages| of |theSet| whose image file isn't in the
+//  listing, without removing anything yet. A page left with no photos goes
+//  into |pageRemovals| under its set; otherwise the photos go into
+//  |photoRemovals| under their page. Both hold objects, not indexes, so the
+//  removals can wait. Photos with no thumbnail get marked for optimization.
+//  Returns the number of photos found.
+//
+
+- (NSUInteger)findInvalidPhotosOnPages:(NSArray *)pages
+                                 ofSet:(IPSet *)theSet
+                          pageRemovals:(NSMapTable *)pageRemovals
+                         photoRemovals:(NSMapTable *)photoRemovals {
+  
+  NSSet *documents = self.documentsListing;
+  NSSet *thumbnails = self.thumbnailsListing;
+  __block NSUInteger countOfInvalidPhotos = 0;
+  for (IPPage *thePage in pages) {
+    
+    NSIndexSet *invalidPhotos = [thePage.photos indexesOfObjectsPassingTest:^BOOL(IPPhoto *thePhoto, NSUInteger index, BOOL *stop) {
+      
+      if (thePhoto.filename == nil || ![documents containsObject:[thePhoto.filename lastPathComponent]]) {
+        
+        DDLogVerbose(@"%s -- deleting photo from set %@; image file %@ does not exist",
                      __PRETTY_FUNCTION__,
                      theSet.title,
                      thePhoto.filename);
-          [photosToDelete addObject:thePhoto];
-          continue;
-        }
-        
-        //
-        //  Things that are in the model but have no thumbnail need to get 
-        //  updated. Make sure these get optimized.
-        //
+        return YES;
+      }
+      
+      //
+      //  Things that are in the model but have no thumbnail need to get 
+      //  updated. Make sure these get optimized.
+      //
+      
+      if (![thumbnails containsObject:[thePhoto.thumbnailFilename lastPathComponent]]) {
         
-        fileExists = [[NSFileManager defaultManager] fileExistsAtPath:thePhoto.thumbnailFilename isDirectory:&isDirectory];
-        if (!fileExists || isDirectory) {
-          
-          DDLogVerbose(@"%s -- marking page for optimization from set %@: no thumbnail",
+        DDLogVerbose(@"%s -- marking photo for optimization from set %@: no thumbnail",
                      __PRETTY_FUNCTION__,
                      theSet.title);
-          thePhoto.optimizedVersion = NSNotFound;
-          self.imageOptimizationVersion = NSNotFound;
-        }
+        thePhoto.optimizedVersion = NSNotFound;
+        self.imageOptimizationVersion = NSNotFound;
       }
+      return NO;
+    }];
+    if ([invalidPhotos count] == 0) {
+      continue;
+    }
+    countOfInvalidPhotos += [invalidPhotos count];
+    if ([invalidPhotos count] < [thePage countOfPhotos]) {
+      
+      [photoRemovals setObject:[thePage.photos objectsAtIndexes:invalidPhotos] forKey:thePage];
+      continue;
     }
+    NSMutableArray *setPages = [pageRemovals objectForKey:theSet];
+    if (setPages == nil) {
+      
+      setPages = [NSMutableArray array];
+      [pageRemovals setObject:setPages forKey:theSet];
+    }
+    [setPages addObject:thePage];
   }
+  return countOfInvalidPhotos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The indexes in |objects| of anything in |removals|.
+//
+
++ (NSIndexSet *)indexesInArray:(NSArray *)objects ofObjects:(NSArray *)removals {
   
-  [photosToDelete enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {
-    IPPhoto *photo = (IPPhoto *)obj;
-    IPPage *page = photo.parent;
-    IPSet *set = page.parent;
+  return [objects indexesOfObjectsPassingTest:^BOOL(id object, NSUInteger index, BOOL *stop) {
     
-    [page.photos removeObject:photo];
-    if ([page countOfPhotos] == 0) {
-      [set.pages removeObject:page];
-    }
+    return [removals indexOfObjectIdenticalTo:object] != NSNotFound;
   }];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Applies everything |findInvalidPhotosOnPages:...| found in one go. Pages
+//  and photos that have moved since are found where they are now; ones that
+//  are gone are skipped. Main thread only.
+//
+
+- (void)removePages:(NSMapTable *)pageRemovals photos:(NSMapTable *)photoRemovals {
+  
+  NSAssert([NSThread isMainThread], @"Invalid photos get removed on the main thread");
+  if ([pageRemovals count] == 0 && [photoRemovals count] == 0) {
+    return;
+  }
+  
+  //
+  //  The journal's positions are from before these removals. The next
+  //  change has to go into a new snapshot; schedule one now so the removals
+  //  don't wait for it.
+  //
+  
+  [self.journal invalidate];
+  for (IPPage *thePage in photoRemovals) {
+    
+    NSIndexSet *indexes = [IPPortfolio indexesInArray:thePage.photos ofObjects:[photoRemovals objectForKey:thePage]];
+    [thePage removePhotosAtIndexes:indexes];
+  }
+  for (IPSet *theSet in pageRemovals) {
+    
+    NSIndexSet *indexes = [IPPortfolio indexesInArray:theSet.loadedPages ofObjects:[pageRemovals objectForKey:theSet]];
+    if ([indexes count] > 0) {
+      [theSet removePagesAtIndexes:indexes];
+    }
+  }
+  if (self.portfolioPath != nil) {
+    
+    [[IPPortfolioSaveCoordinator sharedCoordinator] setNeedsSaveOfPortfolio:self toPath:self.portfolioPath];
+  }
+  [[NSNotificationCenter defaultCenter] postNotificationName:IPPortfolioChanged object:self];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)validatePhotoFilesWithDocuments:(NSSet *)documents thumbnails:(NSSet *)thumbnails {
+  
+  CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+  self.documentsListing = documents;
+  self.thumbnailsListing = thumbnails;
+  NSMapTable *pageRemovals = [NSMapTable strongToStrongObjectsMapTable];
+  NSMapTable *photoRemovals = [NSMapTable strongToStrongObjectsMapTable];
+  NSUInteger countOfInvalidPhotos = 0;
+  for (IPSet *theSet in self.sets) {
+    
+    countOfInvalidPhotos += [self findInvalidPhotosOnPages:theSet.loadedPages
+                                                     ofSet:theSet
+                                              pageRemovals:pageRemovals
+                                             photoRemovals:photoRemovals];
+  }
+  [self removePages:pageRemovals photos:photoRemovals];
+  DDLogInfo(@"%s -- checked photos against %d files in %.1fms, removed %d",
+            __PRETTY_FUNCTION__,
+            [documents count] + [thumbnails count],
+            (CFAbsoluteTimeGetCurrent() - start) * 1000,
+            countOfInvalidPhotos);
+  return countOfInvalidPhotos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)validatePhotoFiles {
+  
+  NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+  return [self validatePhotoFilesWithDocuments:[IPPortfolio filenamesInDirectory:paths[0]]
+                                    thumbnails:[IPPortfolio filenamesInDirectory:[IPPhoto thumbnailDirectory]]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The listing happens in the background; checking the model and removing
+//  photos from it happens on the main thread.
+//
+
+- (void)validatePhotoFilesAsyncWithCompletion:(void (^)(NSUInteger countOfRemovedPhotos))completion {
+  
+  completion = [completion copy];
+  dispatch_queue_t defaultQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+  dispatch_async(defaultQueue, ^(void) {
+    
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    NSSet *documents = [IPPortfolio filenamesInDirectory:paths[0]];
+    NSSet *thumbnails = [IPPortfolio filenamesInDirectory:[IPPhoto thumbnailDirectory]];
+    dispatch_async(dispatch_get_main_queue(), ^(void) {
+      
+      NSUInteger countOfRemovedPhotos = [self validatePhotoFilesWithDocuments:documents thumbnails:thumbnails];
+      if (completion != nil) {
+        
+        completion(countOfRemovedPhotos);
+      }
+    });
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Pages loaded after validation get checked against the same listing. Their
+//  files can't have changed since: nothing could touch photos that weren't
+//  loaded.
+//
+//  This runs inside whatever accessor of |set| needed the pages, so nothing
+//  gets removed here; that waits for its own pass on the main queue.
+//
+
+- (void)set:(IPSet *)set didLoadPages:(NSArray *)pages {
+  
+  if (self.documentsListing == nil) {
+    
+    //
+    //  Validation hasn't happened yet; it will take in these pages too.
+    //
+    
+    return;
+  }
+  NSMapTable *pageRemovals = [NSMapTable strongToStrongObjectsMapTable];
+  NSMapTable *photoRemovals = [NSMapTable strongToStrongObjectsMapTable];
+  NSUInteger countOfInvalidPhotos = [self findInvalidPhotosOnPages:pages
+                                                             ofSet:set
+                                                      pageRemovals:pageRemovals
+                                                     photoRemovals:photoRemovals];
+  if (countOfInvalidPhotos == 0) {
+    return;
+  }
+  DDLogInfo(@"%s -- %d photos in %@ have no image file; removing them next",
+            __PRETTY_FUNCTION__,
+            countOfInvalidPhotos,
+            set.title);
+  dispatch_async(dispatch_get_main_queue(), ^(void) {
+    
+    [self removePages:pageRemovals photos:photoRemovals];
+  });
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Look for found pictures asynchronously, then call back on the main thread
-//  with the resulting set.
+//  with the resulting set. The portfolio's file names get gathered here, on
+//  the main thread, where loading a set's pages can't change them partway
+//  through; only the directory scan goes to the background.
 //
 
 - (void)lookForFoundPicturesAsyncWithCompletion:(void(^)(IPSet *foundSet))completion {
   
   completion = [completion copy];
+  NSSet *filenamesInPortfolio = [self photoFilenamesInPortfolio];
+  if (filenamesInPortfolio == nil) {
+    
+    dispatch_async(dispatch_get_main_queue(), ^(void) {
+      
+      completion(nil);
+    });
+    return;
+  }
   dispatch_queue_t defaultQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
   dispatch_async(defaultQueue, ^(void) {
     
-    IPSet *foundSet = [self setWithFoundPictures];
+    IPSet *foundSet = [IPPortfolio setWithFoundPicturesExcludingFilenames:filenamesInPortfolio];
     dispatch_async(dispatch_get_main_queue(), ^(void) {
       
       completion(foundSet);
@@ -245,12 +796,48 @@
   });
 }
 
+//
+//  The file names (last path components) of every photo in the portfolio,
+//  or nil if a set has damaged pages. Those still own files we can't name,
+//  which would all look found.
+//
+
+- (NSSet *)photoFilenamesInPortfolio {
+  
+  NSMutableSet *filenamesInPortfolio = [NSMutableSet setWithCapacity:8];
+  for (IPSet *theSet in self.sets) {
+    
+    NSArray *setFilenames = theSet.photoFilenames;
+    if (setFilenames == nil) {
+      
+      DDLogError(@"%s -- damaged pages in %@; not looking for found pictures", __PRETTY_FUNCTION__, theSet.title);
+      return nil;
+    }
+    [filenamesInPortfolio addObjectsFromArray:setFilenames];
+  }
+  return filenamesInPortfolio;
+}
+
 //
 //  Scans the working directory for files that look like pictures yet aren't
 //  in the portfolio. Sticks them in a new portfolio at the end.
 //
 
 -(IPSet *)setWithFoundPictures {
+  
+  NSSet *filenamesInPortfolio = [self photoFilenamesInPortfolio];
+  if (filenamesInPortfolio == nil) {
+    return nil;
+  }
+  return [IPPortfolio setWithFoundPicturesExcludingFilenames:filenamesInPortfolio];
+}
+
+//
+//  The scan itself. Touches only the file system, so it's safe on any
+//  thread.
+//
+
++ (IPSet *)setWithFoundPicturesExcludingFilenames:(NSSet *)filenamesInPortfolio {
 
   NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
   NSString *docDirectory = paths[0];
@@ -258,22 +845,6 @@
   NSArray *imageExtensions = @[@"jpg", @"jpeg", @"png"];
   NSArray *exclusionList   = @[kBackgroundFilename, kBrandingFilename];
   
-  //
-  //  Build up the set of all filenames that are in the portfolio.
-  //
-  
-  NSMutableSet *filenamesInPortfolio = [NSMutableSet setWithCapacity:8];
-  for (IPSet *theSet in self.sets) {
-    for (IPPage *thePage in theSet.pages) {
-      for (IPPhoto *thePhoto in thePage.photos) {
-        
-        if (thePhoto.filename != nil) {
-          [filenamesInPortfolio addObject:[thePhoto.filename lastPathComponent]];
-        }
-      }
-    }
-  }
-  
   //
   //  Get all files in docDirectory.
   //
@@ -319,17 +890,82 @@
 
 +(IPPortfolio *)loadPortfolioFromPath:(NSString *)portfolioPath {
 
+  CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
   NSData *data = [NSData dataWithContentsOfFile:portfolioPath];
-  NSKeyedUnarchiver *unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
-  IPPortfolio *portfolio = [unarchiver decodeObjectForKey:kAppDelegatePortfolio];
-  [unarchiver finishDecoding];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithData:data];
+  CFAbsoluteTime decoded = CFAbsoluteTimeGetCurrent();
   if (portfolio == nil) {
     portfolio = [[IPPortfolio alloc] init];    
+  } else {
+    
+    //
+    //  Bring the snapshot up to date with the changes saved since.
+    //
+    
+    NSUInteger replayed = [[portfolio journalForPath:portfolioPath] replayOntoPortfolio:portfolio];
+    NSUInteger loadedPages = 0, pages = 0;
+    for (IPSet *theSet in portfolio.sets) {
+      
+      loadedPages += [theSet.loadedPages count];
+      pages += [theSet countOfPages];
+    }
+    DDLogInfo(@"%s -- decoded %d byte snapshot (%d of %d pages) in %.1fms, replayed %d journal entries in %.1fms",
+              __PRETTY_FUNCTION__,
+              [data length],
+              loadedPages,
+              pages,
+              (decoded - start) * 1000,
+              replayed,
+              (CFAbsoluteTimeGetCurrent() - decoded) * 1000);
   }
   [portfolio fixPhotoFileNames];
   return portfolio;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The journal was written against the keyed snapshot, so it gets replayed
+//  onto that before the rewrite, and starts over after.
+//
+
++ (BOOL)migratePortfolioAtPath:(NSString *)portfolioPath {
+  
+  //
+  //  Runs on every launch, so the usual case only reads the magic number.
+  //
+  
+  NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:portfolioPath];
+  NSData *magic = [fileHandle readDataOfLength:4];
+  [fileHandle closeFile];
+  if ([magic length] == 0 || IPPFIsPortfolio([magic bytes], [magic length])) {
+    return NO;
+  }
+  CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+  NSData *data = [NSData dataWithContentsOfFile:portfolioPath];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithData:data];
+  if (portfolio == nil) {
+    
+    DDLogError(@"%s -- %@ is not a portfolio", __PRETTY_FUNCTION__, portfolioPath);
+    return NO;
+  }
+  IPPortfolioJournal *journal = [portfolio journalForPath:portfolioPath];
+  NSUInteger replayed = [journal replayOntoPortfolio:portfolio];
+  NSData *snapshot = [portfolio archivedSnapshot];
+  if (![snapshot writeToFile:portfolioPath atomically:YES]) {
+    
+    DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, portfolioPath);
+    return NO;
+  }
+  [journal resetForPortfolioVersion:portfolio.version];
+  DDLogInfo(@"%s -- rewrote %d byte archive and %d journal entries as %d bytes in %.1fms",
+            __PRETTY_FUNCTION__,
+            [data length],
+            replayed,
+            [snapshot length],
+            (CFAbsoluteTimeGetCurrent() - start) * 1000);
+  return YES;
+}
+
 #pragma mark - Properties
 
 - (UIColor *)navigationColor {
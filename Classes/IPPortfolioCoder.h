@@ -0,0 +1,78 @@
+//
+//  IPPortfolioCoder.h
+//  ipad-portfolio
+//
+//  Moves pages and photos between the model and the structures of the
+//  binary portfolio format (IPPortfolioFormat.h). A coder owns the memory
+//  behind everything it hands out, so structures it builds for encoding
+//  stay good until the coder goes away.
+//
+//  Photo file names go out as just their last path component and come back
+//  rooted in this app's documents directory. Decoded strings that were
+//  written once come back as one NSString, however many photos share them.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "IPPortfolioFormat.h"
+
+@interface IPPortfolioCoder : NSObject
+
+//
+//  |pages| as the contents of a block, and back. |pagesWithData:| returns
+//  nil if |data| isn't a well-formed block.
+//
+
++ (NSData *)dataWithPages:(NSArray *)pages;
++ (NSMutableArray *)pagesWithData:(NSData *)data;
+
+//
+//  The photo file names in a block, without making any model objects. Nil
+//  if |data| isn't a well-formed block.
+//
+
++ (NSArray *)photoFilenamesInPageData:(NSData *)data;
+
+//
+//  Memory that lives as long as the coder.
+//
+
+- (void *)allocateCount:(NSUInteger)count size:(size_t)size;
+
+//
+//  |string| for encoding. Nil becomes a nil string.
+//
+
+- (IPPFString)formatStringWithString:(NSString *)string;
+
+//
+//  IPPFPage structures for |pages| (IPPage objects), for encoding.
+//
+
+- (IPPFPage *)formatPagesWithPages:(NSArray *)pages;
+
+//
+//  A decoded string as an NSString, or nil.
+//
+
+- (NSString *)stringWithFormatString:(IPPFString)string;
+
+//
+//  IPPage objects for decoded pages, with full file names. They have no
+//  parent yet.
+//
+
+- (NSMutableArray *)pagesWithFormatPages:(const IPPFPage *)pages count:(NSUInteger)countOfPages;
+
+@end
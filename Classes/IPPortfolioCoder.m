@@ -0,0 +1,243 @@
+//
+//  IPPortfolioCoder.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPPortfolioCoder.h"
+#import "IPPage.h"
+#import "IPPhoto.h"
+
+@interface IPPortfolioCoder ()
+
+//
+//  Decoded strings, keyed by where their bytes are. Every reference to a
+//  string in a table points at the same bytes.
+//
+
+@property (nonatomic, strong) NSMapTable *strings;
+
+//
+//  Where decoded photo file names get rooted.
+//
+
+@property (nonatomic, copy) NSString *documentsDirectory;
+
+@end
+
+@implementation IPPortfolioCoder {
+
+  IPPFArena _arena;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)init {
+
+  self = [super init];
+  if (self != nil) {
+
+    _strings = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsOpaqueMemory | NSPointerFunctionsOpaquePersonality
+                                         valueOptions:NSPointerFunctionsStrongMemory
+                                             capacity:0];
+    _documentsDirectory = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES)[0] copy];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  IPPFArenaFree(&_arena);
+}
+
+#pragma mark - Blocks
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSData *)dataWithPages:(NSArray *)pages {
+
+  IPPortfolioCoder *coder = [[IPPortfolioCoder alloc] init];
+  IPPFPage *formatPages = [coder formatPagesWithPages:pages];
+  IPPFWriter writer = { NULL, 0, 0, 0 };
+  IPPFResult result = IPPFEncodePages(formatPages, (uint32_t)[pages count], &writer);
+  if (result != IPPFResultOK) {
+
+    DDLogError(@"%s -- unable to encode %d pages: %d", __PRETTY_FUNCTION__, [pages count], result);
+    free(writer.bytes);
+    return nil;
+  }
+  return [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSMutableArray *)pagesWithData:(NSData *)data {
+
+  IPPortfolioCoder *coder = [[IPPortfolioCoder alloc] init];
+  IPPFBlock block = { [data bytes], [data length] };
+  IPPFPage *formatPages = NULL;
+  uint32_t countOfPages = 0;
+  IPPFResult result = IPPFDecodePages(block, &coder->_arena, &formatPages, &countOfPages);
+  if (result != IPPFResultOK) {
+
+    DDLogError(@"%s -- unable to decode %d bytes of pages: %d", __PRETTY_FUNCTION__, [data length], result);
+    return nil;
+  }
+  return [coder pagesWithFormatPages:formatPages count:countOfPages];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSArray *)photoFilenamesInPageData:(NSData *)data {
+
+  IPPortfolioCoder *coder = [[IPPortfolioCoder alloc] init];
+  IPPFBlock block = { [data bytes], [data length] };
+  IPPFPage *formatPages = NULL;
+  uint32_t countOfPages = 0;
+  IPPFResult result = IPPFDecodePages(block, &coder->_arena, &formatPages, &countOfPages);
+  if (result != IPPFResultOK) {
+
+    DDLogError(@"%s -- unable to decode %d bytes of pages: %d", __PRETTY_FUNCTION__, [data length], result);
+    return nil;
+  }
+  NSMutableArray *filenames = [NSMutableArray arrayWithCapacity:countOfPages];
+  for (uint32_t i = 0; i < countOfPages; i++) {
+    for (uint32_t j = 0; j < formatPages[i].countOfPhotos; j++) {
+
+      NSString *filename = [coder stringWithFormatString:formatPages[i].photos[j].filename];
+      if (filename != nil) {
+        [filenames addObject:filename];
+      }
+    }
+  }
+  return filenames;
+}
+
+#pragma mark - Encoding
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void *)allocateCount:(NSUInteger)count size:(size_t)size {
+
+  void *memory = IPPFArenaAllocate(&_arena, count, size);
+  if (memory == NULL && count > 0) {
+
+    [NSException raise:NSMallocException format:@"Unable to allocate %d items of %zu bytes", count, size];
+  }
+  return memory;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (IPPFString)formatStringWithString:(NSString *)string {
+
+  IPPFString formatString = { NULL, 0 };
+  if (string == nil) {
+    return formatString;
+  }
+  const char *utf8 = [string UTF8String];
+  size_t length = strlen(utf8);
+  char *bytes = [self allocateCount:length + 1 size:1];
+  memcpy(bytes, utf8, length);
+  formatString.bytes = bytes;
+  formatString.length = (uint32_t)length;
+  return formatString;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (IPPFPage *)formatPagesWithPages:(NSArray *)pages {
+
+  IPPFPage *formatPages = [self allocateCount:[pages count] size:sizeof(IPPFPage)];
+  [pages enumerateObjectsUsingBlock:^(IPPage *page, NSUInteger pageIndex, BOOL *stop) {
+
+    @autoreleasepool {
+
+      NSArray *photos = page.photos;
+      IPPFPage *formatPage = &formatPages[pageIndex];
+      formatPage->photos = [self allocateCount:[photos count] size:sizeof(IPPFPhoto)];
+      formatPage->countOfPhotos = (uint32_t)[photos count];
+      [photos enumerateObjectsUsingBlock:^(IPPhoto *photo, NSUInteger photoIndex, BOOL *stop) {
+
+        IPPFPhoto *formatPhoto = &formatPage->photos[photoIndex];
+        formatPhoto->filename = [self formatStringWithString:[photo.filename lastPathComponent]];
+        formatPhoto->title = [self formatStringWithString:photo.title];
+        formatPhoto->caption = [self formatStringWithString:photo.caption];
+        formatPhoto->width = photo.imageSize.width;
+        formatPhoto->height = photo.imageSize.height;
+        formatPhoto->optimizedVersion = photo.optimizedVersion;
+      }];
+    }
+  }];
+  return formatPages;
+}
+
+#pragma mark - Decoding
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)stringWithFormatString:(IPPFString)string {
+
+  if (string.bytes == NULL) {
+    return nil;
+  }
+
+  //
+  //  An empty string takes no bytes, so it can share its address with the
+  //  string after it.
+  //
+
+  if (string.length == 0) {
+    return @"";
+  }
+  NSString *decoded = [self.strings objectForKey:(__bridge id)(void *)string.bytes];
+  if (decoded == nil) {
+
+    decoded = [[NSString alloc] initWithBytes:string.bytes length:string.length encoding:NSUTF8StringEncoding];
+    if (decoded != nil) {
+      [self.strings setObject:decoded forKey:(__bridge id)(void *)string.bytes];
+    }
+  }
+  return decoded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSMutableArray *)pagesWithFormatPages:(const IPPFPage *)formatPages count:(NSUInteger)countOfPages {
+
+  NSMutableArray *pages = [[NSMutableArray alloc] initWithCapacity:countOfPages];
+  for (NSUInteger i = 0; i < countOfPages; i++) {
+
+    IPPage *page = [[IPPage alloc] init];
+    for (uint32_t j = 0; j < formatPages[i].countOfPhotos; j++) {
+
+      const IPPFPhoto *formatPhoto = &formatPages[i].photos[j];
+      IPPhoto *photo = [[IPPhoto alloc] init];
+      NSString *filename = [self stringWithFormatString:formatPhoto->filename];
+      photo.filename = (filename == nil) ? nil : [self.documentsDirectory stringByAppendingPathComponent:filename];
+      photo.title = [self stringWithFormatString:formatPhoto->title];
+      photo.caption = [self stringWithFormatString:formatPhoto->caption];
+      photo.imageSize = CGSizeMake(formatPhoto->width, formatPhoto->height);
+      photo.optimizedVersion = (NSUInteger)formatPhoto->optimizedVersion;
+      photo.parent = page;
+      [page.photos addObject:photo];
+    }
+    [pages addObject:page];
+  }
+  return pages;
+}
+
+@end
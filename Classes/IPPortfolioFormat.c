@@ -0,0 +1,808 @@
+//
+//  IPPortfolioFormat.c
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "IPPortfolioFormat.h"
+
+static const uint8_t kIPPFMagic[4] = { 'I', 'P', 'P', 'F' };
+
+//
+//  The smallest a photo can be: three nil strings, two floats and a
+//  one-byte version. Used to reject counts the bytes can't hold before
+//  allocating for them.
+//
+
+#define kIPPFMinimumPhotoLength   (3 + 4 + 4 + 1)
+#define kIPPFArenaChunkSize       (64 * 1024)
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma mark - Arena
+
+struct IPPFArenaChunk {
+  IPPFArenaChunk *next;
+  size_t used;
+  size_t capacity;
+  uint8_t bytes[];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Allocations are 8-byte aligned.
+//
+
+void *IPPFArenaAllocate(IPPFArena *arena, size_t count, size_t size) {
+
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  size_t length = (count * size + 7) & ~(size_t)7;
+  IPPFArenaChunk *chunk = arena->chunks;
+  if (chunk == NULL || chunk->capacity - chunk->used < length) {
+
+    //
+    //  Big allocations get a chunk to themselves, behind the current one so
+    //  its free space stays in use.
+    //
+
+    size_t capacity = (length > kIPPFArenaChunkSize / 4) ? length : kIPPFArenaChunkSize;
+    IPPFArenaChunk *newChunk = malloc(sizeof(IPPFArenaChunk) + capacity);
+    if (newChunk == NULL) {
+      return NULL;
+    }
+    newChunk->used = 0;
+    newChunk->capacity = capacity;
+    if (chunk != NULL && capacity == length) {
+
+      newChunk->next = chunk->next;
+      chunk->next = newChunk;
+
+    } else {
+
+      newChunk->next = chunk;
+      arena->chunks = newChunk;
+    }
+    chunk = newChunk;
+  }
+  void *memory = chunk->bytes + chunk->used;
+  chunk->used += length;
+  memset(memory, 0, length);
+  return memory;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void IPPFArenaFree(IPPFArena *arena) {
+
+  IPPFArenaChunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+
+    IPPFArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->chunks = NULL;
+}
+
+#pragma mark - Writing
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int IPPFReserve(IPPFWriter *writer, size_t length) {
+
+  if (writer->failed) {
+    return 0;
+  }
+  if (writer->capacity - writer->length >= length) {
+    return 1;
+  }
+  size_t capacity = (writer->capacity == 0) ? 4096 : writer->capacity;
+  while (capacity - writer->length < length) {
+    capacity *= 2;
+  }
+  uint8_t *bytes = realloc(writer->bytes, capacity);
+  if (bytes == NULL) {
+
+    writer->failed = 1;
+    return 0;
+  }
+  writer->bytes = bytes;
+  writer->capacity = capacity;
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFWriteBytes(IPPFWriter *writer, const void *bytes, size_t length) {
+
+  if (length != 0 && IPPFReserve(writer, length)) {
+
+    memcpy(writer->bytes + writer->length, bytes, length);
+    writer->length += length;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFWriteVarint(IPPFWriter *writer, uint64_t value) {
+
+  if (!IPPFReserve(writer, 10)) {
+    return;
+  }
+  uint8_t *cursor = writer->bytes + writer->length;
+  while (value >= 0x80) {
+
+    *cursor++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *cursor++ = (uint8_t)value;
+  writer->length = cursor - writer->bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFWriteFloat(IPPFWriter *writer, float value) {
+
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t bytes[4] = { bits & 0xff, (bits >> 8) & 0xff, (bits >> 16) & 0xff, bits >> 24 };
+  IPPFWriteBytes(writer, bytes, sizeof(bytes));
+}
+
+#pragma mark - Reading
+
+typedef struct {
+  const uint8_t *cursor;
+  const uint8_t *end;
+  IPPFResult result;
+} IPPFReader;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int IPPFReaderFail(IPPFReader *reader, IPPFResult result) {
+
+  if (reader->result == IPPFResultOK) {
+    reader->result = result;
+  }
+  reader->cursor = reader->end;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t IPPFRemaining(const IPPFReader *reader) {
+
+  return reader->end - reader->cursor;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t IPPFReadVarint(IPPFReader *reader) {
+
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+
+    if (reader->cursor == reader->end) {
+
+      IPPFReaderFail(reader, IPPFResultTruncated);
+      return 0;
+    }
+    uint8_t byte = *reader->cursor++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  IPPFReaderFail(reader, IPPFResultCorrupt);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A varint that counts things at least |minimumLength| bytes long, which
+//  therefore can't be more than what's left over |minimumLength|.
+//
+
+static uint32_t IPPFReadCount(IPPFReader *reader, size_t minimumLength) {
+
+  uint64_t count = IPPFReadVarint(reader);
+  if (count > UINT32_MAX || count * minimumLength > IPPFRemaining(reader)) {
+
+    IPPFReaderFail(reader, IPPFResultCorrupt);
+    return 0;
+  }
+  return (uint32_t)count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static float IPPFReadFloat(IPPFReader *reader) {
+
+  if (IPPFRemaining(reader) < 4) {
+
+    IPPFReaderFail(reader, IPPFResultTruncated);
+    return 0;
+  }
+  const uint8_t *bytes = reader->cursor;
+  uint32_t bits = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+  reader->cursor += 4;
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A block: the byte count, then that many bytes.
+//
+
+static IPPFBlock IPPFReadBlock(IPPFReader *reader) {
+
+  IPPFBlock block = { NULL, 0 };
+  uint64_t length = IPPFReadVarint(reader);
+  if (length > IPPFRemaining(reader)) {
+
+    IPPFReaderFail(reader, IPPFResultTruncated);
+    return block;
+  }
+  block.bytes = reader->cursor;
+  block.length = (size_t)length;
+  reader->cursor += length;
+  return block;
+}
+
+#pragma mark - String tables
+
+typedef struct {
+  IPPFString string;
+  uint32_t hash;
+  uint32_t index;
+} IPPFInternedString;
+
+//
+//  Gives each distinct string an index, in the order they're first seen.
+//  Strings aren't copied; they have to outlive the table.
+//
+
+typedef struct {
+  IPPFInternedString *slots;
+  uint32_t countOfSlots;
+  IPPFString *strings;
+  uint32_t countOfStrings;
+  int failed;
+} IPPFStringTable;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t IPPFHash(IPPFString string) {
+
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < string.length; i++) {
+
+    hash ^= (uint8_t)string.bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int IPPFStringTableInit(IPPFStringTable *table, uint32_t expectedCount) {
+
+  memset(table, 0, sizeof(*table));
+  uint32_t countOfSlots = 64;
+  while (countOfSlots < expectedCount * 2) {
+    countOfSlots *= 2;
+  }
+  table->slots = calloc(countOfSlots, sizeof(IPPFInternedString));
+  table->strings = malloc(countOfSlots / 2 * sizeof(IPPFString));
+  table->countOfSlots = countOfSlots;
+  table->failed = (table->slots == NULL || table->strings == NULL);
+  return !table->failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFStringTableFree(IPPFStringTable *table) {
+
+  free(table->slots);
+  free(table->strings);
+  memset(table, 0, sizeof(*table));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The slot for |string|: either where it is, or the empty slot where it
+//  would go.
+//
+
+static IPPFInternedString *IPPFStringTableSlot(const IPPFStringTable *table, IPPFString string, uint32_t hash) {
+
+  uint32_t mask = table->countOfSlots - 1;
+  for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+
+    IPPFInternedString *slot = &table->slots[i];
+    if (slot->index == 0) {
+      return slot;
+    }
+    if (slot->hash == hash &&
+        slot->string.length == string.length &&
+        memcmp(slot->string.bytes, string.bytes, string.length) == 0) {
+      return slot;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Keeps the table at most half full.
+//
+
+static int IPPFStringTableGrow(IPPFStringTable *table) {
+
+  IPPFInternedString *oldSlots = table->slots;
+  uint32_t oldCountOfSlots = table->countOfSlots;
+  uint32_t countOfSlots = oldCountOfSlots * 2;
+  IPPFInternedString *slots = calloc(countOfSlots, sizeof(IPPFInternedString));
+  IPPFString *strings = realloc(table->strings, countOfSlots / 2 * sizeof(IPPFString));
+  if (slots == NULL || strings == NULL) {
+
+    free(slots);
+    if (strings != NULL) {
+      table->strings = strings;
+    }
+    table->failed = 1;
+    return 0;
+  }
+  table->slots = slots;
+  table->strings = strings;
+  table->countOfSlots = countOfSlots;
+  for (uint32_t i = 0; i < oldCountOfSlots; i++) {
+
+    if (oldSlots[i].index != 0) {
+      *IPPFStringTableSlot(table, oldSlots[i].string, oldSlots[i].hash) = oldSlots[i];
+    }
+  }
+  free(oldSlots);
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFIntern(IPPFStringTable *table, IPPFString string) {
+
+  if (string.bytes == NULL || table->failed) {
+    return;
+  }
+  uint32_t hash = IPPFHash(string);
+  IPPFInternedString *slot = IPPFStringTableSlot(table, string, hash);
+  if (slot->index != 0) {
+    return;
+  }
+  if (table->countOfStrings + 1 > table->countOfSlots / 2) {
+
+    if (!IPPFStringTableGrow(table)) {
+      return;
+    }
+    slot = IPPFStringTableSlot(table, string, hash);
+  }
+  table->strings[table->countOfStrings++] = string;
+  slot->string = string;
+  slot->hash = hash;
+  slot->index = table->countOfStrings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Writes the reference to a string that has been interned.
+//
+
+static void IPPFWriteStringReference(IPPFWriter *writer, const IPPFStringTable *table, IPPFString string) {
+
+  if (string.bytes == NULL) {
+
+    IPPFWriteVarint(writer, 0);
+    return;
+  }
+  IPPFWriteVarint(writer, IPPFStringTableSlot(table, string, IPPFHash(string))->index);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFWriteStringTable(IPPFWriter *writer, const IPPFStringTable *table) {
+
+  IPPFWriteVarint(writer, table->countOfStrings);
+  for (uint32_t i = 0; i < table->countOfStrings; i++) {
+
+    IPPFWriteVarint(writer, table->strings[i].length);
+    IPPFWriteBytes(writer, table->strings[i].bytes, table->strings[i].length);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Reads a string table into |arena|. The strings point into the reader's
+//  bytes.
+//
+
+static IPPFString *IPPFReadStringTable(IPPFReader *reader, IPPFArena *arena, uint32_t *countOfStrings) {
+
+  *countOfStrings = IPPFReadCount(reader, 1);
+  IPPFString *strings = IPPFArenaAllocate(arena, *countOfStrings, sizeof(IPPFString));
+  if (strings == NULL && *countOfStrings > 0) {
+
+    IPPFReaderFail(reader, IPPFResultNoMemory);
+    return NULL;
+  }
+  for (uint32_t i = 0; i < *countOfStrings && reader->result == IPPFResultOK; i++) {
+
+    uint64_t length = IPPFReadVarint(reader);
+    if (length > IPPFRemaining(reader)) {
+
+      IPPFReaderFail(reader, IPPFResultTruncated);
+      return NULL;
+    }
+    strings[i].bytes = (const char *)reader->cursor;
+    strings[i].length = (uint32_t)length;
+    reader->cursor += length;
+  }
+  return strings;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static IPPFString IPPFReadStringReference(IPPFReader *reader, const IPPFString *strings, uint32_t countOfStrings) {
+
+  IPPFString string = { NULL, 0 };
+  uint64_t index = IPPFReadVarint(reader);
+  if (index > countOfStrings) {
+
+    IPPFReaderFail(reader, IPPFResultCorrupt);
+    return string;
+  }
+  return (index == 0) ? string : strings[index - 1];
+}
+
+#pragma mark - Pages
+
+////////////////////////////////////////////////////////////////////////////////
+
+IPPFResult IPPFEncodePages(const IPPFPage *pages, uint32_t countOfPages, IPPFWriter *writer) {
+
+  uint32_t countOfPhotos = 0;
+  for (uint32_t i = 0; i < countOfPages; i++) {
+    countOfPhotos += pages[i].countOfPhotos;
+  }
+  IPPFStringTable table;
+  if (!IPPFStringTableInit(&table, countOfPhotos + 8)) {
+
+    IPPFStringTableFree(&table);
+    return IPPFResultNoMemory;
+  }
+  for (uint32_t i = 0; i < countOfPages; i++) {
+    for (uint32_t j = 0; j < pages[i].countOfPhotos; j++) {
+
+      const IPPFPhoto *photo = &pages[i].photos[j];
+      IPPFIntern(&table, photo->filename);
+      IPPFIntern(&table, photo->title);
+      IPPFIntern(&table, photo->caption);
+    }
+  }
+  if (table.failed) {
+
+    IPPFStringTableFree(&table);
+    return IPPFResultNoMemory;
+  }
+  IPPFWriteStringTable(writer, &table);
+  IPPFWriteVarint(writer, countOfPages);
+  for (uint32_t i = 0; i < countOfPages; i++) {
+
+    IPPFWriteVarint(writer, pages[i].countOfPhotos);
+    for (uint32_t j = 0; j < pages[i].countOfPhotos; j++) {
+
+      const IPPFPhoto *photo = &pages[i].photos[j];
+      IPPFWriteStringReference(writer, &table, photo->filename);
+      IPPFWriteStringReference(writer, &table, photo->title);
+      IPPFWriteStringReference(writer, &table, photo->caption);
+      IPPFWriteFloat(writer, photo->width);
+      IPPFWriteFloat(writer, photo->height);
+      IPPFWriteVarint(writer, photo->optimizedVersion);
+    }
+  }
+  IPPFStringTableFree(&table);
+  return writer->failed ? IPPFResultNoMemory : IPPFResultOK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+IPPFResult IPPFDecodePages(IPPFBlock block, IPPFArena *arena, IPPFPage **pages, uint32_t *countOfPages) {
+
+  *pages = NULL;
+  *countOfPages = 0;
+  if (block.length == 0) {
+    return IPPFResultOK;
+  }
+  IPPFReader reader = { block.bytes, block.bytes + block.length, IPPFResultOK };
+  uint32_t countOfStrings;
+  IPPFString *strings = IPPFReadStringTable(&reader, arena, &countOfStrings);
+  uint32_t count = IPPFReadCount(&reader, 1);
+  IPPFPage *decoded = IPPFArenaAllocate(arena, count, sizeof(IPPFPage));
+  if (decoded == NULL && count > 0) {
+    return IPPFResultNoMemory;
+  }
+  for (uint32_t i = 0; i < count && reader.result == IPPFResultOK; i++) {
+
+    IPPFPage *page = &decoded[i];
+    page->countOfPhotos = IPPFReadCount(&reader, kIPPFMinimumPhotoLength);
+    page->photos = IPPFArenaAllocate(arena, page->countOfPhotos, sizeof(IPPFPhoto));
+    if (page->photos == NULL && page->countOfPhotos > 0) {
+      return IPPFResultNoMemory;
+    }
+    for (uint32_t j = 0; j < page->countOfPhotos && reader.result == IPPFResultOK; j++) {
+
+      IPPFPhoto *photo = &page->photos[j];
+      photo->filename = IPPFReadStringReference(&reader, strings, countOfStrings);
+      photo->title = IPPFReadStringReference(&reader, strings, countOfStrings);
+      photo->caption = IPPFReadStringReference(&reader, strings, countOfStrings);
+      photo->width = IPPFReadFloat(&reader);
+      photo->height = IPPFReadFloat(&reader);
+      photo->optimizedVersion = IPPFReadVarint(&reader);
+    }
+  }
+  if (reader.result == IPPFResultOK && reader.cursor != reader.end) {
+    IPPFReaderFail(&reader, IPPFResultCorrupt);
+  }
+  if (reader.result != IPPFResultOK) {
+    return reader.result;
+  }
+  *pages = decoded;
+  *countOfPages = count;
+  return IPPFResultOK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Writes |pages| as a block: the byte count, then the pages. |scratch| is
+//  reused from block to block.
+//
+
+static IPPFResult IPPFWritePageBlock(IPPFWriter *writer, IPPFWriter *scratch, const IPPFPage *pages, uint32_t countOfPages) {
+
+  if (countOfPages == 0) {
+
+    IPPFWriteVarint(writer, 0);
+    return IPPFResultOK;
+  }
+  scratch->length = 0;
+  IPPFResult result = IPPFEncodePages(pages, countOfPages, scratch);
+  if (result != IPPFResultOK) {
+    return result;
+  }
+  IPPFWriteVarint(writer, scratch->length);
+  IPPFWriteBytes(writer, scratch->bytes, scratch->length);
+  return IPPFResultOK;
+}
+
+#pragma mark - Documents
+
+////////////////////////////////////////////////////////////////////////////////
+
+int IPPFIsPortfolio(const uint8_t *bytes, size_t length) {
+
+  return length >= sizeof(kIPPFMagic) && memcmp(bytes, kIPPFMagic, sizeof(kIPPFMagic)) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int IPPFCountOfColorComponents(IPPFColorSpace space) {
+
+  switch (space) {
+    case IPPFColorSpaceRGB:
+      return 4;
+
+    case IPPFColorSpaceWhite:
+      return 2;
+
+    default:
+      return 0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFWriteColor(IPPFWriter *writer, const IPPFColor *color) {
+
+  int countOfComponents = IPPFCountOfColorComponents(color->space);
+  IPPFWriteVarint(writer, (countOfComponents == 0) ? IPPFColorSpaceNone : color->space);
+  for (int i = 0; i < countOfComponents; i++) {
+    IPPFWriteFloat(writer, color->components[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPPFReadColor(IPPFReader *reader, IPPFColor *color) {
+
+  uint64_t space = IPPFReadVarint(reader);
+  if (space != IPPFColorSpaceNone && IPPFCountOfColorComponents((IPPFColorSpace)space) == 0) {
+
+    IPPFReaderFail(reader, IPPFResultCorrupt);
+    return;
+  }
+  color->space = (IPPFColorSpace)space;
+  int countOfComponents = IPPFCountOfColorComponents(color->space);
+  for (int i = 0; i < countOfComponents; i++) {
+    color->components[i] = IPPFReadFloat(reader);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+IPPFResult IPPFEncodePortfolio(const IPPFPortfolio *portfolio, IPPFWriter *writer) {
+
+  IPPFStringTable table;
+  if (!IPPFStringTableInit(&table, portfolio->countOfSets + 4)) {
+
+    IPPFStringTableFree(&table);
+    return IPPFResultNoMemory;
+  }
+  IPPFIntern(&table, portfolio->title);
+  IPPFIntern(&table, portfolio->backgroundImageName);
+  IPPFIntern(&table, portfolio->titleFont.name);
+  IPPFIntern(&table, portfolio->textFont.name);
+  for (uint32_t i = 0; i < portfolio->countOfSets; i++) {
+    IPPFIntern(&table, portfolio->sets[i].title);
+  }
+  if (table.failed) {
+
+    IPPFStringTableFree(&table);
+    return IPPFResultNoMemory;
+  }
+
+  IPPFWriteBytes(writer, kIPPFMagic, sizeof(kIPPFMagic));
+  IPPFWriteVarint(writer, kIPPFSchemaVersion);
+  IPPFWriteVarint(writer, ((uint64_t)portfolio->version << 1) ^ (uint64_t)(portfolio->version >> 63));
+  IPPFWriteVarint(writer, portfolio->imageOptimizationVersion);
+  IPPFWriteVarint(writer, portfolio->layoutStyle);
+  IPPFWriteStringTable(writer, &table);
+  IPPFWriteStringReference(writer, &table, portfolio->title);
+  IPPFWriteStringReference(writer, &table, portfolio->backgroundImageName);
+  IPPFWriteColor(writer, &portfolio->navigationColor);
+  IPPFWriteColor(writer, &portfolio->fontColor);
+  IPPFWriteStringReference(writer, &table, portfolio->titleFont.name);
+  IPPFWriteFloat(writer, portfolio->titleFont.size);
+  IPPFWriteStringReference(writer, &table, portfolio->textFont.name);
+  IPPFWriteFloat(writer, portfolio->textFont.size);
+
+  IPPFWriter scratch = { NULL, 0, 0, 0 };
+  IPPFResult result = IPPFResultOK;
+  IPPFWriteVarint(writer, portfolio->countOfSets);
+  for (uint32_t i = 0; i < portfolio->countOfSets && result == IPPFResultOK; i++) {
+
+    const IPPFSet *set = &portfolio->sets[i];
+    IPPFWriteStringReference(writer, &table, set->title);
+    IPPFWriteVarint(writer, (uint64_t)set->countOfPages + set->countOfUnloadedPages);
+    if (set->unloadedPages.bytes != NULL) {
+
+      //
+      //  Pages that were never decoded go back out as they came in.
+      //
+
+      result = IPPFWritePageBlock(writer, &scratch, set->pages, set->countOfPages);
+      IPPFWriteVarint(writer, set->unloadedPages.length);
+      IPPFWriteBytes(writer, set->unloadedPages.bytes, set->unloadedPages.length);
+
+    } else {
+
+      uint32_t countOfLoadedPages = set->countOfPages < kIPPFLoadedPageCount ? set->countOfPages : kIPPFLoadedPageCount;
+      result = IPPFWritePageBlock(writer, &scratch, set->pages, countOfLoadedPages);
+      if (result == IPPFResultOK) {
+
+        result = IPPFWritePageBlock(writer,
+                                    &scratch,
+                                    set->pages + countOfLoadedPages,
+                                    set->countOfPages - countOfLoadedPages);
+      }
+    }
+  }
+  free(scratch.bytes);
+  IPPFStringTableFree(&table);
+  if (result == IPPFResultOK && (writer->failed || scratch.failed)) {
+    result = IPPFResultNoMemory;
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+IPPFResult IPPFDecodePortfolio(const uint8_t *bytes, size_t length, IPPFArena *arena, IPPFPortfolio *portfolio) {
+
+  memset(portfolio, 0, sizeof(*portfolio));
+  if (!IPPFIsPortfolio(bytes, length)) {
+    return IPPFResultNotPortfolio;
+  }
+  IPPFReader reader = { bytes + sizeof(kIPPFMagic), bytes + length, IPPFResultOK };
+  uint64_t schemaVersion = IPPFReadVarint(&reader);
+  if (reader.result != IPPFResultOK) {
+    return reader.result;
+  }
+  if (schemaVersion == 0 || schemaVersion > kIPPFSchemaVersion) {
+    return IPPFResultUnknownSchema;
+  }
+  uint64_t zigzag = IPPFReadVarint(&reader);
+  portfolio->version = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+  portfolio->imageOptimizationVersion = IPPFReadVarint(&reader);
+  portfolio->layoutStyle = IPPFReadVarint(&reader);
+  uint32_t countOfStrings;
+  IPPFString *strings = IPPFReadStringTable(&reader, arena, &countOfStrings);
+  portfolio->title = IPPFReadStringReference(&reader, strings, countOfStrings);
+  portfolio->backgroundImageName = IPPFReadStringReference(&reader, strings, countOfStrings);
+  IPPFReadColor(&reader, &portfolio->navigationColor);
+  IPPFReadColor(&reader, &portfolio->fontColor);
+  portfolio->titleFont.name = IPPFReadStringReference(&reader, strings, countOfStrings);
+  portfolio->titleFont.size = IPPFReadFloat(&reader);
+  portfolio->textFont.name = IPPFReadStringReference(&reader, strings, countOfStrings);
+  portfolio->textFont.size = IPPFReadFloat(&reader);
+
+  //
+  //  A set is at least a title, a page count and two empty blocks.
+  //
+
+  uint32_t countOfSets = IPPFReadCount(&reader, 4);
+  IPPFSet *sets = IPPFArenaAllocate(arena, countOfSets, sizeof(IPPFSet));
+  if (sets == NULL && countOfSets > 0) {
+    return IPPFResultNoMemory;
+  }
+  for (uint32_t i = 0; i < countOfSets && reader.result == IPPFResultOK; i++) {
+
+    IPPFSet *set = &sets[i];
+    set->title = IPPFReadStringReference(&reader, strings, countOfStrings);
+    uint64_t countOfPages = IPPFReadVarint(&reader);
+    IPPFBlock loadedPages = IPPFReadBlock(&reader);
+    set->unloadedPages = IPPFReadBlock(&reader);
+    if (reader.result != IPPFResultOK) {
+      break;
+    }
+    IPPFResult result = IPPFDecodePages(loadedPages, arena, &set->pages, &set->countOfPages);
+    if (result != IPPFResultOK) {
+      return result;
+    }
+    if (countOfPages < set->countOfPages || countOfPages - set->countOfPages > UINT32_MAX) {
+      return IPPFResultCorrupt;
+    }
+    set->countOfUnloadedPages = (uint32_t)(countOfPages - set->countOfPages);
+    if (set->unloadedPages.length == 0) {
+
+      set->unloadedPages.bytes = NULL;
+      if (set->countOfUnloadedPages != 0) {
+        return IPPFResultCorrupt;
+      }
+    }
+  }
+  if (reader.result == IPPFResultOK && reader.cursor != reader.end) {
+    IPPFReaderFail(&reader, IPPFResultCorrupt);
+  }
+  if (reader.result != IPPFResultOK) {
+    return reader.result;
+  }
+  portfolio->sets = sets;
+  portfolio->countOfSets = countOfSets;
+  return IPPFResultOK;
+}
@@ -0,0 +1,223 @@
+//
+//  IPPortfolioFormat.h
+//  ipad-portfolio
+//
+//  The compact binary portfolio format, in plain C so it can be built and
+//  benchmarked anywhere (see Tools/portfolio-format-benchmark.c).
+//  IPPortfolioCoder turns model objects into these structures and back.
+//
+//  Layout. Integers are LEB128 varints; the portfolio version is zigzag
+//  encoded; floats are 32-bit little-endian.
+//
+//    document      "IPPF" schemaVersion version imageOptimizationVersion
+//                  layoutStyle strings title backgroundImageName
+//                  navigationColor fontColor titleFont textFont
+//                  countOfSets set*
+//    set           title countOfPages block(loaded pages) block(the rest)
+//    block         byteCount pages, or just 0 for no pages
+//    pages         strings countOfPages page*
+//    page          countOfPhotos photo*
+//    photo         filename title caption width height optimizedVersion
+//    strings       countOfStrings (byteCount utf8)*
+//    color         0 | 1 red green blue alpha | 2 white alpha
+//    font          name size
+//
+//  Every string is written once per string table and referred to by its
+//  1-based index; 0 is nil. Photo file names are relative to the documents
+//  directory. The portfolio has a string table for its own strings and set
+//  titles; each block of pages has one of its own, so a block can be
+//  decoded, or copied into a new document, without anything else.
+//
+//  Only the first |kIPPFLoadedPageCount| pages of a set go in its first
+//  block. Decoding a document leaves the second block encoded, for the set
+//  to decode when it's needed.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef IPPortfolioFormat_h
+#define IPPortfolioFormat_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define kIPPFSchemaVersion        1
+#define kIPPFLoadedPageCount      5
+
+//
+//  Results.
+//
+
+typedef enum {
+  IPPFResultOK = 0,
+  IPPFResultNotPortfolio,         // Doesn't start with the magic number
+  IPPFResultUnknownSchema,        // Written by a newer version
+  IPPFResultTruncated,
+  IPPFResultCorrupt,
+  IPPFResultNoMemory
+} IPPFResult;
+
+//
+//  A string that isn't necessarily NUL-terminated. |bytes| is NULL for nil.
+//  Decoded strings point into the buffer they were decoded from.
+//
+
+typedef struct {
+  const char *bytes;
+  uint32_t length;
+} IPPFString;
+
+typedef struct {
+  IPPFString filename;
+  IPPFString title;
+  IPPFString caption;
+  float width;
+  float height;
+  uint64_t optimizedVersion;
+} IPPFPhoto;
+
+typedef struct {
+  IPPFPhoto *photos;
+  uint32_t countOfPhotos;
+} IPPFPage;
+
+//
+//  Encoded pages: a block, as found in a document.
+//
+
+typedef struct {
+  const uint8_t *bytes;
+  size_t length;
+} IPPFBlock;
+
+//
+//  A set. |pages| holds the pages that are decoded. Pages that aren't are
+//  in |unloadedPages|, |countOfUnloadedPages| of them.
+//
+//  When encoding a set with no |unloadedPages|, everything past the first
+//  |kIPPFLoadedPageCount| of |pages| goes into the second block. Otherwise
+//  all of |pages| goes into the first, and |unloadedPages| is copied as is.
+//
+
+typedef struct {
+  IPPFString title;
+  IPPFPage *pages;
+  uint32_t countOfPages;
+  IPPFBlock unloadedPages;
+  uint32_t countOfUnloadedPages;
+} IPPFSet;
+
+//
+//  A color: none, red green blue alpha, or white alpha.
+//
+
+typedef enum {
+  IPPFColorSpaceNone = 0,
+  IPPFColorSpaceRGB = 1,
+  IPPFColorSpaceWhite = 2
+} IPPFColorSpace;
+
+typedef struct {
+  IPPFColorSpace space;
+  float components[4];
+} IPPFColor;
+
+typedef struct {
+  IPPFString name;
+  float size;
+} IPPFFont;
+
+typedef struct {
+  int64_t version;
+  uint64_t imageOptimizationVersion;
+  uint64_t layoutStyle;
+  IPPFString title;
+  IPPFString backgroundImageName;
+  IPPFColor navigationColor;
+  IPPFColor fontColor;
+  IPPFFont titleFont;
+  IPPFFont textFont;
+  IPPFSet *sets;
+  uint32_t countOfSets;
+} IPPFPortfolio;
+
+//
+//  Growable output buffer. Start zeroed; free |bytes| when done.
+//
+
+typedef struct {
+  uint8_t *bytes;
+  size_t length;
+  size_t capacity;
+  int failed;
+} IPPFWriter;
+
+//
+//  Where decoded structures get allocated. Start zeroed; everything goes
+//  away with |IPPFArenaFree|.
+//
+
+typedef struct IPPFArenaChunk IPPFArenaChunk;
+typedef struct {
+  IPPFArenaChunk *chunks;
+} IPPFArena;
+
+//
+//  Zeroed memory for |count| things of |size| bytes, which lives as long as
+//  |arena|. NULL if out of memory.
+//
+
+void *IPPFArenaAllocate(IPPFArena *arena, size_t count, size_t size);
+void IPPFArenaFree(IPPFArena *arena);
+
+//
+//  Is |bytes| (at least the start of it) a document in this format?
+//
+
+int IPPFIsPortfolio(const uint8_t *bytes, size_t length);
+
+//
+//  Appends |portfolio|, as a document, to |writer|.
+//
+
+IPPFResult IPPFEncodePortfolio(const IPPFPortfolio *portfolio, IPPFWriter *writer);
+
+//
+//  Decodes a document. Strings and unloaded pages in |portfolio| point into
+//  |bytes|; everything else is in |arena|.
+//
+
+IPPFResult IPPFDecodePortfolio(const uint8_t *bytes, size_t length, IPPFArena *arena, IPPFPortfolio *portfolio);
+
+//
+//  Appends |countOfPages| pages to |writer| as the contents of a block,
+//  without the leading byte count.
+//
+
+IPPFResult IPPFEncodePages(const IPPFPage *pages, uint32_t countOfPages, IPPFWriter *writer);
+
+//
+//  Decodes the contents of a block.
+//
+
+IPPFResult IPPFDecodePages(IPPFBlock block, IPPFArena *arena, IPPFPage **pages, uint32_t *countOfPages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
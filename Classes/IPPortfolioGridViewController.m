@@ -30,11 +30,12 @@
 #import "IPPortfolio.h"
 #import "IPPortfolioGridViewController.h"
 #import "IPSetGridViewController.h"
+#import "IPSetCompositor.h"
 #import "IPSetPagingViewController.h"
+#import "IPThumbnailFetcher.h"
 #import "IPTutorialManager.h"
 #import "IPUserDefaults.h"
 #import "NSString+TestHelper.h"
-#import "UIImage+Border.h"
 #import "UIImage+Resize.h"
 
 static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier";
@@ -58,84 +59,100 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 
 @end
 
-@implementation IPSetCell
-
-////////////////////////////////////////////////////////////////////////////////
-//
-//  Gets the composite image for the set -- a stack of the first five images of
-//  the set.
-//
-
-- (UIImage *)compositeImage {
+@implementation IPSetCell {
   
   //
-  //  Bail out if there's nothing to composite.
+  //  The composite |image| shows or is about to show, and the size it was
+  //  picked for.
   //
   
-  if ([self.currentSet countOfPages] == 0) {
-    
-    return [UIImage imageNamed:@"Portfolio-72.png"];
-  }
-  
-  UIView *compositeView = [[UIView alloc] initWithFrame:self.bounds];
+  NSString *_compositeKey;
+  CGSize _thumbnailSize;
   
   //
-  //  Build a thumbnail from 5 images.
+  //  Makes the composite or decodes the tile image in the background.
+  //  Cancelled when the cell moves on to something else.
   //
   
-  for (int i = 0; i < 5; i++) {
+  NSOperation *_thumbnailOperation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The photos on top of the stack: the first photo of each of the first
+//  pages.
+//
+
+- (NSArray *)stackPhotos {
+  
+  NSMutableArray *photos = [NSMutableArray arrayWithCapacity:kIPSetCompositeMaxPhotos];
+  for (NSUInteger i = 0; i < kIPSetCompositeMaxPhotos && i < [self.currentSet countOfPages]; i++) {
     
-    if (i >= [self.currentSet countOfPages]) {
-      break;
-    }
-    @autoreleasepool {
-      IPPage *page = [self.currentSet objectInPagesAtIndex:i];
-      IPPhoto *photo = [page objectInPhotosAtIndex:0];
-      UIImage *bordered = [photo.thumbnail imageWithBorderWidth:10.0 andColor:[[UIColor whiteColor] CGColor]];
-      bordered = [bordered imageWithBorderWidth:1.0 andColor:[[UIColor lightGrayColor] CGColor]];
-      UIImageView *photoView = [[UIImageView alloc] initWithImage:bordered];
-      CGAffineTransform transform = CGAffineTransformMakeRotation(i * 0.15);
-      CGRect postTransformViewSize = CGRectApplyAffineTransform(photoView.frame, transform);
-      CGFloat heightScale = compositeView.bounds.size.height / postTransformViewSize.size.height;
-      CGFloat widthScale  = compositeView.bounds.size.width  / postTransformViewSize.size.width;
-      CGFloat finalScale = MIN(heightScale, widthScale);
-      transform = CGAffineTransformScale(transform, finalScale, finalScale);
-      photoView.center = compositeView.center;
-      photoView.transform = transform;
-      photoView.contentMode = UIViewContentModeScaleAspectFit;
-      [compositeView addSubview:photoView];
-      [compositeView sendSubviewToBack:photoView];
+    IPPhoto *photo = [[self.currentSet objectInPagesAtIndex:i] objectInPhotosAtIndex:0];
+    if (photo != nil) {
+      
+      [photos addObject:photo];
     }
   }
-  
-  UIGraphicsBeginImageContextWithOptions(compositeView.frame.size, NO, 0);
-  [compositeView.layer renderInContext:UIGraphicsGetCurrentContext()];
-  UIImage *compositeImage = UIGraphicsGetImageFromCurrentImageContext();
-  UIGraphicsEndImageContext();
+  return photos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
 
-  return compositeImage;
+- (void)dealloc {
+  
+  [_thumbnailOperation cancel];
+  self.currentSet = nil;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Does the compositing on a background thread, then calls a completion
-//  routine with the composite image on the main thread.
+//  Shows the composite for the set -- a stack of the first five images of
+//  the set. It comes from the compositor's cache if it can; otherwise it
+//  gets made in the background and swapped in, unless the cell has moved on
+//  to something else by then.
 //
 
-- (void)compositeAsyncWithCompletion:(void(^)(UIImage *compositeImage))completion {
+- (void)updateComposite {
   
-  completion = [completion copy];
-  
-  //
-  //  ACK! Note that UIGraphicsBeginImageContextWithOptions must be called
-  //  on the main thread. Compositing uses this function. Ergo, we'll do the
-  //  operation async but we'll do it on the main queue.
-  //
+  NSArray *photos = [self stackPhotos];
+  if ([photos count] == 0) {
+    
+    [_thumbnailOperation cancel];
+    _thumbnailOperation = nil;
+    _compositeKey = nil;
+    self.image = [UIImage imageNamed:@"Portfolio-72.png"];
+    return;
+  }
   
-  [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
-    UIImage *composite = [self compositeImage];
-    completion(composite);
-  }];
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  IPSetCompositor *compositor = [IPSetCompositor sharedCompositor];
+  NSString *key = [IPSetCompositor keyForPhotos:photos size:self.bounds.size scale:scale];
+  if ([key isEqualToString:_compositeKey]) {
+    
+    return;
+  }
+  _compositeKey = key;
+  [_thumbnailOperation cancel];
+  _thumbnailOperation = nil;
+  UIImage *composite = [compositor cachedCompositeForKey:key];
+  if (composite != nil) {
+    
+    self.image = composite;
+    return;
+  }
+  __weak IPSetCell *weakSelf = self;
+  _thumbnailOperation = [compositor compositeOfPhotos:photos 
+                                                 size:self.bounds.size 
+                                                scale:scale 
+                                           completion:^(UIImage *composite) {
+                                             
+                                             IPSetCell *strongSelf = weakSelf;
+                                             if ([key isEqualToString:strongSelf->_compositeKey]) {
+                                               
+                                               strongSelf.image = composite;
+                                             }
+                                           }];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -145,34 +162,32 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 
 - (void)updateThumbnail {
   
-  IPPage *page;
-  if ([self.currentSet countOfPages] > 0) {
-    
-    page = [self.currentSet objectInPagesAtIndex:0];
-    
-  } else {
-    
-    page = nil;
-  }
-  IPPhoto *photo = [page objectInPhotosAtIndex:0];
-  
+  _thumbnailSize = self.bounds.size;
   switch (self.style) {
     case BDGridCellStyleDefault: {
-      [self compositeAsyncWithCompletion:^(UIImage *compositeImage) {
-        self.image = compositeImage;
-      }];
+      [self updateComposite];
       break;
     }
       
     case BDGridCellStyleTile: {
-      if (self.frame.size.width <= kThumbnailSize) {
-        
-        self.image = photo.thumbnail;
-        
-      } else {
+      _compositeKey = nil;
+      [_thumbnailOperation cancel];
+      _thumbnailOperation = nil;
+      IPPhoto *photo = nil;
+      if ([self.currentSet countOfPages] > 0) {
         
-        self.image = photo.image;
+        photo = [[self.currentSet objectInPagesAtIndex:0] objectInPhotosAtIndex:0];
       }
+      CGFloat scale = [[UIScreen mainScreen] scale];
+      CGSize pixelSize = CGSizeMake(self.frame.size.width * scale, self.frame.size.height * scale);
+      self.image = nil;
+      __weak IPSetCell *weakSelf = self;
+      _thumbnailOperation = [[IPThumbnailFetcher sharedFetcher] fetchImageOfPhoto:photo 
+                                                               decodedToPixelSize:pixelSize 
+                                                                       completion:^(UIImage *image) {
+                                                                         
+                                                                         weakSelf.image = image;
+                                                                       }];
       break;
     }
   }
@@ -180,14 +195,34 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  Looks at the size of the image and the size of the cell to determine if
-//  we should update the thumbnail.
+//  A new size (e.g., after a style change) needs a thumbnail made for it.
+//  Redraws don't.
 //
 
-- (void)drawRect:(CGRect)rect {
+- (void)layoutSubviews {
   
-  [self updateThumbnail];
-  [super drawRect:rect];
+  [super layoutSubviews];
+  if (self.currentSet != nil && !CGSizeEqualToSize(self.bounds.size, _thumbnailSize)) {
+    
+    [self updateThumbnail];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The photos this cell shows are on screen. If any are still waiting on a
+//  background upgrade, move them to the front.
+//
+
+- (void)promoteVisiblePhotos {
+  
+  IPPhotoOptimizationManager *optimizationManager = [IPPhotoOptimizationManager sharedManager];
+  for (int i = 0; i < 5 && i < [self.currentSet countOfPages]; i++) {
+    
+    IPPage *page = [self.currentSet objectInPagesAtIndex:i];
+    [optimizationManager promotePhoto:[page objectInPhotosAtIndex:0] 
+                               toLane:IPOptimizationLaneInteractive];
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -215,6 +250,7 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
     //  queues up work on another thread, and |self| will no longer be valid.
     //
     
+    [self promoteVisiblePhotos];
     [self updateThumbnail];
     
     self.caption = _currentSet.title;
@@ -230,7 +266,16 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 
 - (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context {
   
-  [self updateThumbnail];
+  if ([keyPath isEqualToString:kIPSetThumbnailFilename]) {
+    
+    //
+    //  The same key may now stand for a stack that's no longer missing
+    //  photos; look again.
+    //
+    
+    _compositeKey = nil;
+    [self updateThumbnail];
+  }
   self.caption = self.currentSet.title;
 }
 
@@ -259,6 +304,7 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 
 - (void)dealloc {
 
+  [[NSNotificationCenter defaultCenter] removeObserver:self name:IPPortfolioChanged object:nil];
   [self _stopObservingPortfolio:self.portfolio];
 }
 
@@ -299,6 +345,10 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
   [_gridView addGestureRecognizer:swipeUp];
   
   [self.view addSubview:_gridView];
+  [[NSNotificationCenter defaultCenter] addObserver:self
+                                           selector:@selector(portfolioChanged:)
+                                               name:IPPortfolioChanged
+                                             object:nil];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -532,6 +582,19 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The portfolio changed without going through us (it dropped photos whose
+//  files are gone). Set thumbnails may have changed with it.
+//
+
+- (void)portfolioChanged:(NSNotification *)notification {
+  
+  if (notification.object == self.portfolio) {
+    [self.gridView reloadData];
+  }
+}
+
 #pragma mark - Actions
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -550,24 +613,26 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
     if (foundSet != nil) {
       
       NSUInteger insertionIndex = [self.portfolio countOfSets];
-      __block NSUInteger currentIndex = 0;
       IPSet *optimizedSet = [[IPSet alloc] init];
       optimizedSet.title = foundSet.title;
       [self.portfolio insertObject:optimizedSet inSetsAtIndex:insertionIndex];
+      [self.portfolio saveInsertionAtIndex:insertionIndex 
+                                  inObject:self.portfolio 
+                                    toPath:[IPPortfolio defaultPortfolioPath]];
       NSIndexPath *indexPath = [NSIndexPath indexPathForItem:insertionIndex inSection:0];
       [self.gridView insertItemsAtIndexPaths:@[indexPath]];
       IPSetCell *cell = (IPSetCell *)[self.gridView cellForItemAtIndexPath:indexPath];
 
-      for (IPPage *page in foundSet.pages) {
+      [[IPPhotoOptimizationManager sharedManager] asyncOptimizePages:foundSet.pages 
+                                                              inLane:IPOptimizationLaneImport 
+                                                       withInsertion:^(IPPage *page, NSUInteger offset) {
         
-        [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page withCompletion:^(void) {
-          
-          [optimizedSet insertObject:page inPagesAtIndex:currentIndex];
-          [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-          [cell updateThumbnail];
-          currentIndex++;
-        }];
-      }
+        [optimizedSet insertObject:page inPagesAtIndex:offset];
+        [self.portfolio saveInsertionAtIndex:offset 
+                                    inObject:optimizedSet 
+                                      toPath:[IPPortfolio defaultPortfolioPath]];
+        [cell updateThumbnail];
+      }];
     }
   }];
 }
@@ -697,6 +762,25 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
   return CGSizeMake(cellWidth, 200);
 }
 
+#pragma mark - UIScrollViewDelegate
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidEndDragging:(UIScrollView *)scrollView willDecelerate:(BOOL)decelerate {
+  
+  if (!decelerate) {
+    
+    [[IPThumbnailFetcher sharedFetcher] endScroll];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidEndDecelerating:(UIScrollView *)scrollView {
+  
+  [[IPThumbnailFetcher sharedFetcher] endScroll];
+}
+
 #pragma mark -
 #pragma mark BDGridViewDelegate
 
@@ -748,7 +832,7 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
       photo.filename = filename;
       photo.title = [asset title];
       
-      [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo withCompletion:^(void) {
+      [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo inLane:IPOptimizationLaneImport withCompletion:^(void) {
         
         IPPage *page = [IPPage pageWithPhoto:photo];
         [workersDone lock];
@@ -811,7 +895,7 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
     [set deletePhotoFiles];
     [[UIPasteboard generalPasteboard] setData:data forPasteboardType:kIPPasteboardObjectUTI];
     [self.portfolio removeObjectFromSetsAtIndex:index];
-    [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+    [self.portfolio saveRemovalAtIndex:index inObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
     NSIndexPath *indexPath = [NSIndexPath indexPathForItem:index inSection:0];
     [collectionView performBatchUpdates:^{
       [collectionView deleteItemsAtIndexPaths:@[indexPath]];
@@ -873,25 +957,27 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
     //
     
     [self.portfolio insertObject:optimizedSet inSetsAtIndex:insertionPoint];
-    [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+    [self.portfolio saveInsertionAtIndex:insertionPoint 
+                                inObject:self.portfolio 
+                                  toPath:[IPPortfolio defaultPortfolioPath]];
     [collectionView performBatchUpdates:^{
       [collectionView insertItemsAtIndexPaths:@[indexPath]];
     } completion:nil];
     
     //
     //  Optimize each page from the unoptimized set and stick it in the
-    //  optimized set.
+    //  optimized set, in the order it had on the pasteboard.
     //
     
-    __block NSUInteger currentSetIndex = 0;
-    for (IPPage *page in unoptimizedSet.pages) {
+    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePages:unoptimizedSet.pages 
+                                                            inLane:IPOptimizationLaneImport 
+                                                     withInsertion:^(IPPage *page, NSUInteger offset) {
       
-      [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page withCompletion:^(void) {
-        
-        [optimizedSet insertObject:page inPagesAtIndex:currentSetIndex];
-        currentSetIndex++;
-      }];
-    }
+      [optimizedSet insertObject:page inPagesAtIndex:offset];
+      [self.portfolio saveInsertionAtIndex:offset 
+                                  inObject:optimizedSet 
+                                    toPath:[IPPortfolio defaultPortfolioPath]];
+    }];
   }
 }
 
@@ -905,7 +991,7 @@ static NSString * const IPPortfolioCellIdentifier = @"IPPortfolioCellIdentifier"
 - (void)textFieldDidEndEditing:(UITextField *)textField {
   
   self.portfolio.title = textField.text;
-  [self.portfolio savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.portfolio saveValueForKey:kIPPortfolioTitle ofObject:self.portfolio toPath:[IPPortfolio defaultPortfolioPath]];
   if ([self.tutorialManager updateTutorialStateForEvent:IPTutorialManagerEventEditTitle]) {
     
     self.overlayController = [self overlayControllerForCurrentState];
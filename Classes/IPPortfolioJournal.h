@@ -0,0 +1,104 @@
+//
+//  IPPortfolioJournal.h
+//  ipad-portfolio
+//
+//  An append-only log of changes made to a portfolio since its snapshot was
+//  last written. Renaming a caption or moving a page costs one small record
+//  at the end of the journal instead of a rewrite of the whole archive. When
+//  the portfolio is loaded, the journal gets replayed on top of the snapshot;
+//  when the snapshot is rewritten, the journal starts over.
+//
+//  Model objects are found by their position in the hierarchy (set, page,
+//  photo), so records have to be replayed in order onto exactly the snapshot
+//  they were written against. The journal header records that snapshot's
+//  version, and a journal for any other version is ignored.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+//
+//  Past either of these, it's time to fold the journal into a new snapshot.
+//
+
+#define kIPPortfolioJournalCompactionCount    (500)
+#define kIPPortfolioJournalCompactionBytes    (512 * 1024)
+
+@class IPPortfolio;
+
+@interface IPPortfolioJournal : NSObject
+
+//
+//  Where the journal lives.
+//
+
+@property (nonatomic, readonly, copy) NSString *path;
+
+//
+//  Records in the journal, and its size on disk.
+//
+
+@property (nonatomic, readonly) NSUInteger countOfEntries;
+@property (nonatomic, readonly) unsigned long long byteCount;
+
+//
+//  The journal that goes with the snapshot at |portfolioPath|.
+//
+
++ (NSString *)journalPathForPortfolioPath:(NSString *)portfolioPath;
+
+- (id)initWithPath:(NSString *)path;
+
+//
+//  Applies the journal on disk to |portfolio|, which has just been loaded
+//  from its snapshot. Does nothing if the journal was written against a
+//  different snapshot. Stops at a record torn by a crash, or at one that
+//  doesn't fit the model. Returns the number of records applied.
+//
+
+- (NSUInteger)replayOntoPortfolio:(IPPortfolio *)portfolio;
+
+//
+//  Can changes to the portfolio with snapshot |version| be appended? Only
+//  after a replay onto that snapshot or a reset for it.
+//
+
+- (BOOL)extendsPortfolioVersion:(NSInteger)version;
+
+//
+//  A new snapshot with |version| has been written; empty the journal.
+//
+
+- (void)resetForPortfolioVersion:(NSInteger)version;
+
+//
+//  The model has changed in a way the journal didn't record. Until the next
+//  reset, nothing more can be appended.
+//
+
+- (void)invalidate;
+
+//
+//  Each of these appends one record, after the change has been made to the
+//  model. |object| and |container| are the portfolio or one of the sets,
+//  pages or photos in it. They return NO, and append nothing, if the object
+//  can't be found in its portfolio; the caller should write a snapshot.
+//
+
+- (BOOL)appendValueForKey:(NSString *)key ofObject:(id)object;
+- (BOOL)appendInsertionAtIndex:(NSUInteger)index inObject:(id)container;
+- (BOOL)appendRemovalAtIndex:(NSUInteger)index inObject:(id)container;
+- (BOOL)appendMoveFromIndex:(NSUInteger)fromIndex toIndex:(NSUInteger)toIndex inObject:(id)container;
+
+@end
@@ -0,0 +1,509 @@
+//
+//  IPPortfolioJournal.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPPortfolioJournal.h"
+#import "IPPortfolio.h"
+
+//
+//  The journal starts with a four byte tag and the version of the snapshot
+//  it extends (little-endian, 64 bits). Each record after that is a 32-bit
+//  little-endian length followed by a binary property list. A record only
+//  counts once all of it is on disk, so a write torn by a crash just looks
+//  like a change that never happened.
+//
+
+#define kIPPortfolioJournalTag              "IPJ1"
+#define kIPPortfolioJournalTagLength        (4)
+#define kIPPortfolioJournalHeaderLength     (kIPPortfolioJournalTagLength + sizeof(int64_t))
+
+//
+//  Keys in each record. Short, because there are a lot of records.
+//
+
+#define kIPPortfolioJournalOperation        @"op"
+#define kIPPortfolioJournalIndexPath        @"at"
+#define kIPPortfolioJournalKey              @"key"
+#define kIPPortfolioJournalValue            @"value"
+#define kIPPortfolioJournalToIndex          @"to"
+
+typedef enum {
+  IPPortfolioJournalOperationValue,
+  IPPortfolioJournalOperationInsertion,
+  IPPortfolioJournalOperationRemoval,
+  IPPortfolioJournalOperationMove
+} IPPortfolioJournalOperation;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The sets, pages or photos directly under |object|, or nil if it's a
+//  photo (or not a model object at all).
+//
+
+static NSArray *IPChildrenOfModelObject(id object) {
+  
+  if ([object isKindOfClass:[IPPortfolio class]]) {
+    
+    return [(IPPortfolio *)object sets];
+  }
+  if ([object isKindOfClass:[IPSet class]]) {
+    
+    return [(IPSet *)object pages];
+  }
+  if ([object isKindOfClass:[IPPage class]]) {
+    
+    return [(IPPage *)object photos];
+  }
+  return nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static id IPParentOfModelObject(id object) {
+  
+  if ([object isKindOfClass:[IPSet class]]) {
+    
+    return [(IPSet *)object parent];
+  }
+  if ([object isKindOfClass:[IPPage class]]) {
+    
+    return [(IPPage *)object parent];
+  }
+  if ([object isKindOfClass:[IPPhoto class]]) {
+    
+    return [(IPPhoto *)object parent];
+  }
+  return nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Inserts and removes through the KVC accessors, so parent pointers get
+//  maintained the same way they are for edits made in the UI.
+//
+
+static void IPInsertChild(id container, id child, NSUInteger index) {
+  
+  if ([container isKindOfClass:[IPPortfolio class]]) {
+    
+    [(IPPortfolio *)container insertObject:child inSetsAtIndex:index];
+    
+  } else if ([container isKindOfClass:[IPSet class]]) {
+    
+    [(IPSet *)container insertObject:child inPagesAtIndex:index];
+    
+  } else {
+    
+    [(IPPage *)container insertObject:child inPhotosAtIndex:index];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPRemoveChild(id container, NSUInteger index) {
+  
+  if ([container isKindOfClass:[IPPortfolio class]]) {
+    
+    [(IPPortfolio *)container removeObjectFromSetsAtIndex:index];
+    
+  } else if ([container isKindOfClass:[IPSet class]]) {
+    
+    [(IPSet *)container removeObjectFromPagesAtIndex:index];
+    
+  } else {
+    
+    [(IPPage *)container removeObjectFromPhotosAtIndex:index];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPPortfolioJournal ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+@property (nonatomic, readwrite) NSUInteger countOfEntries;
+@property (nonatomic, readwrite) unsigned long long byteCount;
+@property (nonatomic, strong) NSFileHandle *fileHandle;
+
+//
+//  The snapshot the journal on disk extends, and whether appending to it
+//  is currently allowed.
+//
+
+@property (nonatomic, assign) NSInteger portfolioVersion;
+@property (nonatomic, assign, getter = isOpen) BOOL open;
+
+@end
+
+@implementation IPPortfolioJournal
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSString *)journalPathForPortfolioPath:(NSString *)portfolioPath {
+  
+  return [portfolioPath stringByAppendingPathExtension:@"journal"];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithPath:(NSString *)path {
+  
+  self = [super init];
+  if (self != nil) {
+    
+    _path = [path copy];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+  
+  [_fileHandle closeFile];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Lazily opens the journal for appending.
+//
+
+- (NSFileHandle *)fileHandle {
+  
+  if (_fileHandle == nil) {
+    
+    _fileHandle = [NSFileHandle fileHandleForWritingAtPath:self.path];
+    [_fileHandle seekToEndOfFile];
+  }
+  return _fileHandle;
+}
+
+#pragma mark - Finding model objects
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Where |object| sits under its portfolio: empty for the portfolio itself,
+//  then set, page and photo indexes. Nil if it isn't attached to one.
+//
+
+- (NSArray *)indexPathOfObject:(id)object {
+  
+  NSMutableArray *indexPath = [NSMutableArray arrayWithCapacity:3];
+  id current = object;
+  while (![current isKindOfClass:[IPPortfolio class]]) {
+    
+    id parent = IPParentOfModelObject(current);
+    NSUInteger index = [IPChildrenOfModelObject(parent) indexOfObjectIdenticalTo:current];
+    if (parent == nil || index == NSNotFound) {
+      
+      return nil;
+    }
+    [indexPath insertObject:@(index) atIndex:0];
+    current = parent;
+  }
+  return indexPath;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)objectAtIndexPath:(NSArray *)indexPath inPortfolio:(IPPortfolio *)portfolio {
+  
+  id object = portfolio;
+  for (NSNumber *index in indexPath) {
+    
+    NSArray *children = IPChildrenOfModelObject(object);
+    if ([index unsignedIntegerValue] >= [children count]) {
+      
+      return nil;
+    }
+    object = children[[index unsignedIntegerValue]];
+  }
+  return object;
+}
+
+#pragma mark - Replaying
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Makes the change described by |record|. Returns NO if it doesn't fit the
+//  model, which means the journal and the snapshot have come apart.
+//
+
+- (BOOL)applyRecord:(NSDictionary *)record toPortfolio:(IPPortfolio *)portfolio {
+  
+  IPPortfolioJournalOperation operation = [record[kIPPortfolioJournalOperation] integerValue];
+  NSArray *indexPath = record[kIPPortfolioJournalIndexPath];
+  NSData *valueData = record[kIPPortfolioJournalValue];
+  id value = nil;
+  if ([valueData length] > 0) {
+    
+    value = [NSKeyedUnarchiver unarchiveObjectWithData:valueData];
+  }
+  if (operation == IPPortfolioJournalOperationValue) {
+    
+    id object = [self objectAtIndexPath:indexPath inPortfolio:portfolio];
+    NSString *key = record[kIPPortfolioJournalKey];
+    if (object == nil || [key length] == 0) {
+      
+      return NO;
+    }
+    [object setValue:value forKey:key];
+    return YES;
+  }
+  
+  //
+  //  Everything else names a container and an index within it.
+  //
+  
+  if ([indexPath count] == 0) {
+    
+    return NO;
+  }
+  id container = [self objectAtIndexPath:[indexPath subarrayWithRange:NSMakeRange(0, [indexPath count] - 1)]
+                             inPortfolio:portfolio];
+  NSArray *children = IPChildrenOfModelObject(container);
+  NSUInteger index = [[indexPath lastObject] unsignedIntegerValue];
+  switch (operation) {
+    case IPPortfolioJournalOperationInsertion:
+      if (children == nil || index > [children count] || value == nil) {
+        
+        return NO;
+      }
+      IPInsertChild(container, value, index);
+      return YES;
+      
+    case IPPortfolioJournalOperationRemoval:
+      if (index >= [children count]) {
+        
+        return NO;
+      }
+      IPRemoveChild(container, index);
+      return YES;
+      
+    case IPPortfolioJournalOperationMove: {
+      NSUInteger toIndex = [record[kIPPortfolioJournalToIndex] unsignedIntegerValue];
+      if (index >= [children count] || toIndex >= [children count]) {
+        
+        return NO;
+      }
+      id child = children[index];
+      IPRemoveChild(container, index);
+      IPInsertChild(container, child, toIndex);
+      return YES;
+    }
+      
+    default:
+      return NO;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)replayOntoPortfolio:(IPPortfolio *)portfolio {
+  
+  [_fileHandle closeFile];
+  _fileHandle = nil;
+  self.open = NO;
+  self.countOfEntries = 0;
+  NSData *contents = [NSData dataWithContentsOfFile:self.path options:NSDataReadingMappedIfSafe error:NULL];
+  const uint8_t *bytes = [contents bytes];
+  NSUInteger length = [contents length];
+  if (length < kIPPortfolioJournalHeaderLength ||
+      memcmp(bytes, kIPPortfolioJournalTag, kIPPortfolioJournalTagLength) != 0) {
+    
+    return 0;
+  }
+  int64_t version;
+  memcpy(&version, bytes + kIPPortfolioJournalTagLength, sizeof(version));
+  if ((NSInteger)CFSwapInt64LittleToHost(version) != portfolio.version) {
+    
+    DDLogVerbose(@"%s -- ignoring journal for another snapshot", __PRETTY_FUNCTION__);
+    return 0;
+  }
+  
+  NSUInteger offset = kIPPortfolioJournalHeaderLength;
+  NSUInteger applied = 0;
+  BOOL consistent = YES;
+  while (offset + sizeof(uint32_t) <= length) {
+    
+    uint32_t recordLength;
+    memcpy(&recordLength, bytes + offset, sizeof(recordLength));
+    recordLength = CFSwapInt32LittleToHost(recordLength);
+    if (offset + sizeof(uint32_t) + recordLength > length) {
+      
+      break;
+    }
+    NSData *payload = [contents subdataWithRange:NSMakeRange(offset + sizeof(uint32_t), recordLength)];
+    NSDictionary *record = [NSPropertyListSerialization propertyListWithData:payload
+                                                                     options:NSPropertyListImmutable
+                                                                      format:NULL
+                                                                       error:NULL];
+    if (![record isKindOfClass:[NSDictionary class]] || ![self applyRecord:record toPortfolio:portfolio]) {
+      
+      consistent = NO;
+      break;
+    }
+    offset += sizeof(uint32_t) + recordLength;
+    applied++;
+  }
+  if (!consistent) {
+    
+    //
+    //  Don't add to a journal we couldn't follow. The next change writes a
+    //  snapshot of whatever did apply.
+    //
+    
+    DDLogError(@"%s -- journal record %d doesn't fit the model; stopping", __PRETTY_FUNCTION__, applied);
+    return applied;
+  }
+  if (offset < length) {
+    
+    //
+    //  Drop the torn record so the next append starts on a clean boundary.
+    //
+    
+    [self.fileHandle truncateFileAtOffset:offset];
+  }
+  self.portfolioVersion = portfolio.version;
+  self.countOfEntries = applied;
+  self.byteCount = offset;
+  self.open = YES;
+  return applied;
+}
+
+#pragma mark - Writing
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)extendsPortfolioVersion:(NSInteger)version {
+  
+  return self.open && self.portfolioVersion == version;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)resetForPortfolioVersion:(NSInteger)version {
+  
+  [_fileHandle closeFile];
+  _fileHandle = nil;
+  NSMutableData *header = [NSMutableData dataWithBytes:kIPPortfolioJournalTag length:kIPPortfolioJournalTagLength];
+  int64_t littleVersion = CFSwapInt64HostToLittle(version);
+  [header appendBytes:&littleVersion length:sizeof(littleVersion)];
+  self.open = [header writeToFile:self.path atomically:YES];
+  self.portfolioVersion = version;
+  self.countOfEntries = 0;
+  self.byteCount = [header length];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)invalidate {
+  
+  self.open = NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Frames |record| and flushes it to disk.
+//
+
+- (BOOL)appendRecord:(NSDictionary *)record {
+  
+  if (!self.open) {
+    
+    return NO;
+  }
+  NSData *payload = [NSPropertyListSerialization dataWithPropertyList:record
+                                                               format:NSPropertyListBinaryFormat_v1_0
+                                                              options:0
+                                                                error:NULL];
+  if (payload == nil) {
+    
+    return NO;
+  }
+  uint32_t recordLength = CFSwapInt32HostToLittle((uint32_t)[payload length]);
+  NSMutableData *entry = [NSMutableData dataWithBytes:&recordLength length:sizeof(recordLength)];
+  [entry appendData:payload];
+  [self.fileHandle writeData:entry];
+  [self.fileHandle synchronizeFile];
+  self.countOfEntries++;
+  self.byteCount += [entry length];
+  return YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)appendValueForKey:(NSString *)key ofObject:(id)object {
+  
+  NSArray *indexPath = [self indexPathOfObject:object];
+  if (indexPath == nil) {
+    
+    return NO;
+  }
+  id value = [object valueForKey:key];
+  NSData *valueData = (value == nil) ? [NSData data] : [NSKeyedArchiver archivedDataWithRootObject:value];
+  return [self appendRecord:@{kIPPortfolioJournalOperation: @(IPPortfolioJournalOperationValue),
+                              kIPPortfolioJournalIndexPath: indexPath,
+                              kIPPortfolioJournalKey: key,
+                              kIPPortfolioJournalValue: valueData}];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)appendInsertionAtIndex:(NSUInteger)index inObject:(id)container {
+  
+  NSArray *indexPath = [self indexPathOfObject:container];
+  NSArray *children = IPChildrenOfModelObject(container);
+  if (indexPath == nil || index >= [children count]) {
+    
+    return NO;
+  }
+  NSData *childData = [NSKeyedArchiver archivedDataWithRootObject:children[index]];
+  return [self appendRecord:@{kIPPortfolioJournalOperation: @(IPPortfolioJournalOperationInsertion),
+                              kIPPortfolioJournalIndexPath: [indexPath arrayByAddingObject:@(index)],
+                              kIPPortfolioJournalValue: childData}];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)appendRemovalAtIndex:(NSUInteger)index inObject:(id)container {
+  
+  NSArray *indexPath = [self indexPathOfObject:container];
+  if (indexPath == nil) {
+    
+    return NO;
+  }
+  return [self appendRecord:@{kIPPortfolioJournalOperation: @(IPPortfolioJournalOperationRemoval),
+                              kIPPortfolioJournalIndexPath: [indexPath arrayByAddingObject:@(index)]}];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)appendMoveFromIndex:(NSUInteger)fromIndex toIndex:(NSUInteger)toIndex inObject:(id)container {
+  
+  NSArray *indexPath = [self indexPathOfObject:container];
+  if (indexPath == nil) {
+    
+    return NO;
+  }
+  return [self appendRecord:@{kIPPortfolioJournalOperation: @(IPPortfolioJournalOperationMove),
+                              kIPPortfolioJournalIndexPath: [indexPath arrayByAddingObject:@(fromIndex)],
+                              kIPPortfolioJournalToIndex: @(toIndex)}];
+}
+
+@end
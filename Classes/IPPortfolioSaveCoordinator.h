@@ -0,0 +1,83 @@
+//
+//  IPPortfolioSaveCoordinator.h
+//  ipad-portfolio
+//
+//  Takes full portfolio saves off the UI callbacks. Asking for a save marks
+//  the portfolio dirty; everything asked for within a short window turns
+//  into one save. The snapshot is archived on the main thread (the model
+//  lives there) and then written and flushed on a background queue. Only
+//  |flushPortfolio:toPath:|, for termination and backgrounding, saves while
+//  the caller waits.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+//
+//  How long a dirty portfolio waits for more changes before it's saved.
+//
+
+#define kIPPortfolioSaveCoalescingInterval    (2.0)
+
+@class IPPortfolio;
+
+@interface IPPortfolioSaveCoordinator : NSObject
+
+//
+//  Snapshots written, and their total size.
+//
+
+@property (nonatomic, readonly) NSUInteger saveCount;
+@property (nonatomic, readonly) unsigned long long bytesWritten;
+
+//
+//  For the last save: the time from the first request to the snapshot being
+//  on disk, and the part of that spent archiving on the main thread.
+//
+
+@property (nonatomic, readonly) NSTimeInterval lastSaveLatency;
+@property (nonatomic, readonly) NSTimeInterval lastArchiveTime;
+
++ (IPPortfolioSaveCoordinator *)sharedCoordinator;
+
+- (id)initWithCoalescingInterval:(NSTimeInterval)interval;
+
+//
+//  Saves |portfolio| to |portfolioPath| once the coalescing window closes.
+//  Requests from other threads are passed to the main thread.
+//
+
+- (void)setNeedsSaveOfPortfolio:(IPPortfolio *)portfolio toPath:(NSString *)portfolioPath;
+
+//
+//  Is a save of |portfolio| waiting for its window to close?
+//
+
+- (BOOL)hasPendingSaveOfPortfolio:(IPPortfolio *)portfolio;
+
+//
+//  Saves |portfolio| now, after any writes already under way, and returns
+//  once it's on disk. Replaces any pending save. Main thread only, unless
+//  |portfolio| is nil (which just waits for the writes).
+//
+
+- (void)flushPortfolio:(IPPortfolio *)portfolio toPath:(NSString *)portfolioPath;
+
+//
+//  Blocks until background writes are done. For tests.
+//
+
+- (void)waitUntilSavesFinish;
+
+@end
@@ -0,0 +1,240 @@
+//
+//  IPPortfolioSaveCoordinator.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPPortfolioSaveCoordinator.h"
+#import "IPPortfolio.h"
+
+@interface IPPortfolioSaveCoordinator ()
+
+@property (nonatomic, readwrite) NSUInteger saveCount;
+@property (nonatomic, readwrite) unsigned long long bytesWritten;
+@property (nonatomic, readwrite) NSTimeInterval lastSaveLatency;
+@property (nonatomic, readwrite) NSTimeInterval lastArchiveTime;
+
+//
+//  The save waiting for its window, and when it was first asked for.
+//
+
+@property (nonatomic, strong) IPPortfolio *pendingPortfolio;
+@property (nonatomic, copy) NSString *pendingPath;
+@property (nonatomic, assign) CFAbsoluteTime pendingSince;
+
+@end
+
+@implementation IPPortfolioSaveCoordinator {
+  
+  NSTimeInterval _coalescingInterval;
+  
+  //
+  //  Writes happen one at a time, in the order they were archived.
+  //
+  
+  dispatch_queue_t _writeQueue;
+  
+  //
+  //  Numbers each archive, so a write that finishes after a newer one has
+  //  been flushed doesn't get the last word on the journal.
+  //
+  
+  NSUInteger _archiveSequence;
+  NSUInteger _writtenSequence;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPPortfolioSaveCoordinator *)sharedCoordinator {
+  
+  static IPPortfolioSaveCoordinator *sharedCoordinator = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    
+    sharedCoordinator = [[IPPortfolioSaveCoordinator alloc] initWithCoalescingInterval:kIPPortfolioSaveCoalescingInterval];
+  });
+  return sharedCoordinator;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithCoalescingInterval:(NSTimeInterval)interval {
+  
+  self = [super init];
+  if (self != nil) {
+    
+    _coalescingInterval = interval;
+    _writeQueue = dispatch_queue_create("pholio.portfolio-save", DISPATCH_QUEUE_SERIAL);
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+  
+  [NSObject cancelPreviousPerformRequestsWithTarget:self];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)hasPendingSaveOfPortfolio:(IPPortfolio *)portfolio {
+  
+  return portfolio != nil && self.pendingPortfolio == portfolio;
+}
+
+#pragma mark - Saving
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)setNeedsSaveOfPortfolio:(IPPortfolio *)portfolio toPath:(NSString *)portfolioPath {
+  
+  if (![NSThread isMainThread]) {
+    
+    //
+    //  E.g., a portfolio being set up on the loading queue. The request
+    //  waits its turn on the main thread with everything else.
+    //
+    
+    dispatch_async(dispatch_get_main_queue(), ^(void) {
+      
+      [self setNeedsSaveOfPortfolio:portfolio toPath:portfolioPath];
+    });
+    return;
+  }
+  if (self.pendingPortfolio == portfolio && [self.pendingPath isEqualToString:portfolioPath]) {
+    
+    //
+    //  Already dirty. The window runs from the first request, so a steady
+    //  stream of edits can't put the save off indefinitely.
+    //
+    
+    return;
+  }
+  if (self.pendingPortfolio != nil) {
+    
+    [self savePendingPortfolio];
+  }
+  self.pendingPortfolio = portfolio;
+  self.pendingPath = portfolioPath;
+  self.pendingSince = CFAbsoluteTimeGetCurrent();
+  [self performSelector:@selector(savePendingPortfolio) withObject:nil afterDelay:_coalescingInterval];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The window has closed: archive now, write in the background.
+//
+
+- (void)savePendingPortfolio {
+  
+  [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(savePendingPortfolio) object:nil];
+  IPPortfolio *portfolio = self.pendingPortfolio;
+  NSString *portfolioPath = self.pendingPath;
+  CFAbsoluteTime requested = self.pendingSince;
+  self.pendingPortfolio = nil;
+  self.pendingPath = nil;
+  if (portfolio == nil) {
+    
+    return;
+  }
+  dispatch_block_t write = [self writeBlockForPortfolio:portfolio toPath:portfolioPath requestedAt:requested];
+  dispatch_async(_writeQueue, write);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)flushPortfolio:(IPPortfolio *)portfolio toPath:(NSString *)portfolioPath {
+  
+  if (portfolio == nil) {
+    
+    [self waitUntilSavesFinish];
+    return;
+  }
+  NSAssert([NSThread isMainThread], @"Portfolios get archived on the main thread");
+  CFAbsoluteTime requested = CFAbsoluteTimeGetCurrent();
+  if (self.pendingPortfolio == portfolio && [self.pendingPath isEqualToString:portfolioPath]) {
+    
+    requested = self.pendingSince;
+    self.pendingPortfolio = nil;
+    self.pendingPath = nil;
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(savePendingPortfolio) object:nil];
+    
+  } else if (self.pendingPortfolio != nil) {
+    
+    [self savePendingPortfolio];
+  }
+  dispatch_block_t write = [self writeBlockForPortfolio:portfolio toPath:portfolioPath requestedAt:requested];
+  dispatch_sync(_writeQueue, write);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Archives |portfolio| and returns the block that writes it. The archive is
+//  the immutable snapshot: once it exists, the model can keep changing.
+//
+
+- (dispatch_block_t)writeBlockForPortfolio:(IPPortfolio *)portfolio
+                                    toPath:(NSString *)portfolioPath
+                               requestedAt:(CFAbsoluteTime)requested {
+  
+  CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+  NSData *snapshot = [portfolio archivedSnapshot];
+  NSInteger version = portfolio.version;
+  NSUInteger sequence = ++_archiveSequence;
+  self.lastArchiveTime = CFAbsoluteTimeGetCurrent() - start;
+  
+  return [^(void) {
+    
+    if (![snapshot writeToFile:portfolioPath atomically:YES]) {
+      
+      DDLogError(@"%s -- unable to write %@", __PRETTY_FUNCTION__, portfolioPath);
+      return;
+    }
+    NSTimeInterval latency = CFAbsoluteTimeGetCurrent() - requested;
+    void (^didWrite)(void) = ^(void) {
+      
+      self.saveCount++;
+      self.bytesWritten += [snapshot length];
+      self.lastSaveLatency = latency;
+      if (sequence > self->_writtenSequence) {
+        
+        self->_writtenSequence = sequence;
+        [portfolio didWriteSnapshotWithVersion:version toPath:portfolioPath];
+      }
+      DDLogVerbose(@"%s -- saved %d bytes %.1fms after the request (%.1fms archiving)",
+                   __PRETTY_FUNCTION__,
+                   [snapshot length],
+                   latency * 1000,
+                   self.lastArchiveTime * 1000);
+    };
+    if ([NSThread isMainThread]) {
+      
+      didWrite();
+      
+    } else {
+      
+      dispatch_async(dispatch_get_main_queue(), didWrite);
+    }
+  } copy];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilSavesFinish {
+  
+  dispatch_sync(_writeQueue, ^(void) { });
+}
+
+@end
@@ -0,0 +1,109 @@
+//
+//  IPPredecodeWindow.h
+//  ipad-portfolio
+//
+//  Keeps the display images of the pages around the current one decoded, so
+//  paging to a neighbor (or back) shows pixels right away. The window is the
+//  current page +/- |radius| pages; it widens while the user swipes fast.
+//  Decoded images are held under a byte budget and evicted farthest-first;
+//  while held, they're pinned in the IPImageMemoryManager.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+#define kIPPredecodeWindowDefaultByteLimit    (48 * 1024 * 1024)
+#define kIPPredecodeWindowDefaultMaxRadius    4
+
+//
+//  How far ahead, in seconds of swiping, the window reaches.
+//
+
+#define kIPPredecodeWindowLookahead           0.5
+
+@class IPPhoto;
+
+@interface IPPredecodeWindow : NSObject
+
+@property (nonatomic, readonly) NSUInteger byteLimit;
+
+//
+//  Bytes of decoded pixels currently held.
+//
+
+@property (nonatomic, readonly) NSUInteger currentBytes;
+
+//
+//  Pages kept decoded on each side of the current page right now.
+//
+
+@property (nonatomic, readonly) NSUInteger radius;
+
+//
+//  The most |radius| can grow to. Memory warnings lower it.
+//
+
+@property (nonatomic, readonly) NSUInteger maxRadius;
+
+//
+//  How many pixels a page shows; images are decoded to cover this. If zero,
+//  the whole display image gets decoded.
+//
+
+@property (nonatomic, assign) CGSize targetPixelSize;
+
+//
+//  The pages, in order: one photo per page.
+//
+
+@property (nonatomic, copy) NSArray *photos;
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit maxRadius:(NSUInteger)maxRadius;
+
+//
+//  The user is on page |index|, moving at |pagesPerSecond| (signed; positive
+//  toward higher indexes). Sizes the window, evicts what fell out of it, and
+//  decodes what's missing in the background, nearest pages first.
+//
+
+- (void)moveToIndex:(NSUInteger)index velocity:(CGFloat)pagesPerSecond;
+
+//
+//  The decoded display image of |photo|, if the window holds it.
+//
+
+- (UIImage *)decodedImageForPhoto:(IPPhoto *)photo;
+
+//
+//  Offers an image decoded elsewhere (e.g., for the page on screen). Kept
+//  only if |photo| is inside the window.
+//
+
+- (void)addDecodedImage:(UIImage *)image forPhoto:(IPPhoto *)photo;
+
+//
+//  Shrinks the window by one page per side, and halves the budget, evicting
+//  what no longer fits. The current page's image is kept.
+//
+
+- (void)didReceiveMemoryWarning;
+
+//
+//  Blocks until queued decodes finish. For tests.
+//
+
+- (void)waitUntilDecodesFinish;
+
+@end
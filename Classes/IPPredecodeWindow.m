@@ -0,0 +1,356 @@
+//
+//  IPPredecodeWindow.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPPredecodeWindow.h"
+#import "IPPhoto.h"
+
+@interface IPPredecodeWindow ()
+
+@property (nonatomic, readwrite) NSUInteger byteLimit;
+@property (nonatomic, readwrite) NSUInteger currentBytes;
+@property (nonatomic, readwrite) NSUInteger radius;
+@property (nonatomic, readwrite) NSUInteger maxRadius;
+@property (nonatomic, assign) NSUInteger centerIndex;
+
+//
+//  Page index -> decoded image, and page index -> cost in bytes.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *images;
+@property (nonatomic, strong) NSMutableDictionary *costs;
+
+//
+//  Page index -> queued or running decode.
+//
+
+@property (nonatomic, strong) NSMutableDictionary *decodes;
+
+@property (nonatomic, strong) NSOperationQueue *decodeQueue;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPPredecodeWindow
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  All state is touched on the main thread only; decodes report back there.
+//
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit maxRadius:(NSUInteger)maxRadius {
+
+  self = [super init];
+  if (self != nil) {
+
+    _byteLimit = byteLimit;
+    _maxRadius = maxRadius;
+    _radius = MIN(1, maxRadius);
+    _images = [[NSMutableDictionary alloc] init];
+    _costs = [[NSMutableDictionary alloc] init];
+    _decodes = [[NSMutableDictionary alloc] init];
+    _decodeQueue = [[NSOperationQueue alloc] init];
+    _decodeQueue.maxConcurrentOperationCount = 1;
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(didReceiveMemoryWarning)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)init {
+
+  return [self initWithByteLimit:kIPPredecodeWindowDefaultByteLimit maxRadius:kIPPredecodeWindowDefaultMaxRadius];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [[NSNotificationCenter defaultCenter] removeObserver:self];
+  [_decodeQueue cancelAllOperations];
+  for (NSNumber *index in _images) {
+
+    [_photos[[index unsignedIntegerValue]] unpinDecodedImages];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A new set of pages invalidates everything held.
+//
+
+- (void)setPhotos:(NSArray *)photos {
+
+  for (NSNumber *index in [self.images allKeys]) {
+
+    [self evictIndex:index];
+  }
+  _photos = [photos copy];
+  [self.decodeQueue cancelAllOperations];
+  [self.decodes removeAllObjects];
+}
+
+#pragma mark - Window
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)indexIsInWindow:(NSUInteger)index {
+
+  NSUInteger distance = (index > self.centerIndex) ? index - self.centerIndex : self.centerIndex - index;
+  return distance <= self.radius;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Drops the image at |index|. The memory manager may keep it a while
+//  longer, but no longer pinned.
+//
+
+- (void)evictIndex:(NSNumber *)index {
+
+  if ((self.images)[index] == nil) {
+
+    return;
+  }
+  [(self.photos)[[index unsignedIntegerValue]] unpinDecodedImages];
+  self.currentBytes -= [(self.costs)[index] unsignedIntegerValue];
+  [self.images removeObjectForKey:index];
+  [self.costs removeObjectForKey:index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Evicts everything outside the window, cancels decodes that are no longer
+//  wanted, then evicts farthest-first until under budget. The current page
+//  goes last.
+//
+
+- (void)trim {
+
+  for (NSNumber *index in [self.images allKeys]) {
+
+    if (![self indexIsInWindow:[index unsignedIntegerValue]]) {
+
+      [self evictIndex:index];
+    }
+  }
+  for (NSNumber *index in [self.decodes allKeys]) {
+
+    if (![self indexIsInWindow:[index unsignedIntegerValue]]) {
+
+      [(self.decodes)[index] cancel];
+      [self.decodes removeObjectForKey:index];
+    }
+  }
+  while (self.currentBytes > self.byteLimit && [self.images count] > 1) {
+
+    NSNumber *farthest = nil;
+    NSUInteger farthestDistance = 0;
+    for (NSNumber *index in self.images) {
+
+      NSUInteger value = [index unsignedIntegerValue];
+      NSUInteger distance = (value > self.centerIndex) ? value - self.centerIndex : self.centerIndex - value;
+      if (farthest == nil || distance > farthestDistance) {
+
+        farthest = index;
+        farthestDistance = distance;
+      }
+    }
+    [self evictIndex:farthest];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Only photos displayed through a plain image view benefit. Unoptimized
+//  photos get optimized by the scroll view, and full-resolution photos are
+//  drawn from tiles.
+//
+
+- (BOOL)shouldDecodePhoto:(IPPhoto *)photo {
+
+  return [photo isOptimized] && ![photo keepsFullResolution];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)queueDecodeOfIndex:(NSUInteger)index {
+
+  NSNumber *key = @(index);
+  if (index >= [self.photos count] || (self.images)[key] != nil || (self.decodes)[key] != nil) {
+
+    return;
+  }
+  IPPhoto *photo = (self.photos)[index];
+  if (![self shouldDecodePhoto:photo]) {
+
+    return;
+  }
+  CGSize targetPixelSize = self.targetPixelSize;
+  NSBlockOperation *decode = [[NSBlockOperation alloc] init];
+  __weak NSBlockOperation *weakDecode = decode;
+  [decode addExecutionBlock:^(void) {
+
+    if ([weakDecode isCancelled]) {
+      return;
+    }
+    UIImage *image;
+    if (targetPixelSize.width > 0 && targetPixelSize.height > 0) {
+
+      image = [photo imageDecodedToPixelSize:targetPixelSize];
+
+    } else {
+
+      image = [photo decodedImage];
+    }
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+
+      if ((self.decodes)[key] == weakDecode) {
+
+        [self.decodes removeObjectForKey:key];
+      }
+
+      //
+      //  Once the operation is gone, |weakDecode| is nil and can't say it was
+      //  cancelled, so check the photo is still the one at |index|.
+      //
+
+      BOOL stillWanted = (index < [self.photos count] && (self.photos)[index] == photo);
+      if (stillWanted && ![weakDecode isCancelled] && image != nil) {
+
+        [self addDecodedImage:image atIndex:index];
+      }
+    }];
+  }];
+  (self.decodes)[key] = decode;
+  [self.decodeQueue addOperation:decode];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)moveToIndex:(NSUInteger)index velocity:(CGFloat)pagesPerSecond {
+
+  //
+  //  At rest, one page each side. Swiping fast reaches as far as the user
+  //  will get in |kIPPredecodeWindowLookahead| seconds.
+  //
+
+  NSUInteger reach = 1 + (NSUInteger)ceilf(fabsf(pagesPerSecond) * kIPPredecodeWindowLookahead);
+  self.radius = MIN(reach, self.maxRadius);
+  self.centerIndex = index;
+  [self trim];
+
+  //
+  //  Nearest first, and at equal distance, the page we're heading toward.
+  //
+
+  NSInteger direction = (pagesPerSecond < 0) ? -1 : 1;
+  for (NSUInteger distance = 1; distance <= self.radius; distance++) {
+
+    NSInteger ahead = (NSInteger)index + direction * (NSInteger)distance;
+    NSInteger behind = (NSInteger)index - direction * (NSInteger)distance;
+    if (ahead >= 0) {
+
+      [self queueDecodeOfIndex:ahead];
+    }
+    if (behind >= 0) {
+
+      [self queueDecodeOfIndex:behind];
+    }
+  }
+}
+
+#pragma mark - Images
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)decodedImageForPhoto:(IPPhoto *)photo {
+
+  NSUInteger index = [self.photos indexOfObjectIdenticalTo:photo];
+  if (index == NSNotFound) {
+
+    return nil;
+  }
+  return (self.images)[@(index)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)addDecodedImage:(UIImage *)image forPhoto:(IPPhoto *)photo {
+
+  NSUInteger index = [self.photos indexOfObjectIdenticalTo:photo];
+  if (index == NSNotFound || image == nil) {
+
+    return;
+  }
+  [self addDecodedImage:image atIndex:index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)addDecodedImage:(UIImage *)image atIndex:(NSUInteger)index {
+
+  NSNumber *key = @(index);
+  if (![self indexIsInWindow:index] || (self.images)[key] != nil) {
+
+    return;
+  }
+  CGImageRef pixels = [image CGImage];
+  NSUInteger cost = CGImageGetBytesPerRow(pixels) * CGImageGetHeight(pixels);
+  (self.images)[key] = image;
+  (self.costs)[key] = @(cost);
+  self.currentBytes += cost;
+
+  //
+  //  The memory manager holds the same pixels; keep it from shedding them
+  //  while they're in the window.
+  //
+
+  [(self.photos)[index] pinDecodedImages];
+  [self trim];
+}
+
+#pragma mark - Memory
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)didReceiveMemoryWarning {
+
+  DDLogVerbose(@"%s -- shrinking from radius %d, %d bytes", __PRETTY_FUNCTION__, self.maxRadius, self.byteLimit);
+  if (self.maxRadius > 0) {
+
+    self.maxRadius--;
+  }
+  self.byteLimit /= 2;
+  self.radius = MIN(self.radius, self.maxRadius);
+  [self trim];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilDecodesFinish {
+
+  [self.decodeQueue waitUntilAllOperationsAreFinished];
+}
+
+@end
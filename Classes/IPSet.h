@@ -24,6 +24,7 @@
 #import "IPPhoto.h"
 #import "IPPage.h"
 #import "IPPasteboardObject.h"
+#import "IPPortfolioFormat.h"
 
 //
 //  A set is a collection of pages.
@@ -34,12 +35,27 @@
 #define kIPSetThumbnailFilename     @"thumbnailFilename"
 #define kIPSetUTI                   @"org.brians-brain.pholio.set"
 
+//
+//  Only the first pages of a set -- enough for its spot in the portfolio
+//  grid -- get decoded with the portfolio snapshot. The rest stay encoded,
+//  as a block of the binary portfolio format (IPPortfolioFormat.h), until
+//  something needs them. Snapshots from before that format kept the rest as
+//  a keyed archive under |kIPSetUnloadedPages|; those get decoded right away.
+//
+
+#define kIPSetPreloadedPageCount          kIPPFLoadedPageCount
+#define kIPSetUnloadedPages               @"unloadedPages"
+
 @class IPPortfolio;
 @interface IPSet : NSObject <NSCoding, NSCopying, IPPasteboardObjectDelegate> {
     @private
     NSString *title_;
     NSMutableArray *pages_;
     IPPortfolio *__weak parent_;
+    NSData *unloadedPages_;
+    NSUInteger unloadedPageCount_;
+    NSArray *unloadedPhotoFilenames_;
+    BOOL unloadedPagesDamaged_;
 }
 
 //
@@ -61,11 +77,48 @@
 @property (weak, nonatomic, readonly) UIImage *thumbnail;
 
 //
-//  The pages that comprise the set.
+//  The pages that comprise the set. Decodes any pages that haven't been yet.
 //
 
 @property (nonatomic, strong) NSMutableArray *pages;
 
+//
+//  The pages decoded so far, which always start the set. Doesn't decode
+//  anything.
+//
+
+@property (nonatomic, readonly) NSArray *loadedPages;
+
+//
+//  Have all of the pages been decoded?
+//
+
+@property (nonatomic, readonly, getter = arePagesLoaded) BOOL pagesLoaded;
+
+//
+//  The pages that haven't been decoded, as a block of the binary format, or
+//  nil if they all have been. A block that won't decode stays here, and out
+//  of |pages|, so saving the portfolio writes it back unchanged.
+//
+
+@property (nonatomic, readonly) NSData *unloadedPageData;
+
+//
+//  How many pages |unloadedPageData| holds.
+//
+
+@property (nonatomic, readonly) NSUInteger unloadedPageCount;
+
+//
+//  The file names (last path components) of every photo in the set. Doesn't
+//  make model objects for pages that haven't been decoded. Nil if those
+//  pages are damaged, since then the names of some photos aren't known.
+//  Loading pages changes what this reads, so call it on the main thread (or
+//  before the set is shared).
+//
+
+@property (nonatomic, readonly) NSArray *photoFilenames;
+
 //
 //  And the parent portfolio.
 //
@@ -79,13 +132,24 @@
 + (IPSet *)setWithPages:(IPPage *)firstPage, ...;
 
 //
-//  Key-value compliance for the |pages| collection.
+//  For decoders: the set starts with |pages|, followed by |countOfPages|
+//  more still encoded in |data|.
+//
+
+- (void)setLoadedPages:(NSMutableArray *)pages
+      unloadedPageData:(NSData *)data
+                 count:(NSUInteger)countOfPages;
+
+//
+//  Key-value compliance for the |pages| collection. Counting pages, and
+//  getting or removing one of the loaded ones, doesn't decode the rest.
 //
 
 -(NSUInteger)countOfPages;
 -(IPPage *)objectInPagesAtIndex:(NSUInteger)index;
 -(void)insertObject:(IPPage *)page inPagesAtIndex:(NSUInteger) index;
 -(void)removeObjectFromPagesAtIndex:(NSUInteger)index;
+-(void)removePagesAtIndexes:(NSIndexSet *)indexes;
 -(void)appendPage:(IPPage *)page;
 
 //
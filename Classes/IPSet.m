@@ -19,6 +19,8 @@
 //
 
 #import "IPSet.h"
+#import "IPPortfolio.h"
+#import "IPPortfolioCoder.h"
 
 
 @implementation IPSet
@@ -135,23 +137,192 @@
   }
 }
 
+#pragma mark Page loading
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSMutableArray *)pages {
+  
+  [self loadPages];
+  return pages_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)setPages:(NSMutableArray *)pages {
+  
+  pages_ = pages;
+  unloadedPages_ = nil;
+  unloadedPageCount_ = 0;
+  unloadedPhotoFilenames_ = nil;
+  unloadedPagesDamaged_ = NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSArray *)loadedPages {
+  
+  return pages_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)arePagesLoaded {
+  
+  return unloadedPages_ == nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSData *)unloadedPageData {
+  
+  return unloadedPages_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)unloadedPageCount {
+  
+  return unloadedPageCount_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)setLoadedPages:(NSMutableArray *)pages
+      unloadedPageData:(NSData *)data
+                 count:(NSUInteger)countOfPages {
+  
+  pages_ = pages;
+  [pages_ makeObjectsPerformSelector:@selector(setParent:) withObject:self];
+  unloadedPages_ = (countOfPages > 0) ? data : nil;
+  unloadedPageCount_ = (unloadedPages_ != nil) ? countOfPages : 0;
+  unloadedPhotoFilenames_ = nil;
+  unloadedPagesDamaged_ = NO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decodes the pages that weren't decoded with the portfolio and puts them
+//  after the loaded ones, then tells the portfolio so it can check their
+//  photos. It won't change the pages while this set is still in the middle
+//  of an accessor.
+//
+//  A block that doesn't decode to the pages it should hold is kept as it
+//  is, so the next save doesn't write the loss to disk. The set carries on
+//  with just its loaded pages.
+//
+
+- (void)loadPages {
+  
+  if (unloadedPages_ == nil || unloadedPagesDamaged_) {
+    return;
+  }
+  CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+  NSArray *pages = [IPPortfolioCoder pagesWithData:unloadedPages_];
+  if (pages == nil || [pages count] != unloadedPageCount_) {
+    
+    DDLogError(@"%s -- pages of %@ are corrupt: expected %d, decoded %d. Keeping them encoded",
+               __PRETTY_FUNCTION__,
+               self.title,
+               unloadedPageCount_,
+               [pages count]);
+    unloadedPagesDamaged_ = YES;
+    return;
+  }
+  unloadedPages_ = nil;
+  unloadedPageCount_ = 0;
+  unloadedPhotoFilenames_ = nil;
+  [pages makeObjectsPerformSelector:@selector(setParent:) withObject:self];
+  [pages_ addObjectsFromArray:pages];
+  DDLogVerbose(@"%s -- decoded %d pages of %@ in %.1fms",
+               __PRETTY_FUNCTION__,
+               [pages count],
+               self.title,
+               (CFAbsoluteTimeGetCurrent() - start) * 1000);
+  [self.parent set:self didLoadPages:pages];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSArray *)photoFilenamesInPages:(NSArray *)pages {
+  
+  NSMutableArray *filenames = [NSMutableArray arrayWithCapacity:[pages count]];
+  for (IPPage *page in pages) {
+    for (IPPhoto *photo in page.photos) {
+      
+      if (photo.filename != nil) {
+        [filenames addObject:[photo.filename lastPathComponent]];
+      }
+    }
+  }
+  return filenames;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//
+//  The names in the pages that haven't been decoded come straight from
+//  their block, once.
+//
+
+- (NSArray *)photoFilenames {
+  
+  if (unloadedPagesDamaged_) {
+    return nil;
+  }
+  NSArray *filenames = [IPSet photoFilenamesInPages:pages_];
+  if (unloadedPages_ != nil) {
+    
+    if (unloadedPhotoFilenames_ == nil) {
+      unloadedPhotoFilenames_ = [IPPortfolioCoder photoFilenamesInPageData:unloadedPages_];
+    }
+    if (unloadedPhotoFilenames_ == nil) {
+      
+      DDLogError(@"%s -- pages of %@ are corrupt. Keeping them encoded", __PRETTY_FUNCTION__, self.title);
+      unloadedPagesDamaged_ = YES;
+      return nil;
+    }
+    filenames = [filenames arrayByAddingObjectsFromArray:unloadedPhotoFilenames_];
+  }
+  return filenames;
+}
+
 #pragma mark NSCoding
 
 -(id)initWithCoder:(NSCoder *)aDecoder {
   if ((self = [super init]) != nil) {
     self.title = [aDecoder decodeObjectForKey:kIPSetTitle];
     self.pages = [aDecoder decodeObjectForKey:kIPSetPages];
-    if (self.pages == nil) {
+    if (pages_ == nil) {
       pages_ = [[NSMutableArray alloc] init];
     }
-    [self.pages makeObjectsPerformSelector:@selector(setParent:) withObject:self];
+    [pages_ makeObjectsPerformSelector:@selector(setParent:) withObject:self];
+    
+    //
+    //  Snapshots saved before the binary format kept pages past the first
+    //  few in a keyed archive of their own. They get decoded now so nothing
+    //  has to read that format again.
+    //
+    
+    NSData *archivedPages = [aDecoder decodeObjectForKey:kIPSetUnloadedPages];
+    if (archivedPages != nil) {
+      
+      NSArray *pages = [NSKeyedUnarchiver unarchiveObjectWithData:archivedPages];
+      [pages makeObjectsPerformSelector:@selector(setParent:) withObject:self];
+      [pages_ addObjectsFromArray:pages];
+    }
   }
   return self;
 }
 
+//
+//  Keyed archives (the pasteboard, journal records) carry every page, with
+//  full file names. Only the portfolio snapshot leaves pages encoded.
+//
+
 -(void)encodeWithCoder:(NSCoder *)aCoder {
   [aCoder encodeObject:title_ forKey:kIPSetTitle];
-  [aCoder encodeObject:pages_ forKey:kIPSetPages];
+  [aCoder encodeObject:self.pages forKey:kIPSetPages];
 }
 
 #pragma mark NSCopying
@@ -159,7 +330,7 @@
 -(id)copyWithZone:(NSZone *)zone {
   IPSet *copy = [[IPSet allocWithZone:zone] init];
   copy.title  = [title_ copyWithZone:zone];
-  copy.pages = [[NSMutableArray alloc] initWithArray:pages_ copyItems:YES];
+  copy.pages = [[NSMutableArray alloc] initWithArray:self.pages copyItems:YES];
   
   //
   //  Fix up the parent pointers
@@ -172,14 +343,20 @@
 #pragma mark Key-value compliance for |pages| collection
 
 -(NSUInteger)countOfPages {
-  return [pages_ count];
+  return [pages_ count] + (unloadedPagesDamaged_ ? 0 : unloadedPageCount_);
 }
 
 -(IPPage *)objectInPagesAtIndex:(NSUInteger)index {
+  if (index >= [pages_ count]) {
+    [self loadPages];
+  }
   return (IPPage *)pages_[index];
 }
 
 -(void)insertObject:(IPPage *)page inPagesAtIndex:(NSUInteger) index {
+  if (index > [pages_ count]) {
+    [self loadPages];
+  }
   if (index == 0) {
     [self willChangeValueForKey:kIPSetThumbnailFilename];
   }
@@ -202,6 +379,20 @@
   }
 }
 
+-(void)removePagesAtIndexes:(NSIndexSet *)indexes {
+  if ([indexes lastIndex] >= [pages_ count]) {
+    [self loadPages];
+  }
+  [[pages_ objectsAtIndexes:indexes] makeObjectsPerformSelector:@selector(setParent:) withObject:nil];
+  if ([indexes containsIndex:0]) {
+    [self willChangeValueForKey:kIPSetThumbnailFilename];
+  }
+  [pages_ removeObjectsAtIndexes:indexes];
+  if ([indexes containsIndex:0]) {
+    [self didChangeValueForKey:kIPSetThumbnailFilename];
+  }
+}
+
 -(void)appendPage:(IPPage *)page {
   [self insertObject:page inPagesAtIndex:[self countOfPages]];
 }
@@ -0,0 +1,91 @@
+//
+//  IPSetCompositor.h
+//  ipad-portfolio
+//
+//  Renders the stack of bordered, rotated thumbnails that stands for a set
+//  in the portfolio grid. Rendering is plain Core Graphics into a bitmap, so
+//  it runs off the main thread. Finished composites are saved in the caches
+//  folder and held by the IPImageMemoryManager, keyed by the thumbnails they
+//  show and the size they were drawn at, so each one gets rendered once.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+//
+//  Most photos in a stack.
+//
+
+#define kIPSetCompositeMaxPhotos        5
+
+#define kIPSetCompositeDirectory        @"Composites"
+
+@interface IPSetCompositor : NSObject
+
+//
+//  Composites actually drawn, as opposed to found in memory or on disk. For
+//  tests.
+//
+
+@property (nonatomic, readonly) NSUInteger renderCount;
+
++ (IPSetCompositor *)sharedCompositor;
+
+//
+//  Saves composites in |directory|, which gets created if needed.
+//
+
+- (id)initWithDirectory:(NSString *)directory;
+
+//
+//  Identifies the composite of |photos| (at most the first
+//  |kIPSetCompositeMaxPhotos|) drawn |size| points big at |scale|.
+//
+
++ (NSString *)keyForPhotos:(NSArray *)photos size:(CGSize)size scale:(CGFloat)scale;
+
+//
+//  The composite for |key| if it's already in memory; never touches disk.
+//  Cheap enough for the main thread.
+//
+
+- (UIImage *)cachedCompositeForKey:(NSString *)key;
+
+//
+//  The composite of |photos|, from memory, from disk, or freshly drawn.
+//  Photos that aren't optimized yet get left out, and then the result isn't
+//  kept. Slow; call it off the main thread.
+//
+
+- (UIImage *)compositeOfPhotos:(NSArray *)photos size:(CGSize)size scale:(CGFloat)scale;
+
+//
+//  |compositeOfPhotos:size:scale:| in the background. |completion| gets
+//  called on the main thread unless the returned operation gets cancelled
+//  first.
+//
+
+- (NSOperation *)compositeOfPhotos:(NSArray *)photos
+                              size:(CGSize)size
+                             scale:(CGFloat)scale
+                        completion:(void (^)(UIImage *composite))completion;
+
+//
+//  Blocks until queued composites finish. For tests.
+//
+
+- (void)waitUntilCompositesFinish;
+
+@end
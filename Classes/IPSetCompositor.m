@@ -0,0 +1,332 @@
+//
+//  IPSetCompositor.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <CommonCrypto/CommonDigest.h>
+#import <ImageIO/ImageIO.h>
+#import "IPSetCompositor.h"
+#import "IPPhoto.h"
+#import "IPImageMemoryManager.h"
+#import "NSString+TestHelper.h"
+
+//
+//  Each thumbnail gets a white mat and a thin gray edge around it, and is
+//  turned a little more than the one in front of it.
+//
+
+#define kIPSetCompositeMatWidth         10.0
+#define kIPSetCompositeEdgeWidth        1.0
+#define kIPSetCompositeRotationStep     0.15
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Draws |thumbnails| as a stack into a new |width| x |height| bitmap, the
+//  first one on top. Each is scaled so that, rotated, it fits the bitmap.
+//  Returns a +1 reference, or NULL on failure.
+//
+
+static CGImageRef IPCreateStackComposite(NSArray *thumbnails, size_t width, size_t height) {
+
+  CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef bitmap = CGBitmapContextCreate(NULL,
+                                              width,
+                                              height,
+                                              8,
+                                              0,
+                                              rgbColorSpace,
+                                              kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+  CGColorSpaceRelease(rgbColorSpace);
+  if (bitmap == NULL) {
+
+    return NULL;
+  }
+  CGContextSetInterpolationQuality(bitmap, kCGInterpolationHigh);
+  CGFloat border = kIPSetCompositeMatWidth + kIPSetCompositeEdgeWidth;
+  for (NSInteger i = [thumbnails count] - 1; i >= 0; i--) {
+
+    CGImageRef thumbnail = [thumbnails[i] CGImage];
+    CGFloat framedWidth = CGImageGetWidth(thumbnail) + 2 * border;
+    CGFloat framedHeight = CGImageGetHeight(thumbnail) + 2 * border;
+    CGFloat angle = i * kIPSetCompositeRotationStep;
+    CGFloat rotatedWidth = framedWidth * fabs(cos(angle)) + framedHeight * fabs(sin(angle));
+    CGFloat rotatedHeight = framedWidth * fabs(sin(angle)) + framedHeight * fabs(cos(angle));
+    CGFloat scale = MIN(width / rotatedWidth, height / rotatedHeight);
+    CGRect frame = CGRectMake(-framedWidth / 2, -framedHeight / 2, framedWidth, framedHeight);
+
+    //
+    //  UIKit turns positive angles clockwise; with Core Graphics' y axis
+    //  pointing up, that's a negative rotation here.
+    //
+
+    CGContextSaveGState(bitmap);
+    CGContextTranslateCTM(bitmap, width / 2.0, height / 2.0);
+    CGContextRotateCTM(bitmap, -angle);
+    CGContextScaleCTM(bitmap, scale, scale);
+    CGContextSetGrayFillColor(bitmap, 2.0 / 3.0, 1.0);
+    CGContextFillRect(bitmap, frame);
+    CGContextSetGrayFillColor(bitmap, 1.0, 1.0);
+    CGContextFillRect(bitmap, CGRectInset(frame, kIPSetCompositeEdgeWidth, kIPSetCompositeEdgeWidth));
+    CGContextDrawImage(bitmap, CGRectInset(frame, border, border), thumbnail);
+    CGContextRestoreGState(bitmap);
+  }
+  CGImageRef composite = CGBitmapContextCreateImage(bitmap);
+  CGContextRelease(bitmap);
+  return composite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPSetCompositor ()
+
+@property (nonatomic, readwrite) NSUInteger renderCount;
+@property (nonatomic, copy) NSString *directory;
+@property (nonatomic, strong) NSOperationQueue *compositeQueue;
+
+@end
+
+@implementation IPSetCompositor
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPSetCompositor *)sharedCompositor {
+
+  static IPSetCompositor *sharedCompositor = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    sharedCompositor = [[IPSetCompositor alloc] initWithDirectory:[kIPSetCompositeDirectory asPathInCachesFolder]];
+  });
+  return sharedCompositor;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithDirectory:(NSString *)directory {
+
+  self = [super init];
+  if (self != nil) {
+
+    _directory = [directory copy];
+    _compositeQueue = [[NSOperationQueue alloc] init];
+    _compositeQueue.maxConcurrentOperationCount = 2;
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:NULL];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [_compositeQueue cancelAllOperations];
+}
+
+#pragma mark - Keys
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSArray *)stackOfPhotos:(NSArray *)photos {
+
+  if ([photos count] <= kIPSetCompositeMaxPhotos) {
+
+    return photos;
+  }
+  return [photos subarrayWithRange:NSMakeRange(0, kIPSetCompositeMaxPhotos)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Thumbnail names follow the content of the photo, so a changed photo
+//  means a new key.
+//
+
++ (NSString *)keyForPhotos:(NSArray *)photos size:(CGSize)size scale:(CGFloat)scale {
+
+  NSMutableArray *names = [NSMutableArray arrayWithCapacity:kIPSetCompositeMaxPhotos];
+  for (IPPhoto *photo in [self stackOfPhotos:photos]) {
+
+    [names addObject:[photo.thumbnailFilename lastPathComponent] ?: @""];
+  }
+  return [NSString stringWithFormat:@"composite|%@|%.0fx%.0f@%.0f",
+          [names componentsJoinedByString:@","],
+          size.width,
+          size.height,
+          scale];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Where the composite for |key| gets saved: the key's SHA-1, which keeps
+//  arbitrary thumbnail names out of the file name.
+//
+
+- (NSString *)pathForKey:(NSString *)key {
+
+  NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+  unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+  CC_SHA1([keyData bytes], (CC_LONG)[keyData length], digest);
+  NSMutableString *hash = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+  for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+
+    [hash appendFormat:@"%02x", digest[i]];
+  }
+  return [self.directory stringByAppendingPathComponent:[hash stringByAppendingPathExtension:@"png"]];
+}
+
+#pragma mark - Composites
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)cachedCompositeForKey:(NSString *)key {
+
+  return [[IPImageMemoryManager sharedManager] imageForKey:key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Loads a saved composite, decoded now rather than at first draw.
+//
+
+- (UIImage *)compositeFromFile:(NSString *)path scale:(CGFloat)scale {
+
+  if (![[NSFileManager defaultManager] fileExistsAtPath:path]) {
+
+    return nil;
+  }
+  CGImageSourceRef source = CGImageSourceCreateWithURL((__bridge CFURLRef)[NSURL fileURLWithPath:path], NULL);
+  if (source == NULL) {
+
+    return nil;
+  }
+  NSDictionary *options = @{(id)kCGImageSourceShouldCacheImmediately: (id)kCFBooleanTrue};
+  CGImageRef pixels = CGImageSourceCreateImageAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+  CFRelease(source);
+  if (pixels == NULL) {
+
+    return nil;
+  }
+  UIImage *composite = [UIImage imageWithCGImage:pixels scale:scale orientation:UIImageOrientationUp];
+  CGImageRelease(pixels);
+  return composite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)compositeOfPhotos:(NSArray *)photos size:(CGSize)size scale:(CGFloat)scale {
+
+  NSString *key = [IPSetCompositor keyForPhotos:photos size:size scale:scale];
+  IPImageMemoryManager *memoryManager = [IPImageMemoryManager sharedManager];
+  UIImage *composite = [memoryManager imageForKey:key];
+  if (composite != nil) {
+
+    return composite;
+  }
+  NSString *path = [self pathForKey:key];
+  composite = [self compositeFromFile:path scale:scale];
+  if (composite != nil) {
+
+    [memoryManager setImage:composite forKey:key kind:IPImageMemoryKindComposite];
+    return composite;
+  }
+
+  //
+  //  Each thumbnail comes from the smallest rung that covers the whole
+  //  composite.
+  //
+
+  size_t width = MAX(1, (size_t)roundf(size.width * scale));
+  size_t height = MAX(1, (size_t)roundf(size.height * scale));
+  CGSize pixelSize = CGSizeMake(width, height);
+  NSMutableArray *thumbnails = [NSMutableArray arrayWithCapacity:kIPSetCompositeMaxPhotos];
+  BOOL complete = YES;
+  for (IPPhoto *photo in [IPSetCompositor stackOfPhotos:photos]) {
+
+    UIImage *thumbnail = [photo isOptimized] ? [photo thumbnailCoveringPixelSize:pixelSize] : nil;
+    if (thumbnail == nil) {
+
+      complete = NO;
+      continue;
+    }
+    [thumbnails addObject:thumbnail];
+  }
+  CGImageRef pixels = IPCreateStackComposite(thumbnails, width, height);
+  if (pixels == NULL) {
+
+    DDLogError(@"%s -- unable to composite %@", __PRETTY_FUNCTION__, key);
+    return nil;
+  }
+  composite = [UIImage imageWithCGImage:pixels scale:scale orientation:UIImageOrientationUp];
+  CGImageRelease(pixels);
+  @synchronized(self) {
+
+    self.renderCount++;
+  }
+
+  //
+  //  A stack with photos missing would be wrong once they arrive, and the
+  //  key wouldn't change; don't keep it.
+  //
+
+  if (complete) {
+
+    [UIImagePNGRepresentation(composite) writeToFile:path atomically:YES];
+    [memoryManager setImage:composite forKey:key kind:IPImageMemoryKindComposite];
+  }
+  return composite;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSOperation *)compositeOfPhotos:(NSArray *)photos
+                              size:(CGSize)size
+                             scale:(CGFloat)scale
+                        completion:(void (^)(UIImage *composite))completion {
+
+  photos = [photos copy];
+  completion = [completion copy];
+  NSBlockOperation *compositeOperation = [[NSBlockOperation alloc] init];
+  __weak NSBlockOperation *weakOperation = compositeOperation;
+  [compositeOperation addExecutionBlock:^(void) {
+
+    if ([weakOperation isCancelled]) {
+      return;
+    }
+    UIImage *composite = [self compositeOfPhotos:photos size:size scale:scale];
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+
+      if (![weakOperation isCancelled] && completion != nil) {
+
+        completion(composite);
+      }
+    }];
+  }];
+  [self.compositeQueue addOperation:compositeOperation];
+  return compositeOperation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilCompositesFinish {
+
+  [self.compositeQueue waitUntilAllOperationsAreFinished];
+}
+
+@end
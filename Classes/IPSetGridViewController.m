@@ -27,10 +27,17 @@
 #import "BDImagePickerController.h"
 #import "IPAlert.h"
 #import "IPPhotoOptimizationManager.h"
-#import "UIImage+Border.h"
+#import "IPDecoratedThumbnailCache.h"
+#import "IPThumbnailFetcher.h"
 
 static NSString * const kIPSetGridViewCellIdentifier = @"kIPSetGridViewCellIdentifier";
 
+//
+//  Width of the white border around each thumbnail in the grid.
+//
+
+#define kIPPageCellBorderWidth    10.0
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -47,17 +54,48 @@ static NSString * const kIPSetGridViewCellIdentifier = @"kIPSetGridViewCellIdent
 
 @property (nonatomic, strong) IPPhoto *photo;
 
+//
+//  Cancel any work queued to render this cell's image.
+//
+
+- (void)cancelPendingWork;
+
 @end
 
-@implementation IPPageCell
+@implementation IPPageCell {
+  
+  //
+  //  Loads or renders the bordered thumbnail when it isn't in memory.
+  //  Cancelled when the cell gets reused.
+  //
+  
+  NSOperation *_imageOperation;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
 - (void)dealloc {
   
+  [_imageOperation cancel];
   [_photo removeObserver:self forKeyPath:kIPPhotoTitle];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)cancelPendingWork {
+  
+  [_imageOperation cancel];
+  _imageOperation = nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)prepareForReuse {
+  
+  [super prepareForReuse];
+  [self cancelPendingWork];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  When we get assigned a photo, set up the caption / image and also watch
@@ -69,6 +107,7 @@ static NSString * const kIPSetGridViewCellIdentifier = @"kIPSetGridViewCellIdent
   if (_photo == photo) {
     return;
   }
+  [self cancelPendingWork];
   [_photo removeObserver:self forKeyPath:kIPPhotoTitle];
   _photo = photo;
   
@@ -84,14 +123,50 @@ static NSString * const kIPSetGridViewCellIdentifier = @"kIPSetGridViewCellIdent
   }
   [_photo addObserver:self forKeyPath:kIPPhotoTitle options:0 context:NULL];
   self.caption = self.photo.title;
-  UIImage *thumbnail = self.photo.thumbnail;
-  [[[IPPhotoOptimizationManager sharedManager] optimizationQueue] addOperationWithBlock:^(void) {
-    UIImage *bordered = [thumbnail imageWithBorderWidth:10.0 andColor:[[UIColor whiteColor] CGColor]];
-    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+  
+  //
+  //  This photo is on screen now. If it's still waiting on a background
+  //  upgrade, move it to the front.
+  //
+  
+  IPPhotoOptimizationManager *optimizationManager = [IPPhotoOptimizationManager sharedManager];
+  [optimizationManager promotePhoto:photo toLane:IPOptimizationLaneInteractive];
+  
+  //
+  //  Once a thumbnail has been bordered, showing it again is a lookup.
+  //
+  
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  CGSize pixelSize = CGSizeMake(self.bounds.size.width * scale, self.bounds.size.height * scale);
+  IPDecoratedThumbnailCache *thumbnailCache = [IPDecoratedThumbnailCache sharedCache];
+  UIColor *borderColor = [UIColor whiteColor];
+  UIImage *cached = [thumbnailCache cachedThumbnailForPhoto:photo 
+                                                  pixelSize:pixelSize 
+                                                borderWidth:kIPPageCellBorderWidth 
+                                                borderColor:borderColor];
+  if (cached != nil) {
+    
+    self.image = cached;
+    return;
+  }
+  __weak IPPageCell *weakSelf = self;
+  NSOperation *imageOperation = [[IPThumbnailFetcher sharedFetcher] operationDecodingImage:^UIImage *(void) {
+    
+    return [thumbnailCache thumbnailForPhoto:photo 
+                                   pixelSize:pixelSize 
+                                 borderWidth:kIPPageCellBorderWidth 
+                                 borderColor:borderColor];
+    
+  } completion:^(UIImage *bordered) {
+    
+    IPPageCell *strongSelf = weakSelf;
+    if (strongSelf.photo == photo) {
       
-      self.image = bordered;
-    }];
+      strongSelf.image = bordered;
+    }
   }];
+  [optimizationManager addOperation:imageOperation inLane:IPOptimizationLaneInteractive];
+  _imageOperation = imageOperation;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -129,6 +204,13 @@ UINavigationControllerDelegate
 
 @implementation IPSetGridViewController
 
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+  
+  [[NSNotificationCenter defaultCenter] removeObserver:self name:IPPortfolioChanged object:nil];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Free memory.
@@ -164,6 +246,10 @@ UINavigationControllerDelegate
   [_gridView registerClass:[IPPageCell class] forCellWithReuseIdentifier:kIPSetGridViewCellIdentifier];
   _gridView.collectionViewLayout = layout;
   [self.view addSubview:_gridView];
+  [[NSNotificationCenter defaultCenter] addObserver:self
+                                           selector:@selector(portfolioChanged:)
+                                               name:IPPortfolioChanged
+                                             object:nil];
 
   self.navigationItem.leftBarButtonItem = [[UIBarButtonItem alloc] initWithTitle:self.backButtonText 
                                                                             style:UIBarButtonItemStylePlain 
@@ -198,6 +284,24 @@ UINavigationControllerDelegate
   }];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  When we get popped, nothing in the grid will be seen again. Drop any
+//  rendering still queued for it.
+//
+
+- (void)viewDidDisappear:(BOOL)animated {
+  
+  [super viewDidDisappear:animated];
+  if ([self isMovingFromParentViewController]) {
+    
+    for (IPPageCell *cell in [self.gridView visibleCells]) {
+      
+      [cell cancelPendingWork];
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Fade out the grid view before popping back.
@@ -278,6 +382,38 @@ UINavigationControllerDelegate
   return _backButtonText;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The portfolio changed without going through us (it may have dropped pages
+//  of this set whose files are gone). Show what's left.
+//
+
+- (void)portfolioChanged:(NSNotification *)notification {
+  
+  if (notification.object == self.currentSet.parent) {
+    [self.gridView reloadData];
+  }
+}
+
+#pragma mark - UIScrollViewDelegate
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidEndDragging:(UIScrollView *)scrollView willDecelerate:(BOOL)decelerate {
+  
+  if (!decelerate) {
+    
+    [[IPThumbnailFetcher sharedFetcher] endScroll];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)scrollViewDidEndDecelerating:(UIScrollView *)scrollView {
+  
+  [[IPThumbnailFetcher sharedFetcher] endScroll];
+}
+
 #pragma mark - UICollectionViewDataSource
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -339,8 +475,13 @@ UINavigationControllerDelegate
   
   [BDImagePickerController confirmLocationServicesAndPresentPopoverFromRect:rect inView:gridView onSelection:^(NSArray *assets) {
     
-    __block NSUInteger currentInsertionPoint = insertionPoint;
-    for (id<BDSelectableAsset> asset in assets) {
+    //
+    //  Photos finish in any order. Each goes in after the photos picked
+    //  before it that have already gone in, so they keep the picked order.
+    //
+    
+    NSMutableIndexSet *inserted = [[NSMutableIndexSet alloc] init];
+    [assets enumerateObjectsUsingBlock:^(id<BDSelectableAsset> asset, NSUInteger sourceIndex, BOOL *stop) {
       
       [asset imageAsyncWithCompletion:^(NSString *filename, NSString *uti) {
         
@@ -350,16 +491,19 @@ UINavigationControllerDelegate
         IPPhoto *photo = [[IPPhoto alloc] init];
         photo.filename = filename;
         photo.title = [asset title];
-        [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo withCompletion:^(void) {
+        [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo inLane:IPOptimizationLaneImport withCompletion:^(void) {
           
+          NSUInteger index = insertionPoint + [inserted countOfIndexesInRange:NSMakeRange(0, sourceIndex)];
+          [inserted addIndex:sourceIndex];
           IPPage *page = [IPPage pageWithPhoto:photo];
-          [self.currentSet insertObject:page inPagesAtIndex:currentInsertionPoint];
-          [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-          [self.gridView insertCellAtIndex:currentInsertionPoint];
-          currentInsertionPoint++;
+          [self.currentSet insertObject:page inPagesAtIndex:index];
+          [self.currentSet.parent saveInsertionAtIndex:index 
+                                              inObject:self.currentSet 
+                                                toPath:[IPPortfolio defaultPortfolioPath]];
+          [self.gridView insertCellAtIndex:index];
         }];
       }];
-    }
+    }];
   }
    setPopover:^(UIPopoverController *popover) {
      self.activePopoverController = popover;
@@ -388,7 +532,7 @@ UINavigationControllerDelegate
     [pasteboard setData:pageData forPasteboardType:kIPPasteboardObjectUTI];
     [page deletePhotoFiles];
     [self.currentSet removeObjectFromPagesAtIndex:index];
-    [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+    [self.currentSet.parent saveRemovalAtIndex:index inObject:self.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
     [gridView deleteCellAtIndex:index];
   }
 }
@@ -452,10 +596,12 @@ UINavigationControllerDelegate
     
     IPPage *page = (IPPage *)pasteboardObject.modelObject;
 
-    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page withCompletion:^(void) {
+    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page inLane:IPOptimizationLaneImport withCompletion:^(void) {
 
       [self.currentSet insertObject:page inPagesAtIndex:insertionPoint];
-      [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+      [self.currentSet.parent saveInsertionAtIndex:insertionPoint 
+                                          inObject:self.currentSet 
+                                            toPath:[IPPortfolio defaultPortfolioPath]];
       [gridView insertCellAtIndex:insertionPoint];
     }];
     
@@ -466,17 +612,16 @@ UINavigationControllerDelegate
     //
     
     IPSet *set = (IPSet *)pasteboardObject.modelObject;
-    __block NSUInteger currentInsertionPoint = insertionPoint;
-    for (IPPage *page in set.pages) {
+    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePages:set.pages 
+                                                            inLane:IPOptimizationLaneImport 
+                                                     withInsertion:^(IPPage *page, NSUInteger offset) {
       
-      [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page withCompletion:^(void) {
-        
-        [self.currentSet insertObject:page inPagesAtIndex:currentInsertionPoint];
-        [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-        [gridView insertCellAtIndex:currentInsertionPoint];
-        currentInsertionPoint++;
-      }];
-    }
+      [self.currentSet insertObject:page inPagesAtIndex:insertionPoint + offset];
+      [self.currentSet.parent saveInsertionAtIndex:insertionPoint + offset 
+                                          inObject:self.currentSet 
+                                            toPath:[IPPortfolio defaultPortfolioPath]];
+      [gridView insertCellAtIndex:insertionPoint + offset];
+    }];
     
   } else if (pasteboard.image != nil) {
 
@@ -486,10 +631,12 @@ UINavigationControllerDelegate
     //
 
     IPPage *page = [IPPage pageWithImage:pasteboard.image];
-    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page withCompletion:^(void) {
+    [[IPPhotoOptimizationManager sharedManager] asyncOptimizePage:page inLane:IPOptimizationLaneImport withCompletion:^(void) {
       
       [self.currentSet insertObject:page inPagesAtIndex:insertionPoint];
-      [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+      [self.currentSet.parent saveInsertionAtIndex:insertionPoint 
+                                          inObject:self.currentSet 
+                                            toPath:[IPPortfolio defaultPortfolioPath]];
       [gridView insertCellAtIndex:insertionPoint];
     }];
   }
@@ -528,7 +675,7 @@ UINavigationControllerDelegate
      NSUInteger index = [self.currentSet.pages indexOfObject:page];
      [self.currentSet.pages removeObject:page];
      [gridView deleteCellAtIndex:index];
-     [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+     [self.currentSet.parent saveRemovalAtIndex:index inObject:self.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
    }
    ];
 }
@@ -544,7 +691,10 @@ UINavigationControllerDelegate
   IPPage *page = [self.currentSet objectInPagesAtIndex:initialIndex];
   [self.currentSet removeObjectFromPagesAtIndex:initialIndex];
   [self.currentSet insertObject:page inPagesAtIndex:finalIndex];
-  [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.currentSet.parent saveMoveFromIndex:initialIndex 
+                                    toIndex:finalIndex 
+                                   inObject:self.currentSet 
+                                     toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 #endif
@@ -560,7 +710,9 @@ UINavigationControllerDelegate
   
   self.currentSet.title = textField.text;
   self.navigationItem.title = textField.text;
-  [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.currentSet.parent saveValueForKey:kIPSetTitle 
+                                 ofObject:self.currentSet 
+                                   toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 @end
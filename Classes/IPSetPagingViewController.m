@@ -25,6 +25,8 @@
 #import "IPAlert.h"
 #import "IPPhotoScrollView.h"
 #import "IPPhotoScrollViewCell.h"
+#import "IPPhotoStore.h"
+#import "IPPredecodeWindow.h"
 
 static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
 
@@ -40,6 +42,22 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
 {
   NSUInteger _pageIndexBeforeRotation;
   UICollectionViewFlowLayout *_layout;
+
+  //
+  //  Neighbor pages decoded ahead of time, and what we need to work out how
+  //  fast the user is swiping.
+  //
+
+  IPPredecodeWindow *_predecodeWindow;
+  CGFloat _lastContentOffset;
+  NSTimeInterval _lastScrollTime;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+  
+  [[NSNotificationCenter defaultCenter] removeObserver:self name:IPPortfolioChanged object:nil];
 }
 
 #pragma mark - Properties
@@ -57,10 +75,27 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
   _currentSet = currentSet;
   
   self.portfolio = self.currentSet.parent;
+  _predecodeWindow.photos = [self pagePhotos];
   [self.pagingView setNeedsLayout];
   [self setBackgroundImageName:self.currentSet.parent.backgroundImageName];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The photo shown for each page of |currentSet|, in order.
+//
+
+- (NSArray *)pagePhotos {
+  
+  NSUInteger pageCount = [self.currentSet countOfPages];
+  NSMutableArray *photos = [NSMutableArray arrayWithCapacity:pageCount];
+  for (NSUInteger index = 0; index < pageCount; index++) {
+    
+    [photos addObject:[[self.currentSet objectInPagesAtIndex:index] objectInPhotosAtIndex:0]];
+  }
+  return photos;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  We let people mail the current photo from here.
@@ -107,6 +142,7 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
       //  Add the image.
       //
       
+      [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:thePhoto.filename];
       NSData *photoData = [NSData dataWithContentsOfFile:thePhoto.filename];
       [picker addAttachmentData:photoData mimeType:@"image/jpeg" fileName:@"photo.jpg"];
       
@@ -173,9 +209,20 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
   _pagingView.autoresizingMask = UIViewAutoresizingFlexibleHeight | UIViewAutoresizingFlexibleWidth;
   _pagingView.pagingEnabled = YES;
   _pagingView.dataSource = self;
+  _pagingView.delegate = self;
   [_pagingView registerClass:[IPPhotoScrollViewCell class] forCellWithReuseIdentifier:FBPhotoCellIdentifier];
   
   [self.view addSubview:_pagingView];
+  [[NSNotificationCenter defaultCenter] addObserver:self
+                                           selector:@selector(portfolioChanged:)
+                                               name:IPPortfolioChanged
+                                             object:nil];
+  
+  _predecodeWindow = [[IPPredecodeWindow alloc] init];
+  _predecodeWindow.photos = [self pagePhotos];
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  _predecodeWindow.targetPixelSize = CGSizeMake(self.view.bounds.size.width * scale, 
+                                                self.view.bounds.size.height * scale);
   
   // HACK -- Force the setter logic to work, which will position the scroll view
   [_pagingView layoutIfNeeded];
@@ -208,6 +255,7 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
 
   [super viewDidAppear:animated];
   self.navigationController.navigationBar.translucent = YES;
+  [_predecodeWindow moveToIndex:self.currentPageIndex velocity:0];
   self.pagingView.alpha = 0;
   [UIView animateWithDuration:kIPAnimationViewFade animations:^(void) {
     
@@ -243,6 +291,25 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
                                            animated:YES];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  The portfolio changed without going through us (it may have dropped pages
+//  of this set whose files are gone). Page through what's left.
+//
+
+- (void)portfolioChanged:(NSNotification *)notification {
+  
+  if (notification.object != self.currentSet.parent) {
+    return;
+  }
+  _predecodeWindow.photos = [self pagePhotos];
+  [self.pagingView reloadData];
+  NSUInteger countOfPages = [self.currentSet countOfPages];
+  if (countOfPages > 0 && _currentPageIndex >= countOfPages) {
+    [self setCurrentPageIndex:countOfPages - 1 animated:NO];
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Release retained subviews.
@@ -294,6 +361,9 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
 - (void)willAnimateRotationToInterfaceOrientation:(UIInterfaceOrientation)toInterfaceOrientation duration:(NSTimeInterval)duration {
   
   _layout.itemSize = self.view.bounds.size;
+  CGFloat scale = [[UIScreen mainScreen] scale];
+  _predecodeWindow.targetPixelSize = CGSizeMake(self.view.bounds.size.width * scale, 
+                                                self.view.bounds.size.height * scale);
   [_layout invalidateLayout];
   [_pagingView setNeedsLayout];
   [_pagingView layoutIfNeeded];
@@ -326,6 +396,7 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
   IPPhoto *photo = [page objectInPhotosAtIndex:0];
 
   IPPhotoScrollViewCell *cell = [collectionView dequeueReusableCellWithReuseIdentifier:FBPhotoCellIdentifier forIndexPath:indexPath];
+  cell.photoScrollView.predecodeWindow = _predecodeWindow;
   cell.photoScrollView.photo = photo;
   return cell;
 }
@@ -368,6 +439,32 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
   
   // don't go through the setter, because that would trigger more scrolling.
   _currentPageIndex = indexPath.row;
+  
+  //
+  //  Size the predecode window by how fast pages are going by.
+  //
+  
+  NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+  CGFloat pageWidth = _pagingView.bounds.size.width;
+  CGFloat offset = _pagingView.contentOffset.x;
+  CGFloat pagesPerSecond = 0;
+  if (pageWidth > 0 && now > _lastScrollTime) {
+    
+    pagesPerSecond = (offset - _lastContentOffset) / pageWidth / (now - _lastScrollTime);
+  }
+  _lastContentOffset = offset;
+  _lastScrollTime = now;
+  [_predecodeWindow moveToIndex:_currentPageIndex velocity:pagesPerSecond];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  At rest, the window shrinks back to the nearest neighbors.
+//
+
+- (void)scrollViewDidEndDecelerating:(UIScrollView *)scrollView {
+  
+  [_predecodeWindow moveToIndex:_currentPageIndex velocity:0];
 }
 
 #pragma mark - UITextFieldDelegate
@@ -381,7 +478,9 @@ static NSString * const FBPhotoCellIdentifier = @"FBPhotoCellIdentifier";
   
   IPPage *page = [self.currentSet objectInPagesAtIndex:self.currentPageIndex];
   [page setValue:textField.text forKeyPath:kIPPhotoTitle forPhoto:0];
-  [self.currentSet.parent savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [self.currentSet.parent saveValueForKey:kIPPhotoTitle 
+                                 ofObject:[page objectInPhotosAtIndex:0] 
+                                   toPath:[IPPortfolio defaultPortfolioPath]];
 }
 
 @end
@@ -0,0 +1,78 @@
+//
+//  IPThumbnailFetcher.h
+//  ipad-portfolio
+//
+//  Gets thumbnails decoded off the main thread. An image file that's merely
+//  loaded still has to be inflated, and that happens the first time it's
+//  drawn -- on the main thread, in the middle of a scroll. The fetcher does
+//  the decode on a background queue and hands the cell a bitmap that's ready
+//  to draw. Every fetch returns an NSOperation; a cell cancels it when it
+//  gets reused, and the completion never runs.
+//
+//  It also adds up the time it spent decoding, which is time the main thread
+//  would otherwise have spent, and logs it when a scroll comes to rest.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+@class IPPhoto;
+
+@interface IPThumbnailFetcher : NSObject
+
+//
+//  Decodes done, and the seconds they took, since the last |endScroll|.
+//
+
+@property (nonatomic, readonly) NSUInteger decodeCount;
+@property (nonatomic, readonly) NSTimeInterval decodeTime;
+
++ (IPThumbnailFetcher *)sharedFetcher;
+
+//
+//  Wraps |decode| in an operation that times it and then calls |completion|
+//  with the result on the main thread, unless the operation was cancelled
+//  first. The operation isn't queued; that's up to the caller, for work that
+//  belongs in a particular queue.
+//
+
+- (NSOperation *)operationDecodingImage:(UIImage *(^)(void))decode
+                             completion:(void (^)(UIImage *image))completion;
+
+//
+//  Gets |photo| decoded to |pixelSize| (see |-[IPPhoto
+//  imageDecodedToPixelSize:]|). If it's already in memory, |completion| runs
+//  before this returns and the result is nil. Otherwise the decode is queued
+//  and the operation returned; cancel it if the image is no longer wanted.
+//
+
+- (NSOperation *)fetchImageOfPhoto:(IPPhoto *)photo
+                decodedToPixelSize:(CGSize)pixelSize
+                        completion:(void (^)(UIImage *image))completion;
+
+//
+//  Logs how much decoding was kept off the main thread since the last call,
+//  and starts counting again. Call it when a scroll comes to rest.
+//
+
+- (void)endScroll;
+
+//
+//  Blocks until queued fetches are done. For tests.
+//
+
+- (void)waitUntilFetchesFinish;
+
+@end
@@ -0,0 +1,152 @@
+//
+//  IPThumbnailFetcher.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPThumbnailFetcher.h"
+#import "IPPhoto.h"
+
+@interface IPThumbnailFetcher ()
+
+@property (nonatomic, readwrite) NSUInteger decodeCount;
+@property (nonatomic, readwrite) NSTimeInterval decodeTime;
+@property (nonatomic, strong) NSOperationQueue *fetchQueue;
+
+@end
+
+@implementation IPThumbnailFetcher
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPThumbnailFetcher *)sharedFetcher {
+  
+  static IPThumbnailFetcher *sharedFetcher = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    
+    sharedFetcher = [[IPThumbnailFetcher alloc] init];
+  });
+  return sharedFetcher;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)init {
+  
+  self = [super init];
+  if (self != nil) {
+    
+    _fetchQueue = [[NSOperationQueue alloc] init];
+    _fetchQueue.maxConcurrentOperationCount = 2;
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+  
+  [_fetchQueue cancelAllOperations];
+}
+
+#pragma mark - Fetching
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSOperation *)operationDecodingImage:(UIImage *(^)(void))decode
+                             completion:(void (^)(UIImage *image))completion {
+  
+  decode = [decode copy];
+  completion = [completion copy];
+  NSBlockOperation *decodeOperation = [[NSBlockOperation alloc] init];
+  __weak NSBlockOperation *weakOperation = decodeOperation;
+  [decodeOperation addExecutionBlock:^(void) {
+    
+    if ([weakOperation isCancelled]) {
+      return;
+    }
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    UIImage *image = decode();
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    @synchronized(self) {
+      
+      self.decodeCount++;
+      self.decodeTime += elapsed;
+    }
+    [[NSOperationQueue mainQueue] addOperationWithBlock:^(void) {
+      
+      if (![weakOperation isCancelled] && completion != nil) {
+        
+        completion(image);
+      }
+    }];
+  }];
+  return decodeOperation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSOperation *)fetchImageOfPhoto:(IPPhoto *)photo
+                decodedToPixelSize:(CGSize)pixelSize
+                        completion:(void (^)(UIImage *image))completion {
+  
+  UIImage *cached = [photo cachedImageDecodedToPixelSize:pixelSize];
+  if (cached != nil || photo == nil) {
+    
+    if (completion != nil) {
+      
+      completion(cached);
+    }
+    return nil;
+  }
+  NSOperation *fetchOperation = [self operationDecodingImage:^UIImage *(void) {
+    
+    return [photo imageDecodedToPixelSize:pixelSize];
+    
+  } completion:completion];
+  [self.fetchQueue addOperation:fetchOperation];
+  return fetchOperation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)endScroll {
+  
+  NSUInteger count;
+  NSTimeInterval time;
+  @synchronized(self) {
+    
+    count = self.decodeCount;
+    time = self.decodeTime;
+    self.decodeCount = 0;
+    self.decodeTime = 0;
+  }
+  if (count > 0) {
+    
+    DDLogVerbose(@"%s -- %.1fms of decoding kept off the main thread for %d images this scroll",
+                 __PRETTY_FUNCTION__,
+                 time * 1000,
+                 count);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilFetchesFinish {
+  
+  [self.fetchQueue waitUntilAllOperationsAreFinished];
+}
+
+@end
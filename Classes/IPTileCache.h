@@ -0,0 +1,123 @@
+//
+//  IPTileCache.h
+//  ipad-portfolio
+//
+//  Decoded tiles, shared by every tiling view. The pixels are held by an
+//  IPImageMemoryManager, so tiles compete for the same budget as every other
+//  decoded image and are the first to go under memory pressure. Safe to use
+//  from any thread; CATiledLayer draws on several at once.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+@class IPTilePyramid;
+@class IPImageMemoryManager;
+
+@interface IPTileCache : NSObject
+
+@property (nonatomic, readonly, strong) IPImageMemoryManager *memoryManager;
+
+//
+//  The budget of |memoryManager|, which tiles share with other images.
+//
+
+@property (nonatomic, readonly) NSUInteger byteLimit;
+
+//
+//  Bytes of decoded tiles currently held.
+//
+
+@property (nonatomic, readonly) NSUInteger currentBytes;
+
+//
+//  Lookups through |tileFromPyramid:...| that found the tile already decoded,
+//  and those that had to decode it. Prefetches count as neither.
+//
+
+@property (nonatomic, readonly) NSUInteger hits;
+@property (nonatomic, readonly) NSUInteger misses;
+
+//
+//  hits / (hits + misses), or 0 before any lookups.
+//
+
+@property (nonatomic, readonly) CGFloat hitRate;
+
+//
+//  Tiles decoded ahead of time by |prefetchTilesFromPyramid:...|.
+//
+
+@property (nonatomic, readonly) NSUInteger prefetches;
+
+//
+//  Holds its tiles in the shared IPImageMemoryManager.
+//
+
++ (IPTileCache *)sharedCache;
+
+- (id)initWithMemoryManager:(IPImageMemoryManager *)memoryManager;
+
+//
+//  Holds its tiles in a memory manager of its own. For tests.
+//
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit;
+
+//
+//  A fully decoded tile, from the cache if possible. Returns nil if the
+//  pyramid doesn't have the tile.
+//
+
+- (UIImage *)tileFromPyramid:(IPTilePyramid *)pyramid
+                       level:(NSUInteger)level
+                         row:(NSUInteger)row
+                      column:(NSUInteger)column;
+
+//
+//  Decodes the tiles in |rows| x |columns| of |level| in the background, so
+//  they're ready by the time they get drawn. Out-of-range tiles and tiles
+//  already cached get skipped.
+//
+
+- (void)prefetchTilesFromPyramid:(IPTilePyramid *)pyramid
+                           level:(NSUInteger)level
+                            rows:(NSRange)rows
+                         columns:(NSRange)columns;
+
+//
+//  Blocks until queued prefetches finish. For tests.
+//
+
+- (void)waitUntilPrefetchesFinish;
+
+//
+//  Forgets queued prefetches that haven't started, e.g. when the viewport
+//  moves on before they run.
+//
+
+- (void)cancelPrefetches;
+
+//
+//  Drops the tiles of the pyramid at |path|, e.g. when its photo is deleted.
+//
+
+- (void)removeTilesForPyramidAtPath:(NSString *)path;
+
+- (void)removeAllTiles;
+
+- (void)resetCounters;
+
+@end
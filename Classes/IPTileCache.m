@@ -0,0 +1,282 @@
+//
+//  IPTileCache.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPTileCache.h"
+#import "IPTilePyramid.h"
+#import "IPImageMemoryManager.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Identifies one tile of one pyramid in the memory manager. Everything for
+//  a pyramid starts with |IPTileKeyPrefix(path)|.
+//
+
+static NSString *IPTileKeyPrefix(NSString *path) {
+
+  return [NSString stringWithFormat:@"tile|%@|", path];
+}
+
+static NSString *IPTileKey(NSString *path, NSUInteger level, NSUInteger row, NSUInteger column) {
+
+  return [NSString stringWithFormat:@"tile|%@|%d|%d|%d", path, level, row, column];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Draws |image| into a bitmap, so drawing it later doesn't decode.
+//
+
+static UIImage *IPDecodedTile(UIImage *image) {
+
+  CGImageRef source = [image CGImage];
+  if (source == NULL) {
+
+    return nil;
+  }
+  size_t width = CGImageGetWidth(source);
+  size_t height = CGImageGetHeight(source);
+  CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef bitmap = CGBitmapContextCreate(NULL,
+                                              width,
+                                              height,
+                                              8,
+                                              0,
+                                              rgbColorSpace,
+                                              kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+  CGColorSpaceRelease(rgbColorSpace);
+  if (bitmap == NULL) {
+
+    return nil;
+  }
+  CGContextDrawImage(bitmap, CGRectMake(0, 0, width, height), source);
+  CGImageRef decoded = CGBitmapContextCreateImage(bitmap);
+  CGContextRelease(bitmap);
+  UIImage *tile = [UIImage imageWithCGImage:decoded];
+  CGImageRelease(decoded);
+  return tile;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPTileCache ()
+
+@property (nonatomic, readwrite, strong) IPImageMemoryManager *memoryManager;
+@property (nonatomic, readwrite) NSUInteger hits;
+@property (nonatomic, readwrite) NSUInteger misses;
+@property (nonatomic, readwrite) NSUInteger prefetches;
+@property (nonatomic, strong) NSOperationQueue *prefetchQueue;
+
+@end
+
+@implementation IPTileCache
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPTileCache *)sharedCache {
+
+  static IPTileCache *sharedCache = nil;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+
+    sharedCache = [[IPTileCache alloc] initWithMemoryManager:[IPImageMemoryManager sharedManager]];
+  });
+  return sharedCache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithMemoryManager:(IPImageMemoryManager *)memoryManager {
+
+  self = [super init];
+  if (self != nil) {
+
+    _memoryManager = memoryManager;
+    _prefetchQueue = [[NSOperationQueue alloc] init];
+    _prefetchQueue.maxConcurrentOperationCount = 2;
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithByteLimit:(NSUInteger)byteLimit {
+
+  return [self initWithMemoryManager:[[IPImageMemoryManager alloc] initWithByteLimit:byteLimit]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  [_prefetchQueue cancelAllOperations];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)byteLimit {
+
+  return self.memoryManager.byteLimit;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSUInteger)currentBytes {
+
+  return [self.memoryManager bytesOfKind:IPImageMemoryKindTile];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (CGFloat)hitRate {
+
+  @synchronized(self) {
+
+    NSUInteger lookups = self.hits + self.misses;
+    return (lookups == 0) ? 0 : (CGFloat)self.hits / lookups;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Decodes a tile and hands it to the memory manager.
+//
+
+- (UIImage *)decodeTileFromPyramid:(IPTilePyramid *)pyramid
+                             level:(NSUInteger)level
+                               row:(NSUInteger)row
+                            column:(NSUInteger)column
+                               key:(NSString *)key {
+
+  UIImage *tile = IPDecodedTile([pyramid tileAtLevel:level row:row column:column]);
+  if (tile == nil) {
+
+    return nil;
+  }
+  [self.memoryManager setImage:tile forKey:key kind:IPImageMemoryKindTile];
+  return tile;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)tileFromPyramid:(IPTilePyramid *)pyramid
+                       level:(NSUInteger)level
+                         row:(NSUInteger)row
+                      column:(NSUInteger)column {
+
+  if (pyramid == nil) {
+
+    return nil;
+  }
+  NSString *key = IPTileKey(pyramid.path, level, row, column);
+  UIImage *tile = [self.memoryManager imageForKey:key];
+  @synchronized(self) {
+
+    if (tile != nil) {
+
+      self.hits++;
+      return tile;
+    }
+    self.misses++;
+  }
+  return [self decodeTileFromPyramid:pyramid level:level row:row column:column key:key];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)prefetchTilesFromPyramid:(IPTilePyramid *)pyramid
+                           level:(NSUInteger)level
+                            rows:(NSRange)rows
+                         columns:(NSRange)columns {
+
+  if (pyramid == nil || level >= pyramid.levelCount) {
+
+    return;
+  }
+  NSUInteger lastRow = MIN(NSMaxRange(rows), [pyramid rowsAtLevel:level]);
+  NSUInteger lastColumn = MIN(NSMaxRange(columns), [pyramid columnsAtLevel:level]);
+  for (NSUInteger row = rows.location; row < lastRow; row++) {
+
+    for (NSUInteger column = columns.location; column < lastColumn; column++) {
+
+      NSString *key = IPTileKey(pyramid.path, level, row, column);
+      if ([self.memoryManager containsImageForKey:key]) {
+
+        continue;
+      }
+      [self.prefetchQueue addOperationWithBlock:^{
+
+        if ([self.memoryManager containsImageForKey:key]) {
+
+          return;
+        }
+        @synchronized(self) {
+
+          self.prefetches++;
+        }
+        [self decodeTileFromPyramid:pyramid level:level row:row column:column key:key];
+      }];
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)waitUntilPrefetchesFinish {
+
+  [self.prefetchQueue waitUntilAllOperationsAreFinished];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)cancelPrefetches {
+
+  [self.prefetchQueue cancelAllOperations];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeTilesForPyramidAtPath:(NSString *)path {
+
+  if (path == nil) {
+
+    return;
+  }
+  [self.memoryManager removeImagesWithKeyPrefix:IPTileKeyPrefix(path)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)removeAllTiles {
+
+  [self.memoryManager removeImagesOfKind:IPImageMemoryKindTile];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)resetCounters {
+
+  @synchronized(self) {
+
+    self.hits = 0;
+    self.misses = 0;
+    self.prefetches = 0;
+  }
+}
+
+@end
@@ -0,0 +1,68 @@
+//
+//  IPTileEncoder.h
+//  ipad-portfolio
+//
+//  JPEG-encodes the tiles of a pyramid on several cores at once. Tiles of a
+//  row get encoded in parallel but reach the pyramid writer in column order,
+//  so the file comes out the same no matter how many encodes ran at once.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+
+//
+//  How much memory in-flight encodes may use, in total, by default.
+//
+
+#define kIPTileEncoderDefaultMemoryBudget   (32 * 1024 * 1024)
+#define kIPTileEncoderJPEGQuality           0.8
+
+@class IPTilePyramidWriter;
+
+@interface IPTileEncoder : NSObject
+
+@property (nonatomic, readonly) NSUInteger maxConcurrentEncodes;
+
+//
+//  How many encodes of |tileSize| tiles fit in |memoryBudget|, capped at the
+//  number of cores and at least 1.
+//
+
++ (NSUInteger)maxConcurrentEncodesForTileSize:(NSUInteger)tileSize memoryBudget:(NSUInteger)memoryBudget;
+
+//
+//  Designated initializer.
+//
+
+- (id)initWithMaxConcurrentEncodes:(NSUInteger)maxConcurrentEncodes;
+
+//
+//  An encoder sized for |tileSize| tiles within the default memory budget.
+//
+
+- (id)initWithTileSize:(NSUInteger)tileSize;
+
+//
+//  Cuts |band| (one row of tiles: full level width, one tile tall or less)
+//  into tiles and adds them to |writer| as row |row| of |level|. Returns
+//  once every tile is written.
+//
+
+- (BOOL)addRowOfTiles:(CGImageRef)band
+                  row:(NSUInteger)row
+                level:(NSUInteger)level
+            toPyramid:(IPTilePyramidWriter *)writer;
+
+@end
@@ -0,0 +1,146 @@
+//
+//  IPTileEncoder.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <UIKit/UIKit.h>
+#import "IPTileEncoder.h"
+#import "IPTilePyramid.h"
+
+@interface IPTileEncoder ()
+
+@property (nonatomic, readwrite) NSUInteger maxConcurrentEncodes;
+
+//
+//  One count per encode allowed in flight.
+//
+
+@property (nonatomic, strong) dispatch_semaphore_t slots;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPTileEncoder
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  An encode holds the cropped tile's pixels while UIKit reads them, plus
+//  the JPEG output; budget two tiles' worth of pixels for each.
+//
+
++ (NSUInteger)maxConcurrentEncodesForTileSize:(NSUInteger)tileSize memoryBudget:(NSUInteger)memoryBudget {
+
+  NSUInteger bytesPerEncode = MAX(1, tileSize * tileSize * 4 * 2);
+  NSUInteger cores = [[NSProcessInfo processInfo] activeProcessorCount];
+  return MAX(1, MIN(cores, memoryBudget / bytesPerEncode));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithMaxConcurrentEncodes:(NSUInteger)maxConcurrentEncodes {
+
+  self = [super init];
+  if (self != nil) {
+
+    _maxConcurrentEncodes = MAX(1, maxConcurrentEncodes);
+    _slots = dispatch_semaphore_create(_maxConcurrentEncodes);
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (id)initWithTileSize:(NSUInteger)tileSize {
+
+  return [self initWithMaxConcurrentEncodes:[IPTileEncoder maxConcurrentEncodesForTileSize:tileSize
+                                                                             memoryBudget:kIPTileEncoderDefaultMemoryBudget]];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)addRowOfTiles:(CGImageRef)band
+                  row:(NSUInteger)row
+                level:(NSUInteger)level
+            toPyramid:(IPTilePyramidWriter *)writer {
+
+  NSUInteger columns = [writer columnsAtLevel:level];
+  CGFloat tileSize = writer.tileSize;
+  CGFloat width = CGImageGetWidth(band);
+  CGFloat height = CGImageGetHeight(band);
+
+  //
+  //  Slot |column| gets that tile's JPEG bytes, or stays NSNull on failure.
+  //
+
+  NSMutableArray *encoded = [NSMutableArray arrayWithCapacity:columns];
+  for (NSUInteger column = 0; column < columns; column++) {
+
+    [encoded addObject:[NSNull null]];
+  }
+
+  dispatch_group_t group = dispatch_group_create();
+  dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+  for (NSUInteger column = 0; column < columns; column++) {
+
+    //
+    //  Don't queue more than the budget allows; the rest wait here.
+    //
+
+    dispatch_semaphore_wait(self.slots, DISPATCH_TIME_FOREVER);
+    dispatch_group_async(group, queue, ^{
+
+      @autoreleasepool {
+
+        CGRect tileRect = CGRectMake(column * tileSize, 0, MIN(tileSize, width - column * tileSize), height);
+        CGImageRef tile = CGImageCreateWithImageInRect(band, tileRect);
+        NSData *tileData = nil;
+        if (tile != NULL) {
+
+          tileData = UIImageJPEGRepresentation([UIImage imageWithCGImage:tile], kIPTileEncoderJPEGQuality);
+          CGImageRelease(tile);
+        }
+        if (tileData != nil) {
+
+          @synchronized(encoded) {
+
+            encoded[column] = tileData;
+          }
+        }
+      }
+      dispatch_semaphore_signal(self.slots);
+    });
+  }
+  dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+  //
+  //  Ordered completion: append in column order.
+  //
+
+  for (NSUInteger column = 0; column < columns; column++) {
+
+    NSData *tileData = encoded[column];
+    if ((id)tileData == [NSNull null] ||
+        ![writer addTileData:tileData level:level row:row column:column]) {
+
+      return NO;
+    }
+  }
+  return YES;
+}
+
+@end
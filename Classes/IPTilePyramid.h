@@ -0,0 +1,125 @@
+//
+//  IPTilePyramid.h
+//  ipad-portfolio
+//
+//  A single file holding every tile of every level of detail for one photo.
+//  The file starts with a fixed-size header and a table of tile offsets, so
+//  a reader can map it once and find any tile with pointer arithmetic.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import <UIKit/UIKit.h>
+
+#define kIPTilePyramidPathExtension   @"tiles"
+#define kIPTilePyramidMaxLevels       16
+
+//
+//  Level 0 is full resolution. Each level after that is half the size of the
+//  one before, and the last level fits in a single tile. Tiles are square
+//  except along the right and bottom edges.
+//
+
+@interface IPTilePyramid : NSObject
+
+@property (nonatomic, readonly, copy) NSString *path;
+@property (nonatomic, readonly) CGSize imageSize;
+@property (nonatomic, readonly) NSUInteger tileSize;
+@property (nonatomic, readonly) NSUInteger levelCount;
+
+//
+//  Maps the pyramid at |path|. Returns nil if there's no file there or it
+//  isn't a complete, well-formed pyramid.
+//
+
++ (IPTilePyramid *)pyramidWithContentsOfFile:(NSString *)path;
+
+//
+//  How many levels an image of |imageSize| gets with |tileSize| tiles.
+//
+
++ (NSUInteger)levelCountForImageSize:(CGSize)imageSize tileSize:(NSUInteger)tileSize;
+
+//
+//  The pixel size of |level| for an image of |imageSize|.
+//
+
++ (CGSize)sizeOfLevel:(NSUInteger)level forImageSize:(CGSize)imageSize;
+
+//
+//  The level to draw for a display |scale| (1.0, 0.5, 0.25, ...), rounded to
+//  the nearest power of two.
+//
+
++ (NSUInteger)levelForScale:(CGFloat)scale;
+
+- (NSUInteger)columnsAtLevel:(NSUInteger)level;
+- (NSUInteger)rowsAtLevel:(NSUInteger)level;
+
+//
+//  The encoded (JPEG) bytes of a tile, or nil if out of range.
+//
+
+- (NSData *)tileDataAtLevel:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column;
+
+//
+//  A tile as an image. The image reads straight from the mapped file; no
+//  bytes get copied.
+//
+
+- (UIImage *)tileAtLevel:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column;
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+//
+//  Builds a pyramid file. Tiles may be added in any order, from any thread.
+//  Nothing shows up at |path| until |finish| succeeds.
+//
+
+@interface IPTilePyramidWriter : NSObject
+
+@property (nonatomic, readonly, copy) NSString *path;
+@property (nonatomic, readonly) CGSize imageSize;
+@property (nonatomic, readonly) NSUInteger tileSize;
+@property (nonatomic, readonly) NSUInteger levelCount;
+
+- (id)initWithPath:(NSString *)path imageSize:(CGSize)imageSize tileSize:(NSUInteger)tileSize;
+
+- (NSUInteger)columnsAtLevel:(NSUInteger)level;
+- (NSUInteger)rowsAtLevel:(NSUInteger)level;
+
+//
+//  Appends one encoded tile. Returns NO on a write error or a bad position.
+//
+
+- (BOOL)addTileData:(NSData *)data level:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column;
+
+//
+//  Writes the header and offset table and moves the file into place. Fails
+//  if any tile is missing.
+//
+
+- (BOOL)finish;
+
+//
+//  Throws away a partly-written pyramid.
+//
+
+- (void)cancel;
+
+@end
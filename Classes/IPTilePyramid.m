@@ -0,0 +1,546 @@
+//
+//  IPTilePyramid.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "IPTilePyramid.h"
+
+//
+//  On-disk layout. All integers are little-endian.
+//
+//    IPTilePyramidHeader       fixed size
+//    IPTilePyramidEntry[]      one per tile, levels in order, row-major
+//    tile data                 JPEG bytes, in whatever order they were added
+//
+//  A zero-length entry means the tile was never written; readers reject such
+//  files.
+//
+
+#define kIPTilePyramidMagic     0x50545049    // "IPTP"
+#define kIPTilePyramidVersion   1
+
+typedef struct {
+  uint32_t columns;
+  uint32_t rows;
+  uint32_t firstEntry;
+  uint32_t reserved;
+} IPTilePyramidLevel;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t tileSize;
+  uint32_t levelCount;
+  uint32_t entryCount;
+  uint32_t reserved;
+  IPTilePyramidLevel levels[kIPTilePyramidMaxLevels];
+} IPTilePyramidHeader;
+
+typedef struct {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t reserved;
+} IPTilePyramidEntry;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Fills in |header| for the given geometry, in host byte order. Returns NO
+//  if the image needs more levels than the format allows.
+//
+
+static BOOL IPTilePyramidLayout(IPTilePyramidHeader *header, CGSize imageSize, NSUInteger tileSize) {
+
+  memset(header, 0, sizeof(*header));
+  NSUInteger levelCount = [IPTilePyramid levelCountForImageSize:imageSize tileSize:tileSize];
+  if (levelCount == 0 || levelCount > kIPTilePyramidMaxLevels) {
+
+    return NO;
+  }
+  header->magic      = kIPTilePyramidMagic;
+  header->version    = kIPTilePyramidVersion;
+  header->width      = imageSize.width;
+  header->height     = imageSize.height;
+  header->tileSize   = tileSize;
+  header->levelCount = levelCount;
+  uint32_t entry = 0;
+  for (NSUInteger level = 0; level < levelCount; level++) {
+
+    CGSize levelSize = [IPTilePyramid sizeOfLevel:level forImageSize:imageSize];
+    header->levels[level].columns    = ceilf(levelSize.width / tileSize);
+    header->levels[level].rows       = ceilf(levelSize.height / tileSize);
+    header->levels[level].firstEntry = entry;
+    entry += header->levels[level].columns * header->levels[level].rows;
+  }
+  header->entryCount = entry;
+  return YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Index of a tile in the entry table, or NSNotFound.
+//
+
+static NSUInteger IPTilePyramidEntryIndex(const IPTilePyramidHeader *header,
+                                          NSUInteger level,
+                                          NSUInteger row,
+                                          NSUInteger column) {
+
+  if (level >= header->levelCount) {
+
+    return NSNotFound;
+  }
+  const IPTilePyramidLevel *levelInfo = &header->levels[level];
+  if (row >= levelInfo->rows || column >= levelInfo->columns) {
+
+    return NSNotFound;
+  }
+  return levelInfo->firstEntry + row * levelInfo->columns + column;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void IPTilePyramidSwapHeader(IPTilePyramidHeader *header) {
+
+  uint32_t *words = (uint32_t *)header;
+  for (size_t i = 0; i < sizeof(*header) / sizeof(uint32_t); i++) {
+
+    words[i] = CFSwapInt32(words[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Releases the mapping that backs a tile's data provider.
+//
+
+static void IPTilePyramidReleaseMapping(void *info, const void *data, size_t size) {
+
+  CFRelease(info);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPTilePyramid ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+@property (nonatomic, strong) NSData *mapping;
+
+@end
+
+@implementation IPTilePyramid {
+
+  //
+  //  Header, converted to host byte order.
+  //
+
+  IPTilePyramidHeader _header;
+
+  //
+  //  Points into |mapping|.
+  //
+
+  const IPTilePyramidEntry *_entries;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSUInteger)levelCountForImageSize:(CGSize)imageSize tileSize:(NSUInteger)tileSize {
+
+  if (tileSize == 0 || imageSize.width < 1 || imageSize.height < 1) {
+
+    return 0;
+  }
+  NSUInteger levelCount = 1;
+  CGFloat longEdge = MAX(imageSize.width, imageSize.height);
+  while (longEdge > tileSize) {
+
+    longEdge = ceilf(longEdge / 2);
+    levelCount++;
+  }
+  return levelCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (CGSize)sizeOfLevel:(NSUInteger)level forImageSize:(CGSize)imageSize {
+
+  CGFloat divisor = (CGFloat)(1 << level);
+  return CGSizeMake(MAX(1, ceilf(imageSize.width / divisor)),
+                    MAX(1, ceilf(imageSize.height / divisor)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (NSUInteger)levelForScale:(CGFloat)scale {
+
+  if (scale >= 1.0 || scale <= 0) {
+
+    return 0;
+  }
+  return (NSUInteger)roundf(-log2f(scale));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
++ (IPTilePyramid *)pyramidWithContentsOfFile:(NSString *)path {
+
+  NSData *mapping = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:NULL];
+  if (mapping == nil) {
+
+    return nil;
+  }
+  IPTilePyramid *pyramid = [[IPTilePyramid alloc] init];
+  pyramid.path = path;
+  pyramid.mapping = mapping;
+  if (![pyramid validate]) {
+
+    DDLogError(@"%s -- %@ is not a valid tile pyramid", __PRETTY_FUNCTION__, path);
+    return nil;
+  }
+  return pyramid;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Reads the header and checks that the file is complete. Everything after
+//  this trusts the header and the entry table.
+//
+
+- (BOOL)validate {
+
+  if ([self.mapping length] < sizeof(IPTilePyramidHeader)) {
+
+    return NO;
+  }
+  memcpy(&_header, [self.mapping bytes], sizeof(_header));
+  if (CFByteOrderGetCurrent() == CFByteOrderBigEndian) {
+
+    IPTilePyramidSwapHeader(&_header);
+  }
+  IPTilePyramidHeader expected;
+  if (_header.magic != kIPTilePyramidMagic ||
+      _header.version != kIPTilePyramidVersion ||
+      !IPTilePyramidLayout(&expected, CGSizeMake(_header.width, _header.height), _header.tileSize) ||
+      memcmp(&expected, &_header, sizeof(expected)) != 0) {
+
+    return NO;
+  }
+  NSUInteger tableEnd = sizeof(IPTilePyramidHeader) + _header.entryCount * sizeof(IPTilePyramidEntry);
+  if ([self.mapping length] < tableEnd) {
+
+    return NO;
+  }
+  _entries = (const IPTilePyramidEntry *)((const uint8_t *)[self.mapping bytes] + sizeof(IPTilePyramidHeader));
+  for (NSUInteger i = 0; i < _header.entryCount; i++) {
+
+    uint64_t offset = CFSwapInt64LittleToHost(_entries[i].offset);
+    uint32_t length = CFSwapInt32LittleToHost(_entries[i].length);
+    if (length == 0 || offset < tableEnd || offset + length > [self.mapping length]) {
+
+      return NO;
+    }
+  }
+  return YES;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (CGSize)imageSize {
+
+  return CGSizeMake(_header.width, _header.height);
+}
+
+- (NSUInteger)tileSize {
+
+  return _header.tileSize;
+}
+
+- (NSUInteger)levelCount {
+
+  return _header.levelCount;
+}
+
+- (NSUInteger)columnsAtLevel:(NSUInteger)level {
+
+  return (level < _header.levelCount) ? _header.levels[level].columns : 0;
+}
+
+- (NSUInteger)rowsAtLevel:(NSUInteger)level {
+
+  return (level < _header.levelCount) ? _header.levels[level].rows : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Where a tile's bytes live in the mapping. Returns NULL if out of range.
+//
+
+- (const void *)bytesOfTileAtLevel:(NSUInteger)level
+                               row:(NSUInteger)row
+                            column:(NSUInteger)column
+                            length:(size_t *)length {
+
+  NSUInteger index = IPTilePyramidEntryIndex(&_header, level, row, column);
+  if (index == NSNotFound) {
+
+    return NULL;
+  }
+  *length = CFSwapInt32LittleToHost(_entries[index].length);
+  return (const uint8_t *)[self.mapping bytes] + CFSwapInt64LittleToHost(_entries[index].offset);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSData *)tileDataAtLevel:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column {
+
+  size_t length;
+  const void *bytes = [self bytesOfTileAtLevel:level row:row column:column length:&length];
+  if (bytes == NULL) {
+
+    return nil;
+  }
+  return [NSData dataWithBytes:bytes length:length];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (UIImage *)tileAtLevel:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column {
+
+  size_t length;
+  const void *bytes = [self bytesOfTileAtLevel:level row:row column:column length:&length];
+  if (bytes == NULL) {
+
+    return nil;
+  }
+
+  //
+  //  The provider keeps the mapping alive for as long as the image needs it.
+  //
+
+  CGDataProviderRef provider = CGDataProviderCreateWithData((void *)CFBridgingRetain(self.mapping),
+                                                            bytes,
+                                                            length,
+                                                            IPTilePyramidReleaseMapping);
+  CGImageRef tile = CGImageCreateWithJPEGDataProvider(provider, NULL, YES, kCGRenderingIntentDefault);
+  CGDataProviderRelease(provider);
+  if (tile == NULL) {
+
+    return nil;
+  }
+  UIImage *image = [UIImage imageWithCGImage:tile];
+  CGImageRelease(tile);
+  return image;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPTilePyramidWriter ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+@property (nonatomic, copy) NSString *partialPath;
+@property (nonatomic, strong) NSFileHandle *fileHandle;
+
+@end
+
+@implementation IPTilePyramidWriter {
+
+  IPTilePyramidHeader _header;
+  IPTilePyramidEntry *_entries;
+  uint64_t _endOfFile;
+  BOOL _failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Designated initializer. Reserves room for the header and the entry table
+//  at the front of a temporary file.
+//
+
+- (id)initWithPath:(NSString *)path imageSize:(CGSize)imageSize tileSize:(NSUInteger)tileSize {
+
+  self = [super init];
+  if (self != nil) {
+
+    if (!IPTilePyramidLayout(&_header, imageSize, tileSize)) {
+
+      return nil;
+    }
+    _path = [path copy];
+    _partialPath = [path stringByAppendingPathExtension:@"partial"];
+    _entries = calloc(_header.entryCount, sizeof(IPTilePyramidEntry));
+    _endOfFile = sizeof(IPTilePyramidHeader) + _header.entryCount * sizeof(IPTilePyramidEntry);
+
+    NSMutableData *reserved = [NSMutableData dataWithLength:(NSUInteger)_endOfFile];
+    if (![reserved writeToFile:_partialPath atomically:NO]) {
+
+      DDLogError(@"%s -- unable to create %@", __PRETTY_FUNCTION__, _partialPath);
+      return nil;
+    }
+    _fileHandle = [NSFileHandle fileHandleForUpdatingAtPath:_partialPath];
+    [_fileHandle seekToEndOfFile];
+  }
+  return self;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)dealloc {
+
+  if (_fileHandle != nil) {
+
+    [_fileHandle closeFile];
+    [[NSFileManager defaultManager] removeItemAtPath:_partialPath error:NULL];
+  }
+  free(_entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (CGSize)imageSize {
+
+  return CGSizeMake(_header.width, _header.height);
+}
+
+- (NSUInteger)tileSize {
+
+  return _header.tileSize;
+}
+
+- (NSUInteger)levelCount {
+
+  return _header.levelCount;
+}
+
+- (NSUInteger)columnsAtLevel:(NSUInteger)level {
+
+  return (level < _header.levelCount) ? _header.levels[level].columns : 0;
+}
+
+- (NSUInteger)rowsAtLevel:(NSUInteger)level {
+
+  return (level < _header.levelCount) ? _header.levels[level].rows : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)addTileData:(NSData *)data level:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column {
+
+  NSUInteger index = IPTilePyramidEntryIndex(&_header, level, row, column);
+  if (index == NSNotFound || [data length] == 0 || [data length] > UINT32_MAX) {
+
+    return NO;
+  }
+  @synchronized(self) {
+
+    if (self.fileHandle == nil || _failed) {
+
+      return NO;
+    }
+    @try {
+
+      [self.fileHandle writeData:data];
+    }
+    @catch (NSException *exception) {
+
+      DDLogError(@"%s -- write failed: %@", __PRETTY_FUNCTION__, exception);
+      _failed = YES;
+      return NO;
+    }
+    _entries[index].offset = CFSwapInt64HostToLittle(_endOfFile);
+    _entries[index].length = CFSwapInt32HostToLittle((uint32_t)[data length]);
+    _endOfFile += [data length];
+    return YES;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)finish {
+
+  @synchronized(self) {
+
+    if (self.fileHandle == nil) {
+
+      return NO;
+    }
+    for (NSUInteger i = 0; i < _header.entryCount; i++) {
+
+      if (_entries[i].length == 0) {
+
+        DDLogError(@"%s -- tile %d of %@ is missing", __PRETTY_FUNCTION__, i, self.path);
+        _failed = YES;
+        break;
+      }
+    }
+    if (_failed) {
+
+      [self cancel];
+      return NO;
+    }
+    IPTilePyramidHeader header = _header;
+    if (CFByteOrderGetCurrent() == CFByteOrderBigEndian) {
+
+      IPTilePyramidSwapHeader(&header);
+    }
+    @try {
+
+      [self.fileHandle seekToFileOffset:0];
+      [self.fileHandle writeData:[NSData dataWithBytes:&header length:sizeof(header)]];
+      [self.fileHandle writeData:[NSData dataWithBytes:_entries
+                                                length:_header.entryCount * sizeof(IPTilePyramidEntry)]];
+      [self.fileHandle synchronizeFile];
+    }
+    @catch (NSException *exception) {
+
+      DDLogError(@"%s -- write failed: %@", __PRETTY_FUNCTION__, exception);
+      [self cancel];
+      return NO;
+    }
+    [self.fileHandle closeFile];
+    self.fileHandle = nil;
+
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    [fileManager removeItemAtPath:self.path error:NULL];
+    if (![fileManager moveItemAtPath:self.partialPath toPath:self.path error:NULL]) {
+
+      DDLogError(@"%s -- unable to move %@ into place", __PRETTY_FUNCTION__, self.path);
+      [fileManager removeItemAtPath:self.partialPath error:NULL];
+      return NO;
+    }
+    return YES;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)cancel {
+
+  @synchronized(self) {
+
+    [self.fileHandle closeFile];
+    self.fileHandle = nil;
+    [[NSFileManager defaultManager] removeItemAtPath:self.partialPath error:NULL];
+  }
+}
+
+@end
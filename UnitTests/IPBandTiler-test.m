@@ -0,0 +1,78 @@
+//
+//  IPBandTiler-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPBandTiler.h"
+#import "IPTilePyramid.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestPyramidName = @"IPBandTilerTest.tiles";
+
+@interface IPBandTiler_test : SenTestCase
+
+@end
+
+@implementation IPBandTiler_test
+
+//
+//  Streams the test image into a pyramid. Every tile of every level should
+//  be there with the right dimensions, and the band buffers should be a
+//  small fraction of the decoded image.
+//
+
+- (void)testTileImage {
+
+  NSString *sourcePath = [kTestMediumImage asPathInBundlePath];
+  NSString *pyramidPath = [kTestPyramidName asPathInCachesFolder];
+  UIImage *source = [UIImage imageWithContentsOfFile:sourcePath];
+  CGSize imageSize = CGSizeMake(CGImageGetWidth([source CGImage]), CGImageGetHeight([source CGImage]));
+  source = nil;
+
+  STAssertTrue([IPBandTiler canTileImageAtPath:sourcePath], nil);
+  IPBandTiler *tiler = [[IPBandTiler alloc] init];
+  STAssertTrue([tiler tileImageAtPath:sourcePath toPyramidAtPath:pyramidPath tileSize:768], nil);
+
+  IPTilePyramid *pyramid = [IPTilePyramid pyramidWithContentsOfFile:pyramidPath];
+  STAssertNotNil(pyramid, nil);
+  STAssertEquals(imageSize, pyramid.imageSize, nil);
+  STAssertEquals([IPTilePyramid levelCountForImageSize:imageSize tileSize:768], pyramid.levelCount, nil);
+
+  for (NSUInteger level = 0; level < pyramid.levelCount; level++) {
+
+    CGSize levelSize = [IPTilePyramid sizeOfLevel:level forImageSize:imageSize];
+    NSUInteger lastRow = [pyramid rowsAtLevel:level] - 1;
+    NSUInteger lastColumn = [pyramid columnsAtLevel:level] - 1;
+    UIImage *first = [pyramid tileAtLevel:level row:0 column:0];
+    UIImage *last = [pyramid tileAtLevel:level row:lastRow column:lastColumn];
+    STAssertEquals(MIN((CGFloat)768, levelSize.width), first.size.width, @"Level %d", level);
+    STAssertEquals(MIN((CGFloat)768, levelSize.height), first.size.height, @"Level %d", level);
+    STAssertEquals(levelSize.width - lastColumn * 768, last.size.width, @"Level %d", level);
+    STAssertEquals(levelSize.height - lastRow * 768, last.size.height, @"Level %d", level);
+  }
+
+  NSUInteger imageBytes = imageSize.width * imageSize.height * 4;
+  NSLog(@"%s -- band buffers %.1f MB for a %.1f MB image",
+        __PRETTY_FUNCTION__,
+        tiler.peakBandBytes / (1024.0 * 1024.0),
+        imageBytes / (1024.0 * 1024.0));
+  STAssertTrue(tiler.peakBandBytes < imageBytes / 2, nil);
+  [[NSFileManager defaultManager] removeItemAtPath:pyramidPath error:NULL];
+}
+
+@end
@@ -0,0 +1,106 @@
+//
+//  IPDecoratedThumbnailCache-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPDecoratedThumbnailCache.h"
+#import "IPDerivedFileIndex.h"
+#import "IPImageMemoryManager.h"
+#import "IPPhoto.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestDirectory = @"IPDecoratedThumbnailCacheTest";
+
+@interface IPDecoratedThumbnailCache_test : SenTestCase
+
+@property (nonatomic, strong) IPPhoto *photo;
+
+@end
+
+@implementation IPDecoratedThumbnailCache_test
+
+- (void)setUp {
+
+  [super setUp];
+  self.photo = [[IPPhoto alloc] init];
+  self.photo.image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  [self.photo optimize];
+}
+
+- (void)tearDown {
+
+  [self.photo deletePhotoFiles];
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
+  self.photo = nil;
+  [[IPImageMemoryManager sharedManager] removeImagesWithKeyPrefix:@"decorated|"];
+  [[NSFileManager defaultManager] removeItemAtPath:[kTestDirectory asPathInCachesFolder] error:NULL];
+  [super tearDown];
+}
+
+//
+//  A bordered thumbnail gets drawn once. After that it comes from memory,
+//  then from disk; the file is recorded against the photo.
+//
+
+- (void)testThumbnailIsDrawnOnce {
+
+  CGSize pixelSize = CGSizeMake(200, 200);
+  UIColor *white = [UIColor whiteColor];
+  IPDecoratedThumbnailCache *cache = [[IPDecoratedThumbnailCache alloc] initWithDirectory:[kTestDirectory asPathInCachesFolder]];
+  STAssertNil([cache cachedThumbnailForPhoto:self.photo pixelSize:pixelSize borderWidth:10 borderColor:white], nil);
+
+  UIImage *decorated = [cache thumbnailForPhoto:self.photo pixelSize:pixelSize borderWidth:10 borderColor:white];
+  UIImage *plain = [self.photo thumbnailCoveringPixelSize:pixelSize];
+  STAssertNotNil(decorated, nil);
+  STAssertEquals(plain.size.width + 20, decorated.size.width, nil);
+  STAssertEquals((NSUInteger)1, cache.renderCount, nil);
+  STAssertEquals(decorated, [cache cachedThumbnailForPhoto:self.photo pixelSize:pixelSize borderWidth:10 borderColor:white], nil);
+  NSArray *derivedPaths = [[IPDerivedFileIndex sharedIndex] pathsForFilename:self.photo.filename];
+  NSPredicate *isDecorated = [NSPredicate predicateWithFormat:@"SELF CONTAINS %@", kTestDirectory];
+  STAssertEquals((NSUInteger)1, [[derivedPaths filteredArrayUsingPredicate:isDecorated] count], nil);
+
+  [[IPImageMemoryManager sharedManager] removeImagesWithKeyPrefix:@"decorated|"];
+  IPDecoratedThumbnailCache *relaunched = [[IPDecoratedThumbnailCache alloc] initWithDirectory:[kTestDirectory asPathInCachesFolder]];
+  UIImage *saved = [relaunched thumbnailForPhoto:self.photo pixelSize:pixelSize borderWidth:10 borderColor:white];
+  STAssertEquals((NSUInteger)0, relaunched.renderCount, @"Should come from disk");
+  STAssertEquals(decorated.size, saved.size, nil);
+}
+
+//
+//  Changing the decoration means a different thumbnail.
+//
+
+- (void)testKeysFollowDecoration {
+
+  CGSize pixelSize = CGSizeMake(200, 200);
+  NSString *key = [IPDecoratedThumbnailCache keyForPhoto:self.photo
+                                               pixelSize:pixelSize
+                                             borderWidth:10
+                                             borderColor:[UIColor whiteColor]];
+  STAssertNotNil(key, nil);
+  STAssertFalse([key isEqualToString:[IPDecoratedThumbnailCache keyForPhoto:self.photo
+                                                                  pixelSize:pixelSize
+                                                                borderWidth:4
+                                                                borderColor:[UIColor whiteColor]]], nil);
+  STAssertFalse([key isEqualToString:[IPDecoratedThumbnailCache keyForPhoto:self.photo
+                                                                  pixelSize:pixelSize
+                                                                borderWidth:10
+                                                                borderColor:[UIColor blackColor]]], nil);
+}
+
+@end
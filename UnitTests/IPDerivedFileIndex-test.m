@@ -0,0 +1,160 @@
+//
+//  IPDerivedFileIndex-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "IPDerivedFileIndex.h"
+#import "IPPhotoStore.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestIndexFolder = @"IPDerivedFileIndexTest";
+
+@interface IPDerivedFileIndex_test : SenTestCase
+
+@property (nonatomic, copy) NSString *directory;
+
+@end
+
+@implementation IPDerivedFileIndex_test
+
+//
+//  Each test gets an empty folder.
+//
+
+- (void)setUp {
+  
+  [super setUp];
+  self.directory = [kTestIndexFolder asPathInCachesFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:self.directory error:NULL];
+  [[NSFileManager defaultManager] createDirectoryAtPath:self.directory 
+                            withIntermediateDirectories:YES 
+                                             attributes:nil 
+                                                  error:NULL];
+}
+
+- (void)tearDown {
+  
+  [[NSFileManager defaultManager] removeItemAtPath:self.directory error:NULL];
+  [super tearDown];
+}
+
+//
+//  Helper: creates an empty file in the test folder and returns its path.
+//
+
+- (NSString *)touch:(NSString *)name {
+  
+  NSString *path = [self.directory stringByAppendingPathComponent:name];
+  [[NSData data] writeToFile:path atomically:NO];
+  return path;
+}
+
+- (BOOL)exists:(NSString *)path {
+  
+  return [[NSFileManager defaultManager] fileExistsAtPath:path];
+}
+
+//
+//  Releasing a photo file nothing else uses takes exactly what was recorded
+//  for it, plus the known paths, and leaves other photos alone. The index survives a reload.
+//
+
+- (void)testRemoveOnlyWhatThePhotoOwns {
+  
+  IPDerivedFileIndex *index = [[IPDerivedFileIndex alloc] initWithDirectory:self.directory 
+                                                               rootDirectory:self.directory];
+  NSString *photo = [self touch:@"photo.jpg"];
+  NSString *thumbnail = [self touch:@"photo-thumb.jpg"];
+  NSString *pyramid = [self touch:@"photo.tiles"];
+  NSString *known = [self touch:@"photo-96.jpg"];
+  NSString *other = [self touch:@"other.jpg"];
+  NSString *otherThumbnail = [self touch:@"other-thumb.jpg"];
+  
+  [index addPath:thumbnail forFilename:photo];
+  [index addPath:pyramid forFilename:photo];
+  [index addPath:otherThumbnail forFilename:other];
+  STAssertEquals((NSUInteger)2, [[index pathsForFilename:photo] count], nil);
+  STAssertTrue([[index pathsForFilename:photo] containsObject:pyramid], nil);
+  
+  [index releaseFilename:photo derivedPaths:@[known]];
+  [index waitUntilRemovalsFinish];
+  for (NSString *path in @[photo, thumbnail, pyramid, known]) {
+    
+    STAssertFalse([self exists:path], @"%@ should be gone", path);
+  }
+  STAssertTrue([self exists:other], nil);
+  STAssertTrue([self exists:otherThumbnail], nil);
+  STAssertEquals((NSUInteger)0, [[index pathsForFilename:photo] count], nil);
+  
+  IPDerivedFileIndex *reloaded = [[IPDerivedFileIndex alloc] initWithDirectory:self.directory 
+                                                                  rootDirectory:self.directory];
+  STAssertEqualObjects(@[otherThumbnail], [reloaded pathsForFilename:other], nil);
+  STAssertEquals((NSUInteger)0, [[reloaded pathsForFilename:photo] count], nil);
+}
+
+//
+//  Releasing a file other photos still use keeps it and what was made from
+//  it. The last release takes both.
+//
+
+- (void)testReleaseKeepsSharedFiles {
+  
+  IPDerivedFileIndex *index = [[IPDerivedFileIndex alloc] initWithDirectory:self.directory 
+                                                               rootDirectory:self.directory];
+  IPPhotoStore *store = [IPPhotoStore sharedStore];
+  NSData *data = [[[NSProcessInfo processInfo] globallyUniqueString] dataUsingEncoding:NSUTF8StringEncoding];
+  NSString *photo = [store filenameForData:data sourceIdentifier:nil];
+  STAssertTrue([store retainFilename:photo], nil);
+  NSString *thumbnail = [self touch:@"shared-thumb.jpg"];
+  [index addPath:thumbnail forFilename:photo];
+  
+  [index releaseFilename:photo derivedPaths:nil];
+  [index waitUntilRemovalsFinish];
+  STAssertEquals((NSUInteger)1, [store referenceCountForFilename:photo], nil);
+  STAssertTrue([self exists:photo], nil);
+  STAssertTrue([self exists:thumbnail], nil);
+  
+  [index releaseFilename:photo derivedPaths:nil];
+  [index waitUntilRemovalsFinish];
+  STAssertEquals((NSUInteger)0, [store referenceCountForFilename:photo], nil);
+  STAssertFalse([self exists:photo], nil);
+  STAssertFalse([self exists:thumbnail], nil);
+  STAssertEquals((NSUInteger)0, [[index pathsForFilename:photo] count], nil);
+}
+
+//
+//  The first index in a folder sweeps out the per-scale tile folders of
+//  older versions, and nothing else.
+//
+
+- (void)testLegacyTileDirectoriesRemovedOnce {
+  
+  NSString *legacy = [self.directory stringByAppendingPathComponent:@"photo_jpg_768_1000"];
+  [[NSFileManager defaultManager] createDirectoryAtPath:legacy 
+                            withIntermediateDirectories:YES 
+                                             attributes:nil 
+                                                  error:NULL];
+  NSString *keep = [self touch:@"photo.tiles"];
+  
+  IPDerivedFileIndex *index = [[IPDerivedFileIndex alloc] initWithDirectory:self.directory 
+                                                               rootDirectory:self.directory];
+  [index waitUntilRemovalsFinish];
+  STAssertFalse([self exists:legacy], nil);
+  STAssertTrue([self exists:keep], nil);
+  STAssertTrue([self exists:[self.directory stringByAppendingPathComponent:kIPDerivedFileIndexFilename]], nil);
+}
+
+@end
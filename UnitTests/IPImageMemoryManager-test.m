@@ -0,0 +1,130 @@
+//
+//  IPImageMemoryManager-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPImageMemoryManager.h"
+
+#define kTestImageEdge    64
+
+@interface IPImageMemoryManager_test : SenTestCase
+
+@end
+
+@implementation IPImageMemoryManager_test
+
+//
+//  Helper: a small bitmap-backed image.
+//
+
+- (UIImage *)testImage {
+
+  CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+  CGContextRef bitmap = CGBitmapContextCreate(NULL,
+                                              kTestImageEdge,
+                                              kTestImageEdge,
+                                              8,
+                                              0,
+                                              rgbColorSpace,
+                                              kCGImageAlphaNoneSkipFirst | kCGBitmapByteOrder32Little);
+  CGColorSpaceRelease(rgbColorSpace);
+  CGContextSetRGBFillColor(bitmap, 0.5, 0.5, 0.5, 1);
+  CGContextFillRect(bitmap, CGRectMake(0, 0, kTestImageEdge, kTestImageEdge));
+  CGImageRef pixels = CGBitmapContextCreateImage(bitmap);
+  CGContextRelease(bitmap);
+  UIImage *image = [UIImage imageWithCGImage:pixels];
+  CGImageRelease(pixels);
+  return image;
+}
+
+- (NSUInteger)bytesPerImage {
+
+  CGImageRef pixels = [[self testImage] CGImage];
+  return CGImageGetBytesPerRow(pixels) * CGImageGetHeight(pixels);
+}
+
+//
+//  Over budget, the least recently used image goes first, whatever its kind,
+//  and the accounting follows.
+//
+
+- (void)testEvictsLeastRecentlyUsed {
+
+  IPImageMemoryManager *manager = [[IPImageMemoryManager alloc] initWithByteLimit:2 * [self bytesPerImage]];
+  [manager setImage:[self testImage] forKey:@"a" kind:IPImageMemoryKindThumbnail];
+  [manager setImage:[self testImage] forKey:@"b" kind:IPImageMemoryKindTile];
+  STAssertNotNil([manager imageForKey:@"a"], nil);
+  [manager setImage:[self testImage] forKey:@"c" kind:IPImageMemoryKindFullImage];
+
+  STAssertNotNil([manager imageForKey:@"a"], @"Recently used image should survive");
+  STAssertNil([manager imageForKey:@"b"], @"Least recently used image should be evicted");
+  STAssertEquals((NSUInteger)2, manager.count, nil);
+  STAssertEquals(2 * [self bytesPerImage], manager.currentBytes, nil);
+  STAssertEquals((NSUInteger)0, [manager bytesOfKind:IPImageMemoryKindTile], nil);
+  STAssertEquals([self bytesPerImage], [manager bytesOfKind:IPImageMemoryKindThumbnail], nil);
+
+  [manager removeImagesWithKeyPrefix:@"a"];
+  STAssertEquals([self bytesPerImage], manager.currentBytes, nil);
+}
+
+//
+//  Pinned images are never evicted, including ones added after the pin.
+//
+
+- (void)testPinning {
+
+  IPImageMemoryManager *manager = [[IPImageMemoryManager alloc] initWithByteLimit:2 * [self bytesPerImage]];
+  [manager pinImagesWithKeyPrefix:@"visible|"];
+  [manager setImage:[self testImage] forKey:@"visible|image" kind:IPImageMemoryKindFullImage];
+  [manager setImage:[self testImage] forKey:@"other|image" kind:IPImageMemoryKindFullImage];
+  [manager setImage:[self testImage] forKey:@"another|image" kind:IPImageMemoryKindFullImage];
+  STAssertTrue([manager containsImageForKey:@"visible|image"], nil);
+  STAssertFalse([manager containsImageForKey:@"other|image"], nil);
+  STAssertEquals([self bytesPerImage], manager.pinnedBytes, nil);
+
+  [manager shedImagesToByteCount:0];
+  STAssertTrue([manager containsImageForKey:@"visible|image"], nil);
+  STAssertEquals([self bytesPerImage], manager.currentBytes, nil);
+
+  [manager unpinImagesWithKeyPrefix:@"visible|"];
+  [manager shedImagesToByteCount:0];
+  STAssertEquals((NSUInteger)0, manager.currentBytes, nil);
+}
+
+//
+//  Under pressure, tiles go before full images, and full images before
+//  thumbnails, regardless of how recently they were used.
+//
+
+- (void)testShedsInPriorityOrder {
+
+  IPImageMemoryManager *manager = [[IPImageMemoryManager alloc] initWithByteLimit:NSUIntegerMax];
+  [manager setImage:[self testImage] forKey:@"thumbnail" kind:IPImageMemoryKindThumbnail];
+  [manager setImage:[self testImage] forKey:@"image" kind:IPImageMemoryKindFullImage];
+  [manager setImage:[self testImage] forKey:@"tile" kind:IPImageMemoryKindTile];
+
+  [manager shedImagesToByteCount:2 * [self bytesPerImage]];
+  STAssertFalse([manager containsImageForKey:@"tile"], nil);
+  STAssertTrue([manager containsImageForKey:@"image"], nil);
+
+  [manager shedImagesToByteCount:[self bytesPerImage]];
+  STAssertFalse([manager containsImageForKey:@"image"], nil);
+  STAssertTrue([manager containsImageForKey:@"thumbnail"], nil);
+  NSLog(@"%s -- %@", __PRETTY_FUNCTION__, [manager usageDescription]);
+}
+
+@end
@@ -0,0 +1,118 @@
+//
+//  IPOptimizationJournal-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GTMSenTestCase.h"
+#import "IPOptimizationJournal.h"
+#import "IPPhoto.h"
+#import "NSString+TestHelper.h"
+
+#define kTestJournal    @"test-optimization-journal.txt"
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPOptimizationJournal_test : GTMTestCase { }
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPOptimizationJournal_test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Start each test without a journal on disk.
+//
+
+- (void)setUp {
+  
+  [[NSFileManager defaultManager] removeItemAtPath:[kTestJournal asPathInDocumentsFolder] error:NULL];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Helper: a photo with the given filename.
+//
+
+- (IPPhoto *)photoNamed:(NSString *)name {
+  
+  IPPhoto *photo = [[[IPPhoto alloc] init] autorelease];
+  photo.filename = [name asPathInDocumentsFolder];
+  return photo;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Commits survive reopening the journal; a different version starts over;
+//  |finish| removes the file.
+//
+
+- (void)testCommitAndResume {
+  
+  NSString *path = [kTestJournal asPathInDocumentsFolder];
+  IPPhoto *first = [self photoNamed:@"first.jpg"];
+  IPPhoto *second = [self photoNamed:@"second.jpg"];
+  
+  IPOptimizationJournal *journal = [IPOptimizationJournal journalAtPath:path forOptimizationVersion:4];
+  STAssertFalse([journal containsPhoto:first], nil);
+  [journal commitPhoto:first];
+  [journal commitPhoto:first];
+  STAssertTrue([journal containsPhoto:first], nil);
+  
+  IPOptimizationJournal *resumed = [IPOptimizationJournal journalAtPath:path forOptimizationVersion:4];
+  STAssertEquals((NSUInteger)1, resumed.countOfCommittedPhotos, nil);
+  STAssertTrue([resumed containsPhoto:first], nil);
+  STAssertFalse([resumed containsPhoto:second], nil);
+  
+  IPOptimizationJournal *newer = [IPOptimizationJournal journalAtPath:path forOptimizationVersion:5];
+  STAssertEquals((NSUInteger)0, newer.countOfCommittedPhotos, nil);
+  
+  [newer finish];
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path], nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A record without its trailing newline (a write torn by a crash) does
+//  not count as committed.
+//
+
+- (void)testTornWrite {
+  
+  NSString *path = [kTestJournal asPathInDocumentsFolder];
+  NSString *contents = @"IPOptimizationJournal 4\nfirst.jpg\nsecond.j";
+  [contents writeToFile:path atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+  
+  IPOptimizationJournal *journal = [IPOptimizationJournal journalAtPath:path forOptimizationVersion:4];
+  STAssertEquals((NSUInteger)1, journal.countOfCommittedPhotos, nil);
+  STAssertTrue([journal containsPhoto:[self photoNamed:@"first.jpg"]], nil);
+  STAssertFalse([journal containsPhoto:[self photoNamed:@"second.jpg"]], nil);
+  
+  //
+  //  The next commit should not get glued onto the torn record.
+  //
+  
+  [journal commitPhoto:[self photoNamed:@"second.jpg"]];
+  IPOptimizationJournal *resumed = [IPOptimizationJournal journalAtPath:path forOptimizationVersion:4];
+  STAssertTrue([resumed containsPhoto:[self photoNamed:@"second.jpg"]], nil);
+  [resumed finish];
+}
+
+@end
@@ -20,24 +20,16 @@
 
 #import <SenTestingKit/SenTestingKit.h>
 #import <UIKit/UIKit.h>
+#import <mach/mach.h>
 #import "IPPhoto.h"
+#import "IPPhotoStore.h"
+#import "IPDerivedFileIndex.h"
+#import "IPImageMemoryManager.h"
 #import "NSString+TestHelper.h"
 
 static NSString * const kIPPhotoTestKey  = @"kIPPhotoTestKey";
 static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
 
-//
-//  Private methods I know exist on IPPhoto.
-//
-
-@interface IPPhoto (Private)
-
-- (void)saveTilesOfSize:(CGSize)size 
-               forImage:(UIImage*)image 
-            toDirectory:(NSString*)directoryPath 
-            usingPrefix:(NSString*)prefix;
-@end
-
 @interface IPPhoto_test : SenTestCase {
   
 }
@@ -47,6 +39,21 @@ static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
 
 @implementation IPPhoto_test
 
+//
+//  Helper function: The peak resident size of this process, in bytes.
+//
+
+static mach_vm_size_t PeakResidentSize(void) {
+  
+  struct mach_task_basic_info info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+    
+    return 0;
+  }
+  return info.resident_size_max;
+}
+
 //
 //  Helper routine: Saves a photo to a path.
 //
@@ -227,8 +234,11 @@ static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
   //    (2) A thumbnail image stored in |thumbnail|
   //    (3) The thumbnail file to get saved in |thumbnailFile|
   //
+  //  The save happens in the background, so wait for it.
+  //
   
   STAssertNotNil(photo.filename, @"Photo should have a filename");
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:photo.filename];
   STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.filename],
                @"File should be saved");
 
@@ -251,6 +261,7 @@ static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
   //
   
   [photo deletePhotoFiles];
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
   STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:photo.filename],
                @"File should be deleted");
   STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:photo.thumbnailFilename],
@@ -262,6 +273,7 @@ static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
   
   photo.image = image;
   STAssertNotNil(photo.filename, @"Photo should have a filename");
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:photo.filename];
   STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.filename],
                @"File should be saved");
   
@@ -274,149 +286,275 @@ static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
                @"Thumbnail should be saved");
   
   //
-  //  In this case, assign a "new" image to the photo property. This should
-  //  delete the image files associated with the photo and create new ones.
+  //  In this case, assign the image again. Files are named for their
+  //  content, so this replaces the files with identical ones under the
+  //  same names.
   //
   
   NSString *originalFileName  = [photo.filename copy];
   NSString *originalThumbnail = [photo.thumbnailFilename copy];
   photo.image = image;
   [photo optimize];
-  STAssertFalse([photo.filename isEqualToString:originalFileName], nil);
-  STAssertFalse([photo.thumbnailFilename isEqualToString:originalThumbnail], nil);
+  STAssertEqualObjects(photo.filename, originalFileName, nil);
+  STAssertEqualObjects(photo.thumbnailFilename, originalThumbnail, nil);
 
   STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.filename],
                @"File should be saved");
   STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.thumbnailFilename],
                @"Thumbnail should be saved");
+  
+  //
+  //  A different image gets a different file, and the old files go away.
+  //
+  
+  UIImage *otherImage = [UIImage imageWithCGImage:[image CGImage] 
+                                            scale:1.0 
+                                      orientation:UIImageOrientationRight];
+  photo.image = otherImage;
+  [photo optimize];
+  STAssertFalse([photo.filename isEqualToString:originalFileName], nil);
+  STAssertFalse([photo.thumbnailFilename isEqualToString:originalThumbnail], nil);
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
   STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:originalFileName],
                 @"File should be deleted");
   STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:originalThumbnail],
                 @"Thumbnail should be deleted");
+  [photo deletePhotoFiles];
 }
 
 //
-//  Test image tiling
+//  Test image tiling. All levels go into one pyramid file, and every tile
+//  of every level can be read back.
 //
 
-- (void)disabled_testTiling {
+- (void)testTiling {
   
   IPPhoto *photo = [[IPPhoto alloc] init];
-  UIImage *image = [UIImage imageNamed:kTestMediumImage];
+  UIImage *image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
   CGSize tileSize = [photo defaultTileSize];
+  STAssertEquals((size_t)1, [photo levelsOfDetail], @"No pyramid yet, so one level");
   
   //
-  //  Ensure the cache directory is empty.
+  //  Assign |image| to |photo| and make sure all tiles get created.
   //
   
-  [[NSFileManager defaultManager] removeItemAtPath:[NSString cachesFolder] 
-                                             error:NULL];
-  [[NSFileManager defaultManager] createDirectoryAtPath:[NSString cachesFolder] 
-                            withIntermediateDirectories:YES 
-                                             attributes:nil 
-                                                  error:NULL];
-  
-  NSLog(@"%s -- image size is %f by %f",
-        __PRETTY_FUNCTION__,
-        image.size.width,
-        image.size.height);
-  [photo saveTilesOfSize:tileSize
-                forImage:image
-             toDirectory:[NSString cachesFolder]
-             usingPrefix:@"testTiling"];
-  
-  //
-  //  |image| is 3000x4000 pixels. That's 4x6 = 24 tiles.
-  //
-  
-  NSArray *cacheContents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[NSString cachesFolder] 
-                                                                               error:NULL];
-  STAssertEquals((NSUInteger)24, [cacheContents count], nil);
-  
-  //
-  //  Now, assign |image| to |photo| and make sure all tiles get created.
-  //
-  
-  CGSize originalSize = image.size;
+  CGSize originalSize = CGSizeMake(CGImageGetWidth([image CGImage]), CGImageGetHeight([image CGImage]));
   photo.image = image;
-  STAssertEquals(originalSize, photo.image.size, nil);
   [photo saveTilesForAllScales];
+  STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[photo tilePyramidPath]], nil);
   
   //
-  //  Validate scale arithmetic. For a photo with the long edge of 4000 pixels,
-  //  there will be 3 levels of detail and a minimum scale of 0.25.
+  //  Validate scale arithmetic: halve the long edge until it fits in a tile.
   //
   
-  STAssertEquals((size_t)3, [photo levelsOfDetail], nil);
-  STAssertEquals((CGFloat)0.25, [photo minimumTileScale], nil);
+  size_t expectedLevels = 1;
+  for (CGFloat longEdge = MAX(originalSize.width, originalSize.height); longEdge > tileSize.width; longEdge = ceilf(longEdge / 2)) {
+    
+    expectedLevels++;
+  }
+  STAssertEquals(expectedLevels, [photo levelsOfDetail], nil);
+  STAssertEquals((CGFloat)1.0 / (1 << (expectedLevels - 1)), [photo minimumTileScale], nil);
   
   CGFloat currentScale = 1.0;
-  CGFloat longEdge     = MAX(originalSize.width, originalSize.height);
-  while (longEdge > 768) {
-    
-    NSString *tileDirectory = [photo tileDirectoryForTileSize:[photo defaultTileSize] andScale:currentScale];
-    NSLog(@"%s -- looking for tiles in %@", __PRETTY_FUNCTION__, tileDirectory);
-    cacheContents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:tileDirectory error:NULL];
-    NSUInteger matchingCount = [cacheContents count];
-
-    NSLog(@"%s -- for scale %f, found %d tiles",
-               __PRETTY_FUNCTION__,
-               currentScale,
-               matchingCount);
-    
-    //
-    //  Figure out the expected number of tiles.
-    //
+  for (size_t level = 0; level < expectedLevels; level++) {
     
-    NSUInteger expectedTileCount = ceilf(originalSize.width / tileSize.width) *
-                                   ceilf(originalSize.height / tileSize.height);
-    
-    STAssertEquals(expectedTileCount, matchingCount, 
-                   @"Scale %f: Found %d tiles, expected %d", 
-                   currentScale,
-                   matchingCount,
-                   expectedTileCount);
     STAssertTrue([photo tilesExistForScale:currentScale], nil);
     
     //
-    //  Now, make sure I can get some tiles.
+    //  Now, make sure I can get the corner tiles, and that edge tiles are
+    //  truncated rather than padded.
     //
     
-    NSUInteger interestingRows[] = { 0, ceilf(originalSize.height / tileSize.height) - 1 };
-    NSUInteger interestingCols[] = { 0, ceilf(originalSize.width / tileSize.width) - 1 };
-    
-    for (int rowOffset = 0; rowOffset < sizeof(interestingRows) / sizeof(NSUInteger); rowOffset++) {
-      
-      for (int colOffset = 0; colOffset < sizeof(interestingCols) / sizeof(NSUInteger); colOffset++) {
-        
-        UIImage *tile = [photo tileForScale:currentScale 
-                                        row:interestingRows[rowOffset] 
-                                     column:interestingCols[colOffset]];
-        STAssertNotNil(tile, 
-                       @"Scale %f: Should get tile for row = %d, col = %d",
-                       currentScale,
-                       interestingRows[rowOffset],
-                       interestingCols[colOffset]);
-      }
-    }
+    NSUInteger rows = ceilf(originalSize.height / tileSize.height);
+    NSUInteger cols = ceilf(originalSize.width / tileSize.width);
+    UIImage *first = [photo tileForScale:currentScale row:0 column:0];
+    UIImage *last  = [photo tileForScale:currentScale row:rows - 1 column:cols - 1];
+    STAssertNotNil(first, @"Scale %f: missing first tile", currentScale);
+    STAssertNotNil(last, @"Scale %f: missing last tile", currentScale);
+    STAssertEqualsWithAccuracy(originalSize.width - (cols - 1) * tileSize.width, last.size.width, (CGFloat)1.0, nil);
+    STAssertEqualsWithAccuracy(originalSize.height - (rows - 1) * tileSize.height, last.size.height, (CGFloat)1.0, nil);
+    STAssertNil([photo tileForScale:currentScale row:rows column:0], nil);
     
     currentScale /= 2;
-    longEdge /= 2;
-    originalSize = CGSizeMake(originalSize.width / 2, originalSize.height / 2);
+    originalSize = CGSizeMake(ceilf(originalSize.width / 2), ceilf(originalSize.height / 2));
   }
+  STAssertFalse([photo tilesExistForScale:currentScale], nil);
   
   //
-  //  Removing photo files should also remove the tiles. The only files we should
-  //  have left are the 192 created when we called |saveTiles...|.
+  //  Removing photo files should also remove the tiles.
   //
   
+  NSString *pyramidPath = [photo tilePyramidPath];
+  [photo deletePhotoFiles];
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:pyramidPath], nil);
+}
+
+//
+//  Optimizing a photo should decode the file exactly once, and should produce
+//  the display image, the thumbnail, and the image size from that decode.
+//  Logs decodes per optimize and peak RSS for a few runs.
+//
+
+- (void)testOptimizeDecodesOnce {
+  
+  for (NSUInteger i = 0; i < 4; i++) {
+    
+    NSString *filename = [IPPhoto filenameForNewPhoto];
+    [[NSFileManager defaultManager] copyItemAtPath:[kTestMediumImage asPathInBundlePath] 
+                                            toPath:filename 
+                                             error:NULL];
+    IPPhoto *photo = [[IPPhoto alloc] init];
+    photo.filename = filename;
+    
+    NSUInteger decodesBefore = [IPPhoto decodeCount];
+    [photo optimize];
+    NSUInteger decodes = [IPPhoto decodeCount] - decodesBefore;
+    
+    STAssertTrue([photo isOptimized], nil);
+    STAssertNotNil(photo.thumbnail, nil);
+    STAssertNotNil(photo.image, nil);
+    STAssertTrue(CGSizeEqualToSize(photo.imageSize, photo.image.size), nil);
+    STAssertLessThanOrEqual(MAX(photo.imageSize.width, photo.imageSize.height), 
+                            kIPPhotoMaxEdgeSize, 
+                            nil);
+    STAssertLessThanOrEqual(MAX(photo.thumbnail.size.width, photo.thumbnail.size.height), 
+                            (CGFloat)kThumbnailSize, 
+                            nil);
+    STAssertEquals((NSUInteger)1, decodes, nil);
+    STAssertEquals((NSUInteger)1, 
+                   [IPPhoto decodeCount] - decodesBefore, 
+                   @"Reading back image & thumbnail should not decode again");
+    STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.thumbnailFilename], nil);
+    NSLog(@"%s -- run %d: %d decode(s), peak RSS %.1f MB",
+          __PRETTY_FUNCTION__,
+          i,
+          decodes,
+          PeakResidentSize() / (1024.0 * 1024.0));
+    [photo deletePhotoFiles];
+  }
+}
+
+//
+//  A photo made from an in-memory image keeps those pixels: neither the
+//  assignment nor the optimize that follows decodes the file.
+//
+
+- (void)testSetImageDoesNotDecode {
+  
+  UIImage *image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  STAssertNotNil(image, @"Internal validation: Should load test image");
+  
+  NSUInteger decodesBefore = [IPPhoto decodeCount];
+  IPPhoto *photo = [[IPPhoto alloc] init];
+  photo.image = image;
+  STAssertEquals(CGImageGetWidth([image CGImage]), (size_t)photo.imageSize.width, nil);
+  STAssertEquals(CGImageGetHeight([image CGImage]), (size_t)photo.imageSize.height, nil);
+  [photo optimize];
+  STAssertEquals((NSUInteger)0, [IPPhoto decodeCount] - decodesBefore, nil);
+  
+  STAssertTrue([photo isOptimized], nil);
+  STAssertNotNil(photo.thumbnail, nil);
+  STAssertLessThanOrEqual(MAX(photo.imageSize.width, photo.imageSize.height), 
+                          kIPPhotoMaxEdgeSize, 
+                          nil);
+  [[IPPhotoStore sharedStore] waitUntilFilenameIsWritten:photo.filename];
+  STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.filename], nil);
+  STAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:photo.thumbnailFilename], nil);
+  [photo deletePhotoFiles];
+}
+
+//
+//  Once memory pressure has taken the pixels, |decodedImage| loads the
+//  display image once, from the file, and keeps the decoded copy as |image|.
+//
+
+- (void)testDecodedImage {
+  
+  UIImage *image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  IPPhoto *photo = [[IPPhoto alloc] init];
+  photo.image = image;
+  [photo optimize];
+  [photo unloadImage];
+  [[IPImageMemoryManager sharedManager] removeAllImages];
+  
+  NSUInteger decodesBefore = [IPPhoto decodeCount];
+  UIImage *decoded = [photo decodedImage];
+  STAssertEquals((NSUInteger)1, [IPPhoto decodeCount] - decodesBefore, nil);
+  STAssertNotNil(decoded, nil);
+  STAssertEquals(photo.imageSize, decoded.size, nil);
+  STAssertEquals(decoded, photo.image, nil);
+  [photo deletePhotoFiles];
+}
+
+//
+//  A downsampled decode covers the requested size from the smallest source
+//  that can, and the second request for that size comes from the cache.
+//
+
+- (void)testImageDecodedToPixelSize {
+  
+  UIImage *image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  IPPhoto *photo = [[IPPhoto alloc] init];
+  photo.image = image;
+  [photo optimize];
+  [photo unloadImage];
+  
+  NSUInteger decodesBefore = [IPPhoto decodeCount];
+  UIImage *small = [photo imageDecodedToPixelSize:CGSizeMake(300, 200)];
+  STAssertNotNil(small, nil);
+  STAssertEquals((CGFloat)kThumbnailSize, MAX(small.size.width, small.size.height), nil);
+  STAssertEquals(small, [photo imageDecodedToPixelSize:CGSizeMake(310, 180)], nil);
+  STAssertEquals((NSUInteger)1, [IPPhoto decodeCount] - decodesBefore, nil);
+  
+  UIImage *large = [photo imageDecodedToPixelSize:CGSizeMake(100000, 100000)];
+  STAssertEquals(photo.imageSize, large.size, @"Never bigger than the source");
+  [photo deletePhotoFiles];
+}
+
+//
+//  Optimizing writes every rung of the thumbnail ladder, and the covering API
+//  picks the smallest rung that is big enough.
+//
+
+- (void)testThumbnailLadder {
+  
+  NSString *filename = [IPPhoto filenameForNewPhoto];
+  [[NSFileManager defaultManager] copyItemAtPath:[kTestMediumImage asPathInBundlePath] 
+                                          toPath:filename 
+                                           error:NULL];
+  IPPhoto *photo = [[IPPhoto alloc] init];
+  photo.filename = filename;
+  [photo optimize];
+  
+  for (NSNumber *edge in [IPPhoto thumbnailLadder]) {
+    
+    NSString *rungFilename = [photo thumbnailFilenameForEdge:[edge unsignedIntegerValue]];
+    UIImage *rung = [UIImage imageWithContentsOfFile:rungFilename];
+    STAssertNotNil(rung, @"Missing rung %@", edge);
+    STAssertLessThanOrEqual(MAX(rung.size.width, rung.size.height), [edge floatValue], nil);
+  }
+  
+  STAssertEqualObjects([photo thumbnailFilenameForEdge:kThumbnailSizeSmall],
+                       [photo thumbnailFilenameCoveringPixelSize:CGSizeMake(75, 75)], 
+                       nil);
+  STAssertEqualObjects(photo.thumbnailFilename,
+                       [photo thumbnailFilenameCoveringPixelSize:CGSizeMake(200, 384)], 
+                       nil);
+  STAssertEqualObjects([photo thumbnailFilenameForEdge:kThumbnailSizeLarge],
+                       [photo thumbnailFilenameCoveringPixelSize:CGSizeMake(768, 500)], 
+                       nil);
+  STAssertEqualObjects(photo.filename,
+                       [photo thumbnailFilenameCoveringPixelSize:CGSizeMake(2048, 1536)], 
+                       nil);
+  
   [photo deletePhotoFiles];
-  cacheContents = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:[NSString cachesFolder] 
-                                                                      error:NULL];
-  STAssertEquals((NSUInteger)24, [cacheContents count], 
-                 @"Expected 24 files, but found %d (%@)", 
-                 [cacheContents count],
-                 [cacheContents description]);
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
+  for (NSNumber *edge in [IPPhoto thumbnailLadder]) {
+    
+    STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[photo thumbnailFilenameForEdge:[edge unsignedIntegerValue]]], 
+                  nil);
+  }
 }
 
 @end
@@ -27,6 +27,12 @@
 
 #define kTestMediumImage    @"AlexGrass_20110604.jpg"
 
+//
+//  How many copies of each JPEG fixture go into the throughput benchmark.
+//
+
+#define kBenchmarkCopiesPerFixture    (4)
+
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
@@ -72,7 +78,9 @@
   STAssertGreaterThan(longEdge, (CGFloat)1500, nil);
   
   [[IPPhotoOptimizationManager sharedManager] setWorkSynchronouslyForDebugging:NO];
-  [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo withCompletion:^(void) {
+  [[IPPhotoOptimizationManager sharedManager] asyncOptimizePhoto:photo 
+                                                          inLane:IPOptimizationLaneImport 
+                                                  withCompletion:^(void) {
     
     STAssertTrue([photo isOptimized], nil);
     longEdge = MAX(photo.imageSize.width, photo.imageSize.height);
@@ -86,4 +94,255 @@
   STAssertFalse([photo isOptimized], nil);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Helper: Copies each JPEG fixture into the documents folder |copies| times
+//  and returns unoptimized photos for them.
+//
+
+- (NSArray *)benchmarkPhotosWithCopies:(NSUInteger)copies {
+  
+  NSArray *fixtures = @[@"zoo.jpg", @"smoke.jpg", @"test-medium.jpg"];
+  NSMutableArray *photos = [NSMutableArray array];
+  for (NSString *fixture in fixtures) {
+    
+    for (NSUInteger i = 0; i < copies; i++) {
+      
+      NSString *filename = [IPPhoto filenameForNewPhoto];
+      [[NSFileManager defaultManager] copyItemAtPath:[fixture asPathInBundlePath] 
+                                              toPath:filename 
+                                               error:NULL];
+      IPPhoto *photo = [[[IPPhoto alloc] init] autorelease];
+      photo.filename = filename;
+      [photos addObject:photo];
+    }
+  }
+  return photos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Helper: Optimizes |photos| with |concurrency| lanes, spinning the run loop
+//  until the completion fires. Returns elapsed seconds.
+//
+
+- (NSTimeInterval)optimizePhotos:(NSArray *)photos withConcurrency:(NSInteger)concurrency {
+  
+  IPPhotoOptimizationManager *manager = [IPPhotoOptimizationManager sharedManager];
+  NSInteger savedConcurrency = [manager.optimizationQueue maxConcurrentOperationCount];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:concurrency];
+  
+  __block BOOL done = NO;
+  NSDate *start = [NSDate date];
+  [manager asyncOptimizePhotos:photos inLane:IPOptimizationLaneBackground withCompletion:^(void) {
+    
+    done = YES;
+  }];
+  while (!done) {
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:savedConcurrency];
+  
+  for (IPPhoto *photo in photos) {
+    
+    STAssertTrue([photo isOptimized], nil);
+    [photo deletePhotoFiles];
+  }
+  return elapsed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmark: optimize the JPEG fixtures with one lane, then with one lane
+//  per core. Logs photos/sec for each; the multi-core run should not be
+//  slower than the single lane.
+//
+
+- (void)testOptimizationThroughput {
+  
+  NSUInteger cores = [[NSProcessInfo processInfo] activeProcessorCount];
+  NSArray *serialPhotos = [self benchmarkPhotosWithCopies:kBenchmarkCopiesPerFixture];
+  NSArray *parallelPhotos = [self benchmarkPhotosWithCopies:kBenchmarkCopiesPerFixture];
+  
+  NSTimeInterval serial = [self optimizePhotos:serialPhotos withConcurrency:1];
+  NSTimeInterval parallel = [self optimizePhotos:parallelPhotos withConcurrency:cores];
+  
+  NSLog(@"%s -- %d photos. 1 lane: %.2f photos/sec. %d lanes: %.2f photos/sec.",
+        __PRETTY_FUNCTION__,
+        [serialPhotos count],
+        [serialPhotos count] / serial,
+        cores,
+        [parallelPhotos count] / parallel);
+  STAssertLessThanOrEqual(parallel, serial * 1.1, nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  With one lane of concurrency, interactive work queued behind background
+//  work should still run first, and a cancelled operation should never call
+//  its completion.
+//
+
+- (void)testLanesAndCancellation {
+  
+  IPPhotoOptimizationManager *manager = [IPPhotoOptimizationManager sharedManager];
+  NSInteger savedConcurrency = [manager.optimizationQueue maxConcurrentOperationCount];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:1];
+  NSArray *photos = [self benchmarkPhotosWithCopies:1];
+  IPPhoto *backgroundPhoto = photos[0];
+  IPPhoto *interactivePhoto = photos[1];
+  IPPhoto *cancelledPhoto = photos[2];
+  
+  //
+  //  Hold the queue until everything is queued up. (Interactive blocks have
+  //  a queue of their own, so the gate goes in the background lane; the
+  //  queue is idle, so it starts right away.)
+  //
+  
+  NSConditionLock *gate = [[[NSConditionLock alloc] initWithCondition:0] autorelease];
+  [manager addOperationInLane:IPOptimizationLaneBackground withBlock:^(void) {
+    
+    [gate lockWhenCondition:1];
+    [gate unlock];
+  }];
+  
+  NSMutableArray *finished = [NSMutableArray array];
+  __block BOOL cancelledCompletionCalled = NO;
+  [manager asyncOptimizePhotos:@[backgroundPhoto] 
+                        inLane:IPOptimizationLaneBackground 
+                withCompletion:^(void) {
+                  
+                  [finished addObject:backgroundPhoto];
+                }];
+  NSOperation *cancelled = [manager asyncOptimizePhoto:cancelledPhoto 
+                                                inLane:IPOptimizationLaneImport 
+                                        withCompletion:^(void) {
+                                          
+                                          cancelledCompletionCalled = YES;
+                                        }];
+  [manager asyncOptimizePhoto:interactivePhoto 
+                       inLane:IPOptimizationLaneBackground 
+               withCompletion:^(void) {
+                 
+                 [finished addObject:interactivePhoto];
+               }];
+  [cancelled cancel];
+  [manager promotePhoto:interactivePhoto toLane:IPOptimizationLaneInteractive];
+  [gate lock];
+  [gate unlockWithCondition:1];
+  
+  while ([finished count] < 2) {
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  [manager.optimizationQueue waitUntilAllOperationsAreFinished];
+  [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                           beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:savedConcurrency];
+  
+  STAssertEquals(interactivePhoto, finished[0], @"Promoted photo should finish first");
+  STAssertFalse(cancelledCompletionCalled, nil);
+  STAssertFalse([cancelledPhoto isOptimized], nil);
+  for (IPPhoto *photo in photos) {
+    
+    [photo deletePhotoFiles];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Interactive work that isn't an optimization runs even while every slot
+//  on the optimization queue is taken.
+//
+
+- (void)testInteractiveWorkDoesNotWaitForOptimizations {
+  
+  IPPhotoOptimizationManager *manager = [IPPhotoOptimizationManager sharedManager];
+  NSInteger savedConcurrency = [manager.optimizationQueue maxConcurrentOperationCount];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:1];
+  NSConditionLock *gate = [[[NSConditionLock alloc] initWithCondition:0] autorelease];
+  [manager addOperationInLane:IPOptimizationLaneBackground withBlock:^(void) {
+    
+    [gate lockWhenCondition:1];
+    [gate unlock];
+  }];
+  
+  NSOperation *interactive = [manager addOperationInLane:IPOptimizationLaneInteractive withBlock:^(void) {
+    
+    // Nothing to do; it only has to run.
+  }];
+  NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+  while (![interactive isFinished] && [deadline timeIntervalSinceNow] > 0) {
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  STAssertTrue([interactive isFinished], @"Interactive work shouldn't wait for the optimization queue");
+  
+  [gate lock];
+  [gate unlockWithCondition:1];
+  [manager.optimizationQueue waitUntilAllOperationsAreFinished];
+  [manager.optimizationQueue setMaxConcurrentOperationCount:savedConcurrency];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A batch commits each photo off the main thread as it finishes, reports
+//  it, and only then completes.
+//
+
+- (void)testBatchProgress {
+  
+  IPPhotoOptimizationManager *manager = [IPPhotoOptimizationManager sharedManager];
+  NSArray *photos = [self benchmarkPhotosWithCopies:2];
+  NSMutableArray *committed = [NSMutableArray array];
+  NSMutableArray *reported = [NSMutableArray array];
+  __block NSUInteger lastCount = 0;
+  __block BOOL done = NO;
+  
+  [manager asyncOptimizePhotos:photos 
+                        inLane:IPOptimizationLaneImport 
+                        commit:^(IPPhoto *photo) {
+                          
+                          STAssertFalse([NSThread isMainThread], @"Commits belong on the worker");
+                          STAssertTrue([photo isOptimized], nil);
+                          @synchronized(committed) {
+                            
+                            [committed addObject:photo];
+                          }
+                          
+                        } progress:^(IPPhoto *photo, NSUInteger completedCount, NSUInteger totalCount) {
+                        
+                        STAssertFalse(done, @"Progress after completion");
+                        @synchronized(committed) {
+                          
+                          STAssertTrue([committed containsObject:photo], @"Commit should come before progress");
+                        }
+                        STAssertEquals(lastCount + 1, completedCount, nil);
+                        STAssertEquals([photos count], totalCount, nil);
+                        STAssertTrue([photo isOptimized], nil);
+                        lastCount = completedCount;
+                        [reported addObject:photo];
+                        
+                      } withCompletion:^(void) {
+                        
+                        done = YES;
+                      }];
+  while (!done) {
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  STAssertEquals([photos count], [reported count], nil);
+  for (IPPhoto *photo in photos) {
+    
+    STAssertTrue([reported containsObject:photo], nil);
+    [photo deletePhotoFiles];
+  }
+}
+
 @end
@@ -0,0 +1,130 @@
+//
+//  IPPhotoStore-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "IPPhotoStore.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestStoreFolder = @"IPPhotoStoreTest";
+
+@interface IPPhotoStore_test : SenTestCase
+
+@property (nonatomic, copy) NSString *directory;
+
+@end
+
+@implementation IPPhotoStore_test
+
+//
+//  Each test gets an empty store directory.
+//
+
+- (void)setUp {
+  
+  [super setUp];
+  self.directory = [kTestStoreFolder asPathInCachesFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:self.directory error:NULL];
+  [[NSFileManager defaultManager] createDirectoryAtPath:self.directory 
+                            withIntermediateDirectories:YES 
+                                             attributes:nil 
+                                                  error:NULL];
+}
+
+- (void)tearDown {
+  
+  [[NSFileManager defaultManager] removeItemAtPath:self.directory error:NULL];
+  [super tearDown];
+}
+
+//
+//  Helper: copies the test image to a staging name in the store directory.
+//
+
+- (NSString *)stagedCopyNamed:(NSString *)name {
+  
+  NSString *path = [self.directory stringByAppendingPathComponent:name];
+  [[NSFileManager defaultManager] copyItemAtPath:[kTestMediumImage asPathInBundlePath] toPath:path error:NULL];
+  return path;
+}
+
+//
+//  Importing the same content twice stores it once, and the file lives until
+//  the last reference goes away.
+//
+
+- (void)testDeduplicationAndReferenceCounts {
+  
+  IPPhotoStore *store = [[IPPhotoStore alloc] initWithDirectory:self.directory];
+  NSString *first = [store adoptFileAtPath:[self stagedCopyNamed:@"a.jpg"] sourceIdentifier:@"source-a"];
+  NSString *second = [store adoptFileAtPath:[self stagedCopyNamed:@"b.jpg"] sourceIdentifier:@"source-b"];
+  
+  STAssertNotNil(first, nil);
+  STAssertEqualObjects(first, second, nil);
+  STAssertEquals((NSUInteger)2, [store referenceCountForFilename:first], nil);
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:[self.directory stringByAppendingPathComponent:@"b.jpg"]], 
+                @"Duplicate staging file should be gone");
+  
+  //
+  //  A known source skips the fetch entirely.
+  //
+  
+  STAssertEqualObjects(first, [store retainFilenameForSourceIdentifier:@"source-b"], nil);
+  STAssertNil([store retainFilenameForSourceIdentifier:@"source-c"], nil);
+  STAssertEquals((NSUInteger)3, [store referenceCountForFilename:first], nil);
+  
+  //
+  //  The index gets written in the background; once flushed, it survives
+  //  reopening.
+  //
+  
+  [store flushIndex];
+  IPPhotoStore *reopened = [[IPPhotoStore alloc] initWithDirectory:self.directory];
+  STAssertEquals((NSUInteger)3, [reopened referenceCountForFilename:first], nil);
+  
+  STAssertFalse([reopened releaseFilename:first], nil);
+  STAssertFalse([reopened releaseFilename:first], nil);
+  STAssertTrue([reopened releaseFilename:first], @"Last reference should say delete");
+  STAssertNil([reopened retainFilenameForSourceIdentifier:@"source-a"], nil);
+}
+
+//
+//  Files the store never saw are unmanaged: releasing them says delete.
+//  Resetting counts from the model fixes drift.
+//
+
+- (void)testUnmanagedFilesAndReset {
+  
+  IPPhotoStore *store = [[IPPhotoStore alloc] initWithDirectory:self.directory];
+  STAssertTrue([store releaseFilename:@"legacy.jpg"], nil);
+  STAssertFalse([store retainFilename:@"legacy.jpg"], nil);
+  
+  NSData *data = [NSData dataWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  NSString *filename = [store filenameForData:data sourceIdentifier:nil];
+  [store retainFilename:filename];
+  [store retainFilename:filename];
+  STAssertEquals((NSUInteger)3, [store referenceCountForFilename:filename], nil);
+  
+  [store resetReferenceCountsWithFilenames:@[filename, @"legacy.jpg"]];
+  STAssertEquals((NSUInteger)1, [store referenceCountForFilename:filename], nil);
+  STAssertEquals((NSUInteger)0, [store referenceCountForFilename:@"legacy.jpg"], nil);
+  
+  [store setOptimizedVersion:4 forFilename:filename];
+  STAssertEquals((NSUInteger)4, [store optimizedVersionForFilename:filename], nil);
+}
+
+@end
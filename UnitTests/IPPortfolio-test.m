@@ -11,6 +11,7 @@
 #import <UIKit/UIKit.h>
 #import <OCMock/OCMock.h>
 #import "IPPortfolio.h"
+#import "IPPortfolioCoder.h"
 #import "IPSet+TestHelpers.h"
 #import "IPPage+TestHelpers.h"
 #import "IPPortfolio+TestHelpers.h"
@@ -293,6 +294,8 @@
   [[[set objectInPagesAtIndex:2] objectInPhotosAtIndex:0] optimize];
   
   STAssertNoThrow([portfolio performSelector:@selector(fixPhotoFileNames)], nil);
+  STAssertEquals((NSUInteger)6, [set countOfPages], @"Fixing names shouldn't check files");
+  STAssertEquals((NSUInteger)2, [portfolio validatePhotoFiles], nil);
   
   STAssertEquals((NSUInteger)4, [set countOfPages], nil);
   STAssertEquals((NSUInteger)NSNotFound, [portfolio imageOptimizationVersion], nil);
@@ -327,6 +330,58 @@
   }
 }
 
+//
+//  Pages that load after validation get checked too, but a missing file
+//  doesn't pull a page out from under whoever asked for it. The removal
+//  comes after, and says so.
+//
+
+- (void)testValidatingLoadedPagesWaits {
+  
+  NSMutableArray *pages = [NSMutableArray array];
+  NSMutableArray *filenames = [NSMutableArray array];
+  NSUInteger countOfPages = kIPSetPreloadedPageCount + 2;
+  for (NSUInteger i = 0; i < countOfPages; i++) {
+    
+    NSString *filename = [IPPhoto filenameForNewPhoto];
+    if (i < countOfPages - 1) {
+      
+      [[NSData data] writeToFile:filename atomically:NO];
+      [filenames addObject:filename];
+    }
+    [pages addObject:[IPPage pageWithFilename:filename andTitle:@"Lazy"]];
+  }
+  NSArray *rest = [pages subarrayWithRange:NSMakeRange(kIPSetPreloadedPageCount, 2)];
+  [pages removeObjectsInArray:rest];
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  [set setLoadedPages:pages unloadedPageData:[IPPortfolioCoder dataWithPages:rest] count:[rest count]];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:set, nil];
+  STAssertEquals((NSUInteger)0, [portfolio validatePhotoFiles], @"Only loaded pages get checked");
+  
+  __block NSUInteger countOfNotifications = 0;
+  id observer = [[NSNotificationCenter defaultCenter] addObserverForName:IPPortfolioChanged
+                                                                  object:portfolio
+                                                                   queue:nil
+                                                              usingBlock:^(NSNotification *note) {
+                                                                countOfNotifications++;
+                                                              }];
+  IPPage *lastPage = nil;
+  STAssertNoThrow(lastPage = [set objectInPagesAtIndex:countOfPages - 1], nil);
+  STAssertEquals(countOfPages, [set countOfPages], @"Loading shouldn't remove pages under its caller");
+  STAssertEquals(set, lastPage.parent, nil);
+  STAssertEquals((NSUInteger)0, countOfNotifications, nil);
+  
+  [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+  STAssertEquals(countOfPages - 1, [set countOfPages], nil);
+  STAssertNil(lastPage.parent, nil);
+  STAssertEquals((NSUInteger)1, countOfNotifications, nil);
+  
+  [[NSNotificationCenter defaultCenter] removeObserver:observer];
+  for (NSString *filename in filenames) {
+    [[NSFileManager defaultManager] removeItemAtPath:filename error:NULL];
+  }
+}
+
 //
 //  Tests the search for new photos.
 //
@@ -358,6 +413,26 @@
   }
 }
 
+//
+//  A set whose encoded pages are damaged still owns files nobody can name,
+//  so there's no telling which pictures are found. Don't look.
+//
+
+- (void)testDamagedPagesStopFoundPictures {
+  
+  [self resetTestImages];
+  NSArray *pages = @[[IPPage pageWithFilename:[IPPhoto filenameForNewPhoto] andTitle:@"Damaged"]];
+  NSData *data = [IPPortfolioCoder dataWithPages:pages];
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  [set setLoadedPages:[NSMutableArray array]
+     unloadedPageData:[data subdataWithRange:NSMakeRange(0, [data length] - 1)]
+                count:[pages count]];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:set, nil];
+  
+  STAssertNil(set.photoFilenames, @"Damaged pages have no known file names");
+  STAssertNil([portfolio setWithFoundPictures], nil);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Test that new portfolios get a random, non-zero version.
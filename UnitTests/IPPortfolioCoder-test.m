@@ -0,0 +1,242 @@
+//
+//  IPPortfolioCoder-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GTMSenTestCase.h"
+#import "IPPortfolio.h"
+#import "IPPortfolioCoder.h"
+#import "IPPortfolioJournal.h"
+#import "NSString+TestHelper.h"
+
+#define kTestPortfolio    @"test-binary-portfolio"
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPPortfolioCoder_test : GTMTestCase
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPPortfolioCoder_test
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)tearDown {
+
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  [[NSFileManager defaultManager] removeItemAtPath:[IPPortfolioJournal journalPathForPortfolioPath:path] error:NULL];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Helper: a set of |count| one-photo pages. Every photo has its own file
+//  and title; they all share a caption.
+//
+
+- (IPSet *)setWithTitle:(NSString *)title pageCount:(NSUInteger)count {
+
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  set.title = title;
+  for (NSUInteger i = 0; i < count; i++) {
+
+    NSString *pageTitle = [NSString stringWithFormat:@"%@ %d", title, i];
+    IPPage *page = [IPPage pageWithFilename:[IPPhoto filenameForNewPhoto] andTitle:pageTitle];
+    IPPhoto *photo = [page objectInPhotosAtIndex:0];
+    photo.caption = @"Shared caption";
+    photo.imageSize = CGSizeMake(1024, 768);
+    photo.optimizedVersion = i;
+    [set appendPage:page];
+  }
+  return set;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Everything saved comes back, including which appearance settings were
+//  never made. Pages past the first few stay encoded, even across another
+//  save.
+//
+
+- (void)testRoundTrip {
+
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:[self setWithTitle:@"Short" pageCount:2],
+                            [self setWithTitle:@"Long" pageCount:kIPSetPreloadedPageCount + 3],
+                            nil];
+  portfolio.title = @"Binary";
+  portfolio.backgroundImageName = @"drops.jpg";
+  portfolio.fontColor = [UIColor whiteColor];
+  portfolio.titleFont = [UIFont fontWithName:@"Futura-Medium" size:kIPPortfolioTitleFontSize];
+  portfolio.layoutStyle = IPPortfolioLayoutStyleStacks;
+  portfolio.imageOptimizationVersion = 3;
+  IPSet *longSet = [portfolio objectInSetsAtIndex:1];
+  NSArray *filenames = longSet.photoFilenames;
+  [portfolio savePortfolioToPath:path];
+
+  NSData *data = [NSData dataWithContentsOfFile:path];
+  STAssertTrue(IPPFIsPortfolio([data bytes], [data length]), @"Should save in the binary format");
+  IPPortfolio *loaded = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEquals(portfolio.version, loaded.version, nil);
+  STAssertEqualStrings(@"Binary", loaded.title, nil);
+  STAssertEqualStrings(@"drops.jpg", loaded.backgroundImageName, nil);
+  STAssertEqualObjects([UIColor whiteColor], loaded.fontColor, nil);
+  STAssertEqualStrings(@"Futura-Medium", loaded.titleFont.fontName, nil);
+  STAssertEquals((CGFloat)kIPPortfolioTitleFontSize, loaded.titleFont.pointSize, nil);
+  STAssertEquals(IPPortfolioLayoutStyleStacks, loaded.layoutStyle, nil);
+  STAssertEquals((NSUInteger)3, loaded.imageOptimizationVersion, nil);
+  STAssertTrue([loaded setDefaultNavigationColor:[UIColor redColor]], @"No navigation color was saved");
+  STAssertTrue([loaded setDefaultTextFont:[UIFont systemFontOfSize:12]], @"No text font was saved");
+
+  IPSet *loadedSet = [loaded objectInSetsAtIndex:1];
+  STAssertEqualStrings(@"Long", loadedSet.title, nil);
+  STAssertFalse([loadedSet arePagesLoaded], @"Only the first pages should load");
+  STAssertEquals((NSUInteger)kIPSetPreloadedPageCount, [loadedSet.loadedPages count], nil);
+  STAssertEquals([longSet countOfPages], [loadedSet countOfPages], nil);
+  STAssertEqualObjects(filenames, loadedSet.photoFilenames, nil);
+
+  [loaded savePortfolioToPath:path];
+  IPPortfolio *reloaded = [IPPortfolio loadPortfolioFromPath:path];
+  IPSet *reloadedSet = [reloaded objectInSetsAtIndex:1];
+  STAssertFalse([reloadedSet arePagesLoaded], nil);
+  IPPage *lastPage = [reloadedSet objectInPagesAtIndex:[reloadedSet countOfPages] - 1];
+  IPPhoto *lastPhoto = [lastPage objectInPhotosAtIndex:0];
+  STAssertTrue([reloadedSet arePagesLoaded], @"Asking for a page should load the rest");
+  STAssertEquals(reloadedSet, lastPage.parent, nil);
+  STAssertEqualStrings(@"Long 7", lastPhoto.title, nil);
+  STAssertEqualStrings(@"Shared caption", lastPhoto.caption, nil);
+  STAssertEquals(CGSizeMake(1024, 768), lastPhoto.imageSize, nil);
+  STAssertEquals((NSUInteger)7, lastPhoto.optimizedVersion, nil);
+  STAssertEqualStrings([filenames lastObject], [lastPhoto.filename lastPathComponent], nil);
+  STAssertTrue([lastPhoto.filename isAbsolutePath], @"Loading should root file names");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Pages that won't decode stay out of the set, but stay encoded in it, so
+//  saving the portfolio doesn't lose them.
+//
+
+- (void)testKeepsDamagedPages {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPSet *source = [self setWithTitle:@"Damaged" pageCount:kIPSetPreloadedPageCount + 3];
+  NSArray *loadedPages = [source.pages subarrayWithRange:NSMakeRange(0, kIPSetPreloadedPageCount)];
+  NSArray *rest = [source.pages subarrayWithRange:NSMakeRange(kIPSetPreloadedPageCount, 3)];
+  NSData *restData = [IPPortfolioCoder dataWithPages:rest];
+  NSData *damaged = [restData subdataWithRange:NSMakeRange(0, [restData length] - 1)];
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  set.title = @"Damaged";
+  [set setLoadedPages:[NSMutableArray arrayWithArray:loadedPages] unloadedPageData:damaged count:[rest count]];
+  
+  STAssertEquals((NSUInteger)kIPSetPreloadedPageCount, [set.pages count], @"Damaged pages shouldn't load");
+  STAssertEquals((NSUInteger)kIPSetPreloadedPageCount, [set countOfPages], nil);
+  STAssertEqualObjects(damaged, set.unloadedPageData, @"Damaged pages should stay encoded");
+  STAssertEquals([rest count], set.unloadedPageCount, nil);
+  
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:set, nil];
+  [portfolio savePortfolioToPath:path];
+  IPSet *loadedSet = [[IPPortfolio loadPortfolioFromPath:path] objectInSetsAtIndex:0];
+  STAssertEqualObjects(damaged, loadedSet.unloadedPageData, @"Saving should write damaged pages back unchanged");
+  STAssertEquals([rest count], loadedSet.unloadedPageCount, nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A string written once comes back as one object.
+//
+
+- (void)testStringsAreShared {
+
+  IPSet *set = [self setWithTitle:@"Shared" pageCount:3];
+  NSArray *pages = [IPPortfolioCoder pagesWithData:[IPPortfolioCoder dataWithPages:set.pages]];
+  STAssertEquals((NSUInteger)3, [pages count], nil);
+  IPPhoto *first = [[pages objectAtIndex:0] objectInPhotosAtIndex:0];
+  IPPhoto *last = [[pages objectAtIndex:2] objectInPhotosAtIndex:0];
+  STAssertEqualStrings(@"Shared caption", first.caption, nil);
+  STAssertTrue(first.caption == last.caption, @"Captions should be the same object");
+  STAssertEquals([pages objectAtIndex:0], first.parent, nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A keyed archive gets rewritten in the binary format once, and loads the
+//  same after.
+//
+
+- (void)testMigratesKeyedArchive {
+
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  NSError *error = nil;
+  BOOL copied = [[NSFileManager defaultManager] copyItemAtPath:[@"version1-portfolio.dat" asPathInBundlePath]
+                                                        toPath:path
+                                                         error:&error];
+  STAssertTrue(copied, @"Unable to copy test portfolio: %@", error);
+  IPPortfolio *keyed = [IPPortfolio loadPortfolioFromPath:path];
+
+  STAssertTrue([IPPortfolio migratePortfolioAtPath:path], nil);
+  NSData *data = [NSData dataWithContentsOfFile:path];
+  STAssertTrue(IPPFIsPortfolio([data bytes], [data length]), nil);
+  STAssertFalse([IPPortfolio migratePortfolioAtPath:path], @"Should only migrate once");
+
+  IPPortfolio *migrated = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEquals([keyed countOfSets], [migrated countOfSets], nil);
+  STAssertEqualStrings(keyed.title, migrated.title, nil);
+  for (NSUInteger i = 0; i < [keyed countOfSets]; i++) {
+
+    IPSet *keyedSet = [keyed objectInSetsAtIndex:i];
+    IPSet *migratedSet = [migrated objectInSetsAtIndex:i];
+    STAssertEqualStrings(keyedSet.title, migratedSet.title, nil);
+    STAssertEquals([keyedSet countOfPages], [migratedSet countOfPages], nil);
+    STAssertEqualObjects(keyedSet.photoFilenames, migratedSet.photoFilenames, nil);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Damaged snapshots, or ones from a newer schema, don't decode.
+//
+
+- (void)testRejectsDamagedData {
+
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:[self setWithTitle:@"A" pageCount:8], nil];
+  [portfolio savePortfolioToPath:path];
+  NSData *data = [NSData dataWithContentsOfFile:path];
+
+  NSData *truncated = [data subdataWithRange:NSMakeRange(0, [data length] - 1)];
+  [truncated writeToFile:path atomically:YES];
+  STAssertEquals((NSUInteger)0, [[IPPortfolio loadPortfolioFromPath:path] countOfSets], nil);
+
+  NSMutableData *newerSchema = [NSMutableData dataWithData:data];
+  ((uint8_t *)[newerSchema mutableBytes])[4] = kIPPFSchemaVersion + 1;
+  [newerSchema writeToFile:path atomically:YES];
+  STAssertEquals((NSUInteger)0, [[IPPortfolio loadPortfolioFromPath:path] countOfSets], nil);
+
+  NSData *pageData = [IPPortfolioCoder dataWithPages:[[portfolio objectInSetsAtIndex:0] pages]];
+  STAssertNotNil([IPPortfolioCoder pagesWithData:pageData], nil);
+  NSData *damagedPageData = [pageData subdataWithRange:NSMakeRange(0, [pageData length] - 1)];
+  STAssertNil([IPPortfolioCoder pagesWithData:damagedPageData], nil);
+  STAssertNotNil([IPPortfolioCoder photoFilenamesInPageData:pageData], nil);
+  STAssertNil([IPPortfolioCoder photoFilenamesInPageData:damagedPageData], nil);
+}
+
+@end
@@ -25,6 +25,8 @@
 #import "IPPortfolio+TestHelpers.h"
 #import "IPAlertConfirmTest.h"
 #import "IPPhotoOptimizationManager.h"
+#import "IPDerivedFileIndex.h"
+#import "IPPortfolioCoder.h"
 
 #define kNibName        @"IPPortfolioGridViewController"
 
@@ -172,6 +174,7 @@
 - (void)verifySetDeleted:(IPSet *)set {
 
   NSFileManager *defaultManager = [NSFileManager defaultManager];
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
   for (IPPage *page in set.pages) {
     
     for (IPPhoto *photo in page.photos) {
@@ -262,6 +265,90 @@
   [self verifyPortfolio];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Cut and paste a set with more pages than the portfolio decodes up front,
+//  the way it comes out of a saved portfolio. Every page has to make it
+//  through the pasteboard.
+//
+
+- (void)testCutLargeSet {
+  
+  UIImage *smoke = [UIImage imageNamed:@"smoke.jpg"];
+  NSMutableArray *pages = [NSMutableArray array];
+  for (NSUInteger i = 0; i < kIPSetPreloadedPageCount + 2; i++) {
+    
+    NSString *title = [NSString stringWithFormat:@"Large set %d", i];
+    [pages addObject:[IPPage pageWithImage:smoke andTitle:title]];
+  }
+  NSArray *rest = [pages subarrayWithRange:NSMakeRange(kIPSetPreloadedPageCount, 2)];
+  [pages removeObjectsInArray:rest];
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  [set setLoadedPages:pages unloadedPageData:[IPPortfolioCoder dataWithPages:rest] count:[rest count]];
+  [self.portfolio insertObject:set inSetsAtIndex:0];
+  NSUInteger countOfPages = [set countOfPages];
+  STAssertEquals((NSUInteger)kIPSetPreloadedPageCount + 2, countOfPages, nil);
+  
+  NSSet *victim = [NSSet setWithObject:[NSNumber numberWithUnsignedInteger:0]];
+  [self.controller _collectionView:self.controller.gridView didCut:victim];
+  STAssertEquals((NSUInteger)2, [self.portfolio countOfSets], nil);
+  [self verifySetDeleted:set];
+  
+  [self.controller gridView:self.controller.gridView didPasteAtPoint:0];
+  STAssertEquals((NSUInteger)3, [self.portfolio countOfSets], nil);
+  IPSet *pasted = [self.portfolio objectInSetsAtIndex:0];
+  STAssertEquals(countOfPages, [pasted countOfPages], nil);
+  for (IPPage *page in pasted.pages) {
+    
+    IPPhoto *photo = [page objectInPhotosAtIndex:0];
+    STAssertTrue([photo.filename isAbsolutePath], @"Pasted %@ has a relative path: %@", photo.title, photo.filename);
+  }
+  [self verifyPortfolio];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Paste a set whose big and small pages finish optimizing out of order.
+//  The pasted pages still come out in the order they were copied.
+//
+
+- (void)testPasteMixedSizeSetKeepsPageOrder {
+  
+  UIImage *large = [UIImage imageNamed:@"AlexGrass_20110604.jpg"];
+  UIImage *small = [UIImage imageNamed:@"smoke.jpg"];
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  set.title = @"Mixed";
+  NSUInteger countOfPages = 12;
+  for (NSUInteger i = 0; i < countOfPages; i++) {
+    
+    NSString *title = [NSString stringWithFormat:@"Mixed %d", i];
+    [set appendPage:[IPPage pageWithImage:(i % 3 == 0) ? large : small andTitle:title]];
+  }
+  [self.portfolio insertObject:set inSetsAtIndex:0];
+  NSSet *victim = [NSSet setWithObject:[NSNumber numberWithUnsignedInteger:0]];
+  [self.controller _collectionView:self.controller.gridView didCopy:victim];
+  
+  IPPhotoOptimizationManager *manager = [IPPhotoOptimizationManager sharedManager];
+  manager.workSynchronouslyForDebugging = NO;
+  [self.controller gridView:self.controller.gridView didPasteAtPoint:0];
+  IPSet *pasted = [self.portfolio objectInSetsAtIndex:0];
+  NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:60];
+  while ([pasted countOfPages] < countOfPages && [deadline timeIntervalSinceNow] > 0) {
+    
+    [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode 
+                             beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  manager.workSynchronouslyForDebugging = YES;
+  
+  STAssertEquals(countOfPages, [pasted countOfPages], nil);
+  for (NSUInteger i = 0; i < [pasted countOfPages]; i++) {
+    
+    NSString *title = [NSString stringWithFormat:@"Mixed %d", i];
+    STAssertEqualStrings(title, [[pasted objectInPagesAtIndex:i] valueForKeyPath:kIPPhotoTitle forPhoto:0], nil);
+  }
+  [self verifyPortfolio];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  Test delete.
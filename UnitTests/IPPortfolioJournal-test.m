@@ -0,0 +1,205 @@
+//
+//  IPPortfolioJournal-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GTMSenTestCase.h"
+#import "IPPortfolio.h"
+#import "IPPortfolioJournal.h"
+#import "NSString+TestHelper.h"
+
+#define kTestPortfolio    @"test-journaled-portfolio"
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPPortfolioJournal_test : GTMTestCase {
+  
+  IPPhoto *photo_;
+}
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPPortfolioJournal_test
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Every page in the test portfolio shows the same optimized photo, so the
+//  file checks on load leave them all in place.
+//
+
+- (void)setUp {
+  
+  photo_ = [[IPPhoto alloc] init];
+  photo_.image = [UIImage imageNamed:@"zoo.jpg"];
+  [photo_ optimize];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)tearDown {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  [[NSFileManager defaultManager] removeItemAtPath:[IPPortfolioJournal journalPathForPortfolioPath:path] error:NULL];
+  [photo_ deletePhotoFiles];
+  [photo_ release];
+  photo_ = nil;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Helper: a set of |count| pages titled "<title> <n>".
+//
+
+- (IPSet *)setWithTitle:(NSString *)title pageCount:(NSUInteger)count {
+  
+  IPSet *set = [[[IPSet alloc] init] autorelease];
+  set.title = title;
+  for (NSUInteger i = 0; i < count; i++) {
+    
+    NSString *pageTitle = [NSString stringWithFormat:@"%@ %d", title, i];
+    [set appendPage:[IPPage pageWithFilename:photo_.filename andTitle:pageTitle]];
+  }
+  return set;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (NSString *)titleOfPage:(NSUInteger)pageIndex inSet:(NSUInteger)setIndex ofPortfolio:(IPPortfolio *)portfolio {
+  
+  IPPage *page = [[portfolio objectInSetsAtIndex:setIndex] objectInPagesAtIndex:pageIndex];
+  return [page valueForKeyPath:kIPPhotoTitle forPhoto:0];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  Edits after a snapshot go into the journal, leave the snapshot alone,
+//  and are all there after a reload.
+//
+
+- (void)testEditsAreAppended {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:[self setWithTitle:@"A" pageCount:3],
+                            [self setWithTitle:@"B" pageCount:3],
+                            nil];
+  [portfolio savePortfolioToPath:path];
+  NSData *snapshot = [NSData dataWithContentsOfFile:path];
+  NSString *journalPath = [IPPortfolioJournal journalPathForPortfolioPath:path];
+  unsigned long long emptySize = [[[NSFileManager defaultManager] attributesOfItemAtPath:journalPath error:NULL] fileSize];
+  
+  IPSet *setA = [portfolio objectInSetsAtIndex:0];
+  IPSet *setB = [portfolio objectInSetsAtIndex:1];
+  IPPage *renamed = [setB objectInPagesAtIndex:2];
+  [renamed setValue:@"Renamed" forKeyPath:kIPPhotoTitle forPhoto:0];
+  [portfolio saveValueForKey:kIPPhotoTitle ofObject:[renamed objectInPhotosAtIndex:0] toPath:path];
+  unsigned long long renameSize = [[[NSFileManager defaultManager] attributesOfItemAtPath:journalPath error:NULL] fileSize];
+  STAssertTrue(renameSize - emptySize < 512, @"A rename should be a small append, was %llu bytes", renameSize - emptySize);
+  
+  IPPage *moved = [setA objectInPagesAtIndex:0];
+  [setA removeObjectFromPagesAtIndex:0];
+  [setA insertObject:moved inPagesAtIndex:2];
+  [portfolio saveMoveFromIndex:0 toIndex:2 inObject:setA toPath:path];
+  
+  [setB removeObjectFromPagesAtIndex:0];
+  [portfolio saveRemovalAtIndex:0 inObject:setB toPath:path];
+  
+  [portfolio insertObject:[self setWithTitle:@"C" pageCount:1] inSetsAtIndex:0];
+  [portfolio saveInsertionAtIndex:0 inObject:portfolio toPath:path];
+  
+  portfolio.title = @"Journaled";
+  portfolio.layoutStyle = IPPortfolioLayoutStyleStacks;
+  [portfolio saveValueForKey:kIPPortfolioTitle ofObject:portfolio toPath:path];
+  [portfolio saveValueForKey:kIPPortfolioLayoutStyle ofObject:portfolio toPath:path];
+  
+  STAssertEqualObjects(snapshot, [NSData dataWithContentsOfFile:path], @"Snapshot should not be rewritten");
+  
+  IPPortfolio *loaded = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEqualStrings(@"Journaled", loaded.title, nil);
+  STAssertEquals(IPPortfolioLayoutStyleStacks, loaded.layoutStyle, nil);
+  STAssertEquals((NSUInteger)3, [loaded countOfSets], nil);
+  STAssertEqualStrings(@"C", [[loaded objectInSetsAtIndex:0] title], nil);
+  STAssertEqualStrings(@"A 1", [self titleOfPage:0 inSet:1 ofPortfolio:loaded], nil);
+  STAssertEqualStrings(@"A 0", [self titleOfPage:2 inSet:1 ofPortfolio:loaded], nil);
+  STAssertEquals((NSUInteger)2, [[loaded objectInSetsAtIndex:2] countOfPages], nil);
+  STAssertEqualStrings(@"Renamed", [self titleOfPage:1 inSet:2 ofPortfolio:loaded], nil);
+  STAssertEquals(loaded, [[loaded objectInSetsAtIndex:0] parent], nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A journal only applies to the snapshot it was written against, and a new
+//  snapshot empties it.
+//
+
+- (void)testJournalForOtherSnapshotIsIgnored {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  NSString *journalPath = [IPPortfolioJournal journalPathForPortfolioPath:path];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:[self setWithTitle:@"A" pageCount:1], nil];
+  portfolio.title = @"Snapshot";
+  [portfolio savePortfolioToPath:path];
+  portfolio.title = @"Journaled";
+  [portfolio saveValueForKey:kIPPortfolioTitle ofObject:portfolio toPath:path];
+  NSData *staleJournal = [NSData dataWithContentsOfFile:journalPath];
+  
+  [portfolio savePortfolioToPath:path];
+  STAssertTrue([[NSData dataWithContentsOfFile:journalPath] length] < [staleJournal length], nil);
+  portfolio.title = @"Newer snapshot";
+  [portfolio savePortfolioToPath:path];
+  [staleJournal writeToFile:journalPath atomically:YES];
+  
+  IPPortfolio *loaded = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEqualStrings(@"Newer snapshot", loaded.title, nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A record cut short by a crash is dropped, and later appends still land.
+//
+
+- (void)testTornRecordIsDropped {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  NSString *journalPath = [IPPortfolioJournal journalPathForPortfolioPath:path];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSets:[self setWithTitle:@"A" pageCount:1], nil];
+  [portfolio savePortfolioToPath:path];
+  IPSet *set = [portfolio objectInSetsAtIndex:0];
+  set.title = @"First";
+  [portfolio saveValueForKey:kIPSetTitle ofObject:set toPath:path];
+  portfolio.title = @"Torn";
+  [portfolio saveValueForKey:kIPPortfolioTitle ofObject:portfolio toPath:path];
+  
+  NSData *journal = [NSData dataWithContentsOfFile:journalPath];
+  [[journal subdataWithRange:NSMakeRange(0, [journal length] - 3)] writeToFile:journalPath atomically:YES];
+  
+  IPPortfolio *loaded = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEqualStrings(@"First", [[loaded objectInSetsAtIndex:0] title], nil);
+  STAssertNil(loaded.title, nil);
+  
+  loaded.title = @"After";
+  [loaded saveValueForKey:kIPPortfolioTitle ofObject:loaded toPath:path];
+  IPPortfolio *reloaded = [IPPortfolio loadPortfolioFromPath:path];
+  STAssertEqualStrings(@"After", reloaded.title, nil);
+  STAssertEqualStrings(@"First", [[reloaded objectInSetsAtIndex:0] title], nil);
+}
+
+@end
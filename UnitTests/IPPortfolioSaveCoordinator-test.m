@@ -0,0 +1,101 @@
+//
+//  IPPortfolioSaveCoordinator-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "GTMSenTestCase.h"
+#import "IPPortfolio.h"
+#import "IPPortfolio+TestHelpers.h"
+#import "IPPortfolioJournal.h"
+#import "IPPortfolioSaveCoordinator.h"
+#import "NSString+TestHelper.h"
+
+#define kTestPortfolio    @"test-coordinated-portfolio"
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@interface IPPortfolioSaveCoordinator_test : GTMTestCase { }
+
+@end
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+@implementation IPPortfolioSaveCoordinator_test
+
+////////////////////////////////////////////////////////////////////////////////
+
+- (void)tearDown {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+  [[NSFileManager defaultManager] removeItemAtPath:[IPPortfolioJournal journalPathForPortfolioPath:path] error:NULL];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A burst of requests is one save, done once the window closes.
+//
+
+- (void)testBurstIsCoalesced {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPPortfolioSaveCoordinator *coordinator = [[[IPPortfolioSaveCoordinator alloc] initWithCoalescingInterval:0.1] autorelease];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSetCount:3];
+  NSInteger version = portfolio.version;
+  for (int i = 0; i < 5; i++) {
+    
+    portfolio.title = [NSString stringWithFormat:@"Edit %d", i];
+    [coordinator setNeedsSaveOfPortfolio:portfolio toPath:path];
+  }
+  STAssertTrue([coordinator hasPendingSaveOfPortfolio:portfolio], nil);
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:path], nil);
+  
+  [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.3]];
+  [coordinator waitUntilSavesFinish];
+  [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+  
+  STAssertFalse([coordinator hasPendingSaveOfPortfolio:portfolio], nil);
+  STAssertEquals((NSUInteger)1, coordinator.saveCount, nil);
+  STAssertEquals(version + 1, portfolio.version, nil);
+  unsigned long long fileSize = [[[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL] fileSize];
+  STAssertEquals(fileSize, coordinator.bytesWritten, nil);
+  STAssertTrue(coordinator.lastSaveLatency >= 0.1, nil);
+  STAssertEqualStrings(@"Edit 4", [IPPortfolio loadPortfolioFromPath:path].title, nil);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  A flush doesn't wait for the window, and takes the pending save's place.
+//
+
+- (void)testFlushSavesNow {
+  
+  NSString *path = [kTestPortfolio asPathInDocumentsFolder];
+  IPPortfolioSaveCoordinator *coordinator = [[[IPPortfolioSaveCoordinator alloc] initWithCoalescingInterval:60] autorelease];
+  IPPortfolio *portfolio = [IPPortfolio portfolioWithSetCount:1];
+  portfolio.title = @"Flushed";
+  [coordinator setNeedsSaveOfPortfolio:portfolio toPath:path];
+  [coordinator flushPortfolio:portfolio toPath:path];
+  
+  STAssertFalse([coordinator hasPendingSaveOfPortfolio:portfolio], nil);
+  STAssertEquals((NSUInteger)1, coordinator.saveCount, nil);
+  STAssertEqualStrings(@"Flushed", [IPPortfolio loadPortfolioFromPath:path].title, nil);
+}
+
+@end
@@ -0,0 +1,145 @@
+//
+//  IPPredecodeWindow-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPPredecodeWindow.h"
+#import "IPPhoto.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static const NSUInteger kTestPageCount = 8;
+
+@interface IPPredecodeWindow_test : SenTestCase
+
+@property (nonatomic, strong) NSArray *photos;
+
+@end
+
+@implementation IPPredecodeWindow_test
+
+//
+//  Every test pages through the same optimized photos.
+//
+
+- (void)setUp {
+  
+  [super setUp];
+  UIImage *image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  NSMutableArray *photos = [NSMutableArray array];
+  for (NSUInteger index = 0; index < kTestPageCount; index++) {
+    
+    IPPhoto *photo = [[IPPhoto alloc] init];
+    photo.image = image;
+    [photo optimize];
+    [photo unloadImage];
+    [photos addObject:photo];
+  }
+  self.photos = photos;
+}
+
+- (void)tearDown {
+  
+  [self.photos makeObjectsPerformSelector:@selector(deletePhotoFiles)];
+  self.photos = nil;
+  [super tearDown];
+}
+
+//
+//  Helper: lets queued decodes finish and report back on the main thread.
+//
+
+- (void)settle:(IPPredecodeWindow *)window {
+  
+  [window waitUntilDecodesFinish];
+  [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+}
+
+- (NSUInteger)bytesPerImage {
+  
+  CGSize size = [(self.photos)[0] imageSize];
+  return size.width * size.height * 4;
+}
+
+//
+//  At rest the window holds the neighbors; swiping fast widens it toward
+//  where the user is going, and moving on evicts what fell behind.
+//
+
+- (void)testWindowFollowsVelocity {
+  
+  IPPredecodeWindow *window = [[IPPredecodeWindow alloc] initWithByteLimit:NSUIntegerMax maxRadius:3];
+  window.photos = self.photos;
+  
+  [window moveToIndex:2 velocity:0];
+  [self settle:window];
+  STAssertEquals((NSUInteger)1, window.radius, nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[1]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[3]], nil);
+  STAssertNil([window decodedImageForPhoto:(self.photos)[2]], @"The scroll view decodes the current page");
+  STAssertNil([window decodedImageForPhoto:(self.photos)[4]], nil);
+  
+  [window moveToIndex:3 velocity:10];
+  [self settle:window];
+  STAssertEquals((NSUInteger)3, window.radius, nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[6]], nil);
+  
+  [window moveToIndex:6 velocity:0];
+  [self settle:window];
+  STAssertNil([window decodedImageForPhoto:(self.photos)[1]], nil);
+  STAssertNil([window decodedImageForPhoto:(self.photos)[3]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[5]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[7]], nil);
+}
+
+//
+//  Over budget, the pages farthest from the current one go first.
+//
+
+- (void)testBudgetEvictsByDistance {
+  
+  IPPredecodeWindow *window = [[IPPredecodeWindow alloc] initWithByteLimit:[self bytesPerImage] * 3 maxRadius:3];
+  window.photos = self.photos;
+  [window moveToIndex:3 velocity:10];
+  [self settle:window];
+  STAssertTrue(window.currentBytes <= window.byteLimit, nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[2]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[4]], nil);
+  STAssertNil([window decodedImageForPhoto:(self.photos)[0]], nil);
+}
+
+//
+//  A memory warning narrows the window but keeps the nearest pages.
+//
+
+- (void)testMemoryWarningShrinksWindow {
+  
+  IPPredecodeWindow *window = [[IPPredecodeWindow alloc] initWithByteLimit:NSUIntegerMax maxRadius:2];
+  window.photos = self.photos;
+  [window moveToIndex:3 velocity:10];
+  [self settle:window];
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[5]], nil);
+  
+  [window didReceiveMemoryWarning];
+  STAssertEquals((NSUInteger)1, window.maxRadius, nil);
+  STAssertEquals((NSUInteger)1, window.radius, nil);
+  STAssertNil([window decodedImageForPhoto:(self.photos)[5]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[4]], nil);
+  STAssertNotNil([window decodedImageForPhoto:(self.photos)[2]], nil);
+}
+
+@end
@@ -21,6 +21,7 @@
 #import "GTMSenTestCase.h"
 #import <UIKit/UIKit.h>
 #import "IPSet.h"
+#import "IPPortfolioCoder.h"
 #import "NSString+TestHelper.h"
 #import "IPPhoto+TestHelpers.h"
 #import "IPPage+TestHelpers.h"
@@ -281,4 +282,64 @@
   [set removeObserver:self forKeyPath:kIPSetThumbnailFilename];
 }
 
+//
+//  Pages past the first few stay encoded until something asks for them.
+//
+
+- (void)testPagesLoadOnDemand {
+  
+  IPSet *set = [IPSet setWithPageCount:kIPSetPreloadedPageCount + 3];
+  for (IPPage *page in set.pages) {
+    [page objectInPhotosAtIndex:0].filename = [IPPhoto filenameForNewPhoto];
+  }
+  NSArray *filenames = set.photoFilenames;
+  NSArray *loadedPages = [set.pages subarrayWithRange:NSMakeRange(0, kIPSetPreloadedPageCount)];
+  NSArray *rest = [set.pages subarrayWithRange:NSMakeRange(kIPSetPreloadedPageCount, 3)];
+  IPSet *newSet = [[[IPSet alloc] init] autorelease];
+  [newSet setLoadedPages:[NSMutableArray arrayWithArray:loadedPages]
+        unloadedPageData:[IPPortfolioCoder dataWithPages:rest]
+                   count:[rest count]];
+  STAssertFalse([newSet arePagesLoaded], @"Only the first pages should load");
+  STAssertEquals((NSUInteger)kIPSetPreloadedPageCount, [newSet.loadedPages count], nil);
+  STAssertEquals([set countOfPages], [newSet countOfPages], nil);
+  STAssertEqualObjects(filenames, newSet.photoFilenames, nil);
+  
+  IPPage *lastPage = [newSet objectInPagesAtIndex:[newSet countOfPages] - 1];
+  STAssertTrue([newSet arePagesLoaded], @"Asking for a page should load the rest");
+  STAssertEquals(newSet, lastPage.parent, @"parent pointer should be set");
+  STAssertEquals([set countOfPages], [newSet.loadedPages count], nil);
+  STAssertEqualObjects(filenames, newSet.photoFilenames, nil);
+  STAssertTrue([[lastPage objectInPhotosAtIndex:0].filename isAbsolutePath],
+               @"Pages loaded without a portfolio should still have full file names");
+}
+
+//
+//  A keyed archive of a set (the pasteboard, the journal) carries every
+//  page, loaded or not, with its full file names.
+//
+
+- (void)testKeyedArchiveHasEveryPage {
+  
+  IPSet *set = [IPSet setWithPageCount:kIPSetPreloadedPageCount + 3];
+  for (IPPage *page in set.pages) {
+    [page objectInPhotosAtIndex:0].filename = [IPPhoto filenameForNewPhoto];
+  }
+  NSArray *pages = [NSArray arrayWithArray:set.pages];
+  NSArray *rest = [pages subarrayWithRange:NSMakeRange(kIPSetPreloadedPageCount, 3)];
+  [set setLoadedPages:[NSMutableArray arrayWithArray:[pages subarrayWithRange:NSMakeRange(0, kIPSetPreloadedPageCount)]]
+     unloadedPageData:[IPPortfolioCoder dataWithPages:rest]
+                count:[rest count]];
+  
+  IPSet *newSet = [NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:set]];
+  STAssertTrue([newSet arePagesLoaded], @"Keyed archives shouldn't leave pages encoded");
+  STAssertEquals([pages count], [newSet.loadedPages count], nil);
+  for (NSUInteger i = 0; i < [pages count]; i++) {
+    
+    IPPhoto *photo = [[pages objectAtIndex:i] objectInPhotosAtIndex:0];
+    IPPhoto *newPhoto = [[newSet objectInPagesAtIndex:i] objectInPhotosAtIndex:0];
+    STAssertEqualStrings(photo.filename, newPhoto.filename, nil);
+    STAssertEquals(newSet, [newSet objectInPagesAtIndex:i].parent, nil);
+  }
+}
+
 @end
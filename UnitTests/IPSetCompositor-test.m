@@ -0,0 +1,124 @@
+//
+//  IPSetCompositor-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPSetCompositor.h"
+#import "IPPhoto.h"
+#import "IPImageMemoryManager.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestDirectory = @"IPSetCompositorTest";
+
+@interface IPSetCompositor_test : SenTestCase
+
+@property (nonatomic, strong) IPPhoto *photo;
+
+@end
+
+@implementation IPSetCompositor_test
+
+- (void)setUp {
+
+  [super setUp];
+  self.photo = [[IPPhoto alloc] init];
+  self.photo.image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  [self.photo optimize];
+}
+
+- (void)tearDown {
+
+  [self.photo deletePhotoFiles];
+  self.photo = nil;
+  [[IPImageMemoryManager sharedManager] removeImagesOfKind:IPImageMemoryKindComposite];
+  [[NSFileManager defaultManager] removeItemAtPath:[kTestDirectory asPathInCachesFolder] error:NULL];
+  [super tearDown];
+}
+
+//
+//  A composite gets drawn once: after that it comes from memory, and once
+//  memory has let it go, from disk, even for a new compositor.
+//
+
+- (void)testCompositeIsDrawnOnce {
+
+  NSArray *photos = @[self.photo, self.photo, self.photo];
+  CGSize size = CGSizeMake(200, 150);
+  IPSetCompositor *compositor = [[IPSetCompositor alloc] initWithDirectory:[kTestDirectory asPathInCachesFolder]];
+  UIImage *composite = [compositor compositeOfPhotos:photos size:size scale:2];
+  STAssertNotNil(composite, nil);
+  STAssertEquals(size, composite.size, nil);
+  STAssertEquals((size_t)400, CGImageGetWidth([composite CGImage]), nil);
+  STAssertEquals((NSUInteger)1, compositor.renderCount, nil);
+
+  NSString *key = [IPSetCompositor keyForPhotos:photos size:size scale:2];
+  STAssertEquals(composite, [compositor cachedCompositeForKey:key], nil);
+  STAssertEquals(composite, [compositor compositeOfPhotos:photos size:size scale:2], nil);
+  STAssertEquals((NSUInteger)1, compositor.renderCount, nil);
+
+  [[IPImageMemoryManager sharedManager] removeImagesOfKind:IPImageMemoryKindComposite];
+  IPSetCompositor *relaunched = [[IPSetCompositor alloc] initWithDirectory:[kTestDirectory asPathInCachesFolder]];
+  UIImage *saved = [relaunched compositeOfPhotos:photos size:size scale:2];
+  STAssertEquals((NSUInteger)0, relaunched.renderCount, @"Should come from disk");
+  STAssertEquals(composite.size, saved.size, nil);
+}
+
+//
+//  The key follows the stack's thumbnails and the size, and ignores photos
+//  past the top of the stack.
+//
+
+- (void)testKeys {
+
+  IPPhoto *other = [[IPPhoto alloc] init];
+  other.filename = [IPPhoto filenameForNewPhoto];
+  NSArray *photos = @[self.photo, self.photo];
+  NSString *key = [IPSetCompositor keyForPhotos:photos size:CGSizeMake(200, 150) scale:2];
+
+  STAssertEqualObjects(key, [IPSetCompositor keyForPhotos:photos size:CGSizeMake(200, 150) scale:2], nil);
+  STAssertFalse([key isEqualToString:[IPSetCompositor keyForPhotos:photos size:CGSizeMake(200, 150) scale:1]], nil);
+  STAssertFalse([key isEqualToString:[IPSetCompositor keyForPhotos:@[other, self.photo]
+                                                               size:CGSizeMake(200, 150)
+                                                              scale:2]], nil);
+
+  NSMutableArray *tall = [NSMutableArray arrayWithCapacity:kIPSetCompositeMaxPhotos + 1];
+  for (NSUInteger i = 0; i < kIPSetCompositeMaxPhotos; i++) {
+
+    [tall addObject:self.photo];
+  }
+  NSString *tallKey = [IPSetCompositor keyForPhotos:tall size:CGSizeMake(200, 150) scale:2];
+  [tall addObject:other];
+  STAssertEqualObjects(tallKey, [IPSetCompositor keyForPhotos:tall size:CGSizeMake(200, 150) scale:2], nil);
+}
+
+//
+//  A stack missing an unoptimized photo still draws, but isn't kept.
+//
+
+- (void)testIncompleteStackIsNotKept {
+
+  IPPhoto *unoptimized = [[IPPhoto alloc] init];
+  unoptimized.filename = [IPPhoto filenameForNewPhoto];
+  NSArray *photos = @[self.photo, unoptimized];
+  IPSetCompositor *compositor = [[IPSetCompositor alloc] initWithDirectory:[kTestDirectory asPathInCachesFolder]];
+  STAssertNotNil([compositor compositeOfPhotos:photos size:CGSizeMake(200, 150) scale:1], nil);
+  STAssertNotNil([compositor compositeOfPhotos:photos size:CGSizeMake(200, 150) scale:1], nil);
+  STAssertEquals((NSUInteger)2, compositor.renderCount, nil);
+}
+
+@end
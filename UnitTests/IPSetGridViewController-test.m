@@ -26,6 +26,7 @@
 #import "IPSet+TestHelpers.h"
 #import "IPAlertConfirmTest.h"
 #import "IPPhotoOptimizationManager.h"
+#import "IPDerivedFileIndex.h"
 
 #define kNibName        @"IPSetGridViewController"
 
@@ -74,6 +75,7 @@
 - (void)assertFilesDoNotExistForPage:(IPPage *)page {
   
   NSFileManager *defaultManager = [NSFileManager defaultManager];
+  [[IPDerivedFileIndex sharedIndex] waitUntilRemovalsFinish];
   for (IPPhoto *photo in page.photos) {
     
     STAssertFalse([defaultManager fileExistsAtPath:photo.filename], 
@@ -177,11 +179,11 @@
   IPPage *victim = [[[set objectInPagesAtIndex:0] retain] autorelease];
   [victim setValue:@"This is the victim" forKeyPath:kIPPhotoTitle forPhoto:0];
   [self assertFilesExistForPage:victim];
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveRemovalAtIndex:0 inObject:set toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didCut:victims];
   
   //
-  //  Verify that the portfolio was saved after the cut.
+  //  Verify that the cut was saved.
   //
   
   STAssertNoThrow([mockPortfolio verify], nil);
@@ -208,7 +210,7 @@
   //  Just for grins, make sure we can actually paste.
   //
   
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveInsertionAtIndex:1 inObject:set toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didPasteAtPoint:1];
   STAssertNoThrow([mockPortfolio verify], nil);
   STAssertEquals((NSUInteger)2, [set countOfPages], nil);
@@ -241,7 +243,7 @@
   [self assertFilesExistForPage:page2];
   
   NSSet *victims = [NSSet setWithObject:[NSNumber numberWithUnsignedInteger:0]];
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveRemovalAtIndex:0 inObject:set toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didDelete:victims];
   STAssertTrue(confirmTester.confirmCalled, nil);
   
@@ -280,7 +282,7 @@
   //
   
   id mockPortfolio = controller.currentSet.parent;
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveInsertionAtIndex:0 inObject:controller.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didPasteAtPoint:0];
   expectedPages = 3;
   STAssertEquals(expectedPages, [controller.currentSet countOfPages], nil);
@@ -313,11 +315,11 @@
   STAssertTrue([controller gridViewCanPaste:controller.gridView], nil);
   
   //
-  //  Not a typo. savePortfolioToPath: will get called twice.
+  //  Each page gets saved as it goes in.
   //
   
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveInsertionAtIndex:1 inObject:controller.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveInsertionAtIndex:2 inObject:controller.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didPasteAtPoint:1];
   STAssertNoThrow([mockPortfolio verify], nil);
   STAssertEquals((NSUInteger)4, [controller.currentSet countOfPages], nil);
@@ -338,7 +340,7 @@
   pasteboard.image = image;
   
   STAssertTrue([controller gridViewCanPaste:controller.gridView], nil);
-  [[mockPortfolio expect] savePortfolioToPath:[IPPortfolio defaultPortfolioPath]];
+  [[mockPortfolio expect] saveInsertionAtIndex:1 inObject:controller.currentSet toPath:[IPPortfolio defaultPortfolioPath]];
   [controller gridView:controller.gridView didPasteAtPoint:1];
   STAssertNoThrow([mockPortfolio verify], nil);
   STAssertEquals((NSUInteger)3, [controller.currentSet countOfPages], nil);
@@ -0,0 +1,124 @@
+//
+//  IPThumbnailFetcher-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPThumbnailFetcher.h"
+#import "IPImageMemoryManager.h"
+#import "IPPhoto.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+
+@interface IPThumbnailFetcher_test : SenTestCase
+
+@property (nonatomic, strong) IPPhoto *photo;
+
+@end
+
+@implementation IPThumbnailFetcher_test
+
+- (void)setUp {
+  
+  [super setUp];
+  self.photo = [[IPPhoto alloc] init];
+  self.photo.image = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  [self.photo optimize];
+  [[IPImageMemoryManager sharedManager] removeAllImages];
+}
+
+- (void)tearDown {
+  
+  [self.photo deletePhotoFiles];
+  self.photo = nil;
+  [super tearDown];
+}
+
+//
+//  Spins the main run loop until |done| or a few seconds pass.
+//
+
+- (void)waitFor:(BOOL *)done {
+  
+  NSDate *giveUp = [NSDate dateWithTimeIntervalSinceNow:5];
+  while (!*done && [giveUp timeIntervalSinceNow] > 0) {
+    
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+  }
+}
+
+//
+//  A miss decodes in the background and counts the time; after that, a
+//  fetch is answered on the spot.
+//
+
+- (void)testFetchDecodesInBackground {
+  
+  IPThumbnailFetcher *fetcher = [[IPThumbnailFetcher alloc] init];
+  CGSize pixelSize = CGSizeMake(200, 200);
+  __block UIImage *fetched = nil;
+  __block BOOL done = NO;
+  NSOperation *operation = [fetcher fetchImageOfPhoto:self.photo 
+                                   decodedToPixelSize:pixelSize 
+                                           completion:^(UIImage *image) {
+                                             
+                                             STAssertTrue([NSThread isMainThread], nil);
+                                             fetched = image;
+                                             done = YES;
+                                           }];
+  STAssertNotNil(operation, nil);
+  [self waitFor:&done];
+  STAssertNotNil(fetched, nil);
+  STAssertEquals((NSUInteger)1, fetcher.decodeCount, nil);
+  STAssertTrue(fetcher.decodeTime > 0, nil);
+  
+  __block UIImage *again = nil;
+  operation = [fetcher fetchImageOfPhoto:self.photo decodedToPixelSize:pixelSize completion:^(UIImage *image) {
+    
+    again = image;
+  }];
+  STAssertNil(operation, @"Should come from memory");
+  STAssertEquals(fetched, again, nil);
+  
+  [fetcher endScroll];
+  STAssertEquals((NSUInteger)0, fetcher.decodeCount, nil);
+}
+
+//
+//  A cancelled fetch never calls back.
+//
+
+- (void)testCancelledFetchDoesNotComplete {
+  
+  IPThumbnailFetcher *fetcher = [[IPThumbnailFetcher alloc] init];
+  __block BOOL called = NO;
+  NSOperation *operation = [fetcher operationDecodingImage:^UIImage *(void) {
+    
+    return [self.photo thumbnail];
+    
+  } completion:^(UIImage *image) {
+    
+    called = YES;
+  }];
+  [operation cancel];
+  [operation start];
+  [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+  STAssertFalse(called, nil);
+  STAssertEquals((NSUInteger)0, fetcher.decodeCount, nil);
+}
+
+@end
@@ -0,0 +1,121 @@
+//
+//  IPTileCache-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "IPBandTiler.h"
+#import "IPTileCache.h"
+#import "IPTilePyramid.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestPyramidName = @"IPTileCacheTest.tiles";
+
+//
+//  Bytes of one decoded full-size tile.
+//
+
+#define kTestTileBytes    (768 * 768 * 4)
+
+@interface IPTileCache_test : SenTestCase
+
+@property (nonatomic, strong) IPTilePyramid *pyramid;
+
+@end
+
+@implementation IPTileCache_test
+
+- (void)setUp {
+
+  [super setUp];
+  NSString *path = [kTestPyramidName asPathInCachesFolder];
+  IPBandTiler *tiler = [[IPBandTiler alloc] init];
+  [tiler tileImageAtPath:[kTestMediumImage asPathInBundlePath] toPyramidAtPath:path tileSize:768];
+  self.pyramid = [IPTilePyramid pyramidWithContentsOfFile:path];
+}
+
+- (void)tearDown {
+
+  [[NSFileManager defaultManager] removeItemAtPath:self.pyramid.path error:NULL];
+  self.pyramid = nil;
+  [super tearDown];
+}
+
+//
+//  The second lookup of a tile is a hit, and returns the same decoded image.
+//
+
+- (void)testHitsAndMisses {
+
+  IPTileCache *cache = [[IPTileCache alloc] initWithByteLimit:4 * kTestTileBytes];
+  UIImage *first = [cache tileFromPyramid:self.pyramid level:0 row:0 column:0];
+  UIImage *second = [cache tileFromPyramid:self.pyramid level:0 row:0 column:0];
+  STAssertNotNil(first, nil);
+  STAssertTrue(first == second, nil);
+  STAssertEquals((NSUInteger)1, cache.hits, nil);
+  STAssertEquals((NSUInteger)1, cache.misses, nil);
+  STAssertEqualsWithAccuracy((CGFloat)0.5, cache.hitRate, (CGFloat)0.001, nil);
+  STAssertNil([cache tileFromPyramid:self.pyramid level:0 row:1000 column:0], nil);
+
+  [cache resetCounters];
+  STAssertEquals((CGFloat)0, cache.hitRate, nil);
+}
+
+//
+//  Over budget, the least recently used tile goes first.
+//
+
+- (void)testEviction {
+
+  IPTileCache *cache = [[IPTileCache alloc] initWithByteLimit:2 * kTestTileBytes];
+  [cache tileFromPyramid:self.pyramid level:0 row:0 column:0];
+  [cache tileFromPyramid:self.pyramid level:0 row:0 column:1];
+  [cache tileFromPyramid:self.pyramid level:0 row:0 column:0];
+  [cache tileFromPyramid:self.pyramid level:0 row:1 column:0];
+  STAssertTrue(cache.currentBytes <= cache.byteLimit, nil);
+
+  [cache resetCounters];
+  [cache tileFromPyramid:self.pyramid level:0 row:0 column:0];
+  STAssertEquals((NSUInteger)1, cache.hits, @"Recently used tile should survive");
+  [cache tileFromPyramid:self.pyramid level:0 row:0 column:1];
+  STAssertEquals((NSUInteger)1, cache.misses, @"Least recently used tile should be evicted");
+
+  [cache removeTilesForPyramidAtPath:self.pyramid.path];
+  STAssertEquals((NSUInteger)0, cache.currentBytes, nil);
+}
+
+//
+//  Prefetched tiles are hits when they get drawn.
+//
+
+- (void)testPrefetch {
+
+  IPTileCache *cache = [[IPTileCache alloc] initWithByteLimit:16 * kTestTileBytes];
+  [cache prefetchTilesFromPyramid:self.pyramid level:0 rows:NSMakeRange(0, 2) columns:NSMakeRange(0, 2)];
+  [cache waitUntilPrefetchesFinish];
+  STAssertEquals((NSUInteger)4, cache.prefetches, nil);
+  for (NSUInteger row = 0; row < 2; row++) {
+
+    for (NSUInteger column = 0; column < 2; column++) {
+
+      [cache tileFromPyramid:self.pyramid level:0 row:row column:column];
+    }
+  }
+  STAssertEquals((NSUInteger)4, cache.hits, nil);
+  STAssertEquals((NSUInteger)0, cache.misses, nil);
+}
+
+@end
@@ -0,0 +1,122 @@
+//
+//  IPTileEncoder-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import <UIKit/UIKit.h>
+#import "IPTileEncoder.h"
+#import "IPTilePyramid.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestMediumImage = @"AlexGrass_20110604.jpg";
+static NSString * const kTestPyramidName = @"IPTileEncoderTest.tiles";
+static const NSUInteger kTestTileSize = 256;
+
+@interface IPTileEncoder_test : SenTestCase
+
+@end
+
+@implementation IPTileEncoder_test
+
+//
+//  Fits as many encodes as the budget and the cores allow, and never fewer
+//  than one.
+//
+
+- (void)testMaxConcurrentEncodes {
+
+  NSUInteger cores = [[NSProcessInfo processInfo] activeProcessorCount];
+  NSUInteger bytesPerEncode = 768 * 768 * 4 * 2;
+  STAssertEquals((NSUInteger)1, [IPTileEncoder maxConcurrentEncodesForTileSize:768 memoryBudget:0], nil);
+  STAssertEquals(MIN(cores, (NSUInteger)2),
+                 [IPTileEncoder maxConcurrentEncodesForTileSize:768 memoryBudget:bytesPerEncode * 2],
+                 nil);
+  STAssertEquals(cores,
+                 [IPTileEncoder maxConcurrentEncodesForTileSize:768 memoryBudget:NSUIntegerMax],
+                 nil);
+}
+
+//
+//  Tiles level 0 of the test image with 1, 2, 4, and 8 encodes in flight and
+//  logs tiles/sec for each. The pyramid must come out byte-for-byte the same
+//  every time, since tiles reach the writer in order.
+//
+
+- (void)testEncodeThroughput {
+
+  UIImage *source = [UIImage imageWithContentsOfFile:[kTestMediumImage asPathInBundlePath]];
+  CGImageRef image = [source CGImage];
+  CGSize imageSize = CGSizeMake(CGImageGetWidth(image), CGImageGetHeight(image));
+  NSString *pyramidPath = [kTestPyramidName asPathInCachesFolder];
+  NSData *expected = nil;
+
+  for (NSUInteger workers = 1; workers <= 8; workers *= 2) {
+
+    IPTilePyramidWriter *writer = [[IPTilePyramidWriter alloc] initWithPath:pyramidPath
+                                                                  imageSize:imageSize
+                                                                   tileSize:kTestTileSize];
+    IPTileEncoder *encoder = [[IPTileEncoder alloc] initWithMaxConcurrentEncodes:workers];
+    STAssertEquals(workers, encoder.maxConcurrentEncodes, nil);
+
+    NSUInteger rows = [writer rowsAtLevel:0];
+    NSUInteger tiles = rows * [writer columnsAtLevel:0];
+    NSDate *start = [NSDate date];
+    for (NSUInteger row = 0; row < rows; row++) {
+
+      CGRect rowRect = CGRectMake(0, row * kTestTileSize, imageSize.width,
+                                  MIN(kTestTileSize, imageSize.height - row * kTestTileSize));
+      CGImageRef rowImage = CGImageCreateWithImageInRect(image, rowRect);
+      STAssertTrue([encoder addRowOfTiles:rowImage row:row level:0 toPyramid:writer], nil);
+      CGImageRelease(rowImage);
+    }
+    NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+    NSLog(@"%s -- %d workers: %d tiles in %.3f s, %.1f tiles/sec",
+          __PRETTY_FUNCTION__,
+          workers,
+          tiles,
+          elapsed,
+          tiles / MAX(elapsed, 0.001));
+
+    //
+    //  Only level 0 is written; fill the rest with anything so |finish| can
+    //  write the file.
+    //
+
+    NSData *filler = [@"x" dataUsingEncoding:NSUTF8StringEncoding];
+    for (NSUInteger level = 1; level < writer.levelCount; level++) {
+
+      for (NSUInteger row = 0; row < [writer rowsAtLevel:level]; row++) {
+
+        for (NSUInteger column = 0; column < [writer columnsAtLevel:level]; column++) {
+
+          [writer addTileData:filler level:level row:row column:column];
+        }
+      }
+    }
+    STAssertTrue([writer finish], nil);
+    NSData *written = [NSData dataWithContentsOfFile:pyramidPath];
+    if (expected == nil) {
+
+      expected = written;
+    } else {
+
+      STAssertEqualObjects(expected, written, @"%d workers", workers);
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:pyramidPath error:NULL];
+  }
+}
+
+@end
@@ -0,0 +1,160 @@
+//
+//  IPTilePyramid-test.m
+//  ipad-portfolio
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+#import "IPTilePyramid.h"
+#import "NSString+TestHelper.h"
+
+static NSString * const kTestPyramidName = @"IPTilePyramidTest.tiles";
+
+@interface IPTilePyramid_test : SenTestCase
+
+@property (nonatomic, copy) NSString *path;
+
+@end
+
+@implementation IPTilePyramid_test
+
+- (void)setUp {
+
+  [super setUp];
+  self.path = [kTestPyramidName asPathInCachesFolder];
+  [[NSFileManager defaultManager] removeItemAtPath:self.path error:NULL];
+}
+
+- (void)tearDown {
+
+  [[NSFileManager defaultManager] removeItemAtPath:self.path error:NULL];
+  [super tearDown];
+}
+
+//
+//  Helper: distinct bytes for each tile, so lookups can be checked.
+//
+
+- (NSData *)dataForLevel:(NSUInteger)level row:(NSUInteger)row column:(NSUInteger)column {
+
+  return [[NSString stringWithFormat:@"tile %d/%d/%d", level, row, column] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+//
+//  Helper: writes every tile of a pyramid, last tile first.
+//
+
+- (BOOL)writePyramidOfSize:(CGSize)imageSize tileSize:(NSUInteger)tileSize {
+
+  IPTilePyramidWriter *writer = [[IPTilePyramidWriter alloc] initWithPath:self.path
+                                                                imageSize:imageSize
+                                                                 tileSize:tileSize];
+  for (NSInteger level = writer.levelCount - 1; level >= 0; level--) {
+
+    for (NSInteger row = [writer rowsAtLevel:level] - 1; row >= 0; row--) {
+
+      for (NSInteger column = [writer columnsAtLevel:level] - 1; column >= 0; column--) {
+
+        [writer addTileData:[self dataForLevel:level row:row column:column]
+                      level:level
+                        row:row
+                     column:column];
+      }
+    }
+  }
+  return [writer finish];
+}
+
+//
+//  Geometry: a 3000x4000 image with 768 pixel tiles has levels of 4000,
+//  2000, 1000 and 500 pixels on the long edge.
+//
+
+- (void)testGeometry {
+
+  CGSize imageSize = CGSizeMake(3000, 4000);
+  STAssertEquals((NSUInteger)4, [IPTilePyramid levelCountForImageSize:imageSize tileSize:768], nil);
+  STAssertEquals((NSUInteger)1, [IPTilePyramid levelCountForImageSize:CGSizeMake(768, 100) tileSize:768], nil);
+  STAssertEquals(CGSizeMake(375, 500), [IPTilePyramid sizeOfLevel:3 forImageSize:imageSize], nil);
+  STAssertEquals((NSUInteger)0, [IPTilePyramid levelForScale:1.0], nil);
+  STAssertEquals((NSUInteger)1, [IPTilePyramid levelForScale:0.5], nil);
+  STAssertEquals((NSUInteger)2, [IPTilePyramid levelForScale:0.26], nil);
+}
+
+//
+//  Every tile comes back from the right slot, whatever order it was added in.
+//
+
+- (void)testRoundTrip {
+
+  STAssertTrue([self writePyramidOfSize:CGSizeMake(3000, 4000) tileSize:768], nil);
+  IPTilePyramid *pyramid = [IPTilePyramid pyramidWithContentsOfFile:self.path];
+  STAssertNotNil(pyramid, nil);
+  STAssertEquals((NSUInteger)4, pyramid.levelCount, nil);
+  STAssertEquals((NSUInteger)768, pyramid.tileSize, nil);
+  STAssertEquals(CGSizeMake(3000, 4000), pyramid.imageSize, nil);
+  STAssertEquals((NSUInteger)4, [pyramid columnsAtLevel:0], nil);
+  STAssertEquals((NSUInteger)6, [pyramid rowsAtLevel:0], nil);
+  STAssertEquals((NSUInteger)1, [pyramid rowsAtLevel:3], nil);
+
+  for (NSUInteger level = 0; level < pyramid.levelCount; level++) {
+
+    for (NSUInteger row = 0; row < [pyramid rowsAtLevel:level]; row++) {
+
+      for (NSUInteger column = 0; column < [pyramid columnsAtLevel:level]; column++) {
+
+        STAssertEqualObjects([self dataForLevel:level row:row column:column],
+                             [pyramid tileDataAtLevel:level row:row column:column],
+                             nil);
+      }
+    }
+  }
+  STAssertNil([pyramid tileDataAtLevel:0 row:6 column:0], nil);
+  STAssertNil([pyramid tileDataAtLevel:0 row:0 column:4], nil);
+  STAssertNil([pyramid tileDataAtLevel:4 row:0 column:0], nil);
+}
+
+//
+//  A pyramid missing a tile never gets written.
+//
+
+- (void)testIncompletePyramid {
+
+  IPTilePyramidWriter *writer = [[IPTilePyramidWriter alloc] initWithPath:self.path
+                                                                imageSize:CGSizeMake(1000, 1000)
+                                                                 tileSize:768];
+  [writer addTileData:[self dataForLevel:0 row:0 column:0] level:0 row:0 column:0];
+  STAssertFalse([writer finish], nil);
+  STAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:self.path], nil);
+  STAssertNil([IPTilePyramid pyramidWithContentsOfFile:self.path], nil);
+}
+
+//
+//  Truncated or scribbled-on files are rejected.
+//
+
+- (void)testCorruptPyramid {
+
+  STAssertTrue([self writePyramidOfSize:CGSizeMake(1000, 1000) tileSize:768], nil);
+  NSMutableData *contents = [NSMutableData dataWithContentsOfFile:self.path];
+
+  [[contents subdataWithRange:NSMakeRange(0, [contents length] - 1)] writeToFile:self.path atomically:YES];
+  STAssertNil([IPTilePyramid pyramidWithContentsOfFile:self.path], nil);
+
+  ((uint8_t *)[contents mutableBytes])[0] ^= 0xff;
+  [contents writeToFile:self.path atomically:YES];
+  STAssertNil([IPTilePyramid pyramidWithContentsOfFile:self.path], nil);
+}
+
+@end